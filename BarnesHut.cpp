@@ -0,0 +1,437 @@
+#include "BarnesHut.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+#include "MortonSort.h"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr size_t g_bodyGrain = 1024;			//Bodies per worker chunk
+	constexpr size_t g_leafGrain = 16;				//Leaves per worker chunk when evaluating forces
+	constexpr uint32_t g_minSubtreeSize = 4096;
+	constexpr uint32_t g_subtreesPerThread = 4;
+	constexpr size_t g_simdPadding = 3;
+	const XMVECTORF32 g_bodyLaneIndex = { { { 0.0f, 1.0f, 2.0f, 3.0f } } };
+
+	inline XMVECTOR LoadFloat4(const float* p)
+	{
+		return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p));
+	}
+
+	inline float HorizontalSum(FXMVECTOR v)
+	{
+		XMFLOAT4 f;
+		XMStoreFloat4(&f, v);
+		return (f.x + f.y) + (f.z + f.w);
+	}
+
+	//Sum over bodies [0, count) of m_j (p_j - p) / (|p_j - p|^2 + eps^2)^1.5, four bodies at a time.
+	//A body never pulls on itself, its offset is zero.
+	XMVECTOR SumInteractions(const float* x, const float* y, const float* z, const float* mass, size_t count, FXMVECTOR px, FXMVECTOR py, FXMVECTOR pz, GXMVECTOR softeningSq)
+	{
+		XMVECTOR sumX = XMVectorZero(), sumY = XMVectorZero(), sumZ = XMVectorZero();
+		for(size_t j = 0; j < count; j += 4)
+		{
+			const XMVECTOR dx = LoadFloat4(x + j) - px;
+			const XMVECTOR dy = LoadFloat4(y + j) - py;
+			const XMVECTOR dz = LoadFloat4(z + j) - pz;
+			const XMVECTOR distSq = dx * dx + dy * dy + dz * dz + softeningSq;
+			const XMVECTOR invDist = XMVectorReciprocalSqrt(distSq);
+			//Zero distance only happens without softening, for the body itself or a duplicate
+			XMVECTOR valid = XMVectorGreater(distSq, XMVectorZero());
+			if(count - j < 4)
+			{
+				valid = XMVectorAndInt(valid, XMVectorLess(g_bodyLaneIndex, XMVectorReplicate(static_cast<float>(count - j))));
+			}
+			const XMVECTOR weight = XMVectorSelect(XMVectorZero(), invDist * invDist * invDist * LoadFloat4(mass + j), valid);
+			sumX += dx * weight;
+			sumY += dy * weight;
+			sumZ += dz * weight;
+		}
+		return XMVectorSet(HorizontalSum(sumX), HorizontalSum(sumY), HorizontalSum(sumZ), 0.0f);
+	}
+
+	struct InteractionList				//Bodies and far away cells acting on one leaf, SoA and padded for four wide loads
+	{
+		std::vector<float> x, y, z, mass;
+		size_t count;
+		void Clear()
+		{
+			count = 0;
+			x.clear(); y.clear(); z.clear(); mass.clear();
+		}
+		void Add(float px, float py, float pz, float m)
+		{
+			x.push_back(px); y.push_back(py); z.push_back(pz); mass.push_back(m);
+			++count;
+		}
+		void Pad()
+		{
+			for(size_t i = 0; i < g_simdPadding; ++i)
+			{
+				x.push_back(0.0f); y.push_back(0.0f); z.push_back(0.0f); mass.push_back(0.0f);
+			}
+		}
+	};
+}
+
+BarnesHutTree::BarnesHutTree()
+	:m_mass(1.0f), m_rootSize(1.0f)
+{}
+
+void BarnesHutTree::SortByMortonCode(const float* x, const float* y, const float* z, size_t count)
+{
+	ThreadPool& pool = ThreadPool::Get();
+
+	//Bounds, reduced per block
+	const size_t blockCount = pool.GetThreadCount();
+	const size_t blockSize = (count + blockCount - 1) / blockCount;
+	std::vector<XMFLOAT3> blockMin(blockCount, XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX));
+	std::vector<XMFLOAT3> blockMax(blockCount, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	pool.ParallelFor(0, blockCount, 1, [&](size_t begin, size_t end)
+		{
+			for(size_t block = begin; block < end; ++block)
+			{
+				XMFLOAT3 bMin = blockMin[block], bMax = blockMax[block];
+				const size_t last = (std::min)(count, (block + 1) * blockSize);
+				for(size_t i = block * blockSize; i < last; ++i)
+				{
+					bMin = XMFLOAT3((std::min)(bMin.x, x[i]), (std::min)(bMin.y, y[i]), (std::min)(bMin.z, z[i]));
+					bMax = XMFLOAT3((std::max)(bMax.x, x[i]), (std::max)(bMax.y, y[i]), (std::max)(bMax.z, z[i]));
+				}
+				blockMin[block] = bMin;
+				blockMax[block] = bMax;
+			}
+		});
+	XMFLOAT3 rootMin(FLT_MAX, FLT_MAX, FLT_MAX), rootMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(size_t block = 0; block < blockCount; ++block)
+	{
+		rootMin = XMFLOAT3((std::min)(rootMin.x, blockMin[block].x), (std::min)(rootMin.y, blockMin[block].y), (std::min)(rootMin.z, blockMin[block].z));
+		rootMax = XMFLOAT3((std::max)(rootMax.x, blockMax[block].x), (std::max)(rootMax.y, blockMax[block].y), (std::max)(rootMax.z, blockMax[block].z));
+	}
+
+	//Cubic root cell so every node is a cube and its size is just the root size halved per level
+	m_rootSize = (std::max)({ rootMax.x - rootMin.x, rootMax.y - rootMin.y, rootMax.z - rootMin.z, 1e-6f }) * 1.0001f;
+	const float toGrid = (1u << k_bitsPerAxis) / m_rootSize;
+	const uint32_t maxCoord = (1u << k_bitsPerAxis) - 1;
+
+	m_codes.resize(count);
+	m_order.resize(count);
+	pool.ParallelFor(0, count, g_bodyGrain * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const uint32_t cx = (std::min)(maxCoord, static_cast<uint32_t>((x[i] - rootMin.x) * toGrid));
+				const uint32_t cy = (std::min)(maxCoord, static_cast<uint32_t>((y[i] - rootMin.y) * toGrid));
+				const uint32_t cz = (std::min)(maxCoord, static_cast<uint32_t>((z[i] - rootMin.z) * toGrid));
+				m_codes[i] = MortonSort::Code(cx, cy, cz);
+				m_order[i] = static_cast<uint32_t>(i);
+			}
+		});
+	MortonSort::RadixSort(m_codes, m_order, m_codeScratch, m_orderScratch, 3 * k_bitsPerAxis);
+
+	m_x.resize(count + g_simdPadding, 0.0f);
+	m_y.resize(count + g_simdPadding, 0.0f);
+	m_z.resize(count + g_simdPadding, 0.0f);
+	pool.ParallelFor(0, count, g_bodyGrain * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				m_x[i] = x[m_order[i]];
+				m_y[i] = y[m_order[i]];
+				m_z[i] = z[m_order[i]];
+			}
+		});
+}
+
+void BarnesHutTree::Subdivide(std::vector<Node>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth, std::vector<BuildRange>* frontier, size_t frontierTarget)const
+{
+	Node& node = nodes[nodeIndex];
+	node.first = first;
+	node.count = count;
+	node.size = m_rootSize / static_cast<float>(1u << depth);
+	node.childCount = 0;
+	if(count <= k_maxLeafSize || depth == k_bitsPerAxis)
+	{
+		return;
+	}
+	if(frontier && count <= frontierTarget)
+	{
+		frontier->push_back({ nodeIndex, first, count, depth });
+		return;
+	}
+
+	//Bodies in the node share every code bit above this octant, so the octants are sorted runs
+	const uint32_t shift = 3 * (k_bitsPerAxis - 1 - depth);
+	uint32_t childFirst[8], childCount[8], children(0);
+	const uint32_t* cursor = m_codes.data() + first;
+	const uint32_t* end = cursor + count;
+	for(uint32_t octant = 0; octant < 8 && cursor != end; ++octant)
+	{
+		const uint32_t* runEnd = std::partition_point(cursor, end, [&](uint32_t code) { return ((code >> shift) & 7u) <= octant; });
+		if(runEnd != cursor)
+		{
+			childFirst[children] = static_cast<uint32_t>(cursor - m_codes.data());
+			childCount[children] = static_cast<uint32_t>(runEnd - cursor);
+			++children;
+			cursor = runEnd;
+		}
+	}
+
+	const uint32_t firstChild = static_cast<uint32_t>(nodes.size());
+	nodes.resize(nodes.size() + children);
+	nodes[nodeIndex].firstChild = firstChild;
+	nodes[nodeIndex].childCount = children;
+	for(uint32_t c = 0; c < children; ++c)
+	{
+		Subdivide(nodes, firstChild + c, childFirst[c], childCount[c], depth + 1, frontier, frontierTarget);
+	}
+}
+
+void BarnesHutTree::ComputeMass()
+{
+	//Leaves sum their bodies in parallel, then interior nodes combine their children.
+	//Children always come after their parent, so one reverse sweep sees them first.
+	ThreadPool::Get().ParallelFor(0, m_nodes.size(), g_bodyGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t n = begin; n < end; ++n)
+			{
+				Node& node = m_nodes[n];
+				if(node.childCount != 0)
+				{
+					continue;
+				}
+				float sx(0.0f), sy(0.0f), sz(0.0f);
+				for(uint32_t i = node.first; i < node.first + node.count; ++i)
+				{
+					sx += m_x[i];
+					sy += m_y[i];
+					sz += m_z[i];
+				}
+				const float inv = 1.0f / node.count;
+				node.comX = sx * inv;
+				node.comY = sy * inv;
+				node.comZ = sz * inv;
+				node.mass = m_mass * node.count;
+			}
+		});
+	for(size_t n = m_nodes.size(); n-- > 0;)
+	{
+		Node& node = m_nodes[n];
+		if(node.childCount == 0)
+		{
+			continue;
+		}
+		float sx(0.0f), sy(0.0f), sz(0.0f), mass(0.0f);
+		for(uint32_t c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+		{
+			const Node& child = m_nodes[c];
+			sx += child.comX * child.mass;
+			sy += child.comY * child.mass;
+			sz += child.comZ * child.mass;
+			mass += child.mass;
+		}
+		node.comX = sx / mass;
+		node.comY = sy / mass;
+		node.comZ = sz / mass;
+		node.mass = mass;
+	}
+}
+
+void BarnesHutTree::Build(const float* x, const float* y, const float* z, size_t count, float mass)
+{
+	m_mass = mass;
+	m_nodes.clear();
+	if(count == 0)
+	{
+		m_order.clear();
+		return;
+	}
+	SortByMortonCode(x, y, z, count);
+
+	//Split the top levels here, then build the remaining subtrees in parallel and stitch them in
+	ThreadPool& pool = ThreadPool::Get();
+	const size_t frontierTarget = (std::max)(static_cast<size_t>(g_minSubtreeSize), count / (pool.GetThreadCount() * g_subtreesPerThread));
+	std::vector<BuildRange> frontier;
+	m_nodes.reserve(count / (k_maxLeafSize / 4) + 1);
+	m_nodes.emplace_back();
+	Subdivide(m_nodes, 0, 0, static_cast<uint32_t>(count), 0, &frontier, frontierTarget);
+
+	std::vector<std::vector<Node>> subtrees(frontier.size());
+	pool.ParallelFor(0, frontier.size(), 1, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				subtrees[i].reserve(frontier[i].count / (k_maxLeafSize / 4) + 1);
+				subtrees[i].emplace_back();
+				Subdivide(subtrees[i], 0, frontier[i].first, frontier[i].count, frontier[i].depth, nullptr, 0);
+			}
+		});
+	for(size_t i = 0; i < frontier.size(); ++i)
+	{
+		//Local node k > 0 lands at base + k - 1, the local root replaces the frontier node
+		const uint32_t base = static_cast<uint32_t>(m_nodes.size());
+		for(size_t k = 0; k < subtrees[i].size(); ++k)
+		{
+			Node node = subtrees[i][k];
+			if(node.childCount != 0)
+			{
+				node.firstChild = base + node.firstChild - 1;
+			}
+			if(k == 0)
+				m_nodes[frontier[i].node] = node;
+			else
+				m_nodes.push_back(node);
+		}
+	}
+	ComputeMass();
+
+	m_leaves.clear();
+	for(size_t n = 0; n < m_nodes.size(); ++n)
+	{
+		if(m_nodes[n].childCount == 0)
+		{
+			m_leaves.push_back(static_cast<uint32_t>(n));
+		}
+	}
+}
+
+void BarnesHutTree::Build(const std::vector<Particle>& particles, float mass)
+{
+	//Gather into the acceleration arrays, Build copies the positions out before they are reused
+	m_particleIndex.clear();
+	m_ax.clear(); m_ay.clear(); m_az.clear();
+	for(size_t i = 0; i < particles.size(); ++i)
+	{
+		const Particle& p = particles[i];
+		if(p.alive)
+		{
+			m_particleIndex.push_back(static_cast<uint32_t>(i));
+			m_ax.push_back(p.position.x);
+			m_ay.push_back(p.position.y);
+			m_az.push_back(p.position.z);
+		}
+	}
+	Build(m_ax.data(), m_ay.data(), m_az.data(), m_particleIndex.size(), mass);
+}
+
+void BarnesHutTree::ComputeAccelerations(const NBodyParameters& params, float* ax, float* ay, float* az)const
+{
+	if(m_nodes.empty())
+	{
+		return;
+	}
+	const XMVECTOR softeningSq = XMVectorReplicate(params.softening * params.softening);
+	const float thetaSq = params.openingAngle * params.openingAngle;
+
+	//Walk the tree once per leaf rather than once per body. A cell is accepted when it is far
+	//enough from every point of the leaf's bounds, then every body in the leaf sums the same list.
+	ThreadPool::Get().ParallelFor(0, m_leaves.size(), g_leafGrain, [&](size_t begin, size_t end)
+		{
+			InteractionList list;
+			uint32_t stack[8 * k_bitsPerAxis + 1];
+			for(size_t l = begin; l < end; ++l)
+			{
+				const Node& leaf = m_nodes[m_leaves[l]];
+				float minX(FLT_MAX), minY(FLT_MAX), minZ(FLT_MAX), maxX(-FLT_MAX), maxY(-FLT_MAX), maxZ(-FLT_MAX);
+				for(uint32_t i = leaf.first; i < leaf.first + leaf.count; ++i)
+				{
+					minX = (std::min)(minX, m_x[i]); maxX = (std::max)(maxX, m_x[i]);
+					minY = (std::min)(minY, m_y[i]); maxY = (std::max)(maxY, m_y[i]);
+					minZ = (std::min)(minZ, m_z[i]); maxZ = (std::max)(maxZ, m_z[i]);
+				}
+
+				list.Clear();
+				int top(0);
+				stack[top++] = 0;
+				while(top > 0)
+				{
+					const Node& node = m_nodes[stack[--top]];
+					const float dx = (std::max)({ minX - node.comX, 0.0f, node.comX - maxX });
+					const float dy = (std::max)({ minY - node.comY, 0.0f, node.comY - maxY });
+					const float dz = (std::max)({ minZ - node.comZ, 0.0f, node.comZ - maxZ });
+
+					//The leaf's ancestors hold its own bodies. Their centre of mass can still sit outside
+					//the leaf's bounds at wide opening angles, accepting one would pull the leaf towards itself.
+					const bool holdsLeaf = node.first <= leaf.first && leaf.first < node.first + node.count;
+					if(!holdsLeaf && node.size * node.size < thetaSq * (dx * dx + dy * dy + dz * dz))
+					{
+						list.Add(node.comX, node.comY, node.comZ, node.mass);
+					}
+					else if(node.childCount == 0)
+					{
+						for(uint32_t i = node.first; i < node.first + node.count; ++i)
+						{
+							list.Add(m_x[i], m_y[i], m_z[i], m_mass);
+						}
+					}
+					else
+					{
+						for(uint32_t c = 0; c < node.childCount; ++c)
+						{
+							stack[top++] = node.firstChild + c;
+						}
+					}
+				}
+				list.Pad();
+
+				for(uint32_t i = leaf.first; i < leaf.first + leaf.count; ++i)
+				{
+					const XMVECTOR sum = SumInteractions(list.x.data(), list.y.data(), list.z.data(), list.mass.data(), list.count,
+						XMVectorReplicate(m_x[i]), XMVectorReplicate(m_y[i]), XMVectorReplicate(m_z[i]), softeningSq);
+					XMFLOAT3 a;
+					XMStoreFloat3(&a, sum * params.gravitationalConstant);
+					const uint32_t out = m_order[i];
+					ax[out] = a.x;
+					ay[out] = a.y;
+					az[out] = a.z;
+				}
+			}
+		});
+}
+
+void BarnesHutTree::ComputeAccelerationsDirect(const NBodyParameters& params, float* ax, float* ay, float* az)const
+{
+	const XMVECTOR softeningSq = XMVectorReplicate(params.softening * params.softening);
+	const size_t count = m_order.size();
+	const std::vector<float> masses(count + g_simdPadding, m_mass);
+	ThreadPool::Get().ParallelFor(0, count, g_bodyGrain / 16, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const XMVECTOR sum = SumInteractions(m_x.data(), m_y.data(), m_z.data(), masses.data(), count,
+					XMVectorReplicate(m_x[i]), XMVectorReplicate(m_y[i]), XMVectorReplicate(m_z[i]), softeningSq);
+				XMFLOAT3 a;
+				XMStoreFloat3(&a, sum * params.gravitationalConstant);
+				const uint32_t out = m_order[i];
+				ax[out] = a.x;
+				ay[out] = a.y;
+				az[out] = a.z;
+			}
+		});
+}
+
+void BarnesHutTree::Accelerate(std::vector<Particle>& particles, const NBodyParameters& params, float deltaTime)
+{
+	Build(particles, params.particleMass);
+	const size_t count = m_particleIndex.size();
+	if(count == 0)
+	{
+		return;
+	}
+	ComputeAccelerations(params, m_ax.data(), m_ay.data(), m_az.data());
+	ThreadPool::Get().ParallelFor(0, count, g_bodyGrain * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				XMFLOAT3& v = particles[m_particleIndex[i]].velocity;
+				v.x += m_ax[i] * deltaTime;
+				v.y += m_ay[i] * deltaTime;
+				v.z += m_az[i] * deltaTime;
+			}
+		});
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+struct Particle;
+
+struct NBodyParameters
+{
+	float gravitationalConstant = 1.0f;
+	float particleMass = 1.0f;
+	float softening = 0.1f;			//Plummer softening length, keeps close encounters from blowing up
+	float openingAngle = 0.5f;		//Theta, cells smaller than theta * distance are treated as one body. 0 is exact
+};
+
+//Octree for Barnes-Hut gravity, rebuilt from scratch every frame.
+//Bodies are sorted by Morton code so every node owns a contiguous run of the sorted arrays,
+//which makes the build a series of range splits and keeps leaf sums streaming through memory.
+class BarnesHutTree
+{
+	struct Node
+	{
+		float		comX, comY, comZ;		//Centre of mass
+		float		mass;
+		float		size;					//Edge length of the cell
+		uint32_t	firstChild;				//Children are stored next to each other
+		uint32_t	childCount;				//0 for leaves
+		uint32_t	first;					//Run of sorted bodies covered by the node
+		uint32_t	count;
+	};
+	struct BuildRange
+	{
+		uint32_t node;
+		uint32_t first;
+		uint32_t count;
+		uint32_t depth;
+	};
+
+	std::vector<Node>		m_nodes;
+	std::vector<uint32_t>	m_leaves;
+	std::vector<uint32_t>	m_codes, m_order;					//Morton code and input index of each sorted body
+	std::vector<uint32_t>	m_codeScratch, m_orderScratch;
+	std::vector<float>		m_x, m_y, m_z;						//Sorted positions, padded for four wide loads
+	std::vector<uint32_t>	m_particleIndex;					//Input index -> particle, when built from particles
+	std::vector<float>		m_ax, m_ay, m_az;
+	float					m_mass;
+	float					m_rootSize;
+
+	void SortByMortonCode(const float* x, const float* y, const float* z, size_t count);
+	void Subdivide(std::vector<Node>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth, std::vector<BuildRange>* frontier, size_t frontierTarget)const;
+	void ComputeMass();
+public:
+	static constexpr uint32_t k_bitsPerAxis = 10;		//Morton codes use 30 bits, which caps the depth at 10
+	static constexpr uint32_t k_maxLeafSize = 16;
+
+	BarnesHutTree();
+
+	void Build(const float* x, const float* y, const float* z, size_t count, float mass);
+	void Build(const std::vector<Particle>& particles, float mass);
+
+	size_t GetBodyCount()const { return m_order.size(); }
+	size_t GetNodeCount()const { return m_nodes.size(); }
+
+	//Accelerations for every body in the order they were passed to Build
+	void ComputeAccelerations(const NBodyParameters& params, float* ax, float* ay, float* az)const;
+	//O(N^2) reference, for checking the approximation error of an opening angle
+	void ComputeAccelerationsDirect(const NBodyParameters& params, float* ax, float* ay, float* az)const;
+
+	//Builds the tree over the alive particles and adds their accelerations to their velocities
+	void Accelerate(std::vector<Particle>& particles, const NBodyParameters& params, float deltaTime);
+};
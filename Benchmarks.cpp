@@ -0,0 +1,396 @@
+#include "Benchmarks.h"
+#include "SpatialGrid.h"
+#include "MeshBVH.h"
+#include "BarnesHut.h"
+#include "MeshCache.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr int g_benchmarkRuns = 5;		//Timings are the best of this many, to keep the first touch of memory out of them
+
+	template<class Func>
+	double BestTime(Func&& func)
+	{
+		double best(1e30);
+		for(int run = 0; run < g_benchmarkRuns; ++run)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			func();
+			best = (std::min)(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	std::string Format(const char* format, ...)
+	{
+		char text[256];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		return text;
+	}
+
+	//count points spread evenly through a cube sized for about density points per unit volume
+	void RandomPoints(size_t count, float density, std::vector<float>& x, std::vector<float>& y, std::vector<float>& z)
+	{
+		const float side = std::cbrt(count / density);
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> coord(0.0f, side);
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			x[i] = coord(random);
+			y[i] = coord(random);
+			z[i] = coord(random);
+		}
+	}
+
+	constexpr size_t g_gridCheckPoints = 200;	//Queries compared against brute force
+	constexpr float g_gridDensity = 2.0f;		//About 8 neighbours inside a radius of one cell
+
+	std::string BenchmarkSpatialGrid(size_t count)
+	{
+		std::vector<float> x, y, z;
+		RandomPoints(count, g_gridDensity, x, y, z);
+		const float radius(1.0f);
+		SpatialGrid grid(radius);
+		const double rebuild = BestTime([&] { grid.Build(x.data(), y.data(), z.data(), count); });
+
+		//The same bucket order from a comparison sort of (bucket, index) on one thread, what the grid replaces
+		std::vector<uint64_t> keys(count);
+		std::vector<uint32_t> starts(grid.GetBucketCount() + 1);
+		const double sorted = BestTime([&]
+			{
+				for(size_t i = 0; i < count; ++i)
+				{
+					keys[i] = static_cast<uint64_t>(grid.HashCell(grid.CellCoord(x[i]), grid.CellCoord(y[i]), grid.CellCoord(z[i]))) << 32 | i;
+				}
+				std::sort(keys.begin(), keys.end());
+				std::fill(starts.begin(), starts.end(), 0u);
+				for(uint64_t key : keys)
+				{
+					++starts[(key >> 32) + 1];
+				}
+				std::partial_sum(starts.begin(), starts.end(), starts.begin());
+			});
+
+		std::atomic<size_t> pairs(0);
+		const double query = BestTime([&]
+			{
+				pairs = 0;
+				ThreadPool::Get().ParallelFor(0, count, 4096, [&](size_t begin, size_t end)
+					{
+						size_t found(0);
+						for(size_t i = begin; i < end; ++i)
+						{
+							grid.ForEachNeighbor(DirectX::XMFLOAT3(x[i], y[i], z[i]), radius, [&](uint32_t, float, uint32_t) { ++found; });
+						}
+						pairs += found;
+					});
+			});
+
+		size_t wrong(0);
+		for(size_t i = 0; i < g_gridCheckPoints; ++i)
+		{
+			size_t expected(0), found(0);
+			for(size_t j = 0; j < count; ++j)
+			{
+				const float dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+				expected += dx * dx + dy * dy + dz * dz <= radius * radius ? 1 : 0;
+			}
+			grid.ForEachNeighbor(DirectX::XMFLOAT3(x[i], y[i], z[i]), radius, [&](uint32_t, float, uint32_t) { ++found; });
+			wrong += found != expected ? 1 : 0;
+		}
+
+		return Format("SpatialGrid %zu points: rebuild %.2f ms (serial sort %.2f ms), query all %.2f ms, %.1f neighbours each, %zu of %zu brute force checks differ\n",
+			count, rebuild, sorted, query, static_cast<double>(pairs) / count, wrong, g_gridCheckPoints);
+	}
+
+	//The stream loop LoadTextModel replaced, kept as the reference it has to match
+	bool LoadTextModelStream(const std::string& filename, ModelData& model)
+	{
+		std::ifstream fin(filename);
+		if(!fin)
+		{
+			return false;
+		}
+		uint32_t vcount(0), tcount(0);
+		std::string ignore;
+		fin >> ignore >> vcount;
+		fin >> ignore >> tcount;
+		fin >> ignore >> ignore >> ignore >> ignore;
+
+		model.vertices.resize(vcount);
+		for(ModelVertex& v : model.vertices)
+		{
+			fin >> v.position.x >> v.position.y >> v.position.z;
+			fin >> v.normal.x >> v.normal.y >> v.normal.z;
+		}
+		fin >> ignore >> ignore >> ignore;
+
+		model.indices.resize(3 * static_cast<size_t>(tcount));
+		for(uint32_t& index : model.indices)
+		{
+			fin >> index;
+		}
+		return !fin.fail();
+	}
+
+	template<class Attributes>
+	struct AttributeProbe : Attributes					//Spawns and reads attributes without an emitter around them
+	{
+		using Attributes::AttributesSpawned;
+	};
+
+	//Time to fill the attributes of every particle at spawn, and to read them all back once, as a
+	//frame's update or instance write does
+	template<class Attributes>
+	std::string BenchmarkAttributes(const char* name, size_t extraBytes, const std::vector<Particle>& particles, const std::vector<uint32_t>& spawned)
+	{
+		AttributeProbe<Attributes> attributes;
+		const double spawn = BestTime([&] { attributes.AttributesSpawned(spawned, particles); });
+		float sum(0.0f);
+		const double read = BestTime([&]
+			{
+				for(size_t i = 0; i < particles.size(); ++i)
+				{
+					const ParticleAttributes a = attributes.GetAttributes(i, particles[i]);
+					sum += a.direction.x + a.direction.y + a.direction.z + a.rotation;
+				}
+			});
+		return Format("Attributes %s %zu particles: %zu random bytes a particle, spawn %.2f ms, read all %.2f ms (checksum %.1f)\n",
+			name, particles.size(), sizeof(uint32_t) + extraBytes, spawn, read, sum);
+	}
+
+	struct FluidProbe : Update_policies::SPHFluid		//Steps the policy without an emitter around it
+	{
+		using SPHFluid::UpdatePositions;
+	};
+
+	//count particles in a jittered block at half the smoothing radius apart, falling under gravity
+	std::vector<Particle> FluidBlock(size_t count, float spacing)
+	{
+		std::vector<Particle> particles(count);
+		const size_t side = static_cast<size_t>(std::ceil(std::cbrt(static_cast<double>(count))));
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> jitter(-0.1f * spacing, 0.1f * spacing);
+		for(size_t i = 0; i < count; ++i)
+		{
+			particles[i].alive = true;
+			particles[i].position = DirectX::XMFLOAT3((i % side) * spacing + jitter(random), (i / side % side) * spacing + jitter(random), (i / (side * side)) * spacing + jitter(random));
+		}
+		return particles;
+	}
+
+	//count sweeps of a particle step each, from points around the origin spread by spread, compared
+	//with one traversal per sweep spread over the pool the way SweepSpheres used to run them
+	std::string BenchmarkSweeps(const TriangleBVH& bvh, const char* name, size_t count, float spread, float radius)
+	{
+		std::mt19937 random(1234);
+		std::normal_distribution<float> start(0.0f, spread);
+		std::uniform_real_distribution<float> step(-1.0f, 1.0f);
+		std::vector<DirectX::XMFLOAT3> from(count), to(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			from[i] = DirectX::XMFLOAT3(start(random), start(random), start(random));
+			to[i] = DirectX::XMFLOAT3(from[i].x + step(random), from[i].y + step(random), from[i].z + step(random));
+		}
+		std::vector<SweepHit> packets(count), single(count);
+		const double packetTime = BestTime([&] { bvh.SweepSpheres(from.data(), to.data(), count, radius, packets.data()); });
+		const double singleTime = BestTime([&]
+			{
+				ThreadPool::Get().ParallelFor(0, count, 256, [&](size_t begin, size_t end)
+					{
+						for(size_t i = begin; i < end; ++i)
+						{
+							single[i] = bvh.SweepSphere(from[i], to[i], radius);
+						}
+					});
+			});
+
+		size_t hit(0), differ(0);
+		for(size_t i = 0; i < count; ++i)
+		{
+			hit += packets[i].Hit() ? 1 : 0;
+			differ += packets[i].Hit() != single[i].Hit() || (packets[i].Hit() && packets[i].t != single[i].t) ? 1 : 0;
+		}
+		return Format("MeshBVH %zu %s sweeps: packets %.2f ms, one at a time %.2f ms, %zu hit, %zu differ\n",
+			count, name, packetTime, singleTime, hit, differ);
+	}
+}
+
+std::string BenchmarkSpatialGrid()
+{
+	return BenchmarkSpatialGrid(100000) + BenchmarkSpatialGrid(1000000);
+}
+
+std::string BenchmarkSPHFluid()
+{
+	//The request's budget is 4 ms a 60 Hz frame for 100k particles
+	const size_t count(100000);
+	const float frameTime(1.0f / 60.0f);
+	std::vector<Particle> particles = FluidBlock(count, 0.5f);
+	const std::vector<Particle> start = particles;
+	FluidProbe fluid;
+	const double frame = BestTime([&] { fluid.UpdatePositions(frameTime, particles); });
+
+	//Two fluids from the same start have to end up in the same place, bit for bit
+	std::vector<Particle> again = start;
+	particles = start;
+	FluidProbe first, second;
+	for(int i = 0; i < g_benchmarkRuns; ++i)
+	{
+		first.UpdatePositions(frameTime, particles);
+		second.UpdatePositions(frameTime, again);
+	}
+	size_t differ(0);
+	for(size_t i = 0; i < count; ++i)
+	{
+		differ += memcmp(&particles[i].position, &again[i].position, sizeof(DirectX::XMFLOAT3)) != 0 ? 1 : 0;
+	}
+
+	const int substeps = static_cast<int>(std::ceil(frameTime / fluid.GetFluidParameters().maxTimeStep));
+	return Format("SPHFluid %zu particles: %.2f ms a 60 Hz frame of %d substeps, %zu particles differ between two runs\n",
+		count, frame, substeps, differ);
+}
+
+std::string BenchmarkTextModelParser()
+{
+	const char* filename = "Models/skull.txt";
+	ModelData parsed, streamed;
+	std::string error;
+	bool loaded(true), streamLoaded(true);
+	const double parse = BestTime([&] { loaded = LoadTextModel(filename, parsed, &error); });
+	const double stream = BestTime([&] { streamLoaded = LoadTextModelStream(filename, streamed); });
+	if(!loaded || !streamLoaded)
+	{
+		return Format("TextModel %s: failed to load, %s\n", filename, error.c_str());
+	}
+	const bool same = parsed.vertices.size() == streamed.vertices.size() && parsed.indices == streamed.indices &&
+		memcmp(parsed.vertices.data(), streamed.vertices.data(), parsed.vertices.size() * sizeof(ModelVertex)) == 0;
+	return Format("TextModel %s %zu vertices %zu triangles: parser %.2f ms, >> loop %.2f ms, %s\n",
+		filename, parsed.vertices.size(), parsed.indices.size() / 3, parse, stream, same ? "identical" : "DIFFERENT");
+}
+
+std::string BenchmarkParticleAttributes()
+{
+	//Hashed keeps only the seed, Stored keeps the hashed attributes beside it as well
+	const size_t count(1000000);
+	std::vector<Particle> particles(count);
+	std::vector<uint32_t> spawned(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		particles[i].alive = true;
+		particles[i].seed = ParticleRandom::Hash(static_cast<uint32_t>(i));
+		spawned[i] = static_cast<uint32_t>(i);
+	}
+	return BenchmarkAttributes<Attribute_policies::Hashed>("hashed", 0, particles, spawned) +
+		BenchmarkAttributes<Attribute_policies::Stored>("stored", sizeof(ParticleAttributes), particles, spawned);
+}
+
+std::string BenchmarkBarnesHut()
+{
+	//A galaxy like clump, dense in the middle. The error against the O(N^2) sum needs a count the
+	//direct sum can finish, the tree alone is timed larger.
+	const size_t checked(20000), timed(100000);
+	auto clump = [](size_t count, std::vector<float>& x, std::vector<float>& y, std::vector<float>& z)
+	{
+		std::mt19937 random(1234);
+		std::normal_distribution<float> coord(0.0f, 10.0f);
+		x.resize(count);
+		y.resize(count);
+		z.resize(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			x[i] = coord(random);
+			y[i] = coord(random);
+			z[i] = coord(random);
+		}
+	};
+	std::vector<float> x, y, z;
+	clump(checked, x, y, z);
+	BarnesHutTree tree;
+	NBodyParameters params;
+	std::vector<float> ax(checked), ay(checked), az(checked), dx(checked), dy(checked), dz(checked);
+	tree.Build(x.data(), y.data(), z.data(), checked, params.particleMass);
+	const double direct = BestTime([&] { tree.ComputeAccelerationsDirect(params, dx.data(), dy.data(), dz.data()); });
+
+	std::string report;
+	std::vector<double> errors(checked);
+	for(float theta : { 0.5f, 1.0f, 1.5f })
+	{
+		params.openingAngle = theta;
+		const double approx = BestTime([&]
+			{
+				tree.Build(x.data(), y.data(), z.data(), checked, params.particleMass);
+				tree.ComputeAccelerations(params, ax.data(), ay.data(), az.data());
+			});
+		for(size_t i = 0; i < checked; ++i)
+		{
+			const double ex = ax[i] - dx[i], ey = ay[i] - dy[i], ez = az[i] - dz[i];
+			errors[i] = std::sqrt((ex * ex + ey * ey + ez * ez) / (static_cast<double>(dx[i]) * dx[i] + static_cast<double>(dy[i]) * dy[i] + static_cast<double>(dz[i]) * dz[i]));
+		}
+		const double mean = std::accumulate(errors.begin(), errors.end(), 0.0) / checked;
+		std::nth_element(errors.begin(), errors.begin() + checked * 99 / 100, errors.end());
+		report += Format("BarnesHut %zu bodies theta %.1f: build and walk %.2f ms, direct %.2f ms, relative error mean %.3f%% 99th percentile %.3f%%\n",
+			checked, theta, approx, direct, 100.0 * mean, 100.0 * errors[checked * 99 / 100]);
+	}
+
+	clump(timed, x, y, z);
+	ax.resize(timed); ay.resize(timed); az.resize(timed);
+	params.openingAngle = 0.5f;
+	const double build = BestTime([&] { tree.Build(x.data(), y.data(), z.data(), timed, params.particleMass); });
+	const double walk = BestTime([&] { tree.ComputeAccelerations(params, ax.data(), ay.data(), az.data()); });
+	report += Format("BarnesHut %zu bodies theta 0.5: build %.2f ms, walk %.2f ms, %zu nodes\n", timed, build, walk, tree.GetNodeCount());
+	return report;
+}
+
+std::string BenchmarkMeshBVH()
+{
+	ModelData model;
+	std::string error;
+	if(!LoadTextModel("Models/skull.txt", model, &error))
+	{
+		return "MeshBVH: " + error + "\n";
+	}
+	DirectX::XMFLOAT4X4 world;
+	DirectX::XMStoreFloat4x4(&world, DirectX::XMMatrixIdentity());
+	TriangleBVH bvh;
+	bvh.AddMesh(&model.vertices[0].position, sizeof(ModelVertex), model.indices.data(), model.indices.size(), world);
+	const double build = BestTime([&] { bvh.Build(); });
+
+	//Particles scattered through a room around the skull, and a cloud hugging it as an emitter would leave
+	std::string report = Format("MeshBVH skull %zu triangles: build %.2f ms, depth %u\n", bvh.GetTriangleCount(), build, bvh.GetDepth());
+	report += BenchmarkSweeps(bvh, "scattered", 100000, 6.0f, 0.5f);
+	report += BenchmarkSweeps(bvh, "clustered", 10000, 1.5f, 0.5f);
+	return report;
+}
+
+std::string RunBenchmarks()
+{
+	std::string report = Format("Benchmarks on %u threads\n", ThreadPool::Get().GetThreadCount());
+	report += BenchmarkSpatialGrid();
+	report += BenchmarkSPHFluid();
+	report += BenchmarkParticleAttributes();
+	report += BenchmarkTextModelParser();
+	report += BenchmarkBarnesHut();
+	report += BenchmarkMeshBVH();
+	return report;
+}
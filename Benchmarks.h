@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+
+//Timings of the particle and mesh systems against their reference implementations, so the speedups
+//can be reproduced on the target hardware. Run the app with -benchmark on the command line to get
+//the report instead of the window. Each benchmark returns a line per measurement.
+std::string BenchmarkSpatialGrid();
+std::string BenchmarkSPHFluid();
+std::string BenchmarkParticleAttributes();
+std::string BenchmarkTextModelParser();
+std::string BenchmarkBarnesHut();
+std::string BenchmarkMeshBVH();
+
+//Every benchmark above, in order, with the thread count they ran on
+std::string RunBenchmarks();
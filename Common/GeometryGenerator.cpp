@@ -3,14 +3,281 @@
 //***************************************************************************************
 
 #include "GeometryGenerator.h"
+#include "ThreadPool.h"
 #include <algorithm>
 
 using namespace DirectX;
 
+//
+// Collects generated vertices in small batches and hands each batch to the writer's encoder while
+// it's still in cache, so every vertex is written to the destination once.
+//
+class GeometryGenerator::VertexEmitter
+{
+public:
+    explicit VertexEmitter(const MeshWriter& writer) : mWriter(writer) {}
+
+    void Push(const Vertex& v)
+    {
+        mBatch[mBatchCount++] = v;
+        if(mBatchCount == BatchSize)
+            Flush();
+    }
+
+    // Index of the next vertex pushed.
+    uint32 Count()const { return mWritten + mBatchCount; }
+
+    void Flush()
+    {
+        if(mBatchCount == 0)
+            return;
+
+        mWriter.Encode(mBatch, mBatchCount, static_cast<char*>(mWriter.Vertices) + mWritten*mWriter.VertexStride, mWriter.Context);
+        mWritten += mBatchCount;
+        mBatchCount = 0;
+    }
+
+private:
+    static const uint32 BatchSize = 64;
+
+    const MeshWriter& mWriter;
+    Vertex mBatch[BatchSize];
+    uint32 mBatchCount = 0;
+    uint32 mWritten = 0;
+};
+
+class GeometryGenerator::IndexEmitter
+{
+public:
+    explicit IndexEmitter(const MeshWriter& writer) : mIndices(writer.Indices), mIndexSize(writer.IndexSize) {}
+
+    void Push(uint32 i)
+    {
+        if(mIndexSize == sizeof(uint16))
+            static_cast<uint16*>(mIndices)[mCount++] = static_cast<uint16>(i);
+        else
+            static_cast<uint32*>(mIndices)[mCount++] = i;
+    }
+
+    // Moves past count indices written some other way.
+    void Skip(size_t count) { mCount += count; }
+
+private:
+    void* mIndices;
+    uint32 mIndexSize;
+    size_t mCount = 0;
+};
+
+namespace
+{
+    // Deepest subdivision that's still sensible to hold in memory.  Each level quadruples the triangles: at 8 the
+    // geosphere is 1.3M triangles and 655K vertices, about 45MB with its indices, and the box is 27MB.
+    // The next level would be four times as much, and the 32 bit index count runs out at 13.
+    const GeometryGenerator::uint32 MaxSubdivisions = 8;
+
+    //
+    // Open addressing table from an undirected edge, keyed by its two vertex indices, to the vertex
+    // made at its midpoint.  Neighbouring triangles look up the same edge and share the vertex.
+    //
+    class EdgeMidpoints
+    {
+    public:
+        // Room for edgeCapacity edges at no more than three quarters full.
+        explicit EdgeMidpoints(size_t edgeCapacity)
+        {
+            size_t size = 16;
+            while(size < edgeCapacity + edgeCapacity/3)
+                size *= 2;
+            mKeys.assign(size, EmptyKey);
+            mValues.resize(size);
+            mMask = size - 1;
+        }
+
+        // The midpoint vertex of edge ab, numbered next, which is then advanced, if the edge is new.
+        GeometryGenerator::uint32 Find(GeometryGenerator::uint32 a, GeometryGenerator::uint32 b, GeometryGenerator::uint32& next)
+        {
+            const uint64_t key = a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+            size_t slot = size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mMask;
+            while(mKeys[slot] != key)
+            {
+                if(mKeys[slot] == EmptyKey)
+                {
+                    mKeys[slot] = key;
+                    mValues[slot] = next;
+                    return next++;
+                }
+                slot = (slot + 1) & mMask;
+            }
+            return mValues[slot];
+        }
+
+        // Calls f(a, b, midpoint) for every edge found.
+        template<class F>
+        void ForEach(F f)const
+        {
+            for(size_t slot = 0; slot < mKeys.size(); ++slot)
+            {
+                if(mKeys[slot] != EmptyKey)
+                    f(GeometryGenerator::uint32(mKeys[slot] >> 32), GeometryGenerator::uint32(mKeys[slot]), mValues[slot]);
+            }
+        }
+
+    private:
+        static constexpr uint64_t EmptyKey = ~0ull;
+
+        std::vector<uint64_t> mKeys;
+        std::vector<GeometryGenerator::uint32> mValues;
+        size_t mMask = 0;
+    };
+
+    void CopyVertices(const GeometryGenerator::Vertex* vertices, size_t count, void* out, const void*)
+    {
+        std::copy(vertices, vertices + count, static_cast<GeometryGenerator::Vertex*>(out));
+    }
+
+    // Sizes meshData for a shape and returns a writer that fills it in.
+    GeometryGenerator::MeshWriter MeshDataWriter(GeometryGenerator::MeshData& meshData, const GeometryGenerator::MeshSize& size)
+    {
+        meshData.Vertices.resize(size.VertexCount);
+        meshData.Indices32.resize(size.IndexCount);
+
+        GeometryGenerator::MeshWriter writer;
+        writer.Vertices = meshData.Vertices.data();
+        writer.VertexStride = sizeof(GeometryGenerator::Vertex);
+        writer.Encode = &CopyVertices;
+        writer.Indices = meshData.Indices32.data();
+        writer.IndexSize = sizeof(GeometryGenerator::uint32);
+        return writer;
+    }
+
+    // Fewest vertices worth handing a range of rows to another thread for.
+    const size_t ParallelMinVertices = 4096;
+
+    // Rows per chunk when rows of rowVertices each are generated across the thread pool.  Shapes too
+    // small to be worth splitting come out as a single chunk, which runs on the calling thread.
+    size_t RowGrain(size_t rowCount, size_t rowVertices)
+    {
+        return ThreadPool::Get().GrainFor(rowCount, std::max<size_t>(1, ParallelMinVertices/std::max<size_t>(1, rowVertices)));
+    }
+
+    // A copy of writer that writes from vertex first on, for a range of rows written on its own.
+    GeometryGenerator::MeshWriter OffsetWriter(const GeometryGenerator::MeshWriter& writer, size_t first)
+    {
+        GeometryGenerator::MeshWriter offset = writer;
+        offset.Vertices = static_cast<char*>(writer.Vertices) + first*writer.VertexStride;
+        return offset;
+    }
+
+    //
+    // Indices of a row of quads between two rows of vertices starting at top and bottom, as the grid and
+    // the sphere's inner stacks have them: (top+j, top+j+1, bottom+j) and (bottom+j, top+j+1, bottom+j+1).
+    // Every index is the one a whole number of SIMD registers earlier plus the quads they cover, so with
+    // SSE the row is written a register at a time, three per step, and each step just adds to them.
+    //
+    template<class Index>
+    void WriteQuadRow(Index* out, GeometryGenerator::uint32 top, GeometryGenerator::uint32 bottom, GeometryGenerator::uint32 quads)
+    {
+        GeometryGenerator::uint32 j = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+        // 2 quads of 32 bit indices or 4 of 16 bit fill three registers.
+        const GeometryGenerator::uint32 quadsPerStep = static_cast<GeometryGenerator::uint32>(8/sizeof(Index));
+        if(quads >= quadsPerStep)
+        {
+            Index first[6*quadsPerStep];
+            for(GeometryGenerator::uint32 k = 0; k < quadsPerStep; ++k)
+            {
+                first[6*k+0] = static_cast<Index>(top + k);
+                first[6*k+1] = static_cast<Index>(top + k+1);
+                first[6*k+2] = static_cast<Index>(bottom + k);
+                first[6*k+3] = static_cast<Index>(bottom + k);
+                first[6*k+4] = static_cast<Index>(top + k+1);
+                first[6*k+5] = static_cast<Index>(bottom + k+1);
+            }
+            __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first) + 1);
+            __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first) + 2);
+            const __m128i step = sizeof(Index) == sizeof(GeometryGenerator::uint16) ? _mm_set1_epi16(quadsPerStep) : _mm_set1_epi32(quadsPerStep);
+            for(; j + quadsPerStep <= quads; j += quadsPerStep)
+            {
+                __m128i* dest = reinterpret_cast<__m128i*>(out + 6*size_t(j));
+                _mm_storeu_si128(dest, r0);
+                _mm_storeu_si128(dest + 1, r1);
+                _mm_storeu_si128(dest + 2, r2);
+                if(sizeof(Index) == sizeof(GeometryGenerator::uint16))
+                {
+                    r0 = _mm_add_epi16(r0, step);
+                    r1 = _mm_add_epi16(r1, step);
+                    r2 = _mm_add_epi16(r2, step);
+                }
+                else
+                {
+                    r0 = _mm_add_epi32(r0, step);
+                    r1 = _mm_add_epi32(r1, step);
+                    r2 = _mm_add_epi32(r2, step);
+                }
+            }
+        }
+#endif
+        for(; j < quads; ++j)
+        {
+            Index* quad = out + 6*size_t(j);
+            quad[0] = static_cast<Index>(top + j);
+            quad[1] = static_cast<Index>(top + j+1);
+            quad[2] = static_cast<Index>(bottom + j);
+            quad[3] = static_cast<Index>(bottom + j);
+            quad[4] = static_cast<Index>(top + j+1);
+            quad[5] = static_cast<Index>(bottom + j+1);
+        }
+    }
+
+    // Writes a row of quads from index first of the writer's index buffer.
+    void WriteQuadRow(const GeometryGenerator::MeshWriter& writer, size_t first, GeometryGenerator::uint32 top, GeometryGenerator::uint32 bottom,
+        GeometryGenerator::uint32 quads)
+    {
+        if(writer.IndexSize == sizeof(GeometryGenerator::uint16))
+            WriteQuadRow(static_cast<GeometryGenerator::uint16*>(writer.Indices) + first, top, bottom, quads);
+        else
+            WriteQuadRow(static_cast<GeometryGenerator::uint32*>(writer.Indices) + first, top, bottom, quads);
+    }
+
+    GeometryGenerator::MeshSize MakeSize(GeometryGenerator::uint32 vertexCount, GeometryGenerator::uint32 indexCount, const XMFLOAT3& extents)
+    {
+        GeometryGenerator::MeshSize size;
+        size.VertexCount = vertexCount;
+        size.IndexCount = indexCount;
+        size.Bounds = BoundingBox(XMFLOAT3(0.0f, 0.0f, 0.0f), extents);
+        return size;
+    }
+}
+
 GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float height, float depth, uint32 numSubdivisions)
 {
     MeshData meshData;
 
+    // Put a cap on the number of subdivisions.
+    numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
+
+    // Each face is a (2^n + 1) x (2^n + 1) grid of vertices once subdivided, size for the last level
+    // so no level reallocates.
+    const size_t faceSide = (size_t(1) << numSubdivisions) + 1;
+    meshData.Vertices.reserve(6*faceSide*faceSide);
+    meshData.Indices32.reserve(size_t(36) << (2*numSubdivisions));
+
+    WriteBox(width, height, depth, MeshDataWriter(meshData, GetBoxSize(width, height, depth)));
+
+    for(uint32 i = 0; i < numSubdivisions; ++i)
+        Subdivide(meshData);
+
+    return meshData;
+}
+
+GeometryGenerator::MeshSize GeometryGenerator::GetBoxSize(float width, float height, float depth)
+{
+    return MakeSize(24, 36, XMFLOAT3(0.5f*width, 0.5f*height, 0.5f*depth));
+}
+
+void GeometryGenerator::WriteBox(float width, float height, float depth, const MeshWriter& writer)
+{
     //
 	// Create the vertices.
 	//
@@ -57,12 +324,13 @@ GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float heig
 	v[22] = Vertex(+w2, +h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f);
 	v[23] = Vertex(+w2, -h2, +d2, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f);
 
-	meshData.Vertices.assign(&v[0], &v[24]);
+	writer.Encode(v, 24, writer.Vertices, writer.Context);
  
 	//
 	// Create the indices.
 	//
 
+	IndexEmitter indices(writer);
 	uint32 i[36];
 
 	// Fill in the front face index data
@@ -89,20 +357,31 @@ GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float heig
 	i[30] = 20; i[31] = 21; i[32] = 22;
 	i[33] = 20; i[34] = 22; i[35] = 23;
 
-	meshData.Indices32.assign(&i[0], &i[36]);
+	for(uint32 k = 0; k < 36; ++k)
+		indices.Push(i[k]);
+}
 
-    // Put a cap on the number of subdivisions.
-    numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount)
+{
+    MeshData meshData;
 
-    for(uint32 i = 0; i < numSubdivisions; ++i)
-        Subdivide(meshData);
+    WriteSphere(radius, sliceCount, stackCount, MeshDataWriter(meshData, GetSphereSize(radius, sliceCount, stackCount)));
 
     return meshData;
 }
 
-GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32 sliceCount, uint32 stackCount)
+GeometryGenerator::MeshSize GeometryGenerator::GetSphereSize(float radius, uint32 sliceCount, uint32 stackCount)
 {
-    MeshData meshData;
+    // Two poles and a ring for each stack boundary, a fan at each pole and two triangles per quad between.
+    uint32 vertexCount = 2 + (stackCount-1)*(sliceCount+1);
+    uint32 indexCount = 2*3*sliceCount + 6*(stackCount-2)*sliceCount;
+
+    return MakeSize(vertexCount, indexCount, XMFLOAT3(radius, radius, radius));
+}
+
+void GeometryGenerator::WriteSphere(float radius, uint32 sliceCount, uint32 stackCount, const MeshWriter& writer)
+{
+    IndexEmitter indices(writer);
 
 	//
 	// Compute the vertices stating at the top pole and moving down the stacks.
@@ -114,112 +393,109 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	Vertex topVertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
 	Vertex bottomVertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
 
-	meshData.Vertices.push_back( topVertex );
-
 	float phiStep   = XM_PI/stackCount;
 	float thetaStep = 2.0f*XM_PI/sliceCount;
 
-	// Compute vertices for each stack ring (do not count the poles as rings).
-	for(uint32 i = 1; i <= stackCount-1; ++i)
-	{
-		float phi = i*phiStep;
-
-		// Vertices of ring.
-        for(uint32 j = 0; j <= sliceCount; ++j)
-		{
-			float theta = j*thetaStep;
-
-			Vertex v;
-
-			// spherical to cartesian
-			v.Position.x = radius*sinf(phi)*cosf(theta);
-			v.Position.y = radius*cosf(phi);
-			v.Position.z = radius*sinf(phi)*sinf(theta);
-
-			// Partial derivative of P with respect to theta
-			v.TangentU.x = -radius*sinf(phi)*sinf(theta);
-			v.TangentU.y = 0.0f;
-			v.TangentU.z = +radius*sinf(phi)*cosf(theta);
-
-			XMVECTOR T = XMLoadFloat3(&v.TangentU);
-			XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
-
-			XMVECTOR p = XMLoadFloat3(&v.Position);
-			XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
-
-			v.TexC.x = theta / XM_2PI;
-			v.TexC.y = phi / XM_PI;
+	// Add one because we duplicate the first and last vertex per ring
+	// since the texture coordinates are different.
+    uint32 ringVertexCount = sliceCount + 1;
+	uint32 southPoleIndex = 1 + (stackCount-1)*ringVertexCount;
 
-			meshData.Vertices.push_back( v );
-		}
+	// Every ring goes through the same angles around the axis.
+	std::vector<float> sinTheta(ringVertexCount);
+	std::vector<float> cosTheta(ringVertexCount);
+	for(uint32 j = 0; j <= sliceCount; ++j)
+	{
+		sinTheta[j] = sinf(j*thetaStep);
+		cosTheta[j] = cosf(j*thetaStep);
 	}
 
-	meshData.Vertices.push_back( bottomVertex );
+	writer.Encode(&topVertex, 1, writer.Vertices, writer.Context);
+	writer.Encode(&bottomVertex, 1, static_cast<char*>(writer.Vertices) + southPoleIndex*writer.VertexStride, writer.Context);
 
 	//
-	// Compute indices for top stack.  The top stack was written first to the vertex buffer
-	// and connects the top pole to the first ring.
+	// Compute the top stack's indices, which connect the top pole to the first ring.
 	//
 
     for(uint32 i = 1; i <= sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(0);
-		meshData.Indices32.push_back(i+1);
-		meshData.Indices32.push_back(i);
+		indices.Push(0);
+		indices.Push(i+1);
+		indices.Push(i);
 	}
-	
+
 	//
-	// Compute indices for inner stacks (not connected to poles).
+	// Compute vertices for each stack ring (do not count the poles as rings), and the indices
+	// of each inner stack (not connected to poles) from the ring above it down to it.  Every
+	// range of rings goes to its own part of the buffers, so they're generated in parallel.
 	//
 
-	// Offset the indices to the index of the first vertex in the first ring.
-	// This is just skipping the top pole vertex.
-    uint32 baseIndex = 1;
-    uint32 ringVertexCount = sliceCount + 1;
-	for(uint32 i = 0; i < stackCount-2; ++i)
+	ThreadPool::Get().ParallelFor(1, stackCount, RowGrain(stackCount-1, ringVertexCount), [&](size_t begin, size_t end)
 	{
-		for(uint32 j = 0; j < sliceCount; ++j)
+		const MeshWriter rows = OffsetWriter(writer, 1 + (begin-1)*ringVertexCount);
+		VertexEmitter vertices(rows);
+		for(uint32 i = (uint32)begin; i < (uint32)end; ++i)
 		{
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
+			float phi = i*phiStep;
+			float sinPhi = sinf(phi);
+			float cosPhi = cosf(phi);
+
+			// Vertices of ring.
+			for(uint32 j = 0; j <= sliceCount; ++j)
+			{
+				float theta = j*thetaStep;
+
+				Vertex v;
+
+				// spherical to cartesian
+				v.Position.x = radius*sinPhi*cosTheta[j];
+				v.Position.y = radius*cosPhi;
+				v.Position.z = radius*sinPhi*sinTheta[j];
 
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j+1);
+				// Partial derivative of P with respect to theta
+				v.TangentU.x = -radius*sinPhi*sinTheta[j];
+				v.TangentU.y = 0.0f;
+				v.TangentU.z = +radius*sinPhi*cosTheta[j];
+
+				XMVECTOR T = XMLoadFloat3(&v.TangentU);
+				XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
+
+				XMVECTOR p = XMLoadFloat3(&v.Position);
+				XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
+
+				v.TexC.x = theta / XM_2PI;
+				v.TexC.y = phi / XM_PI;
+
+				vertices.Push( v );
+			}
+
+			// Offset the indices to the index of the first vertex in the first ring.
+			// This is just skipping the top pole vertex.
+			if(i >= 2)
+				WriteQuadRow(writer, 3*sliceCount + 6*size_t(i-2)*sliceCount, 1 + (i-2)*ringVertexCount, 1 + (i-1)*ringVertexCount, sliceCount);
 		}
-	}
+		vertices.Flush();
+	});
 
 	//
 	// Compute indices for bottom stack.  The bottom stack was written last to the vertex buffer
 	// and connects the bottom pole to the bottom ring.
 	//
 
-	// South pole vertex was added last.
-	uint32 southPoleIndex = (uint32)meshData.Vertices.size()-1;
-
 	// Offset the indices to the index of the first vertex in the last ring.
-	baseIndex = southPoleIndex - ringVertexCount;
-	
+	uint32 baseIndex = southPoleIndex - ringVertexCount;
+
+	indices.Skip(6*size_t(stackCount-2)*sliceCount);
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(southPoleIndex);
-		meshData.Indices32.push_back(baseIndex+i);
-		meshData.Indices32.push_back(baseIndex+i+1);
+		indices.Push(southPoleIndex);
+		indices.Push(baseIndex+i);
+		indices.Push(baseIndex+i+1);
 	}
-
-    return meshData;
 }
  
 void GeometryGenerator::Subdivide(MeshData& meshData)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
-
 	//       v1
 	//       *
 	//      / \
@@ -230,48 +506,44 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
-	for(uint32 i = 0; i < numTris; ++i)
+	// The input vertices keep their numbers and each distinct edge adds one midpoint after them, so
+	// triangles sharing an edge share its midpoint.  Edges are matched by vertex index rather than
+	// position, vertices split along a seam keep their own midpoints.
+	const uint32 numVerts = (uint32)meshData.Vertices.size();
+	const uint32 numTris = (uint32)meshData.Indices32.size()/3;
+	EdgeMidpoints midpoints(3*size_t(numTris));
+	uint32 nextVertex = numVerts;
+
+	// Each triangle's four replace it in place.  Working from the back, triangle i writes over
+	// triangles 4i to 4i+3, which are either past the input or already done.
+	meshData.Indices32.resize(12*size_t(numTris));
+	uint32* indices = meshData.Indices32.data();
+	for(uint32 i = numTris; i-- > 0;)
 	{
-		Vertex v0 = inputCopy.Vertices[ inputCopy.Indices32[i*3+0] ];
-		Vertex v1 = inputCopy.Vertices[ inputCopy.Indices32[i*3+1] ];
-		Vertex v2 = inputCopy.Vertices[ inputCopy.Indices32[i*3+2] ];
-
-		//
-		// Generate the midpoints.
-		//
-
-        Vertex m0 = MidPoint(v0, v1);
-        Vertex m1 = MidPoint(v1, v2);
-        Vertex m2 = MidPoint(v0, v2);
-
-		//
-		// Add new geometry.
-		//
-
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
- 
-		meshData.Indices32.push_back(i*6+0);
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+5);
-
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+5);
-
-		meshData.Indices32.push_back(i*6+5);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+2);
-
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+1);
-		meshData.Indices32.push_back(i*6+4);
+		const uint32 v0 = indices[i*3+0];
+		const uint32 v1 = indices[i*3+1];
+		const uint32 v2 = indices[i*3+2];
+
+		const uint32 m0 = midpoints.Find(v0, v1, nextVertex);
+		const uint32 m1 = midpoints.Find(v1, v2, nextVertex);
+		const uint32 m2 = midpoints.Find(v0, v2, nextVertex);
+
+		uint32* out = &indices[size_t(i)*12];
+		out[0] = v0;  out[1] = m0;  out[2] = m2;
+		out[3] = m0;  out[4] = m1;  out[5] = m2;
+		out[6] = m2;  out[7] = m1;  out[8] = v2;
+		out[9] = m0;  out[10] = v1; out[11] = m1;
 	}
+
+	// Now the number of edges is known the vertices grow exactly once.
+	if(meshData.Vertices.capacity() < nextVertex)
+		meshData.Vertices.reserve(nextVertex);
+	meshData.Vertices.resize(nextVertex);
+	Vertex* vertices = meshData.Vertices.data();
+	midpoints.ForEach([&](uint32 a, uint32 b, uint32 m)
+	{
+		vertices[m] = MidPoint(vertices[a], vertices[b]);
+	});
 }
 
 GeometryGenerator::Vertex GeometryGenerator::MidPoint(const Vertex& v0, const Vertex& v1)
@@ -309,7 +581,19 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
     MeshData meshData;
 
 	// Put a cap on the number of subdivisions.
-    numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+    numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
+
+	// A closed mesh of V vertices, E edges and T triangles subdivides into V + E, 2E + 3T and 4T, starting
+	// from the icosahedron's 12, 30 and 20.  Size for the last level so no level reallocates.
+	size_t finalVertices = 12, finalEdges = 30, finalTris = 20;
+	for(uint32 i = 0; i < numSubdivisions; ++i)
+	{
+		finalVertices += finalEdges;
+		finalEdges = 2*finalEdges + 3*finalTris;
+		finalTris *= 4;
+	}
+	meshData.Vertices.reserve(finalVertices);
+	meshData.Indices32.reserve(3*finalTris);
 
 	// Approximate a sphere by tessellating an icosahedron.
 
@@ -383,6 +667,27 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 {
     MeshData meshData;
 
+    WriteCylinder(bottomRadius, topRadius, height, sliceCount, stackCount,
+        MeshDataWriter(meshData, GetCylinderSize(bottomRadius, topRadius, height, sliceCount, stackCount)));
+
+    return meshData;
+}
+
+GeometryGenerator::MeshSize GeometryGenerator::GetCylinderSize(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount)
+{
+    // The side's rings, then each cap's ring and center vertex.
+    uint32 vertexCount = (stackCount+1)*(sliceCount+1) + 2*(sliceCount+2);
+    uint32 indexCount = 6*stackCount*sliceCount + 2*3*sliceCount;
+
+    float r = std::max<float>(bottomRadius, topRadius);
+    return MakeSize(vertexCount, indexCount, XMFLOAT3(r, 0.5f*height, r));
+}
+
+void GeometryGenerator::WriteCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, const MeshWriter& writer)
+{
+    VertexEmitter vertices(writer);
+    IndexEmitter indices(writer);
+
 	//
 	// Build Stacks.
 	// 
@@ -444,7 +749,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 			XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
 			XMStoreFloat3(&vertex.Normal, N);
 
-			meshData.Vertices.push_back(vertex);
+			vertices.Push(vertex);
 		}
 	}
 
@@ -457,26 +762,26 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 	{
 		for(uint32 j = 0; j < sliceCount; ++j)
 		{
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
+			indices.Push(i*ringVertexCount + j);
+			indices.Push((i+1)*ringVertexCount + j);
+			indices.Push((i+1)*ringVertexCount + j+1);
 
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
-			meshData.Indices32.push_back(i*ringVertexCount + j+1);
+			indices.Push(i*ringVertexCount + j);
+			indices.Push((i+1)*ringVertexCount + j+1);
+			indices.Push(i*ringVertexCount + j+1);
 		}
 	}
 
-	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
-	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
+	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, vertices, indices);
+	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, vertices, indices);
 
-    return meshData;
+	vertices.Flush();
 }
 
 void GeometryGenerator::BuildCylinderTopCap(float bottomRadius, float topRadius, float height,
-											uint32 sliceCount, uint32 stackCount, MeshData& meshData)
+											uint32 sliceCount, VertexEmitter& vertices, IndexEmitter& indices)
 {
-	uint32 baseIndex = (uint32)meshData.Vertices.size();
+	uint32 baseIndex = vertices.Count();
 
 	float y = 0.5f*height;
 	float dTheta = 2.0f*XM_PI/sliceCount;
@@ -492,31 +797,31 @@ void GeometryGenerator::BuildCylinderTopCap(float bottomRadius, float topRadius,
 		float u = x/height + 0.5f;
 		float v = z/height + 0.5f;
 
-		meshData.Vertices.push_back( Vertex(x, y, z, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
+		vertices.Push( Vertex(x, y, z, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
 	}
 
 	// Cap center vertex.
-	meshData.Vertices.push_back( Vertex(0.0f, y, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
+	vertices.Push( Vertex(0.0f, y, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
 
 	// Index of center vertex.
-	uint32 centerIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 centerIndex = vertices.Count()-1;
 
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(centerIndex);
-		meshData.Indices32.push_back(baseIndex + i+1);
-		meshData.Indices32.push_back(baseIndex + i);
+		indices.Push(centerIndex);
+		indices.Push(baseIndex + i+1);
+		indices.Push(baseIndex + i);
 	}
 }
 
 void GeometryGenerator::BuildCylinderBottomCap(float bottomRadius, float topRadius, float height,
-											   uint32 sliceCount, uint32 stackCount, MeshData& meshData)
+											   uint32 sliceCount, VertexEmitter& vertices, IndexEmitter& indices)
 {
 	// 
 	// Build bottom cap.
 	//
 
-	uint32 baseIndex = (uint32)meshData.Vertices.size();
+	uint32 baseIndex = vertices.Count();
 	float y = -0.5f*height;
 
 	// vertices of ring
@@ -531,20 +836,20 @@ void GeometryGenerator::BuildCylinderBottomCap(float bottomRadius, float topRadi
 		float u = x/height + 0.5f;
 		float v = z/height + 0.5f;
 
-		meshData.Vertices.push_back( Vertex(x, y, z, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
+		vertices.Push( Vertex(x, y, z, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, u, v) );
 	}
 
 	// Cap center vertex.
-	meshData.Vertices.push_back( Vertex(0.0f, y, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
+	vertices.Push( Vertex(0.0f, y, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f) );
 
 	// Cache the index of center vertex.
-	uint32 centerIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 centerIndex = vertices.Count()-1;
 
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(centerIndex);
-		meshData.Indices32.push_back(baseIndex + i);
-		meshData.Indices32.push_back(baseIndex + i+1);
+		indices.Push(centerIndex);
+		indices.Push(baseIndex + i);
+		indices.Push(baseIndex + i+1);
 	}
 }
 
@@ -552,13 +857,18 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 {
     MeshData meshData;
 
-	uint32 vertexCount = m*n;
-	uint32 faceCount   = (m-1)*(n-1)*2;
+    WriteGrid(width, depth, m, n, MeshDataWriter(meshData, GetGridSize(width, depth, m, n)));
 
-	//
-	// Create the vertices.
-	//
+    return meshData;
+}
+
+GeometryGenerator::MeshSize GeometryGenerator::GetGridSize(float width, float depth, uint32 m, uint32 n)
+{
+    return MakeSize(m*n, (m-1)*(n-1)*2*3, XMFLOAT3(0.5f*width, 0.0f, 0.5f*depth));
+}
 
+void GeometryGenerator::WriteGrid(float width, float depth, uint32 m, uint32 n, const MeshWriter& writer)
+{
 	float halfWidth = 0.5f*width;
 	float halfDepth = 0.5f*depth;
 
@@ -568,49 +878,39 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 	float du = 1.0f / (n-1);
 	float dv = 1.0f / (m-1);
 
-	meshData.Vertices.resize(vertexCount);
-	for(uint32 i = 0; i < m; ++i)
-	{
-		float z = halfDepth - i*dz;
-		for(uint32 j = 0; j < n; ++j)
-		{
-			float x = -halfWidth + j*dx;
-
-			meshData.Vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
-			meshData.Vertices[i*n+j].Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
-			meshData.Vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
-
-			// Stretch texture over grid.
-			meshData.Vertices[i*n+j].TexC.x = j*du;
-			meshData.Vertices[i*n+j].TexC.y = i*dv;
-		}
-	}
- 
-    //
-	// Create the indices.
+	//
+	// Create the vertices of each row, and the indices of each quad between it and the next.
+	// Every range of rows goes to its own part of the buffers, so they're generated in parallel.
 	//
 
-	meshData.Indices32.resize(faceCount*3); // 3 indices per face
-
-	// Iterate over each quad and compute indices.
-	uint32 k = 0;
-	for(uint32 i = 0; i < m-1; ++i)
+	ThreadPool::Get().ParallelFor(0, m, RowGrain(m, n), [&](size_t begin, size_t end)
 	{
-		for(uint32 j = 0; j < n-1; ++j)
+		const MeshWriter rows = OffsetWriter(writer, begin*n);
+		VertexEmitter vertices(rows);
+		for(uint32 i = (uint32)begin; i < (uint32)end; ++i)
 		{
-			meshData.Indices32[k]   = i*n+j;
-			meshData.Indices32[k+1] = i*n+j+1;
-			meshData.Indices32[k+2] = (i+1)*n+j;
+			float z = halfDepth - i*dz;
+			for(uint32 j = 0; j < n; ++j)
+			{
+				float x = -halfWidth + j*dx;
 
-			meshData.Indices32[k+3] = (i+1)*n+j;
-			meshData.Indices32[k+4] = i*n+j+1;
-			meshData.Indices32[k+5] = (i+1)*n+j+1;
+				Vertex v;
+				v.Position = XMFLOAT3(x, 0.0f, z);
+				v.Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
+				v.TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
 
-			k += 6; // next quad
-		}
-	}
+				// Stretch texture over grid.
+				v.TexC.x = j*du;
+				v.TexC.y = i*dv;
 
-    return meshData;
+				vertices.Push(v);
+			}
+
+			if(i < m-1)
+				WriteQuadRow(writer, 6*size_t(i)*(n-1), i*n, (i+1)*n, n-1);
+		}
+		vertices.Flush();
+	});
 }
 
 GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, float w, float h, float depth)
@@ -16,6 +16,7 @@
 
 #include <cstdint>
 #include <DirectXMath.h>
+#include <DirectXCollision.h>
 #include <vector>
 
 class GeometryGenerator
@@ -74,9 +75,40 @@ public:
 		std::vector<uint16> mIndices16;
 	};
 
+	///<summary>
+	/// Exact number of vertices and indices a Write function produces, so the caller can size
+	/// its buffers first.  Bounds is the box the shape's positions lie in.
+	///</summary>
+	struct MeshSize
+	{
+		uint32 VertexCount = 0;
+		uint32 IndexCount = 0;
+		DirectX::BoundingBox Bounds;
+	};
+
+	///<summary>
+	/// Where a Write function puts a shape.  Vertices are generated a small batch at a time and
+	/// handed to Encode, which converts count of them into the caller's format at out, so each
+	/// vertex is written to Vertices once.  Vertices may point into mapped upload memory.
+	/// Indices are IndexSize bytes wide (2 or 4) and count from the shape's first vertex.
+	/// Large grids and spheres are generated a range of rows per thread, so Encode may be
+	/// called from several threads at once, each on its own part of Vertices.
+	///</summary>
+	struct MeshWriter
+	{
+		using EncodeFunc = void(*)(const Vertex* vertices, size_t count, void* out, const void* context);
+
+		void* Vertices = nullptr;
+		size_t VertexStride = 0;
+		EncodeFunc Encode = nullptr;
+		const void* Context = nullptr;
+		void* Indices = nullptr;
+		uint32 IndexSize = sizeof(uint32);
+	};
+
 	///<summary>
 	/// Creates a box centered at the origin with the given dimensions, where each
-    /// face has m rows and n columns of vertices.
+    /// face has m rows and n columns of vertices.  At most 8 subdivisions.
 	///</summary>
     MeshData CreateBox(float width, float height, float depth, uint32 numSubdivisions);
 
@@ -88,7 +120,7 @@ public:
 
 	///<summary>
 	/// Creates a geosphere centered at the origin with the given radius.  The
-	/// depth controls the level of tessellation.
+	/// depth controls the level of tessellation, at most 8 subdivisions.
 	///</summary>
     MeshData CreateGeosphere(float radius, uint32 numSubdivisions);
 
@@ -110,10 +142,30 @@ public:
 	///</summary>
     MeshData CreateQuad(float x, float y, float w, float h, float depth);
 
+	///<summary>
+	/// Sizes of the shapes the Create functions above build, without subdivision.
+	///</summary>
+	MeshSize GetBoxSize(float width, float height, float depth);
+	MeshSize GetSphereSize(float radius, uint32 sliceCount, uint32 stackCount);
+	MeshSize GetCylinderSize(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount);
+	MeshSize GetGridSize(float width, float depth, uint32 m, uint32 n);
+
+	///<summary>
+	/// Generate the same vertices and triangles as the Create functions straight into the writer's
+	/// buffers, which must hold the counts the matching Get*Size returns.
+	///</summary>
+	void WriteBox(float width, float height, float depth, const MeshWriter& writer);
+	void WriteSphere(float radius, uint32 sliceCount, uint32 stackCount, const MeshWriter& writer);
+	void WriteCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, const MeshWriter& writer);
+	void WriteGrid(float width, float depth, uint32 m, uint32 n, const MeshWriter& writer);
+
 private:
+	// Splits every triangle into four, sharing the vertex added on each edge between the triangles on it.
 	void Subdivide(MeshData& meshData);
     Vertex MidPoint(const Vertex& v0, const Vertex& v1);
-    void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
-    void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
+    class VertexEmitter;
+    class IndexEmitter;
+    void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, VertexEmitter& vertices, IndexEmitter& indices);
+    void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, VertexEmitter& vertices, IndexEmitter& indices);
 };
 
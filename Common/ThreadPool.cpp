@@ -0,0 +1,98 @@
+//***************************************************************************************
+// ThreadPool.cpp
+//***************************************************************************************
+
+#include "ThreadPool.h"
+
+thread_local bool ThreadPool::tInsideJob = false;
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+	if(threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	if(threadCount == 0)
+		threadCount = 1;
+
+	mWorkers.reserve(threadCount - 1);
+	for(unsigned i = 1; i < threadCount; ++i)
+		mWorkers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+
+	for(auto& worker : mWorkers)
+		worker.join();
+}
+
+void ThreadPool::Run(const std::function<void(size_t, size_t)>& job, size_t begin, size_t end, size_t grain)
+{
+	std::lock_guard<std::mutex> submitLock(mSubmitMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJob = &job;
+		mNext.store(begin, std::memory_order_relaxed);
+		mEnd = end;
+		mGrain = grain;
+		mBusyWorkers = static_cast<unsigned>(mWorkers.size());
+		++mGeneration;
+	}
+	mWake.notify_all();
+
+	ExecuteChunks();
+
+	// Workers still hold a pointer to the job, so wait for every one of them to check in.
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock, [this]() { return mBusyWorkers == 0; });
+	mJob = nullptr;
+}
+
+void ThreadPool::ExecuteChunks()
+{
+	tInsideJob = true;
+	for(;;)
+	{
+		size_t chunkBegin = mNext.fetch_add(mGrain, std::memory_order_relaxed);
+		if(chunkBegin >= mEnd)
+			break;
+
+		size_t chunkEnd = chunkBegin + mGrain < mEnd ? chunkBegin + mGrain : mEnd;
+		(*mJob)(chunkBegin, chunkEnd);
+	}
+	tInsideJob = false;
+}
+
+void ThreadPool::WorkerLoop()
+{
+	std::uint64_t seenGeneration = 0;
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&]() { return mQuit || mGeneration != seenGeneration; });
+			if(mQuit)
+				return;
+			seenGeneration = mGeneration;
+		}
+
+		ExecuteChunks();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if(--mBusyWorkers == 0)
+				mDone.notify_one();
+		}
+	}
+}
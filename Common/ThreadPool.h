@@ -0,0 +1,83 @@
+//***************************************************************************************
+// ThreadPool.h
+//
+// Small persistent worker pool used to split data parallel loops across cores.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// Pool shared by the whole application, sized to the hardware thread count.
+	static ThreadPool& Get();
+
+	// threadCount includes the calling thread, 0 picks std::thread::hardware_concurrency().
+	explicit ThreadPool(unsigned threadCount = 0);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	// Number of threads that take part in a ParallelFor, including the caller.
+	unsigned GetThreadCount()const { return static_cast<unsigned>(mWorkers.size()) + 1; }
+
+	///<summary>
+	/// Calls func(chunkBegin, chunkEnd) over [begin, end) in chunks of at most grain items and
+	/// returns once every chunk has finished.  The caller works on chunks too.  Nested calls, and
+	/// ranges that fit in a single chunk, run inline on the calling thread.
+	///</summary>
+	template<class Func>
+	void ParallelFor(size_t begin, size_t end, size_t grain, Func&& func)
+	{
+		if(end <= begin)
+			return;
+		if(grain == 0)
+			grain = 1;
+
+		if(end - begin <= grain || mWorkers.empty() || tInsideJob)
+		{
+			func(begin, end);
+			return;
+		}
+
+		std::function<void(size_t, size_t)> job(std::ref(func));
+		Run(job, begin, end, grain);
+	}
+
+	// Splits [begin, end) into roughly one chunk per thread times the oversubscription factor.
+	size_t GrainFor(size_t count, size_t minGrain = 256, size_t chunksPerThread = 4)const
+	{
+		size_t grain = count / (GetThreadCount() * chunksPerThread);
+		return grain < minGrain ? minGrain : grain;
+	}
+
+private:
+	void Run(const std::function<void(size_t, size_t)>& job, size_t begin, size_t end, size_t grain);
+	void ExecuteChunks();
+	void WorkerLoop();
+
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mSubmitMutex;					// One job in flight at a time.
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+
+	const std::function<void(size_t, size_t)>* mJob = nullptr;
+	std::atomic<size_t> mNext{ 0 };
+	size_t mEnd = 0;
+	size_t mGrain = 1;
+	unsigned mBusyWorkers = 0;
+	std::uint64_t mGeneration = 0;
+	bool mQuit = false;
+
+	static thread_local bool tInsideJob;
+};
@@ -55,6 +55,13 @@ public:
         memcpy(&mMappedData[elementIndex*mElementByteSize], &data, sizeof(T));
     }
 
+    // Direct view of the mapped elements for streaming writes.  Only vertex/index style buffers
+    // are tightly packed, constant buffer elements are padded to 256 bytes so they return null.
+    T* MappedElements()
+    {
+        return mIsConstantBuffer ? nullptr : reinterpret_cast<T*>(mMappedData);
+    }
+
 private:
     Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;
     BYTE* mMappedData = nullptr;
@@ -121,6 +121,15 @@ public:
         UINT64 byteSize,
         Microsoft::WRL::ComPtr<ID3D12Resource>& uploadBuffer);
 
+    // Same, but leaves the upload buffer mapped in mappedData so the caller can write the contents
+    // straight into it.  They must be written before the command list is executed.
+    static Microsoft::WRL::ComPtr<ID3D12Resource> CreateDefaultBuffer(
+        ID3D12Device* device,
+        ID3D12GraphicsCommandList* cmdList,
+        UINT64 byteSize,
+        Microsoft::WRL::ComPtr<ID3D12Resource>& uploadBuffer,
+        void** mappedData);
+
 	static Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(
 		const std::wstring& filename,
 		const D3D_SHADER_MACRO* defines,
@@ -155,6 +164,9 @@ struct SubmeshGeometry
     // Bounding box of the geometry defined by this submesh. 
     // This is used in later chapters of the book.
 	DirectX::BoundingBox Bounds;
+
+	// How far a simplified level of detail strays from the full submesh, in object space units.
+	float LodError = 0.0f;
 };
 
 struct MeshGeometry
@@ -163,7 +175,8 @@ struct MeshGeometry
 	std::string Name;
 
 	// System memory copies.  Use Blobs because the vertex/index format can be generic.
-	// It is up to the client to cast appropriately.  
+	// It is up to the client to cast appropriately.  Either may be null: geometry written
+	// straight into its upload buffer has no CPU copy of the vertices.
 	Microsoft::WRL::ComPtr<ID3DBlob> VertexBufferCPU = nullptr;
 	Microsoft::WRL::ComPtr<ID3DBlob> IndexBufferCPU  = nullptr;
 
@@ -179,11 +192,19 @@ struct MeshGeometry
 	DXGI_FORMAT IndexFormat = DXGI_FORMAT_R16_UINT;
 	UINT IndexBufferByteSize = 0;
 
+	// Format of the position every vertex starts with, for CPU readers of VertexBufferCPU.  16 bit
+	// unorm positions are quantized across each submesh's Bounds.
+	DXGI_FORMAT PositionFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+
 	// A MeshGeometry may store multiple geometries in one vertex/index buffer.
 	// Use this container to define the Submesh geometries so we can draw
 	// the Submeshes individually.
 	std::unordered_map<std::string, SubmeshGeometry> DrawArgs;
 
+	// Levels of detail of the submeshes that have them, the full submesh first and the coarsest last.
+	// Each level is also in DrawArgs, as "name_lod1", "name_lod2"...
+	std::unordered_map<std::string, std::vector<SubmeshGeometry>> Lods;
+
 	D3D12_VERTEX_BUFFER_VIEW VertexBufferView()const
 	{
 		D3D12_VERTEX_BUFFER_VIEW vbv;
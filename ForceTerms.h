@@ -0,0 +1,124 @@
+#pragma once
+#include <tuple>
+#include <utility>
+
+#include <DirectXMath.h>
+
+//Four float3s split into x, y and z lanes, one particle per lane
+struct Float3x4
+{
+	DirectX::XMVECTOR x, y, z;
+};
+
+//Force terms for Update_policies::ForceStack. Each term holds its own parameters and adds its
+//acceleration for four particles at a time, so a stack of them inlines into a single loop body.
+namespace Forces
+{
+	struct Gravity
+	{
+		DirectX::XMFLOAT3 acceleration = DirectX::XMFLOAT3(0.0f, -9.8f, 0.0f);
+
+		void Accumulate(const Float3x4& position, const Float3x4& velocity, Float3x4& acc)const
+		{
+			acc.x = DirectX::XMVectorAdd(acc.x, DirectX::XMVectorReplicate(acceleration.x));
+			acc.y = DirectX::XMVectorAdd(acc.y, DirectX::XMVectorReplicate(acceleration.y));
+			acc.z = DirectX::XMVectorAdd(acc.z, DirectX::XMVectorReplicate(acceleration.z));
+		}
+	};
+
+	struct Drag						//Slows particles down, linear drag dominates when slow and quadratic when fast
+	{
+		float linear = 0.5f;
+		float quadratic = 0.0f;
+
+		void Accumulate(const Float3x4& position, const Float3x4& velocity, Float3x4& acc)const
+		{
+			using namespace DirectX;
+			const XMVECTOR speed = XMVectorSqrt(velocity.x * velocity.x + velocity.y * velocity.y + velocity.z * velocity.z);
+			const XMVECTOR k = XMVectorNegate(XMVectorMultiplyAdd(speed, XMVectorReplicate(quadratic), XMVectorReplicate(linear)));
+			acc.x = XMVectorMultiplyAdd(velocity.x, k, acc.x);
+			acc.y = XMVectorMultiplyAdd(velocity.y, k, acc.y);
+			acc.z = XMVectorMultiplyAdd(velocity.z, k, acc.z);
+		}
+	};
+
+	struct Wind						//Pulls particle velocities towards the wind velocity
+	{
+		DirectX::XMFLOAT3 velocity = DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f);
+		float coupling = 0.5f;		//How quickly particles pick up the wind, per second
+
+		void Accumulate(const Float3x4& position, const Float3x4& particleVelocity, Float3x4& acc)const
+		{
+			using namespace DirectX;
+			const XMVECTOR k = XMVectorReplicate(coupling);
+			acc.x = XMVectorMultiplyAdd(XMVectorReplicate(velocity.x) - particleVelocity.x, k, acc.x);
+			acc.y = XMVectorMultiplyAdd(XMVectorReplicate(velocity.y) - particleVelocity.y, k, acc.y);
+			acc.z = XMVectorMultiplyAdd(XMVectorReplicate(velocity.z) - particleVelocity.z, k, acc.z);
+		}
+	};
+
+	struct Attractor				//Inverse square pull towards a point, negative strength repels
+	{
+		DirectX::XMFLOAT3 centre = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float strength = 5.0f;
+		float softening = 0.25f;	//Keeps the pull finite at the centre
+
+		void Accumulate(const Float3x4& position, const Float3x4& velocity, Float3x4& acc)const
+		{
+			using namespace DirectX;
+			const XMVECTOR dx = XMVectorReplicate(centre.x) - position.x;
+			const XMVECTOR dy = XMVectorReplicate(centre.y) - position.y;
+			const XMVECTOR dz = XMVectorReplicate(centre.z) - position.z;
+			const XMVECTOR distSq = dx * dx + dy * dy + dz * dz + XMVectorReplicate(softening * softening);
+			const XMVECTOR invDist = XMVectorReciprocalSqrt(distSq);
+			const XMVECTOR k = XMVectorReplicate(strength) * invDist * invDist * invDist;
+			acc.x = XMVectorMultiplyAdd(dx, k, acc.x);
+			acc.y = XMVectorMultiplyAdd(dy, k, acc.y);
+			acc.z = XMVectorMultiplyAdd(dz, k, acc.z);
+		}
+	};
+
+	struct Vortex					//Swirls particles around an axis through a point, falling off with distance from the axis
+	{
+		DirectX::XMFLOAT3 centre = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 axis = DirectX::XMFLOAT3(0.0f, 1.0f, 0.0f);		//Unit length
+		float strength = 5.0f;
+		float softening = 0.25f;
+
+		void Accumulate(const Float3x4& position, const Float3x4& velocity, Float3x4& acc)const
+		{
+			using namespace DirectX;
+			const XMVECTOR ax = XMVectorReplicate(axis.x), ay = XMVectorReplicate(axis.y), az = XMVectorReplicate(axis.z);
+			XMVECTOR rx = position.x - XMVectorReplicate(centre.x);
+			XMVECTOR ry = position.y - XMVectorReplicate(centre.y);
+			XMVECTOR rz = position.z - XMVectorReplicate(centre.z);
+			const XMVECTOR along = rx * ax + ry * ay + rz * az;
+			rx = XMVectorNegativeMultiplySubtract(along, ax, rx);		//Offset from the axis
+			ry = XMVectorNegativeMultiplySubtract(along, ay, ry);
+			rz = XMVectorNegativeMultiplySubtract(along, az, rz);
+			const XMVECTOR k = XMVectorReplicate(strength) / (rx * rx + ry * ry + rz * rz + XMVectorReplicate(softening * softening));
+			acc.x = XMVectorMultiplyAdd(ay * rz - az * ry, k, acc.x);
+			acc.y = XMVectorMultiplyAdd(az * rx - ax * rz, k, acc.y);
+			acc.z = XMVectorMultiplyAdd(ax * ry - ay * rx, k, acc.z);
+		}
+	};
+}
+
+namespace Forces_detail
+{
+	template<class Tuple, size_t... I>
+	inline void Accumulate(const Tuple& forces, const Float3x4& position, const Float3x4& velocity, Float3x4& acc, std::index_sequence<I...>)
+	{
+		using expand = int[];
+		(void)expand { 0, (std::get<I>(forces).Accumulate(position, velocity, acc), 0)... };
+	}
+}
+
+//Sum of every term in the stack, expanded at compile time so there is no loop over the forces
+template<class... Terms>
+inline Float3x4 AccumulateForces(const std::tuple<Terms...>& forces, const Float3x4& position, const Float3x4& velocity)
+{
+	Float3x4 acc = { DirectX::XMVectorZero(), DirectX::XMVectorZero(), DirectX::XMVectorZero() };
+	Forces_detail::Accumulate(forces, position, velocity, acc, std::index_sequence_for<Terms...>());
+	return acc;
+}
@@ -1,6 +1,6 @@
 #include "FrameResource.h"
 
-FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT trailVertexCount)
 {
     ThrowIfFailed(device->CreateCommandAllocator(
         D3D12_COMMAND_LIST_TYPE_DIRECT,
@@ -10,9 +10,41 @@ FrameResource::FrameResource(ID3D12Device* device, UINT passCount, UINT objectCo
     PassCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
     MaterialCB = std::make_unique<UploadBuffer<ToonMaterialConstants>>(device, materialCount, true);
     ObjectCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+
+    TrailVB = std::make_unique<UploadBuffer<RibbonVertex>>(device, trailVertexCount, false);
 }
 
 FrameResource::~FrameResource()
 {
 
-}
\ No newline at end of file
+}
+
+const SubmeshGeometry* LodSelector::Select(const RenderItem& ri)const
+{
+    if(ri.Lods == nullptr || ri.Lods->empty())
+    {
+        return nullptr;
+    }
+    const std::vector<SubmeshGeometry>& lods = *ri.Lods;
+
+    // Errors are in object space, the largest axis scale of the world matrix takes them to world space.
+    // Distance is measured to the nearest point of the bounds' sphere, so big objects refine as they're approached.
+    const DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&ri.World);
+    const float scale = (std::max)((std::max)(DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[0])),
+        DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[1]))), DirectX::XMVectorGetX(DirectX::XMVector3Length(world.r[2])));
+    const DirectX::BoundingBox& bounds = lods[0].Bounds;
+    const DirectX::XMVECTOR center = DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&bounds.Center), world);
+    const float radius = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMLoadFloat3(&bounds.Extents))) * scale;
+    const float distance = DirectX::XMVectorGetX(DirectX::XMVector3Length(DirectX::XMVectorSubtract(center, DirectX::XMLoadFloat3(&EyePosW)))) - radius;
+    if(distance <= 0.0f || ProjectionScale <= 0.0f)
+    {
+        return &lods[0];
+    }
+    const float pixelsPerUnit = scale * ProjectionScale / distance;
+    size_t level = 0;
+    while(level + 1 < lods.size() && lods[level + 1].LodError * pixelsPerUnit <= PixelError)
+    {
+        ++level;
+    }
+    return &lods[level];
+}
@@ -4,6 +4,9 @@
 #include "Common/MathHelper.h"
 #include "Common/UploadBuffer.h"
 #include "ToonMaterials.h"
+#include "VertexFormats.h"
+#include "Meshlets.h"
+#include "ParticleTrails.h"
 
 //constexpr int g_numFrameResources = 3;
 
@@ -11,6 +14,8 @@ struct ObjectConstants
 {
     DirectX::XMFLOAT4X4 World = MathHelper::Identity4x4();
 	DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
+    PositionDecode PosDecode;
+    DirectX::XMFLOAT4 Tint = { 1.0f, 1.0f, 1.0f, 1.0f };
 };
 
 struct PassConstants
@@ -45,13 +50,33 @@ struct Vertex
     DirectX::XMFLOAT3 Normal;
 };
 
+template<>
+struct VertexFormat<Vertex>
+{
+    static constexpr VertexElement k_elements[] =
+    {
+        VERTEX_ELEMENT(Vertex, Pos, "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT),
+        VERTEX_ELEMENT(Vertex, Normal, "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT),
+    };
+};
+
+template<>
+struct VertexFormat<RibbonVertex>
+{
+    static constexpr VertexElement k_elements[] =
+    {
+        VERTEX_ELEMENT(RibbonVertex, position, "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT),
+        VERTEX_ELEMENT(RibbonVertex, uv, "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT),
+    };
+};
+
 // Stores the resources needed for the CPU to build the command lists
 // for a frame.  
 struct FrameResource
 {
 public:
     
-    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount);
+    FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount, UINT trailVertexCount);
     FrameResource(const FrameResource& rhs) = delete;
     FrameResource& operator=(const FrameResource& rhs) = delete;
     ~FrameResource();
@@ -67,6 +92,10 @@ public:
     std::unique_ptr<UploadBuffer<ToonMaterialConstants>> MaterialCB = nullptr;
     std::unique_ptr<UploadBuffer<ObjectConstants>> ObjectCB = nullptr;
 
+    // We cannot update a dynamic vertex buffer until the GPU is done processing
+    // the commands that reference it.  So each frame needs their own.
+    std::unique_ptr<UploadBuffer<RibbonVertex>> TrailVB = nullptr;
+
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
     UINT64 Fence = 0;
@@ -85,6 +114,13 @@ struct RenderItem
 
     DirectX::XMFLOAT4X4 TexTransform = MathHelper::Identity4x4();
 
+    // How the vertex shader turns quantized positions back into object space, built from
+    // the bounds the geometry was packed across.
+    PositionDecode PosDecode;
+
+    // Multiplies the material's albedo, particles are coloured over their lifetime through it.
+    DirectX::XMFLOAT4 Tint = { 1.0f, 1.0f, 1.0f, 1.0f };
+
     // Dirty flag indicating the object data has changed and we need to update the constant buffer.
     // Because we have an object cbuffer for each FrameResource, we have to apply the
     // update to each FrameResource.  Thus, when we modify obect data we should set 
@@ -104,4 +140,27 @@ struct RenderItem
     UINT IndexCount = 0;
     UINT StartIndexLocation = 0;
     int BaseVertexLocation = 0;
+
+    // Levels of detail of the submesh, one of Geo->Lods, or null to always draw the arguments above.
+    const std::vector<SubmeshGeometry>* Lods = nullptr;
+
+    // Meshlets of the full submesh, indexed from StartIndexLocation. When set the full submesh is drawn
+    // as the index ranges that survive culling against the camera.
+    const std::vector<Meshlet>* Meshlets = nullptr;
+};
+
+// Picks the level of detail render items are drawn with from how large their error looks on screen.
+struct LodSelector
+{
+    DirectX::XMFLOAT3 EyePosW = { 0.0f, 0.0f, 0.0f };
+
+    // Pixels a unit spans at a distance of one unit, half the viewport height times the projection's
+    // y scale. 0 always picks the full mesh.
+    float ProjectionScale = 0.0f;
+
+    // Largest error a level may show on screen, in pixels.
+    float PixelError = 1.0f;
+
+    // The coarsest of the item's levels that stays within PixelError, null when it has no levels.
+    const SubmeshGeometry* Select(const RenderItem& ri)const;
 };
\ No newline at end of file
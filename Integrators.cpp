@@ -0,0 +1,34 @@
+#include "Integrators.h"
+#include "ParticleEmitter.h"
+
+void Integrators::Verlet::BeginStep(const std::vector<Particle>& particles, float deltaTime)
+{
+	const size_t padded = (particles.size() + 3) & ~static_cast<size_t>(3);
+	if(m_prevX.size() != padded)
+	{
+		m_prevX.resize(padded, 0.0f);
+		m_prevY.resize(padded, 0.0f);
+		m_prevZ.resize(padded, 0.0f);
+		m_spawnStamp.resize(padded, -1.0);		//Spawn times are never negative, so every slot gets seeded
+	}
+	m_prevDeltaTime = m_deltaTime > 0.0f ? m_deltaTime : deltaTime;
+	m_deltaTime = deltaTime;
+}
+
+void Integrators::Verlet::SeedHistory(const std::vector<Particle>& particles, size_t first)
+{
+	//Particles spawned since the last step have no history yet, start them as if they'd been
+	//moving at their spawn velocity
+	const size_t end = (std::min)(first + 4, particles.size());
+	for(size_t i = first; i < end; ++i)
+	{
+		const Particle& p = particles[i];
+		if(p.alive && m_spawnStamp[i] != p.spawnTime)
+		{
+			m_spawnStamp[i] = p.spawnTime;
+			m_prevX[i] = p.position.x - p.velocity.x * m_prevDeltaTime;
+			m_prevY[i] = p.position.y - p.velocity.y * m_prevDeltaTime;
+			m_prevZ[i] = p.position.z - p.velocity.z * m_prevDeltaTime;
+		}
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+#include "ForceTerms.h"
+
+struct Particle;
+
+inline Float3x4 MultiplyAdd(const Float3x4& a, DirectX::FXMVECTOR s, const Float3x4& c)
+{
+	return { DirectX::XMVectorMultiplyAdd(a.x, s, c.x), DirectX::XMVectorMultiplyAdd(a.y, s, c.y), DirectX::XMVectorMultiplyAdd(a.z, s, c.z) };
+}
+
+//Integrators for Update_policies::ForceIntegration. Each steps four particles at a time, positions and
+//velocities split into x, y and z lanes, with accel(position, velocity) returning the summed forces.
+//BeginStep is called once a frame before any batch, batches of one frame may run on different threads.
+namespace Integrators
+{
+	struct SemiImplicitEuler			//Velocity first, then position with the new velocity. Symplectic and one force evaluation
+	{
+		void BeginStep(const std::vector<Particle>& particles, float deltaTime) {}
+
+		template<class Accel>
+		void Step(const std::vector<Particle>& particles, size_t first, Float3x4& position, Float3x4& velocity, DirectX::FXMVECTOR dt, const Accel& accel)
+		{
+			velocity = MultiplyAdd(accel(position, velocity), dt, velocity);
+			position = MultiplyAdd(velocity, dt, position);
+		}
+	};
+
+	//Position Verlet. The velocity is implied by the last two positions, so anything that moves a particle,
+	//such as a collision pushing it out of a surface, changes its velocity too and constraints stay stable
+	//at larger steps. Velocity is still written back for other policies to read, but only seeds new particles,
+	//changes other policies make to it are not picked up.
+	class Verlet
+	{
+		std::vector<float>	m_prevX, m_prevY, m_prevZ;		//Positions a step ago, padded to a multiple of four
+		std::vector<double>	m_spawnStamp;					//Spawn time the history belongs to, so reused slots start over
+		float				m_deltaTime;
+		float				m_prevDeltaTime;				//Steps of different lengths scale the implied velocity
+	public:
+		Verlet() :m_deltaTime(0.0f), m_prevDeltaTime(0.0f)
+		{}
+
+		void BeginStep(const std::vector<Particle>& particles, float deltaTime);
+
+		template<class Accel>
+		void Step(const std::vector<Particle>& particles, size_t first, Float3x4& position, Float3x4& velocity, DirectX::FXMVECTOR dt, const Accel& accel)
+		{
+			using namespace DirectX;
+			SeedHistory(particles, first);
+			const Float3x4 prev = { XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_prevX[first])),
+				XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_prevY[first])),
+				XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_prevZ[first])) };
+			const XMVECTOR invPrevDt = XMVectorReplicate(1.0f / m_prevDeltaTime);
+			const Float3x4 implied = { (position.x - prev.x) * invPrevDt, (position.y - prev.y) * invPrevDt, (position.z - prev.z) * invPrevDt };
+			const Float3x4 acc = accel(position, implied);
+
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&m_prevX[first]), position.x);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&m_prevY[first]), position.y);
+			XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&m_prevZ[first]), position.z);
+			velocity = MultiplyAdd(acc, dt, implied);
+			position = MultiplyAdd(velocity, dt, position);
+		}
+	private:
+		void SeedHistory(const std::vector<Particle>& particles, size_t first);
+	};
+
+	struct RK4							//Classic fourth order Runge-Kutta on position and velocity, four force evaluations
+	{
+		void BeginStep(const std::vector<Particle>& particles, float deltaTime) {}
+
+		template<class Accel>
+		void Step(const std::vector<Particle>& particles, size_t first, Float3x4& position, Float3x4& velocity, DirectX::FXMVECTOR dt, const Accel& accel)
+		{
+			using namespace DirectX;
+			const XMVECTOR halfDt = dt * XMVectorReplicate(0.5f);
+			const Float3x4 a1 = accel(position, velocity);
+			const Float3x4 v2 = MultiplyAdd(a1, halfDt, velocity);
+			const Float3x4 a2 = accel(MultiplyAdd(velocity, halfDt, position), v2);
+			const Float3x4 v3 = MultiplyAdd(a2, halfDt, velocity);
+			const Float3x4 a3 = accel(MultiplyAdd(v2, halfDt, position), v3);
+			const Float3x4 v4 = MultiplyAdd(a3, dt, velocity);
+			const Float3x4 a4 = accel(MultiplyAdd(v3, dt, position), v4);
+
+			const XMVECTOR two = XMVectorReplicate(2.0f);
+			const XMVECTOR sixthDt = dt * XMVectorReplicate(1.0f / 6.0f);
+			const Float3x4 dx = { velocity.x + two * (v2.x + v3.x) + v4.x, velocity.y + two * (v2.y + v3.y) + v4.y, velocity.z + two * (v2.z + v3.z) + v4.z };
+			const Float3x4 dv = { a1.x + two * (a2.x + a3.x) + a4.x, a1.y + two * (a2.y + a3.y) + a4.y, a1.z + two * (a2.z + a3.z) + a4.z };
+			position = MultiplyAdd(dx, sixthDt, position);
+			velocity = MultiplyAdd(dv, sixthDt, velocity);
+		}
+	};
+}
@@ -0,0 +1,120 @@
+#include "KillVolumes.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr size_t g_cullGrain = 4096;		//Particles per worker chunk
+
+	//All lanes set where the particle is inside the volume
+	XMVECTOR Inside(const KillVolume& v, FXMVECTOR x, FXMVECTOR y, FXMVECTOR z)
+	{
+		switch(v.type)
+		{
+		case KillVolumeType::Sphere:
+		{
+			const XMVECTOR dx = x - XMVectorReplicate(v.a.x);
+			const XMVECTOR dy = y - XMVectorReplicate(v.a.y);
+			const XMVECTOR dz = z - XMVectorReplicate(v.a.z);
+			return XMVectorLessOrEqual(dx * dx + dy * dy + dz * dz, XMVectorReplicate(v.radius * v.radius));
+		}
+		case KillVolumeType::Box:
+		{
+			const XMVECTOR inX = XMVectorLessOrEqual(XMVectorAbs(x - XMVectorReplicate(v.a.x)), XMVectorReplicate(v.b.x));
+			const XMVECTOR inY = XMVectorLessOrEqual(XMVectorAbs(y - XMVectorReplicate(v.a.y)), XMVectorReplicate(v.b.y));
+			const XMVECTOR inZ = XMVectorLessOrEqual(XMVectorAbs(z - XMVectorReplicate(v.a.z)), XMVectorReplicate(v.b.z));
+			return XMVectorAndInt(inX, XMVectorAndInt(inY, inZ));
+		}
+		default:
+		{
+			const XMVECTOR dist = x * XMVectorReplicate(v.a.x) + y * XMVectorReplicate(v.a.y) + z * XMVectorReplicate(v.a.z) + XMVectorReplicate(v.radius);
+			return XMVectorGreater(dist, XMVectorZero());
+		}
+		}
+	}
+}
+
+void KillVolumeSet::AddSphere(XMFLOAT3 centre, float radius, bool killInside)
+{
+	KillVolume v = {};
+	v.type = KillVolumeType::Sphere;
+	v.killInside = killInside;
+	v.a = centre;
+	v.radius = radius;
+	m_volumes.push_back(v);
+}
+
+void KillVolumeSet::AddBox(XMFLOAT3 minCorner, XMFLOAT3 maxCorner, bool killInside)
+{
+	KillVolume v = {};
+	v.type = KillVolumeType::Box;
+	v.killInside = killInside;
+	v.a = XMFLOAT3(0.5f * (minCorner.x + maxCorner.x), 0.5f * (minCorner.y + maxCorner.y), 0.5f * (minCorner.z + maxCorner.z));
+	v.b = XMFLOAT3(0.5f * (maxCorner.x - minCorner.x), 0.5f * (maxCorner.y - minCorner.y), 0.5f * (maxCorner.z - minCorner.z));
+	m_volumes.push_back(v);
+}
+
+void KillVolumeSet::AddHalfSpace(XMFLOAT3 normal, float offset, bool killInside)
+{
+	KillVolume v = {};
+	v.type = KillVolumeType::HalfSpace;
+	v.killInside = killInside;
+	XMStoreFloat3(&v.a, XMVector3Normalize(XMLoadFloat3(&normal)));
+	v.radius = offset;
+	m_volumes.push_back(v);
+}
+
+void KillVolumeSet::Cull(std::vector<Particle>& particles, XMFLOAT3 origin, ParticleEventBuffer* events)const
+{
+	if(m_volumes.empty())
+	{
+		return;
+	}
+	ThreadPool::Get().ParallelFor(0, particles.size(), g_cullGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t first = begin; first < end; first += 4)
+			{
+				const size_t lanes = (std::min)(static_cast<size_t>(4), end - first);
+				XMFLOAT4 x(0.0f, 0.0f, 0.0f, 0.0f), y(0.0f, 0.0f, 0.0f, 0.0f), z(0.0f, 0.0f, 0.0f, 0.0f);
+				XMVECTORU32 alive = { { { 0, 0, 0, 0 } } };
+				float* laneX = &x.x; float* laneY = &y.x; float* laneZ = &z.x;
+				for(size_t lane = 0; lane < lanes; ++lane)
+				{
+					const Particle& p = particles[first + lane];
+					laneX[lane] = p.position.x - origin.x;
+					laneY[lane] = p.position.y - origin.y;
+					laneZ[lane] = p.position.z - origin.z;
+					alive.u[lane] = p.alive ? 0xFFFFFFFFu : 0u;
+				}
+				if((alive.u[0] | alive.u[1] | alive.u[2] | alive.u[3]) == 0)
+				{
+					continue;
+				}
+
+				const XMVECTOR px = XMLoadFloat4(&x), py = XMLoadFloat4(&y), pz = XMLoadFloat4(&z);
+				XMVECTOR kill = XMVectorFalseInt();
+				for(const KillVolume& v : m_volumes)
+				{
+					const XMVECTOR inside = Inside(v, px, py, pz);
+					kill = XMVectorOrInt(kill, v.killInside ? inside : XMVectorXorInt(inside, XMVectorTrueInt()));
+				}
+
+				XMVECTORU32 killed;
+				killed.v = XMVectorAndInt(kill, alive.v);
+				for(size_t lane = 0; lane < lanes; ++lane)
+				{
+					if(killed.u[lane] != 0)
+					{
+						Particle& p = particles[first + lane];
+						if(events != nullptr)
+						{
+							events->Push(ParticleEventType::Death, p.position, p.velocity, p.seed);
+						}
+						p.Reset();
+					}
+				}
+			}
+		});
+}
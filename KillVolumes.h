@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+struct Particle;
+class ParticleEventBuffer;
+
+enum class KillVolumeType : uint8_t
+{
+	Sphere,
+	Box,			//Axis aligned box
+	HalfSpace		//Everything in front of a plane, the side its normal points to
+};
+
+struct KillVolume
+{
+	KillVolumeType		type;
+	bool				killInside;		//Cull particles inside the volume, otherwise cull the ones outside it
+	DirectX::XMFLOAT3	a;				//Sphere/box centre or plane normal
+	DirectX::XMFLOAT3	b;				//Box half extents
+	float				radius;			//Sphere radius or plane offset (n.x + d = 0)
+};
+
+//Set of regions that cull particles, stored relative to the emitter so moving it is free.
+//Every volume is tested against four particles at a time and the results are OR'd into one kill mask.
+class KillVolumeSet
+{
+	std::vector<KillVolume> m_volumes;
+public:
+	void AddSphere(DirectX::XMFLOAT3 centre, float radius, bool killInside);
+	void AddBox(DirectX::XMFLOAT3 minCorner, DirectX::XMFLOAT3 maxCorner, bool killInside);
+	void AddHalfSpace(DirectX::XMFLOAT3 normal, float offset, bool killInside = true);
+	void Clear() { m_volumes.clear(); }
+	size_t GetVolumeCount()const { return m_volumes.size(); }
+
+	//Resets every alive particle caught by a volume, origin is the emitter position the volumes are relative to.
+	//Each culled particle raises a death event in events when it isn't null.
+	void Cull(std::vector<Particle>& particles, DirectX::XMFLOAT3 origin, ParticleEventBuffer* events = nullptr)const;
+};
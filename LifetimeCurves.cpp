@@ -0,0 +1,117 @@
+#include "LifetimeCurves.h"
+#include "ParticleEmitter.h"
+
+using namespace DirectX;
+
+namespace
+{
+	struct CurveKey
+	{
+		float		time;
+		XMFLOAT4	value;
+	};
+
+	template<class Key, class Value>
+	std::vector<CurveKey> SortedKeys(const std::vector<Key>& keys, Value value, XMFLOAT4 fallback)
+	{
+		std::vector<CurveKey> sorted;
+		for(const Key& k : keys)
+		{
+			sorted.push_back({ k.time, value(k) });
+		}
+		if(sorted.empty())
+		{
+			sorted.push_back({ 0.0f, fallback });
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const CurveKey& a, const CurveKey& b) { return a.time < b.time; });
+		return sorted;
+	}
+
+	//Cubic Hermite through the keys with Catmull-Rom tangents, held flat before the first key and after the last
+	XMVECTOR EvaluateSpline(const std::vector<CurveKey>& keys, float u)
+	{
+		if(u <= keys.front().time)
+		{
+			return XMLoadFloat4(&keys.front().value);
+		}
+		if(u >= keys.back().time)
+		{
+			return XMLoadFloat4(&keys.back().value);
+		}
+		const size_t i = std::upper_bound(keys.begin(), keys.end(), u, [](float time, const CurveKey& k) { return time < k.time; }) - keys.begin() - 1;
+		const float span = keys[i + 1].time - keys[i].time;
+		auto tangent = [&](size_t k)
+		{
+			const size_t a = k > 0 ? k - 1 : k;
+			const size_t b = (std::min)(k + 1, keys.size() - 1);
+			const float dt = keys[b].time - keys[a].time;
+			return dt > 0.0f ? (XMLoadFloat4(&keys[b].value) - XMLoadFloat4(&keys[a].value)) * (span / dt) : XMVectorZero();
+		};
+		return XMVectorHermite(XMLoadFloat4(&keys[i].value), tangent(i), XMLoadFloat4(&keys[i + 1].value), tangent(i + 1), (u - keys[i].time) / span);
+	}
+}
+
+void LifetimeCurves::Bake(uint32_t resolution)
+{
+	resolution = (std::max)(resolution, 2u);
+	const XMFLOAT4 one(1.0f, 1.0f, 1.0f, 1.0f), zero(0.0f, 0.0f, 0.0f, 0.0f);
+	const std::vector<CurveKey> color = SortedKeys(m_color, [](const ColorKey& k) { return XMFLOAT4(k.color.x, k.color.y, k.color.z, 0.0f); }, one);
+	const std::vector<CurveKey> opacity = SortedKeys(m_opacity, [](const ScalarKey& k) { return XMFLOAT4(k.value, 0.0f, 0.0f, 0.0f); }, one);
+	const std::vector<CurveKey> size = SortedKeys(m_size, [](const ScalarKey& k) { return XMFLOAT4(k.value, 0.0f, 0.0f, 0.0f); }, one);
+	const std::vector<CurveKey> spin = SortedKeys(m_angularVelocity, [](const ScalarKey& k) { return XMFLOAT4(k.value, 0.0f, 0.0f, 0.0f); }, zero);
+
+	m_colorTable.resize(resolution);
+	m_shapeTable.resize(resolution);
+	const float step = 1.0f / (resolution - 1);
+	float rotation(0.0f), prevSpin(0.0f);
+	for(uint32_t i = 0; i < resolution; ++i)
+	{
+		const float u = i * step;
+		XMStoreFloat4A(&m_colorTable[i], XMVectorSetW(EvaluateSpline(color, u), XMVectorGetX(EvaluateSpline(opacity, u))));
+
+		//Trapezoid rule over the table entries, in radians since spawn for a lifetime of one second
+		const float angularVelocity = XMVectorGetX(EvaluateSpline(spin, u));
+		if(i > 0)
+		{
+			rotation += 0.5f * (prevSpin + angularVelocity) * step;
+		}
+		prevSpin = angularVelocity;
+		m_shapeTable[i] = XMFLOAT4A((std::max)(0.0f, XMVectorGetX(EvaluateSpline(size, u))), rotation, angularVelocity, 0.0f);
+	}
+}
+
+void LifetimeCurves::WriteInstances(const std::vector<Particle>& particles, double now, float lifeTime, const ParticleAttributes* stored,
+	std::vector<ParticleInstance>& instances)const
+{
+	instances.clear();
+	if(!IsBaked())
+	{
+		return;
+	}
+	instances.reserve(particles.size());
+	//A lifetime that isn't positive has every particle at the end of its curves
+	const uint32_t last = static_cast<uint32_t>(m_colorTable.size()) - 1;
+	const bool ended = !(lifeTime > 0.0f);
+	const float toTable = ended ? 0.0f : last / lifeTime;
+	for(size_t index = 0; index < particles.size(); ++index)
+	{
+		const Particle& p = particles[index];
+		if(!p.alive)
+		{
+			continue;
+		}
+		const float u = ended ? static_cast<float>(last) : (std::min)((std::max)(static_cast<float>(now - p.spawnTime) * toTable, 0.0f), static_cast<float>(last));
+		const uint32_t i0 = static_cast<uint32_t>(u);
+		const uint32_t i1 = (std::min)(i0 + 1, last);
+		const float t = u - i0;
+		const XMVECTOR color = XMVectorLerp(XMLoadFloat4A(&m_colorTable[i0]), XMLoadFloat4A(&m_colorTable[i1]), t);
+		const XMVECTOR shape = XMVectorLerp(XMLoadFloat4A(&m_shapeTable[i0]), XMLoadFloat4A(&m_shapeTable[i1]), t);
+
+		ParticleInstance instance;
+		instance.position = p.position;
+		instance.size = XMVectorGetX(shape);
+		instance.rotation = XMVectorGetY(shape) * (ended ? 0.0f : lifeTime) + (stored ? stored[index].rotation : ParticleRandom::Attributes(p.seed).rotation);
+		PackedVector::XMStoreUByteN4(&instance.color, color);
+		instances.push_back(instance);
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+
+struct Particle;
+struct ParticleAttributes;
+
+//Key times are normalised ages, 0 when the particle spawns and 1 at the end of its lifetime
+struct ScalarKey
+{
+	float time;
+	float value;
+};
+struct ColorKey
+{
+	float				time;
+	DirectX::XMFLOAT3	color;
+};
+
+struct ParticleInstance						//Per instance data for drawing one particle, 24 bytes
+{
+	DirectX::XMFLOAT3					position;
+	float								size;
+	float								rotation;		//Radians around the view axis
+	DirectX::PackedVector::XMUBYTEN4	color;			//RGBA, alpha is the opacity
+};
+
+constexpr uint32_t g_defaultCurveResolution = 64;
+
+//Size, color, opacity and angular velocity over a particle's lifetime.
+//The curves are smooth splines through their keys, baked into fixed resolution tables when the effect
+//is set up so the per frame cost is two table lerps per particle whatever the number of keys.
+//Angular velocity is integrated while baking, so rotation needs no per-particle state either.
+//The tables are over normalised age, the lifetime it's measured against is the deletion policy's and is
+//only given when the instances are written, so the two can't disagree.
+class LifetimeCurves
+{
+	std::vector<ScalarKey>			m_size, m_opacity, m_angularVelocity;
+	std::vector<ColorKey>			m_color;
+	std::vector<DirectX::XMFLOAT4A>	m_colorTable;		//RGB and opacity
+	std::vector<DirectX::XMFLOAT4A>	m_shapeTable;		//Size, rotation since spawn per second of lifetime, angular velocity
+public:
+
+	//An empty curve keeps the default: size 1, white, opaque and not spinning
+	void SetSize(const std::vector<ScalarKey>& keys) { m_size = keys; }
+	void SetColor(const std::vector<ColorKey>& keys) { m_color = keys; }
+	void SetOpacity(const std::vector<ScalarKey>& keys) { m_opacity = keys; }
+	void SetAngularVelocity(const std::vector<ScalarKey>& keys) { m_angularVelocity = keys; }		//Radians per second
+
+	//Call again after changing any curve
+	void Bake(uint32_t resolution = g_defaultCurveResolution);
+	bool IsBaked()const { return !m_colorTable.empty(); }
+
+	//Replaces instances with one entry per alive particle, in particle order, lifeTime seconds after spawning
+	//being a normalised age of 1. Random attributes are read from stored, indexed like particles, or hashed
+	//from each particle's seed when it's null.
+	void WriteInstances(const std::vector<Particle>& particles, double now, float lifeTime, const ParticleAttributes* stored,
+		std::vector<ParticleInstance>& instances)const;
+};
@@ -0,0 +1,873 @@
+#include "MeshBVH.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+#include "VertexFormats.h"
+#include "MortonSort.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <intrin.h>
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr size_t g_bvhGrain = 4096;			//Triangles per worker chunk when computing bounds
+	constexpr size_t g_packetGrain = 8;			//Packets per worker chunk
+	constexpr uint32_t g_sweepPacketSize = 32;	//Neighbouring sweeps that walk the tree together
+	constexpr uint32_t g_minSubtreeSize = 2048;	//Subtrees smaller than this are not worth a task of their own
+	constexpr uint32_t g_subtreesPerThread = 4;
+	constexpr uint32_t g_localStackSize = 64;	//Traversal stack entries kept on the stack, deeper trees use the heap
+
+	const XMVECTORF32 g_boundsEmptyMin = { { { FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX } } };
+	const XMVECTORF32 g_boundsEmptyMax = { { { -FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX } } };
+
+	struct Bin
+	{
+		XMVECTOR boundsMin;
+		XMVECTOR boundsMax;
+		uint32_t count;
+	};
+
+	inline float HalfArea(FXMVECTOR bMin, FXMVECTOR bMax)
+	{
+		XMFLOAT3 d;
+		XMStoreFloat3(&d, bMax - bMin);
+		return (d.x < 0.0f) ? 0.0f : d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	inline float Axis(const XMFLOAT3& v, int axis)
+	{
+		return (&v.x)[axis];
+	}
+
+	inline uint32_t BinIndex(float v, float origin, float scale, uint32_t binCount)
+	{
+		return (std::min)(binCount - 1, static_cast<uint32_t>((v - origin) * scale));
+	}
+
+	//Entry distance of the segment into the box, FLT_MAX when it misses or enters after maxT
+	inline float SegmentBoxEntry(const XMFLOAT3& from, const XMFLOAT3& invDelta, const XMFLOAT3& bMin, const XMFLOAT3& bMax, float radius, float maxT)
+	{
+		float tMin(0.0f), tMax(maxT);
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			const float o = Axis(from, axis), inv = Axis(invDelta, axis);
+			float t0 = (Axis(bMin, axis) - radius - o) * inv;
+			float t1 = (Axis(bMax, axis) + radius - o) * inv;
+			if(t0 > t1)
+			{
+				std::swap(t0, t1);
+			}
+			tMin = (std::max)(tMin, t0);
+			tMax = (std::min)(tMax, t1);
+		}
+		return tMin <= tMax ? tMin : FLT_MAX;
+	}
+
+	inline bool BoxesOverlap(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax)
+	{
+		return aMin.x <= bMax.x && aMax.x >= bMin.x && aMin.y <= bMax.y && aMax.y >= bMin.y && aMin.z <= bMax.z && aMax.z >= bMin.z;
+	}
+
+	//Earliest t at which from + delta * t comes within radius of p, FLT_MAX if it never does
+	inline float SweepPoint(FXMVECTOR from, FXMVECTOR delta, FXMVECTOR p, float radius)
+	{
+		const XMVECTOR m = from - p;
+		const float c = XMVectorGetX(XMVector3LengthSq(m)) - radius * radius;
+		if(c <= 0.0f)
+		{
+			return 0.0f;
+		}
+		const float a = XMVectorGetX(XMVector3LengthSq(delta));
+		const float b = XMVectorGetX(XMVector3Dot(m, delta));
+		const float disc = b * b - a * c;
+		if(b >= 0.0f || disc < 0.0f)
+		{
+			return FLT_MAX;
+		}
+		return (-b - sqrtf(disc)) / a;
+	}
+
+	//Earliest t at which from + delta * t comes within radius of the segment a + s * e somewhere
+	//between its ends, by the motion across the edge entering the cylinder around it. Reaching it
+	//past an end means touching the corner there first, which SweepPoint finds.
+	inline float SweepEdge(FXMVECTOR from, FXMVECTOR delta, FXMVECTOR a, GXMVECTOR e, float radius)
+	{
+		const float ee = XMVectorGetX(XMVector3LengthSq(e));
+		const XMVECTOR m = from - a;
+		const float me = XMVectorGetX(XMVector3Dot(m, e));
+		const float de = XMVectorGetX(XMVector3Dot(delta, e));
+		const XMVECTOR mAcross = m - e * (me / ee);
+		const XMVECTOR dAcross = delta - e * (de / ee);
+		const float c = XMVectorGetX(XMVector3LengthSq(mAcross)) - radius * radius;
+		float t(0.0f);
+		if(c > 0.0f)
+		{
+			const float a2 = XMVectorGetX(XMVector3LengthSq(dAcross));
+			const float b = XMVectorGetX(XMVector3Dot(mAcross, dAcross));
+			const float disc = b * b - a2 * c;
+			if(b >= 0.0f || disc < 0.0f)
+			{
+				return FLT_MAX;
+			}
+			t = (-b - sqrtf(disc)) / a2;
+		}
+		const float s = (me + de * t) / ee;
+		return s >= 0.0f && s <= 1.0f ? t : FLT_MAX;
+	}
+
+	//Closest point on triangle abc to p, from Real-Time Collision Detection 5.1.5
+	XMVECTOR ClosestPointOnTriangle(FXMVECTOR p, FXMVECTOR a, FXMVECTOR ab, GXMVECTOR ac)
+	{
+		const XMVECTOR ap = p - a;
+		const float d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+		const float d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+		if(d1 <= 0.0f && d2 <= 0.0f)
+			return a;
+
+		const XMVECTOR bp = ap - ab;
+		const float d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+		const float d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+		if(d3 >= 0.0f && d4 <= d3)
+			return a + ab;
+
+		const float vc = d1 * d4 - d3 * d2;
+		if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			return a + ab * (d1 / (d1 - d3));
+
+		const XMVECTOR cp = ap - ac;
+		const float d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+		const float d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+		if(d6 >= 0.0f && d5 <= d6)
+			return a + ac;
+
+		const float vb = d5 * d2 - d1 * d6;
+		if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			return a + ac * (d2 / (d2 - d6));
+
+		const float va = d3 * d6 - d5 * d4;
+		if(va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+			return a + ab + (ac - ab) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+		const float denom = 1.0f / (va + vb + vc);
+		return a + ab * (vb * denom) + ac * (vc * denom);
+	}
+}
+
+void TriangleBVH::AddTriangle(FXMVECTOR a, FXMVECTOR b, FXMVECTOR c)
+{
+	//Degenerate triangles have no normal to bounce off
+	if(XMVectorGetX(XMVector3LengthSq(XMVector3Cross(b - a, c - a))) <= 1e-12f)
+	{
+		return;
+	}
+	XMFLOAT3 v;
+	XMStoreFloat3(&v, a); m_vertices.push_back(v);
+	XMStoreFloat3(&v, b); m_vertices.push_back(v);
+	XMStoreFloat3(&v, c); m_vertices.push_back(v);
+}
+
+bool TriangleBVH::AddMesh(const MeshGeometry& geo, const SubmeshGeometry& submesh, const XMFLOAT4X4& world)
+{
+	if(!geo.VertexBufferCPU || !geo.IndexBufferCPU)
+	{
+		return false;
+	}
+	const char* vertices = static_cast<const char*>(geo.VertexBufferCPU->GetBufferPointer()) + static_cast<size_t>(submesh.BaseVertexLocation) * geo.VertexByteStride;
+	const void* indices = geo.IndexBufferCPU->GetBufferPointer();
+	auto addPositions = [&](const auto* positions, const XMFLOAT4X4& transform)
+	{
+		if(geo.IndexFormat == DXGI_FORMAT_R32_UINT)
+		{
+			AddMesh(positions, geo.VertexByteStride, static_cast<const uint32_t*>(indices) + submesh.StartIndexLocation, submesh.IndexCount, transform);
+		}
+		else
+		{
+			AddMesh(positions, geo.VertexByteStride, static_cast<const uint16_t*>(indices) + submesh.StartIndexLocation, submesh.IndexCount, transform);
+		}
+	};
+	if(geo.PositionFormat == DXGI_FORMAT_R16G16B16A16_UNORM)
+	{
+		//Decode into the bounds, position * scale + bias, on the way into world space
+		const PositionDecode decode(submesh.Bounds);
+		XMFLOAT4X4 transform;
+		XMStoreFloat4x4(&transform, XMMatrixMultiply(XMMatrixMultiply(XMMatrixScaling(decode.scale.x, decode.scale.y, decode.scale.z),
+			XMMatrixTranslation(decode.bias.x, decode.bias.y, decode.bias.z)), XMLoadFloat4x4(&world)));
+		addPositions(reinterpret_cast<const PackedVector::XMUSHORTN4*>(vertices), transform);
+	}
+	else
+	{
+		addPositions(reinterpret_cast<const XMFLOAT3*>(vertices), world);
+	}
+	return true;
+}
+
+void TriangleBVH::Clear()
+{
+	m_vertices.clear();
+	m_nodes.clear();
+	m_triangles.clear();
+	m_depth = 0;
+}
+
+void TriangleBVH::UpdateBounds(Node& node, uint32_t first, uint32_t count)const
+{
+	XMVECTOR bMin = g_boundsEmptyMin, bMax = g_boundsEmptyMax;
+	for(uint32_t i = first; i < first + count; ++i)
+	{
+		bMin = XMVectorMin(bMin, XMLoadFloat3(&m_prims[i].boundsMin));
+		bMax = XMVectorMax(bMax, XMLoadFloat3(&m_prims[i].boundsMax));
+	}
+	XMStoreFloat3(&node.boundsMin, bMin);
+	XMStoreFloat3(&node.boundsMax, bMax);
+}
+
+bool TriangleBVH::FindSplit(const Node& node, uint32_t first, uint32_t count, Split& split)const
+{
+	//Bin on the centroid bounds rather than the node bounds so large triangles don't waste bins
+	XMVECTOR cMin = g_boundsEmptyMin, cMax = g_boundsEmptyMax;
+	for(uint32_t i = first; i < first + count; ++i)
+	{
+		const XMVECTOR c = (XMLoadFloat3(&m_prims[i].boundsMin) + XMLoadFloat3(&m_prims[i].boundsMax)) * 0.5f;
+		cMin = XMVectorMin(cMin, c);
+		cMax = XMVectorMax(cMax, c);
+	}
+
+	//Small nodes use fewer bins, most nodes are small and the per bin work would dominate
+	const uint32_t binCount = (std::min)(k_binCount, count);
+	XMFLOAT3 origin, extent;
+	XMStoreFloat3(&origin, cMin);
+	XMStoreFloat3(&extent, cMax - cMin);
+	float scale[3];
+	Bin bins[3][k_binCount];
+	for(int a = 0; a < 3; ++a)
+	{
+		scale[a] = Axis(extent, a) > 1e-6f ? binCount / Axis(extent, a) : 0.0f;
+		for(uint32_t b = 0; b < binCount; ++b)
+		{
+			bins[a][b].boundsMin = g_boundsEmptyMin;
+			bins[a][b].boundsMax = g_boundsEmptyMax;
+			bins[a][b].count = 0;
+		}
+	}
+
+	//One pass fills the bins for all three axes
+	for(uint32_t i = first; i < first + count; ++i)
+	{
+		const BuildPrim& prim = m_prims[i];
+		const XMVECTOR pMin = XMLoadFloat3(&prim.boundsMin);
+		const XMVECTOR pMax = XMLoadFloat3(&prim.boundsMax);
+		for(int a = 0; a < 3; ++a)
+		{
+			Bin& bin = bins[a][BinIndex(prim.Centroid(a), Axis(origin, a), scale[a], binCount)];
+			bin.boundsMin = XMVectorMin(bin.boundsMin, pMin);
+			bin.boundsMax = XMVectorMax(bin.boundsMax, pMax);
+			++bin.count;
+		}
+	}
+
+	float bestCost(FLT_MAX);
+	split.axis = -1;
+	for(int a = 0; a < 3; ++a)
+	{
+		if(scale[a] == 0.0f)
+		{
+			continue;
+		}
+		//Sweep from the right to get the area and count beyond every plane, then from the left
+		float rightArea[k_binCount];
+		uint32_t rightCount[k_binCount];
+		XMVECTOR bMin = g_boundsEmptyMin, bMax = g_boundsEmptyMax;
+		uint32_t sum(0);
+		for(uint32_t b = binCount - 1; b > 0; --b)
+		{
+			sum += bins[a][b].count;
+			bMin = XMVectorMin(bMin, bins[a][b].boundsMin);
+			bMax = XMVectorMax(bMax, bins[a][b].boundsMax);
+			rightCount[b] = sum;
+			rightArea[b] = HalfArea(bMin, bMax);
+		}
+		bMin = g_boundsEmptyMin;
+		bMax = g_boundsEmptyMax;
+		sum = 0;
+		for(uint32_t b = 1; b < binCount; ++b)
+		{
+			sum += bins[a][b - 1].count;
+			bMin = XMVectorMin(bMin, bins[a][b - 1].boundsMin);
+			bMax = XMVectorMax(bMax, bins[a][b - 1].boundsMax);
+			if(sum == 0 || rightCount[b] == 0)
+			{
+				continue;
+			}
+			const float cost = sum * HalfArea(bMin, bMax) + rightCount[b] * rightArea[b];
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				split.axis = a;
+				split.bin = b;
+			}
+		}
+	}
+	if(split.axis < 0)
+	{
+		return false;
+	}
+
+	//Keep small nodes as leaves when splitting them wouldn't make traversal cheaper
+	const float leafCost = count * HalfArea(XMLoadFloat3(&node.boundsMin), XMLoadFloat3(&node.boundsMax));
+	if(bestCost >= leafCost && count <= k_maxLeafSize)
+	{
+		return false;
+	}
+
+	const Bin* axisBins = bins[split.axis];
+	split.binOrigin = Axis(origin, split.axis);
+	split.binScale = scale[split.axis];
+	split.binCount = binCount;
+	XMVECTOR lMin = g_boundsEmptyMin, lMax = g_boundsEmptyMax, rMin = g_boundsEmptyMin, rMax = g_boundsEmptyMax;
+	for(uint32_t b = 0; b < binCount; ++b)
+	{
+		if(b < split.bin)
+		{
+			lMin = XMVectorMin(lMin, axisBins[b].boundsMin);
+			lMax = XMVectorMax(lMax, axisBins[b].boundsMax);
+		}
+		else
+		{
+			rMin = XMVectorMin(rMin, axisBins[b].boundsMin);
+			rMax = XMVectorMax(rMax, axisBins[b].boundsMax);
+		}
+	}
+	XMStoreFloat3(&split.leftMin, lMin);
+	XMStoreFloat3(&split.leftMax, lMax);
+	XMStoreFloat3(&split.rightMin, rMin);
+	XMStoreFloat3(&split.rightMax, rMax);
+	return true;
+}
+
+void TriangleBVH::Subdivide(std::vector<Node>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, std::vector<BuildRange>* frontier, size_t frontierTarget)
+{
+	nodes[nodeIndex].leftFirst = first;
+	nodes[nodeIndex].count = count;
+	if(count <= k_maxLeafSize / 2)
+	{
+		return;
+	}
+	if(frontier && count <= frontierTarget)
+	{
+		frontier->push_back({ nodeIndex, first, count });
+		return;
+	}
+
+	Split split;
+	const bool binned = FindSplit(nodes[nodeIndex], first, count, split);
+	if(!binned && count <= k_maxLeafSize)
+	{
+		return;
+	}
+
+	const uint32_t left = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back();
+	nodes.emplace_back();
+	nodes[nodeIndex].leftFirst = left;
+	nodes[nodeIndex].count = 0;
+
+	uint32_t leftCount;
+	if(binned)
+	{
+		//Same bin test as FindSplit so the bin bounds are exactly the child bounds
+		BuildPrim* begin = m_prims.data() + first;
+		BuildPrim* mid = std::partition(begin, begin + count, [&](const BuildPrim& prim)
+			{
+				return BinIndex(prim.Centroid(split.axis), split.binOrigin, split.binScale, split.binCount) < split.bin;
+			});
+		leftCount = static_cast<uint32_t>(mid - begin);
+		nodes[left].boundsMin = split.leftMin;
+		nodes[left].boundsMax = split.leftMax;
+		nodes[left + 1].boundsMin = split.rightMin;
+		nodes[left + 1].boundsMax = split.rightMax;
+	}
+	else
+	{
+		//Every centroid landed in the same place, split the list in half
+		leftCount = count / 2;
+		UpdateBounds(nodes[left], first, leftCount);
+		UpdateBounds(nodes[left + 1], first + leftCount, count - leftCount);
+	}
+	Subdivide(nodes, left, first, leftCount, frontier, frontierTarget);
+	Subdivide(nodes, left + 1, first + leftCount, count - leftCount, frontier, frontierTarget);
+}
+
+void TriangleBVH::Build()
+{
+	ThreadPool& pool = ThreadPool::Get();
+	const uint32_t triCount = static_cast<uint32_t>(m_vertices.size() / 3);
+	m_nodes.clear();
+	m_triangles.clear();
+	m_depth = 0;
+	if(triCount == 0)
+	{
+		return;
+	}
+
+	m_prims.resize(triCount);
+	pool.ParallelFor(0, triCount, g_bvhGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t t = begin; t < end; ++t)
+			{
+				const XMVECTOR a = XMLoadFloat3(&m_vertices[t * 3 + 0]);
+				const XMVECTOR b = XMLoadFloat3(&m_vertices[t * 3 + 1]);
+				const XMVECTOR c = XMLoadFloat3(&m_vertices[t * 3 + 2]);
+				BuildPrim& prim = m_prims[t];
+				XMStoreFloat3(&prim.boundsMin, XMVectorMin(a, XMVectorMin(b, c)));
+				XMStoreFloat3(&prim.boundsMax, XMVectorMax(a, XMVectorMax(b, c)));
+				prim.triangle = static_cast<uint32_t>(t);
+			}
+		});
+
+	//Split the top of the tree on this thread until there are enough independent subtrees
+	//to keep every worker busy, then finish each subtree in parallel in its own node list
+	const size_t frontierTarget = (std::max)(static_cast<size_t>(g_minSubtreeSize), static_cast<size_t>(triCount / (pool.GetThreadCount() * g_subtreesPerThread)));
+	std::vector<BuildRange> frontier;
+	m_nodes.reserve(triCount * 2 / (k_maxLeafSize / 2) + 1);
+	m_nodes.emplace_back();
+	UpdateBounds(m_nodes[0], 0, triCount);
+	Subdivide(m_nodes, 0, 0, triCount, &frontier, frontierTarget);
+
+	std::vector<std::vector<Node>> subtrees(frontier.size());
+	pool.ParallelFor(0, frontier.size(), 1, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				std::vector<Node>& nodes = subtrees[i];
+				nodes.reserve(frontier[i].count);
+				nodes.push_back(m_nodes[frontier[i].node]);
+				Subdivide(nodes, 0, frontier[i].first, frontier[i].count, nullptr, 0);
+			}
+		});
+
+	//Stitch the subtrees in, local node k > 0 lands at base + k - 1 and its root replaces the frontier node
+	for(size_t i = 0; i < frontier.size(); ++i)
+	{
+		const std::vector<Node>& nodes = subtrees[i];
+		const uint32_t base = static_cast<uint32_t>(m_nodes.size());
+		for(size_t k = 0; k < nodes.size(); ++k)
+		{
+			Node node = nodes[k];
+			if(node.count == 0)
+			{
+				node.leftFirst = base + node.leftFirst - 1;
+			}
+			if(k == 0)
+			{
+				m_nodes[frontier[i].node] = node;
+			}
+			else
+			{
+				m_nodes.push_back(node);
+			}
+		}
+	}
+
+	//Children always come after their parent, so one forward pass finds every node's depth.
+	//Nothing bounds how lopsided the splits get, so the traversal stack is sized from this
+	std::vector<uint32_t> depths(m_nodes.size(), 0);
+	for(size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		if(m_nodes[i].count == 0)
+		{
+			depths[m_nodes[i].leftFirst] = depths[m_nodes[i].leftFirst + 1] = depths[i] + 1;
+			m_depth = (std::max)(m_depth, depths[i] + 1);
+		}
+	}
+
+	//Store the triangles in leaf order so a leaf reads one contiguous run
+	m_triangles.resize(triCount);
+	pool.ParallelFor(0, triCount, g_bvhGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const size_t t = m_prims[i].triangle;
+				const XMVECTOR a = XMLoadFloat3(&m_vertices[t * 3 + 0]);
+				const XMVECTOR e1 = XMLoadFloat3(&m_vertices[t * 3 + 1]) - a;
+				const XMVECTOR e2 = XMLoadFloat3(&m_vertices[t * 3 + 2]) - a;
+				Triangle& tri = m_triangles[i];
+				XMStoreFloat3(&tri.v0, a);
+				XMStoreFloat3(&tri.e1, e1);
+				XMStoreFloat3(&tri.e2, e2);
+				XMStoreFloat3(&tri.normal, XMVector3Normalize(XMVector3Cross(e1, e2)));
+			}
+		});
+
+	//Only needed while building
+	m_prims.clear();
+	m_prims.shrink_to_fit();
+}
+
+void TriangleBVH::SweepTriangle(const Triangle& tri, FXMVECTOR from, FXMVECTOR delta, FXMVECTOR sweepMin, GXMVECTOR sweepMax, float radius, SweepHit& hit)
+{
+	const XMVECTOR v0 = XMLoadFloat3(&tri.v0);
+	const XMVECTOR e1 = XMLoadFloat3(&tri.e1);
+	const XMVECTOR e2 = XMLoadFloat3(&tri.e2);
+	const XMVECTOR v1 = v0 + e1, v2 = v0 + e2;
+
+	//Most triangles of a leaf are nowhere near the sweep, their boxes don't even touch
+	if(!XMVector3LessOrEqual(XMVectorMin(v0, XMVectorMin(v1, v2)), sweepMax) || !XMVector3GreaterOrEqual(XMVectorMax(v0, XMVectorMax(v1, v2)), sweepMin))
+	{
+		return;
+	}
+	XMVECTOR n = XMLoadFloat3(&tri.normal);
+
+	//Triangles are two sided, face the normal towards where the sweep starts
+	float dist0 = XMVectorGetX(XMVector3Dot(n, from - v0));
+	if(dist0 < 0.0f)
+	{
+		n = -n;
+		dist0 = -dist0;
+	}
+
+	//Distance from the plane at the end of the sweep, a sphere that never comes within
+	//radius of the plane can't touch the triangle
+	const float dn = XMVectorGetX(XMVector3Dot(n, delta));
+	const float dist1 = dist0 + dn;
+	if(dist0 >= radius && dist1 >= radius)
+	{
+		return;
+	}
+
+	if(dist0 >= radius)
+	{
+		//Time the sphere touches the plane, then check the touching point is on the face
+		const float t = (dist0 - radius) / -dn;
+		if(t >= hit.t)
+		{
+			return;
+		}
+		const XMVECTOR centre = from + delta * t;
+		const XMVECTOR p = centre - n * radius - v0;
+		const float d00 = XMVectorGetX(XMVector3Dot(e1, e1));
+		const float d01 = XMVectorGetX(XMVector3Dot(e1, e2));
+		const float d11 = XMVectorGetX(XMVector3Dot(e2, e2));
+		const float d20 = XMVectorGetX(XMVector3Dot(p, e1));
+		const float d21 = XMVectorGetX(XMVector3Dot(p, e2));
+		const float invDenom = 1.0f / (d00 * d11 - d01 * d01);
+		const float v = (d11 * d20 - d01 * d21) * invDenom;
+		const float w = (d00 * d21 - d01 * d20) * invDenom;
+		if(v >= 0.0f && w >= 0.0f && v + w <= 1.0f)
+		{
+			hit.t = t;
+			XMStoreFloat3(&hit.normal, n);
+			XMStoreFloat3(&hit.centre, centre);
+			return;
+		}
+	}
+
+	//Otherwise the sphere first touches an edge or a corner, whichever of the capsules around the
+	//edges it runs into first, even part way through a long step
+	float t = (std::min)({ SweepEdge(from, delta, v0, e1, radius), SweepEdge(from, delta, v0, e2, radius), SweepEdge(from, delta, v1, e2 - e1, radius),
+		SweepPoint(from, delta, v0, radius), SweepPoint(from, delta, v1, radius), SweepPoint(from, delta, v2, radius) });
+	if(t > 0.0f && dist0 < radius && XMVectorGetX(XMVector3LengthSq(from - ClosestPointOnTriangle(from, v0, e1, e2))) < radius * radius)
+	{
+		t = 0.0f;		//Already overlapping the face where the sweep starts
+	}
+	if(t > 1.0f || t >= hit.t)
+	{
+		return;
+	}
+	const XMVECTOR centre = from + delta * t;
+	const XMVECTOR closest = ClosestPointOnTriangle(centre, v0, e1, e2);
+	const XMVECTOR offset = centre - closest;
+	const float distSq = XMVectorGetX(XMVector3LengthSq(offset));
+	const XMVECTOR normal = distSq > 1e-12f ? offset / sqrtf(distSq) : n;
+	hit.t = t;
+	XMStoreFloat3(&hit.normal, normal);
+	XMStoreFloat3(&hit.centre, closest + normal * radius);
+}
+
+SweepHit TriangleBVH::SweepSphere(const XMFLOAT3& from, const XMFLOAT3& to, float radius)const
+{
+	SweepHit hit;
+	hit.t = FLT_MAX;
+	if(m_nodes.empty())
+	{
+		return hit;
+	}
+
+	const XMFLOAT3 delta(to.x - from.x, to.y - from.y, to.z - from.z);
+	const XMFLOAT3 invDelta(delta.x != 0.0f ? 1.0f / delta.x : FLT_MAX, delta.y != 0.0f ? 1.0f / delta.y : FLT_MAX, delta.z != 0.0f ? 1.0f / delta.z : FLT_MAX);
+	const XMVECTOR vFrom = XMLoadFloat3(&from);
+	const XMVECTOR vDelta = XMLoadFloat3(&delta);
+	const XMVECTOR vMin = XMVectorMin(vFrom, vFrom + vDelta) - XMVectorReplicate(radius);
+	const XMVECTOR vMax = XMVectorMax(vFrom, vFrom + vDelta) + XMVectorReplicate(radius);
+
+	//Each level leaves at most one far child waiting, so depth + 1 entries always fit
+	uint32_t localStack[g_localStackSize];
+	std::vector<uint32_t> heapStack;
+	uint32_t* stack = localStack;
+	if(m_depth + 1 > g_localStackSize)
+	{
+		heapStack.resize(m_depth + 1);
+		stack = heapStack.data();
+	}
+	uint32_t top(0);
+	if(SegmentBoxEntry(from, invDelta, m_nodes[0].boundsMin, m_nodes[0].boundsMax, radius, 1.0f) == FLT_MAX)
+	{
+		return hit;
+	}
+	stack[top++] = 0;
+	while(top > 0)
+	{
+		const Node& node = m_nodes[stack[--top]];
+		if(node.count > 0)
+		{
+			for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				SweepTriangle(m_triangles[i], vFrom, vDelta, vMin, vMax, radius, hit);
+			}
+			continue;
+		}
+
+		//Visit the nearer child first so later boxes are culled by the closer hit
+		const float maxT = (std::min)(hit.t, 1.0f);
+		uint32_t nearChild = node.leftFirst, farChild = node.leftFirst + 1;
+		float tNear = SegmentBoxEntry(from, invDelta, m_nodes[nearChild].boundsMin, m_nodes[nearChild].boundsMax, radius, maxT);
+		float tFar = SegmentBoxEntry(from, invDelta, m_nodes[farChild].boundsMin, m_nodes[farChild].boundsMax, radius, maxT);
+		if(tFar < tNear)
+		{
+			std::swap(nearChild, farChild);
+			std::swap(tNear, tFar);
+		}
+		if(tFar != FLT_MAX)
+		{
+			stack[top++] = farChild;
+		}
+		if(tNear != FLT_MAX)
+		{
+			stack[top++] = nearChild;
+		}
+	}
+	return hit;
+}
+
+void TriangleBVH::SweepPacket(const XMFLOAT3* from, const XMFLOAT3* to, const uint32_t* sweeps, uint32_t count, float radius, SweepHit* hits)const
+{
+	//Copy the packet's sweeps next to each other, with the box around each for the triangles and its
+	//reciprocal direction for the nodes. Nodes are only tested against the sweeps still active in their
+	//parent, and only as far as each has got before hitting something.
+	XMFLOAT3 start[g_sweepPacketSize], delta[g_sweepPacketSize], invDelta[g_sweepPacketSize];
+	XMFLOAT3 sweepMin[g_sweepPacketSize], sweepMax[g_sweepPacketSize];
+	SweepHit packetHits[g_sweepPacketSize];
+	XMVECTOR packetMin = XMVectorReplicate(FLT_MAX), packetMax = XMVectorReplicate(-FLT_MAX);
+	for(uint32_t k = 0; k < count; ++k)
+	{
+		const XMVECTOR a = XMLoadFloat3(&from[sweeps[k]]);
+		const XMVECTOR b = XMLoadFloat3(&to[sweeps[k]]);
+		XMStoreFloat3(&start[k], a);
+		XMStoreFloat3(&delta[k], b - a);
+		const XMFLOAT3& d = delta[k];
+		invDelta[k] = XMFLOAT3(d.x != 0.0f ? 1.0f / d.x : FLT_MAX, d.y != 0.0f ? 1.0f / d.y : FLT_MAX, d.z != 0.0f ? 1.0f / d.z : FLT_MAX);
+		const XMVECTOR lo = XMVectorMin(a, b) - XMVectorReplicate(radius);
+		const XMVECTOR hi = XMVectorMax(a, b) + XMVectorReplicate(radius);
+		XMStoreFloat3(&sweepMin[k], lo);
+		XMStoreFloat3(&sweepMax[k], hi);
+		packetMin = XMVectorMin(packetMin, lo);
+		packetMax = XMVectorMax(packetMax, hi);
+		packetHits[k].t = FLT_MAX;
+	}
+	XMFLOAT3 groupMin, groupMax;
+	XMStoreFloat3(&groupMin, packetMin);
+	XMStoreFloat3(&groupMax, packetMax);
+
+	//A node outside the box around the whole packet is culled with one test instead of one per sweep
+	auto overlapping = [&](const Node& node, uint32_t active)
+	{
+		if(!BoxesOverlap(node.boundsMin, node.boundsMax, groupMin, groupMax))
+		{
+			return 0u;
+		}
+		uint32_t mask(0);
+		unsigned long k;
+		for(uint32_t bits = active; _BitScanForward(&k, bits); bits &= bits - 1)
+		{
+			if(SegmentBoxEntry(start[k], invDelta[k], node.boundsMin, node.boundsMax, radius, (std::min)(packetHits[k].t, 1.0f)) != FLT_MAX)
+			{
+				mask |= 1u << k;
+			}
+		}
+		return mask;
+	};
+
+	//Both children can be pushed at every level, so depth + 1 entries always fit
+	struct Entry
+	{
+		uint32_t node;
+		uint32_t active;		//Sweeps that reach the node, one bit each
+	};
+	Entry localStack[g_localStackSize];
+	std::vector<Entry> heapStack;
+	Entry* stack = localStack;
+	if(m_depth + 1 > g_localStackSize)
+	{
+		heapStack.resize(m_depth + 1);
+		stack = heapStack.data();
+	}
+	uint32_t top(0);
+	const uint32_t rootActive = overlapping(m_nodes[0], count == 32 ? ~0u : (1u << count) - 1);
+	if(rootActive != 0)
+	{
+		stack[top++] = { 0, rootActive };
+	}
+	while(top > 0)
+	{
+		const Entry entry = stack[--top];
+		const Node& node = m_nodes[entry.node];
+		if(node.count == 0)
+		{
+			//Push the child further from where the packet starts first, so the nearer one is walked
+			//first and its hits cut the sweeps short before the far one is reached
+			float leftDist(0.0f), rightDist(0.0f);
+			for(int axis = 0; axis < 3; ++axis)
+			{
+				const Node& left = m_nodes[node.leftFirst];
+				const Node& right = m_nodes[node.leftFirst + 1];
+				const float twiceStart = 2.0f * (&start[0].x)[axis];
+				leftDist += fabsf((&left.boundsMin.x)[axis] + (&left.boundsMax.x)[axis] - twiceStart);
+				rightDist += fabsf((&right.boundsMin.x)[axis] + (&right.boundsMax.x)[axis] - twiceStart);
+			}
+			const uint32_t nearChild = leftDist <= rightDist ? node.leftFirst : node.leftFirst + 1;
+			const uint32_t children[2] = { 2 * node.leftFirst + 1 - nearChild, nearChild };
+			for(uint32_t child : children)
+			{
+				const uint32_t active = overlapping(m_nodes[child], entry.active);
+				if(active != 0)
+				{
+					stack[top++] = { child, active };
+				}
+			}
+			continue;
+		}
+		unsigned long k;
+		for(uint32_t bits = entry.active; _BitScanForward(&k, bits); bits &= bits - 1)
+		{
+			const XMVECTOR vFrom = XMLoadFloat3(&start[k]);
+			const XMVECTOR vDelta = XMLoadFloat3(&delta[k]);
+			const XMVECTOR vMin = XMLoadFloat3(&sweepMin[k]), vMax = XMLoadFloat3(&sweepMax[k]);
+			for(uint32_t i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				SweepTriangle(m_triangles[i], vFrom, vDelta, vMin, vMax, radius, packetHits[k]);
+			}
+		}
+	}
+
+	for(uint32_t k = 0; k < count; ++k)
+	{
+		hits[sweeps[k]] = packetHits[k];
+	}
+}
+
+void TriangleBVH::SweepSpheres(const XMFLOAT3* from, const XMFLOAT3* to, size_t count, float radius, SweepHit* hits)const
+{
+	if(m_nodes.empty())
+	{
+		for(size_t i = 0; i < count; ++i)
+		{
+			hits[i].t = FLT_MAX;
+		}
+		return;
+	}
+
+	//Order the sweeps along a Morton curve through their starts, so each packet of consecutive
+	//sweeps is a small cluster and its box culls nearly as well as a single sweep's would
+	XMFLOAT3 startMin(FLT_MAX, FLT_MAX, FLT_MAX), startMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(size_t i = 0; i < count; ++i)
+	{
+		startMin = XMFLOAT3((std::min)(startMin.x, from[i].x), (std::min)(startMin.y, from[i].y), (std::min)(startMin.z, from[i].z));
+		startMax = XMFLOAT3((std::max)(startMax.x, from[i].x), (std::max)(startMax.y, from[i].y), (std::max)(startMax.z, from[i].z));
+	}
+	const float extent = (std::max)({ startMax.x - startMin.x, startMax.y - startMin.y, startMax.z - startMin.z, 1e-6f }) * 1.0001f;
+	const float toGrid = 1024.0f / extent;
+	std::vector<uint32_t> codes(count), order(count), codeScratch, orderScratch;
+	ThreadPool& pool = ThreadPool::Get();
+	pool.ParallelFor(0, count, g_packetGrain * g_sweepPacketSize * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				codes[i] = MortonSort::Code(static_cast<uint32_t>((from[i].x - startMin.x) * toGrid),
+					static_cast<uint32_t>((from[i].y - startMin.y) * toGrid), static_cast<uint32_t>((from[i].z - startMin.z) * toGrid));
+				order[i] = static_cast<uint32_t>(i);
+			}
+		});
+	MortonSort::RadixSort(codes, order, codeScratch, orderScratch, 3 * MortonSort::g_radixBits);
+
+	const size_t packetCount = (count + g_sweepPacketSize - 1) / g_sweepPacketSize;
+	pool.ParallelFor(0, packetCount, g_packetGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t packet = begin; packet < end; ++packet)
+			{
+				const size_t first = packet * g_sweepPacketSize;
+				SweepPacket(from, to, order.data() + first, static_cast<uint32_t>((std::min)(count - first, static_cast<size_t>(g_sweepPacketSize))), radius, hits);
+			}
+		});
+}
+
+MeshCollider::MeshCollider()
+	:m_particleRadius(g_defaultParticleRadius), m_restitution(g_defaultMeshRestitution), m_friction(g_defaultMeshFriction)
+{}
+
+void MeshCollider::BeginStep(const std::vector<Particle>& particles)
+{
+	m_aliveIndices.clear();
+	m_from.clear();
+	for(size_t i = 0; i < particles.size(); ++i)
+	{
+		if(particles[i].alive)
+		{
+			m_aliveIndices.push_back(static_cast<uint32_t>(i));
+			m_from.push_back(particles[i].position);
+		}
+	}
+}
+
+void MeshCollider::ResolveCollisions(std::vector<Particle>& particles, ParticleEventBuffer* events)
+{
+	if(m_bvh.GetTriangleCount() == 0 || m_aliveIndices.empty())
+	{
+		return;
+	}
+	const size_t count = m_aliveIndices.size();
+	m_to.resize(count);
+	m_hits.resize(count);
+	for(size_t i = 0; i < count; ++i)
+	{
+		m_to[i] = particles[m_aliveIndices[i]].position;
+	}
+
+	m_bvh.SweepSpheres(m_from.data(), m_to.data(), count, m_particleRadius, m_hits.data());
+
+	for(size_t i = 0; i < count; ++i)
+	{
+		const SweepHit& hit = m_hits[i];
+		if(!hit.Hit())
+		{
+			continue;
+		}
+		Particle& p = particles[m_aliveIndices[i]];
+		p.position = hit.centre;
+
+		//Same response as the analytic colliders, only particles moving into the surface bounce
+		const XMVECTOR n = XMLoadFloat3(&hit.normal);
+		const XMVECTOR v = XMLoadFloat3(&p.velocity);
+		const float vn = XMVectorGetX(XMVector3Dot(v, n));
+		if(vn < 0.0f)
+		{
+			if(events != nullptr && -vn * (1.0f + m_restitution) > g_minCollisionEventSpeed)
+			{
+				events->Push(ParticleEventType::Collision, p.position, p.velocity, p.seed);
+			}
+			XMStoreFloat3(&p.velocity, (v - n * vn) * (1.0f - m_friction) - n * (vn * m_restitution));
+		}
+		XMStoreFloat4x4(&p.render_item.World, XMMatrixTranslation(p.position.x, p.position.y, p.position.z));
+		p.render_item.NumFramesDirty = g_numFrameResources;
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+
+struct MeshGeometry;
+struct SubmeshGeometry;
+struct Particle;
+class ParticleEventBuffer;
+
+struct SweepHit
+{
+	float				t;				//Fraction of the sweep travelled before contact, > 1 means no hit
+	DirectX::XMFLOAT3	normal;			//Surface normal facing the particle
+	DirectX::XMFLOAT3	centre;			//Sphere centre at the contact, just touching the surface
+	bool Hit()const { return t <= 1.0f; }
+};
+
+//Bounding volume hierarchy over a static triangle soup, built with binned SAH.
+//Meshes are transformed into world space as they are added so queries need no transforms.
+class TriangleBVH
+{
+	struct Node				//32 bytes, children of an interior node are stored next to each other
+	{
+		DirectX::XMFLOAT3	boundsMin;
+		uint32_t			leftFirst;	//Left child for interior nodes, first triangle for leaves
+		DirectX::XMFLOAT3	boundsMax;
+		uint32_t			count;		//Triangles in a leaf, 0 for interior nodes
+	};
+	struct Triangle
+	{
+		DirectX::XMFLOAT3	v0, e1, e2;		//First vertex and the two edges leaving it
+		DirectX::XMFLOAT3	normal;
+	};
+	struct BuildPrim		//Partitioned directly rather than through an index list so the build streams through memory
+	{
+		DirectX::XMFLOAT3	boundsMin;
+		uint32_t			triangle;
+		DirectX::XMFLOAT3	boundsMax;
+		float Centroid(int axis)const { return 0.5f * ((&boundsMin.x)[axis] + (&boundsMax.x)[axis]); }
+	};
+	struct Split			//Best SAH plane found by FindSplit, with the bounds of both halves
+	{
+		int					axis;
+		uint32_t			bin;		//Triangles whose centroid falls in a bin below this go left
+		float				binOrigin;
+		float				binScale;
+		uint32_t			binCount;
+		DirectX::XMFLOAT3	leftMin, leftMax;
+		DirectX::XMFLOAT3	rightMin, rightMax;
+	};
+	struct BuildRange
+	{
+		uint32_t node;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	std::vector<DirectX::XMFLOAT3>	m_vertices;			//Triangle corners added so far, three per triangle
+	std::vector<Node>				m_nodes;
+	std::vector<Triangle>			m_triangles;		//In leaf order after Build
+	std::vector<BuildPrim>			m_prims;			//Partitioned in place during the build
+	uint32_t						m_depth = 0;		//Levels below the root, what a traversal stack has to hold
+
+	void AddTriangle(DirectX::FXMVECTOR a, DirectX::FXMVECTOR b, DirectX::FXMVECTOR c);
+	void UpdateBounds(Node& node, uint32_t first, uint32_t count)const;
+	bool FindSplit(const Node& node, uint32_t first, uint32_t count, Split& split)const;
+	void Subdivide(std::vector<Node>& nodes, uint32_t nodeIndex, uint32_t first, uint32_t count, std::vector<BuildRange>* frontier, size_t frontierTarget);
+	static void SweepTriangle(const Triangle& tri, DirectX::FXMVECTOR from, DirectX::FXMVECTOR delta, DirectX::FXMVECTOR sweepMin, DirectX::GXMVECTOR sweepMax, float radius, SweepHit& hit);
+	//Walks the tree once for a packet of sweeps, given by their indices. A node outside the box around the
+	//whole packet is culled with one test, otherwise it is only tested against the sweeps that reached its
+	//parent, and is skipped once none reach it.
+	void SweepPacket(const DirectX::XMFLOAT3* from, const DirectX::XMFLOAT3* to, const uint32_t* sweeps, uint32_t count, float radius, SweepHit* hits)const;
+	static DirectX::XMVECTOR LoadPosition(const DirectX::XMFLOAT3* p) { return DirectX::XMLoadFloat3(p); }
+	static DirectX::XMVECTOR LoadPosition(const DirectX::PackedVector::XMUSHORTN4* p) { return DirectX::PackedVector::XMLoadUShortN4(p); }
+
+public:
+	static constexpr uint32_t k_maxLeafSize = 8;
+	static constexpr uint32_t k_binCount = 16;
+
+	//Positions are float or 16 bit unorm, which world has to decode as well as place
+	template<class Position, class Index>
+	void AddMesh(const Position* positions, size_t vertexStride, const Index* indices, size_t indexCount, const DirectX::XMFLOAT4X4& world)
+	{
+		const DirectX::XMMATRIX transform = DirectX::XMLoadFloat4x4(&world);
+		const char* base = reinterpret_cast<const char*>(positions);
+		for(size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			const Position* p0 = reinterpret_cast<const Position*>(base + indices[i + 0] * vertexStride);
+			const Position* p1 = reinterpret_cast<const Position*>(base + indices[i + 1] * vertexStride);
+			const Position* p2 = reinterpret_cast<const Position*>(base + indices[i + 2] * vertexStride);
+			AddTriangle(DirectX::XMVector3TransformCoord(LoadPosition(p0), transform),
+				DirectX::XMVector3TransformCoord(LoadPosition(p1), transform),
+				DirectX::XMVector3TransformCoord(LoadPosition(p2), transform));
+		}
+	}
+	//Reads the CPU copies of a loaded mesh. Every vertex starts with its position, in the geometry's
+	//PositionFormat, packed positions are decoded across the submesh bounds. Returns false, adding
+	//nothing, when the geometry has no CPU copy of its vertices or indices.
+	bool AddMesh(const MeshGeometry& geo, const SubmeshGeometry& submesh, const DirectX::XMFLOAT4X4& world);
+	void Clear();
+
+	//Builds the hierarchy over every triangle added so far
+	void Build();
+
+	size_t GetTriangleCount()const { return m_triangles.size(); }
+	size_t GetNodeCount()const { return m_nodes.size(); }
+	uint32_t GetDepth()const { return m_depth; }
+
+	//Sweeps a sphere from 'from' to 'to' and reports the first contact
+	SweepHit SweepSphere(const DirectX::XMFLOAT3& from, const DirectX::XMFLOAT3& to, float radius)const;
+	//Runs count sweeps, sorted into packets of neighbouring sweeps that share a traversal, spread over the thread pool.
+	//Meant for many short sweeps such as a frame's particle motion, hits are the same as SweepSphere's.
+	void SweepSpheres(const DirectX::XMFLOAT3* from, const DirectX::XMFLOAT3* to, size_t count, float radius, SweepHit* hits)const;
+};
+
+constexpr float g_defaultMeshRestitution = 0.3f;
+constexpr float g_defaultMeshFriction = 0.2f;
+
+//Collides particles with a triangle BVH by sweeping each one from where it started the
+//frame to where the motion policy left it, so fast particles can't tunnel through thin walls
+class MeshCollider
+{
+	TriangleBVH					m_bvh;
+	std::vector<uint32_t>		m_aliveIndices;
+	std::vector<DirectX::XMFLOAT3> m_from, m_to;
+	std::vector<SweepHit>		m_hits;
+	float						m_particleRadius;
+	float						m_restitution;
+	float						m_friction;
+public:
+	MeshCollider();
+
+	TriangleBVH& GetBVH() { return m_bvh; }
+	void SetParticleRadius(float radius) { m_particleRadius = radius; }
+	void SetResponse(float restitution, float friction) { m_restitution = restitution; m_friction = friction; }
+
+	//Records where every alive particle is before it is moved
+	void BeginStep(const std::vector<Particle>& particles);
+	//Sweeps the recorded particles to their new positions and bounces the ones that hit,
+	//which raise a collision event in events when it isn't null
+	void ResolveCollisions(std::vector<Particle>& particles, ParticleEventBuffer* events = nullptr);
+};
@@ -0,0 +1,660 @@
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+
+#include "Common/ThreadPool.h"
+
+#include <windows.h>
+#include <fstream>
+#include <charconv>
+#include <mutex>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	struct SourceInfo
+	{
+		uint64_t size;
+		uint64_t writeTime;
+	};
+
+	bool GetSourceInfo(const std::string& filename, SourceInfo& info)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if(!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data))
+		{
+			return false;
+		}
+		info.size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		info.writeTime = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+		return true;
+	}
+
+	bool HashFile(const std::string& filename, uint64_t& hash)
+	{
+		std::ifstream fin(filename, std::ios::binary);
+		if(!fin)
+		{
+			return false;
+		}
+		hash = 14695981039346656037ull;		//FNV-1a
+		char block[65536];
+		while(fin)
+		{
+			fin.read(block, sizeof(block));
+			const std::streamsize count = fin.gcount();
+			for(std::streamsize i = 0; i < count; ++i)
+			{
+				hash = (hash ^ static_cast<uint8_t>(block[i])) * 1099511628211ull;
+			}
+		}
+		return true;
+	}
+
+	uint64_t Align16(uint64_t offset)
+	{
+		return (offset + 15) & ~static_cast<uint64_t>(15);
+	}
+
+	//Models/skull.txt -> Models/skull.mesh
+	std::string CacheFilename(const std::string& source)
+	{
+		const size_t slash = source.find_last_of("/\\");
+		const size_t dot = source.find_last_of('.');
+		const bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+		return (hasExtension ? source.substr(0, dot) : source) + ".mesh";
+	}
+
+	//Models/skull.txt -> skull
+	std::string Stem(const std::string& source)
+	{
+		const size_t slash = source.find_last_of("/\\");
+		const std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+		return name.substr(0, name.find_last_of('.'));
+	}
+
+	//Ranges the header can't vouch for: every submesh and meshlet has to lie inside the index stream and every
+	//name has to end inside its field, so nothing read through them runs off the mapping
+	bool TablesAreValid(const MeshFileHeader& h, const MeshFileSubmesh* submeshes, const Meshlet* meshlets)
+	{
+		for(uint32_t i = 0; i < h.submeshCount; ++i)
+		{
+			const MeshFileSubmesh& s = submeshes[i];
+			if(memchr(s.name, '\0', sizeof(s.name)) == nullptr || static_cast<uint64_t>(s.startIndex) + s.indexCount > h.indexCount
+				|| s.baseVertex < 0 || static_cast<uint32_t>(s.baseVertex) > h.vertexCount)
+			{
+				return false;
+			}
+		}
+		if(h.meshletCount > 0 && h.submeshCount == 0)
+		{
+			return false;
+		}
+		for(uint32_t i = 0; i < h.meshletCount; ++i)
+		{
+			if(static_cast<uint64_t>(meshlets[i].startIndex) + 3ull * meshlets[i].triangleCount > submeshes[0].indexCount)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void SetError(std::string* error, const std::string& message)
+	{
+		if(error != nullptr)
+		{
+			*error = message;
+		}
+	}
+
+	bool ReadWholeFile(const std::string& filename, std::string& text)
+	{
+		std::ifstream fin(filename, std::ios::binary | std::ios::ate);
+		if(!fin)
+		{
+			return false;
+		}
+		text.resize(static_cast<size_t>(fin.tellg()));
+		fin.seekg(0);
+		fin.read(&text[0], text.size());
+		return static_cast<bool>(fin);
+	}
+
+	constexpr size_t g_textChunkSize = 64 * 1024;		//Bytes of a block each parse task takes, rounded up to whole lines
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	//Parses the VertexCount/TriangleCount/VertexList/TriangleList text format from a buffer holding the
+	//whole file. The header is read line by line, then each list is cut into line aligned chunks that are
+	//parsed on the thread pool straight into the preallocated arrays: a first pass counts the records in
+	//every chunk so each one knows where its records go, a second parses them.
+	class TextModelParser
+	{
+		struct Block							//Text between a list's braces
+		{
+			const char*	begin;
+			const char*	end;
+			uint32_t	firstLine;
+		};
+		struct Chunk
+		{
+			const char*	begin;
+			const char*	end;
+			size_t		records;				//Non blank lines, then the index of the first one after the prefix sum
+			uint32_t	lines;					//Line breaks, then the line number of the first line
+		};
+
+		const std::string&	m_filename;
+		const char*			m_pos;
+		const char*			m_end;
+		uint32_t			m_line;				//1 based line m_pos is on
+		std::vector<Chunk>	m_chunks;
+		std::mutex			m_errorMutex;		//Chunks report errors in parallel, the one on the earliest line is kept
+		uint32_t			m_errorLine;
+		std::string			m_error;
+
+		void Fail(uint32_t line, const std::string& message)
+		{
+			std::lock_guard<std::mutex> lock(m_errorMutex);
+			if(m_error.empty() || line < m_errorLine)
+			{
+				m_errorLine = line;
+				m_error = m_filename + "(" + std::to_string(line) + "): " + message;
+			}
+		}
+
+		//Next non blank line with surrounding whitespace trimmed
+		bool NextLine(const char*& begin, const char*& end)
+		{
+			while(m_pos < m_end)
+			{
+				const char* lineEnd = static_cast<const char*>(memchr(m_pos, '\n', m_end - m_pos));
+				const char* next = lineEnd != nullptr ? lineEnd + 1 : m_end;
+				begin = m_pos;
+				end = lineEnd != nullptr ? lineEnd : m_end;
+				m_pos = next;
+				while(begin < end && IsSpace(*begin))
+				{
+					++begin;
+				}
+				while(end > begin && IsSpace(end[-1]))
+				{
+					--end;
+				}
+				if(begin != end)
+				{
+					return true;
+				}
+				++m_line;
+			}
+			return false;
+		}
+
+		//Checks the next line starts with keyword and returns the rest of it
+		bool ExpectLine(const char* keyword, const char*& rest, const char*& end)
+		{
+			const char* begin;
+			const size_t length = strlen(keyword);
+			if(!NextLine(begin, end))
+			{
+				Fail(m_line, std::string("unexpected end of file, expected '") + keyword + "'");
+				return false;
+			}
+			if(static_cast<size_t>(end - begin) < length || memcmp(begin, keyword, length) != 0)
+			{
+				Fail(m_line, std::string("expected '") + keyword + "', found '" + std::string(begin, end) + "'");
+				return false;
+			}
+			rest = begin + length;
+			++m_line;
+			return true;
+		}
+
+		bool ExpectCount(const char* keyword, uint32_t& count)
+		{
+			const char* rest;
+			const char* end;
+			if(!ExpectLine(keyword, rest, end))
+			{
+				return false;
+			}
+			while(rest < end && IsSpace(*rest))
+			{
+				++rest;
+			}
+			const std::from_chars_result result = std::from_chars(rest, end, count);
+			if(result.ec != std::errc() || result.ptr != end)
+			{
+				Fail(m_line - 1, std::string("expected a count after '") + keyword + "', found '" + std::string(rest, end) + "'");
+				return false;
+			}
+			return true;
+		}
+
+		//Reads "<keyword> ...", then "{", and finds the matching "}". Numbers never contain a brace so the
+		//first one closes the list.
+		bool ExpectBlock(const char* keyword, Block& block)
+		{
+			const char* rest;
+			const char* end;
+			if(!ExpectLine(keyword, rest, end) || !ExpectLine("{", rest, end))
+			{
+				return false;
+			}
+			if(rest != end)
+			{
+				Fail(m_line - 1, std::string("expected '{' on its own line after '") + keyword + "'");
+				return false;
+			}
+			const char* close = static_cast<const char*>(memchr(m_pos, '}', m_end - m_pos));
+			if(close == nullptr)
+			{
+				Fail(m_line, std::string("missing '}' closing the ") + keyword);
+				return false;
+			}
+			block = { m_pos, close, m_line };
+			m_pos = close + 1;
+			return true;
+		}
+
+		//Cuts the block into line aligned chunks and counts the records and line breaks in each
+		size_t CountRecords(const Block& block)
+		{
+			m_chunks.clear();
+			for(const char* p = block.begin; p < block.end;)
+			{
+				const char* split = p + (std::min)(g_textChunkSize, static_cast<size_t>(block.end - p));
+				const char* lineEnd = static_cast<const char*>(memchr(split, '\n', block.end - split));
+				const char* next = lineEnd != nullptr ? lineEnd + 1 : block.end;
+				m_chunks.push_back({ p, next, 0, 0 });
+				p = next;
+			}
+			ThreadPool::Get().ParallelFor(0, m_chunks.size(), 1, [this](size_t begin, size_t end)
+			{
+				for(size_t c = begin; c < end; ++c)
+				{
+					Chunk& chunk = m_chunks[c];
+					bool blank = true;
+					for(const char* p = chunk.begin; p < chunk.end; ++p)
+					{
+						if(*p == '\n')
+						{
+							chunk.records += blank ? 0 : 1;
+							++chunk.lines;
+							blank = true;
+						}
+						else if(!IsSpace(*p))
+						{
+							blank = false;
+						}
+					}
+					chunk.records += blank ? 0 : 1;
+				}
+			});
+			size_t records = 0;
+			uint32_t line = block.firstLine;
+			for(Chunk& chunk : m_chunks)
+			{
+				const size_t chunkRecords = chunk.records;
+				const uint32_t chunkLines = chunk.lines;
+				chunk.records = records;
+				chunk.lines = line;
+				records += chunkRecords;
+				line += chunkLines;
+			}
+			m_line = line;		//The line the closing brace is on
+			return records;
+		}
+
+		//Parses every non blank line of the block as exactly N numbers and hands them to store(record, values),
+		//which returns an empty string or what was wrong with them
+		template<class T, size_t N, class Store>
+		bool ParseRecords(const Block& block, uint32_t expected, const char* recordName, const char* keyword, Store store)
+		{
+			const size_t records = CountRecords(block);
+			if(records != expected)
+			{
+				Fail(m_line, std::string(keyword) + " holds " + std::to_string(records) + " entries, the header says " + std::to_string(expected));
+				return false;
+			}
+			ThreadPool::Get().ParallelFor(0, m_chunks.size(), 1, [&](size_t begin, size_t end)
+			{
+				for(size_t c = begin; c < end; ++c)
+				{
+					const Chunk& chunk = m_chunks[c];
+					size_t record = chunk.records;
+					uint32_t line = chunk.lines;
+					for(const char* p = chunk.begin; p < chunk.end; ++line)
+					{
+						const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+						const char* next = lineEnd != nullptr ? lineEnd + 1 : chunk.end;
+						const char* last = lineEnd != nullptr ? lineEnd : chunk.end;
+						T values[N];
+						size_t count = 0;
+						while(true)
+						{
+							while(p < last && IsSpace(*p))
+							{
+								++p;
+							}
+							if(p == last)
+							{
+								break;
+							}
+							const char* token = p;
+							while(p < last && !IsSpace(*p))
+							{
+								++p;
+							}
+							if(count == N)
+							{
+								++count;
+								break;
+							}
+							const std::from_chars_result result = std::from_chars(token, p, values[count]);
+							if(result.ec != std::errc() || result.ptr != p)
+							{
+								Fail(line, std::string(recordName) + " " + std::to_string(record) + ": '" + std::string(token, p) + "' is not a valid number");
+								return;
+							}
+							++count;
+						}
+						if(count != 0)
+						{
+							if(count != N)
+							{
+								Fail(line, std::string(recordName) + " " + std::to_string(record) + ": expected " + std::to_string(N) + " numbers, found " +
+									(count > N ? "more" : std::to_string(count)));
+								return;
+							}
+							const std::string message = store(record, values);
+							if(!message.empty())
+							{
+								Fail(line, std::string(recordName) + " " + std::to_string(record) + ": " + message);
+								return;
+							}
+							++record;
+						}
+						p = next;
+					}
+				}
+			});
+			return m_error.empty();
+		}
+	public:
+		TextModelParser(const std::string& filename, const std::string& text)
+			:m_filename(filename), m_pos(text.data()), m_end(text.data() + text.size()), m_line(1), m_errorLine(0)
+		{}
+
+		const std::string& GetError()const { return m_error; }
+
+		bool Parse(ModelData& model)
+		{
+			uint32_t vcount, tcount;
+			Block vertexBlock, triangleBlock;
+			if(!ExpectCount("VertexCount:", vcount) || !ExpectCount("TriangleCount:", tcount) || !ExpectBlock("VertexList", vertexBlock))
+			{
+				return false;
+			}
+			model.vertices.resize(vcount);
+			ModelVertex* vertices = model.vertices.data();
+			if(!ParseRecords<float, 6>(vertexBlock, vcount, "vertex", "VertexList", [vertices](size_t record, const float (&v)[6])
+			{
+				vertices[record] = { { v[0], v[1], v[2] }, { v[3], v[4], v[5] } };
+				return std::string();
+			}))
+			{
+				return false;
+			}
+
+			if(!ExpectBlock("TriangleList", triangleBlock))
+			{
+				return false;
+			}
+			model.indices.resize(3 * static_cast<size_t>(tcount));
+			uint32_t* indices = model.indices.data();
+			return ParseRecords<uint32_t, 3>(triangleBlock, tcount, "triangle", "TriangleList", [indices, vcount](size_t record, const uint32_t (&t)[3])
+			{
+				for(int i = 0; i < 3; ++i)
+				{
+					if(t[i] >= vcount)
+					{
+						return "index " + std::to_string(t[i]) + " is out of range, the model has " + std::to_string(vcount) + " vertices";
+					}
+					indices[3 * record + i] = t[i];
+				}
+				return std::string();
+			});
+		}
+	};
+}
+
+bool LoadTextModel(const std::string& filename, ModelData& model, std::string* error)
+{
+	std::string text;
+	if(!ReadWholeFile(filename, text))
+	{
+		SetError(error, filename + ": could not be read");
+		return false;
+	}
+	TextModelParser parser(filename, text);
+	if(!parser.Parse(model))
+	{
+		SetError(error, parser.GetError());
+		return false;
+	}
+	return true;
+}
+
+MappedMesh::MappedMesh()
+	:m_file(INVALID_HANDLE_VALUE), m_mapping(nullptr), m_view(nullptr), m_size(0)
+{}
+
+MappedMesh::~MappedMesh()
+{
+	Close();
+}
+
+void MappedMesh::Close()
+{
+	if(m_view != nullptr)
+	{
+		UnmapViewOfFile(m_view);
+		m_view = nullptr;
+	}
+	if(m_mapping != nullptr)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if(m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+	m_size = 0;
+}
+
+bool MappedMesh::Open(const std::string& filename)
+{
+	Close();
+	m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if(m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || static_cast<uint64_t>(size.QuadPart) < sizeof(MeshFileHeader))
+	{
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(size.QuadPart);
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_view = m_mapping != nullptr ? static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if(m_view == nullptr)
+	{
+		Close();
+		return false;
+	}
+
+	//Everything the header points at has to be inside the file, in the layout this build reads
+	const MeshFileHeader& h = GetHeader();
+	const bool valid = h.magic == g_meshFileMagic && h.version == g_meshFileVersion
+		&& h.vertexStride == sizeof(ModelVertex) && (h.indexSize == 2 || h.indexSize == 4)
+		&& h.vertexOffset + static_cast<uint64_t>(h.vertexCount) * h.vertexStride <= m_size
+		&& h.indexOffset + static_cast<uint64_t>(h.indexCount) * h.indexSize <= m_size
+		&& h.submeshOffset + static_cast<uint64_t>(h.submeshCount) * sizeof(MeshFileSubmesh) <= m_size
+		&& h.meshletOffset + static_cast<uint64_t>(h.meshletCount) * sizeof(Meshlet) <= m_size
+		&& TablesAreValid(h, GetSubmeshes(), GetMeshlets());
+	if(!valid)
+	{
+		Close();
+	}
+	return valid;
+}
+
+bool WriteMeshFile(const std::string& filename, const ModelData& model, const std::string& submeshName, const std::string& sourceFilename)
+{
+	MeshFileHeader header = {};
+	header.magic = g_meshFileMagic;
+	header.version = g_meshFileVersion;
+	SourceInfo info = {};
+	if(GetSourceInfo(sourceFilename, info))
+	{
+		header.sourceSize = info.size;
+		header.sourceWriteTime = info.writeTime;
+		HashFile(sourceFilename, header.sourceHash);
+	}
+	header.vertexCount = static_cast<uint32_t>(model.vertices.size());
+	header.vertexStride = sizeof(ModelVertex);
+	header.indexCount = static_cast<uint32_t>(model.indices.size());
+	header.indexSize = model.vertices.size() <= 0x10000 ? 2 : 4;		//16 bit indices whenever they fit
+	header.submeshCount = static_cast<uint32_t>(1 + model.lods.size());
+	header.meshletCount = static_cast<uint32_t>(model.meshlets.size());
+	for(int a = 0; a < 3; ++a)
+	{
+		header.boundsMin[a] = model.vertices.empty() ? 0.0f : FLT_MAX;
+		header.boundsMax[a] = model.vertices.empty() ? 0.0f : -FLT_MAX;
+	}
+	for(const ModelVertex& v : model.vertices)
+	{
+		const float p[3] = { v.position.x, v.position.y, v.position.z };
+		for(int a = 0; a < 3; ++a)
+		{
+			header.boundsMin[a] = (std::min)(header.boundsMin[a], p[a]);
+			header.boundsMax[a] = (std::max)(header.boundsMax[a], p[a]);
+		}
+	}
+	header.vertexOffset = Align16(sizeof(MeshFileHeader));
+	header.indexOffset = Align16(header.vertexOffset + static_cast<uint64_t>(header.vertexCount) * header.vertexStride);
+	header.submeshOffset = Align16(header.indexOffset + static_cast<uint64_t>(header.indexCount) * header.indexSize);
+	header.meshletOffset = Align16(header.submeshOffset + static_cast<uint64_t>(header.submeshCount) * sizeof(MeshFileSubmesh));
+
+	std::vector<MeshFileSubmesh> submeshes(header.submeshCount, MeshFileSubmesh{});
+	strncpy_s(submeshes[0].name, submeshName.c_str(), _TRUNCATE);
+	submeshes[0].indexCount = model.lods.empty() ? header.indexCount : model.lods[0].startIndex;
+	for(size_t i = 0; i < model.lods.size(); ++i)
+	{
+		MeshFileSubmesh& lod = submeshes[i + 1];
+		strncpy_s(lod.name, (submeshName + "_lod" + std::to_string(i + 1)).c_str(), _TRUNCATE);
+		lod.indexCount = model.lods[i].indexCount;
+		lod.startIndex = model.lods[i].startIndex;
+		lod.lodError = model.lods[i].error;
+	}
+
+	std::vector<uint8_t> file(static_cast<size_t>(header.meshletOffset + model.meshlets.size() * sizeof(Meshlet)), 0);
+	memcpy(file.data(), &header, sizeof(header));
+	if(!model.vertices.empty())
+	{
+		memcpy(&file[static_cast<size_t>(header.vertexOffset)], model.vertices.data(), model.vertices.size() * sizeof(ModelVertex));
+	}
+	if(header.indexSize == 2)
+	{
+		uint16_t* indices = reinterpret_cast<uint16_t*>(&file[static_cast<size_t>(header.indexOffset)]);
+		for(size_t i = 0; i < model.indices.size(); ++i)
+		{
+			indices[i] = static_cast<uint16_t>(model.indices[i]);
+		}
+	}
+	else if(!model.indices.empty())
+	{
+		memcpy(&file[static_cast<size_t>(header.indexOffset)], model.indices.data(), model.indices.size() * sizeof(uint32_t));
+	}
+	memcpy(&file[static_cast<size_t>(header.submeshOffset)], submeshes.data(), submeshes.size() * sizeof(MeshFileSubmesh));
+	if(!model.meshlets.empty())
+	{
+		memcpy(&file[static_cast<size_t>(header.meshletOffset)], model.meshlets.data(), model.meshlets.size() * sizeof(Meshlet));
+	}
+
+	//Written to the side and moved over the old cache, so a crash never leaves a half written file behind
+	const std::string temp = filename + ".tmp";
+	{
+		std::ofstream fout(temp, std::ios::binary | std::ios::trunc);
+		fout.write(reinterpret_cast<const char*>(file.data()), file.size());
+		if(!fout)
+		{
+			return false;
+		}
+	}
+	return MoveFileExA(temp.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+bool OpenCachedModel(const std::string& sourceFilename, MappedMesh& mesh, std::string* error)
+{
+	const std::string cache = CacheFilename(sourceFilename);
+	SourceInfo info;
+	const bool haveSource = GetSourceInfo(sourceFilename, info);
+	if(mesh.Open(cache))
+	{
+		const MeshFileHeader& header = mesh.GetHeader();
+		if(!haveSource || (header.sourceSize == info.size && header.sourceWriteTime == info.writeTime))
+		{
+			return true;
+		}
+		//Touched but not edited, a checkout or copy changes the time but not the contents
+		uint64_t hash;
+		if(header.sourceSize == info.size && HashFile(sourceFilename, hash) && hash == header.sourceHash)
+		{
+			return true;
+		}
+		mesh.Close();
+	}
+	if(!haveSource)
+	{
+		SetError(error, sourceFilename + ": not found");
+		return false;
+	}
+	ModelData model;
+	if(!LoadTextModel(sourceFilename, model, error))
+	{
+		return false;
+	}
+	OutputDebugStringA(DescribeStats(sourceFilename, OptimizeMesh(model)).c_str());
+	if(!model.vertices.empty())
+	{
+		model.meshlets = BuildMeshlets(model.indices.data(), model.indices.size(), &model.vertices[0].position.x, sizeof(ModelVertex), model.vertices.size());
+	}
+	std::vector<size_t> lodTriangles;
+	for(float fraction : g_meshLodFractions)
+	{
+		lodTriangles.push_back(static_cast<size_t>(fraction * (model.indices.size() / 3)));
+	}
+	if(!model.vertices.empty())
+	{
+		model.lods = BuildLodChain(model.indices, model.indices.size(), &model.vertices[0].position.x, &model.vertices[0].normal.x,
+			sizeof(ModelVertex), model.vertices.size(), lodTriangles);
+	}
+	for(const LodLevel& lod : model.lods)
+	{
+		OutputDebugStringA((sourceFilename + ": level of detail " + std::to_string(lod.indexCount / 3) + " triangles, error "
+			+ std::to_string(lod.error) + "\n").c_str());
+	}
+	if(!WriteMeshFile(cache, model, Stem(sourceFilename), sourceFilename) || !mesh.Open(cache))
+	{
+		SetError(error, cache + ": could not be written");
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+#include "MeshSimplifier.h"
+#include "Meshlets.h"
+
+//Vertex layout of the text model format, matches Vertex in FrameResource.h
+struct ModelVertex
+{
+	DirectX::XMFLOAT3 position;
+	DirectX::XMFLOAT3 normal;
+};
+
+struct ModelData
+{
+	std::vector<ModelVertex>	vertices;
+	std::vector<uint32_t>		indices;
+	std::vector<LodLevel>		lods;			//Simplified copies appended to indices, coarsest last
+	std::vector<Meshlet>		meshlets;		//Clusters of the full mesh, whose triangles are stored in their order
+};
+
+//Parses the VertexCount/TriangleCount/VertexList/TriangleList text format used by Models/*.txt.
+//The file is read in one go and the lists are parsed on the thread pool. On failure error, when given,
+//says what was wrong and where, as "file(line): message".
+bool LoadTextModel(const std::string& filename, ModelData& model, std::string* error = nullptr);
+
+//Binary mesh file: header, then the vertex stream, the index stream and the submesh table at the
+//offsets the header gives, each 16 byte aligned so they can be handed to an upload as they are.
+constexpr uint32_t g_meshFileMagic = 0x48534D50;		//"PMSH"
+constexpr uint32_t g_meshFileVersion = 4;			//2: triangles and vertices are stored optimised, 3: levels of detail, 4: meshlets
+
+//Triangle counts of the levels of detail built for cached models, as fractions of the full mesh
+constexpr float g_meshLodFractions[] = { 0.5f, 1.0f / 6.0f, 1.0f / 30.0f };
+
+struct MeshFileHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	sourceSize;			//Size, write time and FNV-1a hash of the file the cache was built from
+	uint64_t	sourceWriteTime;
+	uint64_t	sourceHash;
+	uint32_t	vertexCount;
+	uint32_t	vertexStride;
+	uint32_t	indexCount;
+	uint32_t	indexSize;			//Bytes per index, 2 or 4
+	uint32_t	submeshCount;
+	uint32_t	meshletCount;		//Meshlets of the first submesh, indexed from its start
+	float		boundsMin[3];
+	float		boundsMax[3];
+	uint64_t	vertexOffset;
+	uint64_t	indexOffset;
+	uint64_t	submeshOffset;
+	uint64_t	meshletOffset;
+};
+
+struct MeshFileSubmesh
+{
+	char		name[32];
+	uint32_t	indexCount;
+	uint32_t	startIndex;
+	int32_t		baseVertex;
+	float		lodError;			//How far a level of detail strays from the full mesh, 0 for the full mesh
+};
+
+//Read only view of a binary mesh file mapped into memory, the streams point straight into the mapping
+class MappedMesh
+{
+	void*			m_file;
+	void*			m_mapping;
+	const uint8_t*	m_view;
+	uint64_t		m_size;
+public:
+	MappedMesh();
+	MappedMesh(const MappedMesh& rhs) = delete;
+	MappedMesh& operator=(const MappedMesh& rhs) = delete;
+	~MappedMesh();
+
+	//Fails if the file is missing, truncated or not a mesh file of this version and vertex layout, or if a
+	//submesh or meshlet reaches outside the index stream or a submesh name isn't terminated
+	bool Open(const std::string& filename);
+	void Close();
+	bool IsOpen()const { return m_view != nullptr; }
+
+	const MeshFileHeader& GetHeader()const { return *reinterpret_cast<const MeshFileHeader*>(m_view); }
+	const void* GetVertices()const { return m_view + GetHeader().vertexOffset; }
+	const void* GetIndices()const { return m_view + GetHeader().indexOffset; }
+	const MeshFileSubmesh* GetSubmeshes()const { return reinterpret_cast<const MeshFileSubmesh*>(m_view + GetHeader().submeshOffset); }
+	const Meshlet* GetMeshlets()const { return reinterpret_cast<const Meshlet*>(m_view + GetHeader().meshletOffset); }
+	uint32_t GetVertexBufferByteSize()const { return GetHeader().vertexCount * GetHeader().vertexStride; }
+	uint32_t GetIndexBufferByteSize()const { return GetHeader().indexCount * GetHeader().indexSize; }
+};
+
+//Writes model as a binary mesh file, recording the source file it came from. The full mesh is the
+//submesh submeshName, each of its levels of detail follows as submeshName_lod1, submeshName_lod2...
+//The full mesh's meshlets go in the meshlet table.
+bool WriteMeshFile(const std::string& filename, const ModelData& model, const std::string& submeshName, const std::string& sourceFilename);
+
+//Maps the binary cache of a text model, Models/skull.txt is cached as Models/skull.mesh.
+//The cache is rebuilt from the text file when it's missing or when the source's size or write time
+//changed and its hash no longer matches. The submeshes are named after the file, "skull", "skull_lod1"...
+//Rebuilt meshes go through OptimizeMesh, are split into meshlets and have their levels of detail
+//simplified first, so the cost is paid once rather than at every start.
+bool OpenCachedModel(const std::string& sourceFilename, MappedMesh& mesh, std::string* error = nullptr);
@@ -0,0 +1,488 @@
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+#include "Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	constexpr uint32_t g_forsythCacheSize = 32;			//LRU cache modelled while scoring, larger than the real one on purpose
+	constexpr uint32_t g_forsythMaxValence = 32;		//Valence boost is flat past this many live triangles
+	constexpr size_t g_vertexCacheBatch = 4096;		//Triangles optimised together, each batch is one task
+	constexpr size_t g_clusterGrain = 64;				//Clusters per worker chunk when computing sort keys
+
+	//Forsyth's scoring: the three vertices of the last triangle score a flat 0.75 so the next triangle
+	//doesn't just reuse the same edge, older entries fall off with the 1.5 power of their position, and
+	//vertices with few triangles left get a boost so they are finished off rather than left stranded.
+	struct ForsythScores
+	{
+		float cache[g_forsythCacheSize];
+		float valence[g_forsythMaxValence + 1];
+
+		ForsythScores()
+		{
+			for(uint32_t i = 0; i < g_forsythCacheSize; ++i)
+			{
+				cache[i] = i < 3 ? 0.75f : powf(1.0f - static_cast<float>(i - 3) / (g_forsythCacheSize - 3), 1.5f);
+			}
+			valence[0] = 0.0f;
+			for(uint32_t i = 1; i <= g_forsythMaxValence; ++i)
+			{
+				valence[i] = 2.0f / sqrtf(static_cast<float>(i));
+			}
+		}
+
+		float Vertex(int cachePosition, uint32_t liveTriangles)const
+		{
+			if(liveTriangles == 0)
+			{
+				return -1.0f;
+			}
+			const float cached = cachePosition >= 0 && cachePosition < static_cast<int>(g_forsythCacheSize) ? cache[cachePosition] : 0.0f;
+			return cached + valence[(std::min)(liveTriangles, g_forsythMaxValence)];
+		}
+	};
+
+	const ForsythScores& Scores()
+	{
+		static const ForsythScores scores;
+		return scores;
+	}
+
+	//Optimises one batch of triangles. indices are numbered 0 to vertexCount - 1 within the batch.
+	void OptimizeBatch(uint32_t* indices, size_t triangleCount, size_t vertexCount)
+	{
+		const ForsythScores& scores = Scores();
+
+		//Triangles around every vertex, live ones first in each run
+		std::vector<uint32_t> live(vertexCount, 0);
+		for(size_t i = 0; i < 3 * triangleCount; ++i)
+		{
+			++live[indices[i]];
+		}
+		std::vector<uint32_t> offsets(vertexCount + 1, 0);
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			offsets[v + 1] = offsets[v] + live[v];
+		}
+		std::vector<uint32_t> adjacency(offsets[vertexCount]);
+		{
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for(size_t i = 0; i < 3 * triangleCount; ++i)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			vertexScore[v] = scores.Vertex(-1, live[v]);
+		}
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		size_t best = 0;
+		for(size_t t = 0; t < triangleCount; ++t)
+		{
+			triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+			best = triangleScore[t] > triangleScore[best] ? t : best;
+		}
+
+		std::vector<uint32_t> output(3 * triangleCount);
+		uint32_t cache[g_forsythCacheSize + 3], newCache[g_forsythCacheSize + 3];
+		uint32_t cacheCount = 0;
+		size_t cursor = 0;				//Every triangle before this has been emitted, restarts scan from here
+		bool haveBest = triangleCount > 0;
+		for(size_t out = 0; out < triangleCount; ++out)
+		{
+			if(!haveBest)
+			{
+				while(emitted[cursor])
+				{
+					++cursor;
+				}
+				best = cursor;
+			}
+			const uint32_t* tri = &indices[3 * best];
+			memcpy(&output[3 * out], tri, 3 * sizeof(uint32_t));
+			emitted[best] = true;
+
+			//Retire the triangle from its vertices and push them to the front of the cache
+			uint32_t newCount = 0;
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t v = tri[k];
+				uint32_t* run = &adjacency[offsets[v]];
+				for(uint32_t j = 0; j < live[v]; ++j)
+				{
+					if(run[j] == best)
+					{
+						run[j] = run[live[v] - 1];
+						run[live[v] - 1] = static_cast<uint32_t>(best);
+						--live[v];
+						break;
+					}
+				}
+				if(std::find(newCache, newCache + newCount, v) == newCache + newCount)
+				{
+					newCache[newCount++] = v;
+				}
+			}
+			for(uint32_t j = 0; j < cacheCount; ++j)
+			{
+				if(cache[j] != tri[0] && cache[j] != tri[1] && cache[j] != tri[2])
+				{
+					newCache[newCount++] = cache[j];
+				}
+			}
+
+			//Rescore everything whose cache position changed, including the entries that just fell out
+			for(uint32_t j = 0; j < newCount; ++j)
+			{
+				const uint32_t v = newCache[j];
+				cachePosition[v] = j < g_forsythCacheSize ? static_cast<int>(j) : -1;
+				vertexScore[v] = scores.Vertex(cachePosition[v], live[v]);
+			}
+			haveBest = false;
+			float bestScore = -FLT_MAX;
+			for(uint32_t j = 0; j < newCount; ++j)
+			{
+				const uint32_t v = newCache[j];
+				for(uint32_t a = offsets[v]; a < offsets[v] + live[v]; ++a)
+				{
+					const uint32_t t = adjacency[a];
+					const uint32_t* u = &indices[3 * t];
+					triangleScore[t] = vertexScore[u[0]] + vertexScore[u[1]] + vertexScore[u[2]];
+					if(triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						best = t;
+						haveBest = true;
+					}
+				}
+			}
+			cacheCount = (std::min)(newCount, g_forsythCacheSize);
+			memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+		}
+		memcpy(indices, output.data(), output.size() * sizeof(uint32_t));
+	}
+
+	float TriangleArea(const float* a, const float* b, const float* c, float normal[3])
+	{
+		const float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		normal[0] = e0[1] * e1[2] - e0[2] * e1[1];
+		normal[1] = e0[2] * e1[0] - e0[0] * e1[2];
+		normal[2] = e0[0] * e1[1] - e0[1] * e1[0];
+		return 0.5f * sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+	}
+
+	//FIFO post transform cache, a vertex stays in it until size more vertices have been loaded after it
+	class FifoCache
+	{
+		std::vector<uint32_t>	m_loadedAt;		//Value of m_clock when each vertex was loaded, 0 if never
+		uint32_t				m_clock;
+		uint32_t				m_size;
+	public:
+		FifoCache(size_t vertexCount, uint32_t size) :m_loadedAt(vertexCount, 0), m_clock(0), m_size(size)
+		{}
+
+		//Returns whether v missed
+		bool Load(uint32_t v)
+		{
+			if(m_loadedAt[v] != 0 && m_clock - m_loadedAt[v] < m_size)
+			{
+				return false;
+			}
+			m_loadedAt[v] = ++m_clock;
+			return true;
+		}
+
+		//Empties the cache without touching every vertex
+		void Flush() { m_clock += m_size; }
+	};
+
+	struct Cluster
+	{
+		size_t	firstTriangle;
+		size_t	triangleCount;
+		float	key;					//Larger draws first
+	};
+
+	template<class Index>
+	VertexCacheStats AnalyzeCache(const Index* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+	{
+		FifoCache cache(vertexCount, cacheSize);
+		std::vector<bool> seen(vertexCount, false);
+		size_t misses = 0, referenced = 0;
+		for(size_t i = 0; i < indexCount; ++i)
+		{
+			const uint32_t v = indices[i];
+			referenced += seen[v] ? 0 : 1;
+			seen[v] = true;
+			misses += cache.Load(v) ? 1 : 0;
+		}
+		VertexCacheStats stats;
+		stats.acmr = indexCount > 0 ? static_cast<float>(misses) / (indexCount / 3) : 0.0f;
+		stats.atvr = referenced > 0 ? static_cast<float>(misses) / referenced : 0.0f;
+		return stats;
+	}
+
+	template<class Index>
+	void OptimizeCache(Index* indices, size_t indexCount, size_t vertexCount)
+	{
+		const size_t triangleCount = indexCount / 3;
+		const size_t batchCount = (triangleCount + g_vertexCacheBatch - 1) / g_vertexCacheBatch;
+		ThreadPool::Get().ParallelFor(0, batchCount, 1, [=](size_t begin, size_t end)
+		{
+			constexpr uint32_t unused = ~0u;
+			std::vector<uint32_t> localOf(vertexCount, unused), vertices, local, original;
+			for(size_t b = begin; b < end; ++b)
+			{
+				//Number the batch's vertices densely so its working set doesn't scale with the whole mesh
+				Index* batch = indices + 3 * b * g_vertexCacheBatch;
+				const size_t count = 3 * ((std::min)(triangleCount, (b + 1) * g_vertexCacheBatch) - b * g_vertexCacheBatch);
+				vertices.clear();
+				local.resize(count);
+				for(size_t i = 0; i < count; ++i)
+				{
+					uint32_t& l = localOf[batch[i]];
+					if(l == unused)
+					{
+						l = static_cast<uint32_t>(vertices.size());
+						vertices.push_back(batch[i]);
+					}
+					local[i] = l;
+				}
+				original = local;
+				OptimizeBatch(local.data(), count / 3, vertices.size());
+
+				//Forsyth's heuristic isn't always better than an order that was optimised already, keep whichever misses less
+				FifoCache before(vertices.size(), g_analysisCacheSize), after(vertices.size(), g_analysisCacheSize);
+				size_t beforeMisses = 0, afterMisses = 0;
+				for(size_t i = 0; i < count; ++i)
+				{
+					beforeMisses += before.Load(original[i]) ? 1 : 0;
+					afterMisses += after.Load(local[i]) ? 1 : 0;
+				}
+				const std::vector<uint32_t>& chosen = afterMisses < beforeMisses ? local : original;
+				for(size_t i = 0; i < count; ++i)
+				{
+					batch[i] = static_cast<Index>(vertices[chosen[i]]);
+				}
+				for(uint32_t v : vertices)
+				{
+					localOf[v] = unused;
+				}
+			}
+		});
+	}
+
+	template<class Vertex>
+	MeshOptimizationStats OptimizeVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const float* positions, bool reduceOverdraw)
+	{
+		MeshOptimizationStats stats;
+		stats.before = AnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+		OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
+		if(reduceOverdraw)
+		{
+			OptimizeOverdraw(indices.data(), indices.size(), positions, sizeof(Vertex), vertices.size());
+		}
+		vertices.resize(OptimizeVertexFetch(vertices.data(), vertices.size(), sizeof(Vertex), indices.data(), indices.size()));
+		stats.after = AnalyzeVertexCache(indices.data(), indices.size(), vertices.size());
+		return stats;
+	}
+}
+
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	return AnalyzeCache(indices, indexCount, vertexCount, cacheSize);
+}
+
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	return AnalyzeCache(indices, indexCount, vertexCount, cacheSize);
+}
+
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	OptimizeCache(indices, indexCount, vertexCount);
+}
+
+void OptimizeVertexCache(uint16_t* indices, size_t indexCount, size_t vertexCount)
+{
+	OptimizeCache(indices, indexCount, vertexCount);
+}
+
+void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, float threshold)
+{
+	const size_t triangleCount = indexCount / 3;
+	if(triangleCount == 0)
+	{
+		return;
+	}
+	auto position = [=](uint32_t v) { return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + v * positionStride); };
+
+	//Hard boundaries where all three vertices miss, the cache restarts there whatever order the clusters go in
+	std::vector<size_t> hard(1, 0);
+	FifoCache cache(vertexCount, g_analysisCacheSize);
+	auto misses = [&](size_t t)
+	{
+		return (cache.Load(indices[3 * t]) ? 1u : 0u) + (cache.Load(indices[3 * t + 1]) ? 1u : 0u) + (cache.Load(indices[3 * t + 2]) ? 1u : 0u);
+	};
+	for(size_t t = 0; t < triangleCount; ++t)
+	{
+		if(misses(t) == 3 && t > 0)
+		{
+			hard.push_back(t);
+		}
+	}
+	hard.push_back(triangleCount);
+
+	//Soft boundaries inside each hard cluster, wherever the run so far is within threshold of the whole cluster
+	std::vector<Cluster> clusters;
+	for(size_t h = 0; h + 1 < hard.size(); ++h)
+	{
+		const size_t first = hard[h], last = hard[h + 1];
+		cache.Flush();
+		size_t clusterMisses = 0;
+		for(size_t t = first; t < last; ++t)
+		{
+			clusterMisses += misses(t);
+		}
+		const float clusterThreshold = threshold * static_cast<float>(clusterMisses) / (last - first);
+
+		cache.Flush();		//Each cluster may end up drawn after anything
+		clusterMisses = 0;
+		size_t start = first;
+		for(size_t t = first; t < last; ++t)
+		{
+			clusterMisses += misses(t);
+			if(t + 1 < last && clusterMisses <= clusterThreshold * (t + 1 - start))
+			{
+				clusters.push_back({ start, t + 1 - start, 0.0f });
+				start = t + 1;
+				cache.Flush();
+				clusterMisses = 0;
+			}
+		}
+		clusters.push_back({ start, last - start, 0.0f });
+	}
+
+	//Area weighted centre of the whole mesh
+	float centre[3] = { 0.0f, 0.0f, 0.0f };
+	float totalArea = 0.0f;
+	for(size_t t = 0; t < triangleCount; ++t)
+	{
+		const float* a = position(indices[3 * t]);
+		const float* b = position(indices[3 * t + 1]);
+		const float* c = position(indices[3 * t + 2]);
+		float normal[3];
+		const float area = TriangleArea(a, b, c, normal);
+		for(int k = 0; k < 3; ++k)
+		{
+			centre[k] += area * (a[k] + b[k] + c[k]) / 3.0f;
+		}
+		totalArea += area;
+	}
+	for(int k = 0; k < 3; ++k)
+	{
+		centre[k] = totalArea > 0.0f ? centre[k] / totalArea : 0.0f;
+	}
+
+	//Clusters further out along their own average normal are more likely to occlude the rest
+	ThreadPool::Get().ParallelFor(0, clusters.size(), g_clusterGrain, [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; ++i)
+		{
+			Cluster& cluster = clusters[i];
+			float clusterCentre[3] = { 0.0f, 0.0f, 0.0f }, clusterNormal[3] = { 0.0f, 0.0f, 0.0f };
+			float clusterArea = 0.0f;
+			for(size_t t = cluster.firstTriangle; t < cluster.firstTriangle + cluster.triangleCount; ++t)
+			{
+				const float* a = position(indices[3 * t]);
+				const float* b = position(indices[3 * t + 1]);
+				const float* c = position(indices[3 * t + 2]);
+				float normal[3];
+				const float area = TriangleArea(a, b, c, normal);
+				for(int k = 0; k < 3; ++k)
+				{
+					clusterCentre[k] += area * (a[k] + b[k] + c[k]) / 3.0f;
+					clusterNormal[k] += normal[k];
+				}
+				clusterArea += area;
+			}
+			const float length = sqrtf(clusterNormal[0] * clusterNormal[0] + clusterNormal[1] * clusterNormal[1] + clusterNormal[2] * clusterNormal[2]);
+			cluster.key = 0.0f;
+			if(clusterArea > 0.0f && length > 0.0f)
+			{
+				for(int k = 0; k < 3; ++k)
+				{
+					cluster.key += (clusterCentre[k] / clusterArea - centre[k]) * clusterNormal[k] / length;
+				}
+			}
+		}
+	});
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.key > b.key; });
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indexCount);
+	for(const Cluster& cluster : clusters)
+	{
+		sorted.insert(sorted.end(), indices + 3 * cluster.firstTriangle, indices + 3 * (cluster.firstTriangle + cluster.triangleCount));
+	}
+	memcpy(indices, sorted.data(), sorted.size() * sizeof(uint32_t));
+}
+
+size_t OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount)
+{
+	constexpr uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(vertexCount, unused);
+	uint32_t next = 0;
+	for(size_t i = 0; i < indexCount; ++i)
+	{
+		uint32_t& newIndex = remap[indices[i]];
+		if(newIndex == unused)
+		{
+			newIndex = next++;
+		}
+		indices[i] = newIndex;
+	}
+
+	uint8_t* data = static_cast<uint8_t*>(vertices);
+	std::vector<uint8_t> moved(static_cast<size_t>(next) * vertexStride);
+	for(size_t v = 0; v < vertexCount; ++v)
+	{
+		if(remap[v] != unused)
+		{
+			memcpy(&moved[remap[v] * vertexStride], data + v * vertexStride, vertexStride);
+		}
+	}
+	if(!moved.empty())
+	{
+		memcpy(data, moved.data(), moved.size());
+	}
+	return next;
+}
+
+MeshOptimizationStats OptimizeMesh(ModelData& model, bool reduceOverdraw)
+{
+	return OptimizeVertices(model.vertices, model.indices, model.vertices.empty() ? nullptr : &model.vertices[0].position.x, reduceOverdraw);
+}
+
+MeshOptimizationStats OptimizeMesh(GeometryGenerator::MeshData& mesh, bool reduceOverdraw)
+{
+	return OptimizeVertices(mesh.Vertices, mesh.Indices32, mesh.Vertices.empty() ? nullptr : &mesh.Vertices[0].Position.x, reduceOverdraw);
+}
+
+std::string DescribeStats(const std::string& name, const MeshOptimizationStats& stats)
+{
+	char text[128];
+	snprintf(text, sizeof(text), ": ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", stats.before.acmr, stats.after.acmr, stats.before.atvr, stats.after.atvr);
+	return name + text;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Common/GeometryGenerator.h"
+
+struct ModelData;
+
+struct VertexCacheStats
+{
+	float acmr;			//Vertices transformed per triangle, 3 is the worst and about 0.5 the best a closed mesh can do
+	float atvr;			//Vertices transformed per vertex referenced, 1 is ideal
+};
+
+struct MeshOptimizationStats
+{
+	VertexCacheStats before;
+	VertexCacheStats after;
+};
+
+constexpr uint32_t g_analysisCacheSize = 16;		//Post transform caches behave roughly like a FIFO of this many vertices
+constexpr float g_overdrawThreshold = 1.05f;		//How much ACMR OptimizeOverdraw may give up for more clusters to sort
+
+//Simulates a FIFO post transform cache over a triangle list
+VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = g_analysisCacheSize);
+VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = g_analysisCacheSize);
+
+//Reorders the triangles of a list in place for post transform cache hits, using Forsyth's linear speed
+//vertex cache optimisation. Large lists are cut into fixed size batches optimised on the thread pool,
+//so the result doesn't depend on the number of cores.
+//The 16 bit overload reorders an index buffer that was generated narrow, in place.
+void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+void OptimizeVertexCache(uint16_t* indices, size_t indexCount, size_t vertexCount);
+
+//Reorders clusters of a cache optimised list so triangles facing away from the centre of the mesh come
+//first and are drawn before the ones they are likely to hide. Clusters are cut where the cache restarts
+//anyway and wherever their ACMR stays within threshold of the unsplit run. positions points at the
+//first vertex position, positionStride bytes apart.
+void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, float threshold = g_overdrawThreshold);
+
+//Renumbers vertices in the order the triangles first use them and moves them to match, so vertex fetch
+//streams through memory. Unreferenced vertices are dropped, returns the number left.
+size_t OptimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexStride, uint32_t* indices, size_t indexCount);
+
+//Runs all three passes over a mesh and reports the cache statistics before and after.
+//A MeshData must be optimised before GetIndices16 is first called, the 16 bit copy isn't refreshed.
+MeshOptimizationStats OptimizeMesh(ModelData& model, bool reduceOverdraw = true);
+MeshOptimizationStats OptimizeMesh(GeometryGenerator::MeshData& mesh, bool reduceOverdraw = true);
+
+//"name: ACMR before -> after, ATVR before -> after" and a line break, for the debug output
+std::string DescribeStats(const std::string& name, const MeshOptimizationStats& stats);
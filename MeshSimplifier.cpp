@@ -0,0 +1,666 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "Common/ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	constexpr size_t g_vertexGrain = 1024;				//Vertices per worker chunk when picking collapses
+	constexpr float g_passErrorBound = 1.5f;			//A pass stops at this multiple of the error it set out to reach
+	constexpr uint32_t g_noCollapse = ~0u;
+
+	enum class VertexKind : uint8_t
+	{
+		Manifold,
+		Border,				//On exactly one open border, only collapses along it
+		Seam,				//Split from one twin at the same position, collapses along the seam together with it
+		Locked				//Corner of several seams or non-manifold, never moves
+	};
+
+	inline void Cross(const float a[3], const float b[3], float out[3])
+	{
+		out[0] = a[1] * b[2] - a[2] * b[1];
+		out[1] = a[2] * b[0] - a[0] * b[2];
+		out[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	inline float Dot(const float a[3], const float b[3])
+	{
+		return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	}
+
+	//Weighted sum of squared plane distances, p'Ap + 2b'p + c
+	struct Quadric
+	{
+		float a00, a11, a22, a10, a20, a21;
+		float b0, b1, b2;
+		float c;
+		float w;						//Total weight, errors are divided by it so they average rather than pile up
+
+		void Add(const float n[3], float d, float weight)
+		{
+			a00 += weight * n[0] * n[0]; a11 += weight * n[1] * n[1]; a22 += weight * n[2] * n[2];
+			a10 += weight * n[1] * n[0]; a20 += weight * n[2] * n[0]; a21 += weight * n[2] * n[1];
+			b0 += weight * n[0] * d; b1 += weight * n[1] * d; b2 += weight * n[2] * d;
+			c += weight * d * d;
+			w += weight;
+		}
+
+		void operator+=(const Quadric& q)
+		{
+			a00 += q.a00; a11 += q.a11; a22 += q.a22; a10 += q.a10; a20 += q.a20; a21 += q.a21;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			w += q.w;
+		}
+
+		float Evaluate(const float p[3])const
+		{
+			const float x = p[0], y = p[1], z = p[2];
+			return x * x * a00 + y * y * a11 + z * z * a22 + 2.0f * (x * y * a10 + x * z * a20 + y * z * a21)
+				+ 2.0f * (x * b0 + y * b1 + z * b2) + c;
+		}
+	};
+
+	//One attribute interpolated over triangles, a(p) = g.p + d on each. The squared difference to a value v
+	//at p summed over the triangles is q(p) - 2v(G.p + D) + Wv^2, with q the quadric of g.p + d and G, D the
+	//weighted sums of g and d.
+	struct AttributeQuadric
+	{
+		Quadric q;
+		float g0, g1, g2, d;
+
+		void Add(const float g[3], float gd, float weight)
+		{
+			q.Add(g, gd, weight);
+			g0 += weight * g[0]; g1 += weight * g[1]; g2 += weight * g[2];
+			d += weight * gd;
+		}
+
+		void operator+=(const AttributeQuadric& a)
+		{
+			q += a.q;
+			g0 += a.g0; g1 += a.g1; g2 += a.g2;
+			d += a.d;
+		}
+
+		float Evaluate(const float p[3], float v)const
+		{
+			return q.Evaluate(p) - 2.0f * v * (g0 * p[0] + g1 * p[1] + g2 * p[2] + d) + q.w * v * v;
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t	from;
+		uint32_t	to;
+		uint32_t	twinFrom;			//The other side of a seam collapse, g_noCollapse otherwise
+		uint32_t	twinTo;
+		float		error;				//Squared, in unit cube space
+	};
+
+	class Simplifier
+	{
+		size_t							m_vertexCount;
+		float							m_scale;			//Mesh units per unit cube unit
+		std::vector<float>				m_positions;		//Three per vertex, scaled into the unit cube
+		std::vector<float>				m_normals;			//Three per vertex times the normal weight, empty without normals
+		std::vector<VertexKind>			m_kinds;
+		std::vector<uint32_t>			m_nextWedge;		//Ring of the vertices sharing each position
+		std::vector<Quadric>			m_quadrics;
+		std::vector<AttributeQuadric>	m_attributes;		//Three per vertex
+		std::vector<uint32_t>			m_indices;
+		std::vector<uint32_t>			m_offsets;			//Triangles around every vertex
+		std::vector<uint32_t>			m_adjacency;
+		std::vector<Collapse>			m_best;				//Cheapest valid collapse of every vertex
+		float							m_error;
+
+		const float* Position(uint32_t v)const { return &m_positions[3 * v]; }
+		const uint32_t* Triangle(uint32_t t)const { return &m_indices[3 * t]; }
+
+		void BuildAdjacency();
+		bool HasHalfEdge(uint32_t from, uint32_t to)const;
+		uint32_t EdgeTriangles(uint32_t a, uint32_t b)const;
+		void ClassifyVertices(const float* positions, size_t vertexStride);
+		void ComputeQuadrics();
+		float CollapseError(uint32_t from, uint32_t to)const;
+		bool CanCollapse(uint32_t from, uint32_t to)const;
+		void PickCollapse(uint32_t v);
+		size_t ApplyCollapse(uint32_t from, uint32_t to, std::vector<uint32_t>& remap, std::vector<bool>& locked);
+	public:
+		Simplifier(const uint32_t* indices, size_t indexCount, const float* positions, const float* normals, size_t vertexStride, size_t vertexCount);
+
+		//Collapses until the target is reached, nothing is left to collapse or the next collapse costs more than maxError
+		void Simplify(size_t targetIndexCount, float maxError);
+
+		const std::vector<uint32_t>& Indices()const { return m_indices; }
+		float Error()const { return sqrtf(m_error) * m_scale; }
+	};
+
+	Simplifier::Simplifier(const uint32_t* indices, size_t indexCount, const float* positions, const float* normals, size_t vertexStride, size_t vertexCount)
+		:m_vertexCount(vertexCount), m_scale(1.0f), m_indices(indices, indices + indexCount - indexCount % 3), m_error(0.0f)
+	{
+		//Work in the unit cube so the normal weight and the float precision don't depend on the mesh's size
+		float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		const char* base = reinterpret_cast<const char*>(positions);
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			const float* p = reinterpret_cast<const float*>(base + v * vertexStride);
+			for(int a = 0; a < 3; ++a)
+			{
+				boundsMin[a] = (std::min)(boundsMin[a], p[a]);
+				boundsMax[a] = (std::max)(boundsMax[a], p[a]);
+			}
+		}
+		const float extent = (std::max)((std::max)(boundsMax[0] - boundsMin[0], boundsMax[1] - boundsMin[1]), boundsMax[2] - boundsMin[2]);
+		m_scale = extent > 0.0f ? extent : 1.0f;
+		m_positions.resize(3 * vertexCount);
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			const float* p = reinterpret_cast<const float*>(base + v * vertexStride);
+			for(int a = 0; a < 3; ++a)
+			{
+				m_positions[3 * v + a] = (p[a] - boundsMin[a]) / m_scale;
+			}
+		}
+		if(normals)
+		{
+			const char* normalBase = reinterpret_cast<const char*>(normals);
+			m_normals.resize(3 * vertexCount);
+			for(size_t v = 0; v < vertexCount; ++v)
+			{
+				const float* n = reinterpret_cast<const float*>(normalBase + v * vertexStride);
+				for(int a = 0; a < 3; ++a)
+				{
+					m_normals[3 * v + a] = n[a] * g_simplifyNormalWeight;
+				}
+			}
+		}
+
+		BuildAdjacency();
+		ClassifyVertices(positions, vertexStride);
+		ComputeQuadrics();
+	}
+
+	void Simplifier::BuildAdjacency()
+	{
+		m_offsets.assign(m_vertexCount + 1, 0);
+		for(uint32_t v : m_indices)
+		{
+			++m_offsets[v + 1];
+		}
+		for(size_t v = 0; v < m_vertexCount; ++v)
+		{
+			m_offsets[v + 1] += m_offsets[v];
+		}
+		m_adjacency.resize(m_indices.size());
+		std::vector<uint32_t> fill(m_offsets.begin(), m_offsets.end() - 1);
+		for(size_t i = 0; i < m_indices.size(); ++i)
+		{
+			m_adjacency[fill[m_indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	}
+
+	bool Simplifier::HasHalfEdge(uint32_t from, uint32_t to)const
+	{
+		for(uint32_t a = m_offsets[from]; a < m_offsets[from + 1]; ++a)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[a]);
+			for(int k = 0; k < 3; ++k)
+			{
+				if(tri[k] == from && tri[(k + 1) % 3] == to)
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	uint32_t Simplifier::EdgeTriangles(uint32_t a, uint32_t b)const
+	{
+		uint32_t count = 0;
+		for(uint32_t i = m_offsets[a]; i < m_offsets[a + 1]; ++i)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[i]);
+			count += tri[0] == b || tri[1] == b || tri[2] == b ? 1 : 0;
+		}
+		return count;
+	}
+
+	void Simplifier::ClassifyVertices(const float* positions, size_t vertexStride)
+	{
+		m_kinds.assign(m_vertexCount, VertexKind::Manifold);
+
+		//A border edge has no twin running the other way, a vertex with exactly one border edge in and
+		//one out lies on a simple border
+		std::vector<uint8_t> borderIn(m_vertexCount, 0), borderOut(m_vertexCount, 0);
+		for(size_t t = 0; t < m_indices.size() / 3; ++t)
+		{
+			const uint32_t* tri = Triangle(static_cast<uint32_t>(t));
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t a = tri[k], b = tri[(k + 1) % 3];
+				if(!HasHalfEdge(b, a))
+				{
+					borderOut[a] = static_cast<uint8_t>((std::min)(borderOut[a] + 1, 255));
+					borderIn[b] = static_cast<uint8_t>((std::min)(borderIn[b] + 1, 255));
+				}
+			}
+		}
+		for(size_t v = 0; v < m_vertexCount; ++v)
+		{
+			if(borderIn[v] != borderOut[v] || borderOut[v] > 1)
+			{
+				m_kinds[v] = VertexKind::Locked;
+			}
+			else if(borderOut[v] == 1)
+			{
+				m_kinds[v] = VertexKind::Border;
+			}
+		}
+
+		//Entries sharing a position are split along a seam in their other attributes. A pair split along one seam
+		//can slide along it as long as both halves move together, anything more tangled stays where it is.
+		std::vector<uint32_t> order(m_vertexCount);
+		for(size_t v = 0; v < m_vertexCount; ++v)
+		{
+			order[v] = static_cast<uint32_t>(v);
+		}
+		const char* base = reinterpret_cast<const char*>(positions);
+		auto position = [&](uint32_t v) { return reinterpret_cast<const float*>(base + v * vertexStride); };
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+		{
+			return std::lexicographical_compare(position(a), position(a) + 3, position(b), position(b) + 3);
+		});
+		m_nextWedge.resize(m_vertexCount);
+		for(size_t begin = 0, end; begin < order.size(); begin = end)
+		{
+			for(end = begin + 1; end < order.size() && memcmp(position(order[begin]), position(order[end]), 3 * sizeof(float)) == 0; ++end)
+			{
+			}
+			for(size_t i = begin; i < end; ++i)
+			{
+				m_nextWedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+			}
+			if(end - begin == 1)
+			{
+				continue;
+			}
+			const bool seam = end - begin == 2 && m_kinds[order[begin]] == VertexKind::Border && m_kinds[order[begin + 1]] == VertexKind::Border;
+			for(size_t i = begin; i < end; ++i)
+			{
+				m_kinds[order[i]] = seam ? VertexKind::Seam : VertexKind::Locked;
+			}
+		}
+	}
+
+	void Simplifier::ComputeQuadrics()
+	{
+		m_quadrics.assign(m_vertexCount, Quadric{});
+		m_attributes.assign(m_normals.empty() ? 0 : 3 * m_vertexCount, AttributeQuadric{});
+		for(size_t t = 0; t < m_indices.size() / 3; ++t)
+		{
+			const uint32_t* tri = Triangle(static_cast<uint32_t>(t));
+			const float* p0 = Position(tri[0]);
+			const float* p1 = Position(tri[1]);
+			const float* p2 = Position(tri[2]);
+			const float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			const float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float normal[3];
+			Cross(e1, e2, normal);
+			const float length = sqrtf(Dot(normal, normal));
+			if(length == 0.0f)
+			{
+				continue;
+			}
+			const float area = 0.5f * length;
+			const float unit[3] = { normal[0] / length, normal[1] / length, normal[2] / length };
+			for(int k = 0; k < 3; ++k)
+			{
+				m_quadrics[tri[k]].Add(unit, -Dot(unit, p0), area);
+			}
+
+			//Open edges get a plane at right angles to the face through them, so borders keep their outline
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t a = tri[k], b = tri[(k + 1) % 3];
+				if(m_kinds[a] == VertexKind::Manifold || m_kinds[b] == VertexKind::Manifold || HasHalfEdge(b, a))
+				{
+					continue;
+				}
+				const float* pa = Position(a);
+				const float* pb = Position(b);
+				const float edge[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+				float side[3];
+				Cross(edge, unit, side);
+				const float sideLength = sqrtf(Dot(side, side));
+				if(sideLength == 0.0f)
+				{
+					continue;
+				}
+				const float n[3] = { side[0] / sideLength, side[1] / sideLength, side[2] / sideLength };
+				const float weight = Dot(edge, edge) * g_simplifyBorderWeight;
+				m_quadrics[a].Add(n, -Dot(n, pa), weight);
+				m_quadrics[b].Add(n, -Dot(n, pa), weight);
+			}
+
+			if(m_normals.empty())
+			{
+				continue;
+			}
+			//Gradient of each normal component across the triangle: g.e1 = a1 - a0 and g.e2 = a2 - a0 in its plane
+			float u[3], v[3];
+			Cross(e2, normal, u);
+			Cross(normal, e1, v);
+			const float invLengthSq = 1.0f / (length * length);
+			for(int c = 0; c < 3; ++c)
+			{
+				const float a0 = m_normals[3 * tri[0] + c];
+				const float d1 = m_normals[3 * tri[1] + c] - a0;
+				const float d2 = m_normals[3 * tri[2] + c] - a0;
+				const float g[3] =
+				{
+					(d1 * u[0] + d2 * v[0]) * invLengthSq,
+					(d1 * u[1] + d2 * v[1]) * invLengthSq,
+					(d1 * u[2] + d2 * v[2]) * invLengthSq
+				};
+				const float d = a0 - Dot(g, p0);
+				for(int k = 0; k < 3; ++k)
+				{
+					m_attributes[3 * tri[k] + c].Add(g, d, area);
+				}
+			}
+		}
+	}
+
+	float Simplifier::CollapseError(uint32_t from, uint32_t to)const
+	{
+		const float* p = Position(to);
+		float error = m_quadrics[from].Evaluate(p);
+		if(!m_normals.empty())
+		{
+			for(int c = 0; c < 3; ++c)
+			{
+				error += m_attributes[3 * from + c].Evaluate(p, m_normals[3 * to + c]);
+			}
+		}
+		const float weight = m_quadrics[from].w;
+		return weight > 0.0f ? fabsf(error) / weight : 0.0f;
+	}
+
+	bool Simplifier::CanCollapse(uint32_t from, uint32_t to)const
+	{
+		//Triangles on the edge, and neighbours of to, to compare with the neighbours of from
+		uint32_t shared = 0;
+		uint32_t toNeighbours[64];
+		uint32_t toNeighbourCount = 0;
+		for(uint32_t a = m_offsets[to]; a < m_offsets[to + 1]; ++a)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[a]);
+			for(int k = 0; k < 3; ++k)
+			{
+				if(tri[k] != to && toNeighbourCount < 64 && std::find(toNeighbours, toNeighbours + toNeighbourCount, tri[k]) == toNeighbours + toNeighbourCount)
+				{
+					toNeighbours[toNeighbourCount++] = tri[k];
+				}
+			}
+			shared += tri[0] == from || tri[1] == from || tri[2] == from ? 1 : 0;
+		}
+		if(toNeighbourCount == 64)
+		{
+			return false;
+		}
+		if(m_kinds[from] != VertexKind::Manifold && (shared != 1 || m_kinds[to] == VertexKind::Manifold))
+		{
+			return false;
+		}
+
+		//Link condition: the only vertices both ends see are the apexes of the triangles on the edge,
+		//anything else would pinch the surface into a non-manifold fin
+		const float* p = Position(from);
+		const float* q = Position(to);
+		uint32_t common = 0;
+		uint32_t seen[64];
+		uint32_t seenCount = 0;
+		for(uint32_t a = m_offsets[from]; a < m_offsets[from + 1]; ++a)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[a]);
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t n = tri[k];
+				if(n == from || n == to || seenCount == 64 || std::find(seen, seen + seenCount, n) != seen + seenCount)
+				{
+					continue;
+				}
+				seen[seenCount++] = n;
+				common += std::find(toNeighbours, toNeighbours + toNeighbourCount, n) != toNeighbours + toNeighbourCount ? 1 : 0;
+			}
+			if(tri[0] == to || tri[1] == to || tri[2] == to)
+			{
+				continue;
+			}
+
+			//Triangles that stay must not flip or collapse when from moves to to
+			const float* v[3] = { Position(tri[0]), Position(tri[1]), Position(tri[2]) };
+			int k = tri[0] == from ? 0 : tri[1] == from ? 1 : 2;
+			const float* b = v[(k + 1) % 3];
+			const float* c = v[(k + 2) % 3];
+			const float eb[3] = { b[0] - p[0], b[1] - p[1], b[2] - p[2] };
+			const float ec[3] = { c[0] - p[0], c[1] - p[1], c[2] - p[2] };
+			const float fb[3] = { b[0] - q[0], b[1] - q[1], b[2] - q[2] };
+			const float fc[3] = { c[0] - q[0], c[1] - q[1], c[2] - q[2] };
+			float before[3], after[3];
+			Cross(eb, ec, before);
+			Cross(fb, fc, after);
+			if(Dot(before, after) <= 0.0f)
+			{
+				return false;
+			}
+		}
+		return seenCount < 64 && common == shared;
+	}
+
+	void Simplifier::PickCollapse(uint32_t v)
+	{
+		Collapse& best = m_best[v];
+		best = { v, g_noCollapse, g_noCollapse, g_noCollapse, FLT_MAX };
+		if(m_kinds[v] == VertexKind::Locked)
+		{
+			return;
+		}
+		const uint32_t twin = m_kinds[v] == VertexKind::Seam ? m_nextWedge[v] : g_noCollapse;
+		for(uint32_t a = m_offsets[v]; a < m_offsets[v + 1]; ++a)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[a]);
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t to = tri[k];
+				if(to == v || to == best.to)
+				{
+					continue;
+				}
+				float error = CollapseError(v, to);
+				if(error >= best.error || !CanCollapse(v, to))
+				{
+					continue;
+				}
+				//The twin has to follow along the other side of the seam, to whichever copy of to is across it
+				uint32_t twinTo = g_noCollapse;
+				if(twin != g_noCollapse)
+				{
+					for(uint32_t w = m_nextWedge[to]; w != to; w = m_nextWedge[w])
+					{
+						if(EdgeTriangles(twin, w) == 1)
+						{
+							twinTo = w;
+							break;
+						}
+					}
+					if(twinTo == g_noCollapse)
+					{
+						continue;
+					}
+					error += CollapseError(twin, twinTo);
+					if(error >= best.error || !CanCollapse(twin, twinTo))
+					{
+						continue;
+					}
+				}
+				best = { v, to, twin, twinTo, error };
+			}
+		}
+	}
+
+	//Moves from onto to and locks the triangles around it for the rest of the pass, returns how many of them go
+	size_t Simplifier::ApplyCollapse(uint32_t from, uint32_t to, std::vector<uint32_t>& remap, std::vector<bool>& locked)
+	{
+		size_t removed = 0;
+		for(uint32_t a = m_offsets[from]; a < m_offsets[from + 1]; ++a)
+		{
+			const uint32_t* tri = Triangle(m_adjacency[a]);
+			locked[tri[0]] = locked[tri[1]] = locked[tri[2]] = true;
+			removed += tri[0] == to || tri[1] == to || tri[2] == to ? 1 : 0;
+		}
+		remap[from] = to;
+		m_quadrics[to] += m_quadrics[from];
+		if(!m_normals.empty())
+		{
+			for(int k = 0; k < 3; ++k)
+			{
+				m_attributes[3 * to + k] += m_attributes[3 * from + k];
+			}
+		}
+		return removed;
+	}
+
+	void Simplifier::Simplify(size_t targetIndexCount, float maxError)
+	{
+		const float errorLimit = maxError == FLT_MAX ? FLT_MAX : (maxError / m_scale) * (maxError / m_scale);
+		const size_t targetTriangles = targetIndexCount / 3;
+		std::vector<Collapse> candidates;
+		std::vector<uint32_t> remap(m_vertexCount);
+		std::vector<bool> locked(m_vertexCount);
+		m_best.resize(m_vertexCount);
+		while(m_indices.size() / 3 > targetTriangles)
+		{
+			const size_t triangleCount = m_indices.size() / 3;
+			ThreadPool::Get().ParallelFor(0, m_vertexCount, g_vertexGrain, [&](size_t begin, size_t end)
+			{
+				for(size_t v = begin; v < end; ++v)
+				{
+					PickCollapse(static_cast<uint32_t>(v));
+				}
+			});
+			candidates.clear();
+			for(const Collapse& c : m_best)
+			{
+				if(c.to != g_noCollapse && c.error <= errorLimit)
+				{
+					candidates.push_back(c);
+				}
+			}
+			if(candidates.empty())
+			{
+				break;
+			}
+			std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+			//Most collapses take two triangles with them. Going further than the goal's error in one pass would
+			//skip cheaper collapses that only open up once their neighbours have settled.
+			const size_t goal = (triangleCount - targetTriangles + 1) / 2;
+			const float passLimit = goal < candidates.size() ? candidates[goal].error * g_passErrorBound : FLT_MAX;
+
+			//Each collapse locks the triangles around it, so the ones made in a pass can't interfere
+			for(size_t v = 0; v < m_vertexCount; ++v)
+			{
+				remap[v] = static_cast<uint32_t>(v);
+			}
+			std::fill(locked.begin(), locked.end(), false);
+			size_t removed = 0;
+			for(const Collapse& c : candidates)
+			{
+				if(c.error > passLimit || triangleCount - removed <= targetTriangles)
+				{
+					break;
+				}
+				const bool seam = c.twinFrom != g_noCollapse;
+				if(locked[c.from] || locked[c.to] || (seam && (locked[c.twinFrom] || locked[c.twinTo])))
+				{
+					continue;
+				}
+				removed += ApplyCollapse(c.from, c.to, remap, locked);
+				if(seam)
+				{
+					removed += ApplyCollapse(c.twinFrom, c.twinTo, remap, locked);
+				}
+				m_error = (std::max)(m_error, c.error);
+			}
+			if(removed == 0)
+			{
+				break;
+			}
+
+			size_t out = 0;
+			for(size_t i = 0; i < m_indices.size(); i += 3)
+			{
+				const uint32_t a = remap[m_indices[i]], b = remap[m_indices[i + 1]], c = remap[m_indices[i + 2]];
+				if(a != b && b != c && a != c)
+				{
+					m_indices[out++] = a;
+					m_indices[out++] = b;
+					m_indices[out++] = c;
+				}
+			}
+			m_indices.resize(out);
+			BuildAdjacency();
+		}
+	}
+}
+
+size_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, const float* normals,
+	size_t vertexStride, size_t vertexCount, size_t targetIndexCount, float targetError, float* error)
+{
+	Simplifier simplifier(indices, indexCount, positions, normals, vertexStride, vertexCount);
+	simplifier.Simplify(targetIndexCount, targetError);
+	const std::vector<uint32_t>& result = simplifier.Indices();
+	std::copy(result.begin(), result.end(), destination);
+	if(error)
+	{
+		*error = simplifier.Error();
+	}
+	return result.size();
+}
+
+std::vector<LodLevel> BuildLodChain(std::vector<uint32_t>& indices, size_t indexCount, const float* positions, const float* normals,
+	size_t vertexStride, size_t vertexCount, const std::vector<size_t>& triangleCounts)
+{
+	std::vector<LodLevel> levels;
+	size_t start = 0, count = indexCount;
+	float error = 0.0f;
+	for(size_t target : triangleCounts)
+	{
+		if(3 * target >= count)
+		{
+			continue;
+		}
+		//Copied out first, indices may reallocate while the level is appended
+		std::vector<uint32_t> level(indices.begin() + start, indices.begin() + start + count);
+		float levelError = 0.0f;
+		const size_t levelCount = SimplifyMesh(level.data(), level.data(), level.size(), positions, normals, vertexStride, vertexCount, 3 * target, FLT_MAX, &levelError);
+		if(levelCount >= count)
+		{
+			continue;
+		}
+		OptimizeVertexCache(level.data(), levelCount, vertexCount);
+		start = indices.size();
+		count = levelCount;
+		error += levelError;
+		indices.insert(indices.end(), level.begin(), level.begin() + levelCount);
+		levels.push_back({ static_cast<uint32_t>(start), static_cast<uint32_t>(count), error });
+	}
+	return levels;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+
+constexpr float g_simplifyNormalWeight = 0.01f;		//Normal error counted against distance, relative to the mesh size
+constexpr float g_simplifyBorderWeight = 10.0f;		//How strongly open borders resist moving off their edges
+
+//Reduces a triangle list towards targetIndexCount by collapsing edges in order of quadric error. The error
+//of a collapse is the squared distance to the planes of the triangles its vertex has absorbed so far, plus
+//how far the normals interpolated over those triangles move from the target vertex's, when normals isn't null.
+//Collapses move a vertex onto a neighbour, so the result indexes the same vertex buffer. Open borders only
+//collapse along themselves, as do attribute seams, where a pair of entries in the buffer share a position and
+//both halves move together. Corners of several seams and non-manifold vertices never move. positions and
+//normals are read vertexStride bytes apart.
+//Stops early rather than make a collapse costing more than targetError, a distance in the mesh's units.
+//Writes the result to destination, which may be indices, and returns its index count. error, when given,
+//receives the largest collapse error made, as a distance in the mesh's units.
+size_t SimplifyMesh(uint32_t* destination, const uint32_t* indices, size_t indexCount, const float* positions, const float* normals,
+	size_t vertexStride, size_t vertexCount, size_t targetIndexCount, float targetError = FLT_MAX, float* error = nullptr);
+
+struct LodLevel
+{
+	uint32_t	startIndex;
+	uint32_t	indexCount;
+	float		error;				//How far the level may stray from the full mesh, in the mesh's units
+};
+
+//Appends a simplified copy of indices[0, indexCount) for each target triangle count to indices, each one
+//simplified from the last so the errors only grow, and optimised for the vertex cache. Targets the mesh
+//couldn't be brought below the previous level for are skipped. Returns the appended levels, coarsest last.
+std::vector<LodLevel> BuildLodChain(std::vector<uint32_t>& indices, size_t indexCount, const float* positions, const float* normals,
+	size_t vertexStride, size_t vertexCount, const std::vector<size_t>& triangleCounts);
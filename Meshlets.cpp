@@ -0,0 +1,376 @@
+#include "Meshlets.h"
+#include "MeshOptimizer.h"
+
+#include <DirectXCollision.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr float g_meshletConeWeight = 24.0f;			//A triangle at right angles to the meshlet weighs as much as this many open neighbours
+	constexpr float g_meshletMinConeDot = 0.1f;			//Cones wider than this cosine don't cull often enough to test
+	constexpr uint8_t g_notInMeshlet = 0xff;
+	constexpr uint32_t g_noTriangle = ~0u;
+
+	struct CullCheckView
+	{
+		const char*	name;
+		XMFLOAT3	direction;		//From the centre of the mesh to the eye
+		XMFLOAT3	up;
+		float		distance;		//In bounding radii
+	};
+	//The sides a model is usually seen from, and one close enough that the frustum cuts most of it off
+	const CullCheckView g_cullCheckViews[] =
+	{
+		{ "front",		{ 0.0f, 0.0f, -1.0f },	{ 0.0f, 1.0f, 0.0f },	4.0f },
+		{ "back",		{ 0.0f, 0.0f, 1.0f },	{ 0.0f, 1.0f, 0.0f },	4.0f },
+		{ "side",		{ 1.0f, 0.0f, 0.0f },	{ 0.0f, 1.0f, 0.0f },	4.0f },
+		{ "top",		{ 0.0f, 1.0f, 0.0f },	{ 0.0f, 0.0f, 1.0f },	4.0f },
+		{ "diagonal",	{ 1.0f, 1.0f, -1.0f },	{ 0.0f, 1.0f, 0.0f },	4.0f },
+		{ "close",		{ 0.0f, 0.0f, -1.0f },	{ 0.0f, 1.0f, 0.0f },	1.0f }
+	};
+
+	template<class Index>
+	std::vector<Meshlet> Build(Index* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount)
+	{
+		const size_t triangleCount = indexCount / 3;
+		const char* base = reinterpret_cast<const char*>(positions);
+		auto position = [&](uint32_t v) { return XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(base + v * vertexStride)); };
+
+		//Unit front face normals, zero for degenerate triangles, which fit in any cone
+		std::vector<XMFLOAT3> normals(triangleCount);
+		for(size_t t = 0; t < triangleCount; ++t)
+		{
+			const XMVECTOR p0 = position(indices[3 * t]);
+			const XMVECTOR n = XMVector3Cross(XMVectorSubtract(position(indices[3 * t + 1]), p0), XMVectorSubtract(position(indices[3 * t + 2]), p0));
+			const float length = XMVectorGetX(XMVector3Length(n));
+			XMStoreFloat3(&normals[t], length > 0.0f ? XMVectorScale(n, 1.0f / length) : XMVectorZero());
+		}
+
+		//Triangles around every vertex
+		std::vector<uint32_t> offsets(vertexCount + 1, 0);
+		for(size_t i = 0; i < 3 * triangleCount; ++i)
+		{
+			++offsets[indices[i] + 1];
+		}
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		std::vector<uint32_t> adjacency(3 * triangleCount);
+		{
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for(size_t i = 0; i < 3 * triangleCount; ++i)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+			}
+		}
+
+		std::vector<Index> out;
+		out.reserve(3 * triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<uint32_t> live(vertexCount);		//Triangles around each vertex not yet emitted
+		for(size_t v = 0; v < vertexCount; ++v)
+		{
+			live[v] = offsets[v + 1] - offsets[v];
+		}
+		std::vector<uint8_t> slot(vertexCount, g_notInMeshlet);
+		std::vector<Meshlet> meshlets;
+
+		uint32_t vertices[g_meshletMaxVertices];
+		uint32_t triangles[g_meshletMaxTriangles];
+		uint32_t vertexUsed = 0, triangleUsed = 0;
+		XMVECTOR normalSum = XMVectorZero();
+
+		//Any triangle left around the meshlet being finished, so the next one starts beside it
+		auto neighbourSeed = [&]()
+		{
+			for(uint32_t i = 0; i < vertexUsed; ++i)
+			{
+				for(uint32_t a = offsets[vertices[i]]; a < offsets[vertices[i] + 1]; ++a)
+				{
+					if(!emitted[adjacency[a]])
+					{
+						return adjacency[a];
+					}
+				}
+			}
+			return g_noTriangle;
+		};
+
+		auto finish = [&]()
+		{
+			Meshlet meshlet = {};
+			meshlet.startIndex = static_cast<uint32_t>(out.size() - 3 * triangleUsed);
+			meshlet.triangleCount = triangleUsed;
+			meshlet.vertexCount = vertexUsed;
+
+			XMFLOAT3 points[g_meshletMaxVertices];
+			for(uint32_t i = 0; i < vertexUsed; ++i)
+			{
+				XMStoreFloat3(&points[i], position(vertices[i]));
+				slot[vertices[i]] = g_notInMeshlet;
+			}
+			BoundingSphere sphere;
+			BoundingSphere::CreateFromPoints(sphere, vertexUsed, points, sizeof(XMFLOAT3));
+			meshlet.center = sphere.Center;
+			meshlet.radius = sphere.Radius;
+
+			//The cone's half angle is the widest normal from the average. Backfacing clusters are found by
+			//widening it by 90 degrees and flipping it, which is where the sine comes from.
+			const float length = XMVectorGetX(XMVector3Length(normalSum));
+			const XMVECTOR axis = length > 0.0f ? XMVectorScale(normalSum, 1.0f / length) : XMVectorZero();
+			float minDot = length > 0.0f ? 1.0f : -1.0f;
+			for(uint32_t i = 0; i < triangleUsed; ++i)
+			{
+				const XMVECTOR n = XMLoadFloat3(&normals[triangles[i]]);
+				if(!XMVector3Equal(n, XMVectorZero()))
+				{
+					minDot = (std::min)(minDot, XMVectorGetX(XMVector3Dot(n, axis)));
+				}
+			}
+			if(minDot <= g_meshletMinConeDot)
+			{
+				meshlet.coneAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				meshlet.coneCutoff = 1.0f;
+			}
+			else
+			{
+				XMStoreFloat3(&meshlet.coneAxis, axis);
+				meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+			}
+			meshlets.push_back(meshlet);
+			vertexUsed = triangleUsed = 0;
+			normalSum = XMVectorZero();
+		};
+
+		size_t cursor = 0;				//Every triangle below it has been emitted
+		uint32_t seed = g_noTriangle;
+		for(size_t remaining = triangleCount; remaining > 0; )
+		{
+			uint32_t best = g_noTriangle;
+			if(triangleUsed == 0)
+			{
+				best = seed;
+				if(best == g_noTriangle)
+				{
+					while(emitted[cursor])
+					{
+						++cursor;
+					}
+					best = static_cast<uint32_t>(cursor);
+				}
+			}
+			else
+			{
+				//Fewest new vertices first, then triangles whose corners have the least left around them, which
+				//finishes off the meshlet's edges before growing it and keeps it round, then the ones facing its way
+				const XMVECTOR axis = XMVector3Normalize(normalSum);
+				uint32_t bestExtra = 4;
+				float bestScore = FLT_MAX;
+				for(uint32_t i = 0; i < vertexUsed; ++i)
+				{
+					for(uint32_t a = offsets[vertices[i]]; a < offsets[vertices[i] + 1]; ++a)
+					{
+						const uint32_t t = adjacency[a];
+						if(emitted[t])
+						{
+							continue;
+						}
+						uint32_t extra = 0;
+						for(int k = 0; k < 3; ++k)
+						{
+							extra += slot[indices[3 * t + k]] == g_notInMeshlet ? 1 : 0;
+						}
+						if(vertexUsed + extra > g_meshletMaxVertices || extra > bestExtra)
+						{
+							continue;
+						}
+						const float facing = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&normals[t]), axis));
+						const float score = static_cast<float>(live[indices[3 * t]] + live[indices[3 * t + 1]] + live[indices[3 * t + 2]])
+							+ g_meshletConeWeight * (1.0f - facing);
+						if(extra < bestExtra || score < bestScore)
+						{
+							bestExtra = extra;
+							bestScore = score;
+							best = t;
+						}
+					}
+				}
+				if(best == g_noTriangle)
+				{
+					seed = neighbourSeed();
+					finish();
+					continue;
+				}
+			}
+
+			for(int k = 0; k < 3; ++k)
+			{
+				const uint32_t v = indices[3 * best + k];
+				if(slot[v] == g_notInMeshlet)
+				{
+					slot[v] = static_cast<uint8_t>(vertexUsed);
+					vertices[vertexUsed++] = v;
+				}
+				out.push_back(static_cast<Index>(v));
+				--live[v];
+			}
+			triangles[triangleUsed++] = best;
+			emitted[best] = true;
+			normalSum = XMVectorAdd(normalSum, XMLoadFloat3(&normals[best]));
+			--remaining;
+			if(triangleUsed == g_meshletMaxTriangles)
+			{
+				seed = neighbourSeed();
+				finish();
+			}
+		}
+		if(triangleUsed > 0)
+		{
+			finish();
+		}
+		//Growing by shared vertices visits them in no order the cache likes, put it back within each meshlet.
+		//Each is renumbered to its own vertices first so the optimiser's tables are sized for 64, not the mesh
+		std::copy(out.begin(), out.end(), indices);
+		uint32_t local[3 * g_meshletMaxTriangles];
+		for(const Meshlet& meshlet : meshlets)
+		{
+			Index* meshletIndices = indices + meshlet.startIndex;
+			const uint32_t count = 3 * meshlet.triangleCount;
+			vertexUsed = 0;
+			for(uint32_t i = 0; i < count; ++i)
+			{
+				const uint32_t v = meshletIndices[i];
+				if(slot[v] == g_notInMeshlet)
+				{
+					slot[v] = static_cast<uint8_t>(vertexUsed);
+					vertices[vertexUsed++] = v;
+				}
+				local[i] = slot[v];
+			}
+			OptimizeVertexCache(local, count, vertexUsed);
+			for(uint32_t i = 0; i < count; ++i)
+			{
+				meshletIndices[i] = static_cast<Index>(vertices[local[i]]);
+			}
+			for(uint32_t i = 0; i < vertexUsed; ++i)
+			{
+				slot[vertices[i]] = g_notInMeshlet;
+			}
+		}
+		return meshlets;
+	}
+}
+
+std::vector<Meshlet> BuildMeshlets(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount)
+{
+	return Build(indices, indexCount, positions, vertexStride, vertexCount);
+}
+
+std::vector<Meshlet> BuildMeshlets(uint16_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount)
+{
+	return Build(indices, indexCount, positions, vertexStride, vertexCount);
+}
+
+MeshletCullView::MeshletCullView(FXMMATRIX world, CXMMATRIX viewProj, const XMFLOAT3& eyePosW)
+{
+	//Gribb and Hartmann: the clip planes are sums and differences of the columns of the object to clip matrix,
+	//which are the rows of its transpose. Depth runs from 0 to w.
+	const XMMATRIX columns = XMMatrixTranspose(XMMatrixMultiply(world, viewProj));
+	const XMVECTOR clipPlanes[6] =
+	{
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2])
+	};
+	for(int i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&planes[i], XMPlaneNormalize(clipPlanes[i]));
+	}
+	XMVECTOR determinant;
+	XMStoreFloat3(&eyePos, XMVector3TransformCoord(XMLoadFloat3(&eyePosW), XMMatrixInverse(&determinant, world)));
+}
+
+size_t CullMeshlets(const Meshlet* meshlets, size_t meshletCount, const MeshletCullView& view, std::vector<IndexRange>& ranges)
+{
+	const XMVECTOR eye = XMLoadFloat3(&view.eyePos);
+	const size_t firstRange = ranges.size();
+	size_t visible = 0;
+	for(size_t i = 0; i < meshletCount; ++i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		const XMVECTOR center = XMLoadFloat3(&meshlet.center);
+		bool outside = false;
+		for(int p = 0; p < 6 && !outside; ++p)
+		{
+			outside = XMVectorGetX(XMPlaneDotCoord(XMLoadFloat4(&view.planes[p]), center)) < -meshlet.radius;
+		}
+		if(outside)
+		{
+			continue;
+		}
+
+		//Every triangle faces away when the eye sees the whole sphere from inside the flipped cone
+		const XMVECTOR toCenter = XMVectorSubtract(center, eye);
+		if(XMVectorGetX(XMVector3Dot(toCenter, XMLoadFloat3(&meshlet.coneAxis))) >= meshlet.coneCutoff * XMVectorGetX(XMVector3Length(toCenter)) + meshlet.radius)
+		{
+			continue;
+		}
+
+		visible += meshlet.triangleCount;
+		const uint32_t indexCount = 3 * meshlet.triangleCount;
+		if(ranges.size() > firstRange && ranges.back().startIndex + ranges.back().indexCount == meshlet.startIndex)
+		{
+			ranges.back().indexCount += indexCount;
+		}
+		else
+		{
+			ranges.push_back({ meshlet.startIndex, indexCount });
+		}
+	}
+	return visible;
+}
+
+std::string DescribeMeshletCulling(const std::string& name, const Meshlet* meshlets, size_t meshletCount)
+{
+	if(meshletCount == 0)
+	{
+		return name + ": no meshlets\n";
+	}
+	BoundingSphere bounds(meshlets[0].center, meshlets[0].radius);
+	size_t triangleCount = 0;
+	for(size_t i = 0; i < meshletCount; ++i)
+	{
+		BoundingSphere::CreateMerged(bounds, bounds, BoundingSphere(meshlets[i].center, meshlets[i].radius));
+		triangleCount += meshlets[i].triangleCount;
+	}
+
+	const XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f * XM_PI, 16.0f / 9.0f, 0.01f * bounds.Radius, 100.0f * bounds.Radius);
+	std::string text = name + ": triangles culled";
+	std::vector<IndexRange> ranges;
+	for(const CullCheckView& check : g_cullCheckViews)
+	{
+		const XMVECTOR target = XMLoadFloat3(&bounds.Center);
+		const XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&check.direction));
+		const XMVECTOR eye = XMVectorAdd(target, XMVectorScale(direction, check.distance * bounds.Radius));
+		XMFLOAT3 eyePos;
+		XMStoreFloat3(&eyePos, eye);
+
+		ranges.clear();
+		const MeshletCullView view(XMMatrixIdentity(), XMMatrixMultiply(XMMatrixLookAtLH(eye, target, XMLoadFloat3(&check.up)), proj), eyePos);
+		const size_t visible = CullMeshlets(meshlets, meshletCount, view, ranges);
+		char entry[64];
+		snprintf(entry, sizeof(entry), "%s %s %.1f%%", &check == g_cullCheckViews ? "" : ",", check.name,
+			100.0 * (triangleCount - visible) / triangleCount);
+		text += entry;
+	}
+	return text + "\n";
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+constexpr uint32_t g_meshletMaxVertices = 64;		//What a mesh shader group usually handles, and what culling pays off at
+constexpr uint32_t g_meshletMaxTriangles = 124;
+
+//A cluster of neighbouring triangles, stored next to each other in the index list it was built from.
+//Plain data so it can go in the mesh file as it is.
+struct Meshlet
+{
+	uint32_t			startIndex;		//First index of its triangles, relative to the start of the list
+	uint32_t			triangleCount;
+	uint32_t			vertexCount;	//Distinct vertices its triangles use
+	float				radius;
+	DirectX::XMFLOAT3	center;			//Bounding sphere of its vertices
+	float				coneCutoff;		//Sine of the widest angle between a triangle normal and the axis, 1 never culls
+	DirectX::XMFLOAT3	coneAxis;		//Average front face normal
+	uint32_t			pad;
+};
+
+struct IndexRange
+{
+	uint32_t	startIndex;
+	uint32_t	indexCount;
+};
+
+//Reorders the triangles of a list in place into meshlets of at most g_meshletMaxVertices vertices and
+//g_meshletMaxTriangles triangles and returns them in list order. Each meshlet grows across shared
+//vertices, preferring triangles that add the fewest new vertices, then those that close off its edges
+//and face the way it does, so it stays round and its normal cone narrow. A full meshlet seeds the next from its own neighbours where it can.
+//Each meshlet's triangles are then reordered for the vertex cache. positions points at the first
+//vertex position, vertexStride bytes apart. Front faces are clockwise, as the rasterizer has them.
+std::vector<Meshlet> BuildMeshlets(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount);
+std::vector<Meshlet> BuildMeshlets(uint16_t* indices, size_t indexCount, const float* positions, size_t vertexStride, size_t vertexCount);
+
+//Frustum planes and eye position in the object space of one instance, where its meshlets are tested
+struct MeshletCullView
+{
+	DirectX::XMFLOAT4	planes[6];		//Pointing inwards, normalised
+	DirectX::XMFLOAT3	eyePos;
+
+	MeshletCullView(DirectX::FXMMATRIX world, DirectX::CXMMATRIX viewProj, const DirectX::XMFLOAT3& eyePosW);
+};
+
+//Drops the meshlets that are wholly outside the frustum or whose triangles all face away from the eye
+//and appends the index ranges of the rest to ranges, merging neighbours so there are as few draws as
+//possible. Returns the number of triangles left to draw.
+size_t CullMeshlets(const Meshlet* meshlets, size_t meshletCount, const MeshletCullView& view, std::vector<IndexRange>& ranges);
+
+//"name: triangles culled front x%, ..." and a line break, for the debug output. Culls the meshlets from a
+//fixed set of views around their bounds, so runs compare like for like.
+std::string DescribeMeshletCulling(const std::string& name, const Meshlet* meshlets, size_t meshletCount);
@@ -0,0 +1,89 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "Common/ThreadPool.h"
+
+//Morton codes and the radix sort that orders them, shared by the structures that sort points along
+//a space filling curve so neighbours in the sorted order are neighbours in space
+namespace MortonSort
+{
+	constexpr uint32_t g_radixBits = 10;			//One pass per axis worth of Morton bits
+	constexpr uint32_t g_radixBuckets = 1u << g_radixBits;
+
+	//Spreads the low 10 bits of v so there are two zero bits between each of them
+	inline uint32_t ExpandBits(uint32_t v)
+	{
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+
+	//30 bit code of a cell of a 1024^3 grid
+	inline uint32_t Code(uint32_t cx, uint32_t cy, uint32_t cz)
+	{
+		return (ExpandBits(cx) << 2) | (ExpandBits(cy) << 1) | ExpandBits(cz);
+	}
+
+	//Stable LSD radix sort of keys with a payload, per thread histograms then a scatter per pass
+	inline void RadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, std::vector<uint32_t>& keyScratch, std::vector<uint32_t>& valueScratch, uint32_t keyBits)
+	{
+		ThreadPool& pool = ThreadPool::Get();
+		const size_t count = keys.size();
+		keyScratch.resize(count);
+		valueScratch.resize(count);
+		const size_t blockCount = pool.GetThreadCount();
+		const size_t blockSize = (count + blockCount - 1) / blockCount;
+		std::vector<uint32_t> offsets(blockCount * g_radixBuckets);
+
+		for(uint32_t shift = 0; shift < keyBits; shift += g_radixBits)
+		{
+			std::fill(offsets.begin(), offsets.end(), 0u);
+			pool.ParallelFor(0, blockCount, 1, [&](size_t begin, size_t end)
+				{
+					for(size_t block = begin; block < end; ++block)
+					{
+						uint32_t* histogram = &offsets[block * g_radixBuckets];
+						const size_t last = (std::min)(count, (block + 1) * blockSize);
+						for(size_t i = block * blockSize; i < last; ++i)
+						{
+							++histogram[(keys[i] >> shift) & (g_radixBuckets - 1)];
+						}
+					}
+				});
+
+			//Digit major, block minor prefix sum keeps the sort stable
+			uint32_t running(0);
+			for(uint32_t digit = 0; digit < g_radixBuckets; ++digit)
+			{
+				for(size_t block = 0; block < blockCount; ++block)
+				{
+					uint32_t& slot = offsets[block * g_radixBuckets + digit];
+					const uint32_t n = slot;
+					slot = running;
+					running += n;
+				}
+			}
+
+			pool.ParallelFor(0, blockCount, 1, [&](size_t begin, size_t end)
+				{
+					for(size_t block = begin; block < end; ++block)
+					{
+						uint32_t* cursor = &offsets[block * g_radixBuckets];
+						const size_t last = (std::min)(count, (block + 1) * blockSize);
+						for(size_t i = block * blockSize; i < last; ++i)
+						{
+							const uint32_t slot = cursor[(keys[i] >> shift) & (g_radixBuckets - 1)]++;
+							keyScratch[slot] = keys[i];
+							valueScratch[slot] = values[i];
+						}
+					}
+				});
+			keys.swap(keyScratch);
+			values.swap(valueScratch);
+		}
+	}
+}
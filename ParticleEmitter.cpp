@@ -1,14 +1,13 @@
 #include "ParticleEmitter.h"
 #include "random"
-
-inline void NormalizeFloat3(DirectX::XMFLOAT3& vec)
-{
-	const float LENGTH = sqrt((vec.x * vec.x) + (vec.y * vec.y) + (vec.z * vec.z));
-	vec = DirectX::XMFLOAT3(vec.x / LENGTH, vec.y / LENGTH, vec.z / LENGTH);
-}
+#include "Common/ThreadPool.h"
 
 void Emission_policies::SphereEmission::Emit(float deltaTime, std::vector<Particle>& particles)
 {
+	if(m_emitInterval <= 0.0f)
+	{
+		return;
+	}
 	m_spawnTime += deltaTime;
 	int spawnCount(0);
 	while(m_spawnTime > m_emitInterval)
@@ -16,30 +15,34 @@ void Emission_policies::SphereEmission::Emit(float deltaTime, std::vector<Partic
 		++spawnCount;
 		m_spawnTime -= m_emitInterval;
 	}
-	if(spawnCount == 0)
-	{
-		return;
-	}
-	for(Particle& p : particles)
+	SpawnParticles(spawnCount, m_spawnPos, 1.0f, DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), particles);
+}
+
+void Emission_policies::SphereEmission::Burst(const SpawnRequest& request, std::vector<Particle>& particles)
+{
+	SpawnParticles(static_cast<int>(request.count), request.position, request.speedScale, request.velocity, particles);
+}
+
+void Emission_policies::SphereEmission::SpawnParticles(int spawnCount, DirectX::XMFLOAT3 position, float speedScale, DirectX::XMFLOAT3 baseVelocity, std::vector<Particle>& particles)
+{
+	for(; spawnCount > 0; --spawnCount)
 	{
-		if(!p.alive)
+		Particle* p = NextFreeParticle(particles);
+		if(p == nullptr)
 		{
-			//Resetting the particle and moving it back to the position of the particle emitter
-			p.alive = true;
-			p.position = m_spawnPos;
-			//DirectX::XMStoreFloat4x4(&p.render_item.World, DirectX::XMMatrixTranslation(m_spawnPos.x, m_spawnPos.y, m_spawnPos.z));
-
-			//Give the particle its direction
-			p.direction.x = static_cast<float>((rand() / static_cast<float>(RAND_MAX)) - 0.5f);
-			p.direction.y = static_cast<float>((rand() / static_cast<float>(RAND_MAX)) - 0.5f);
-			p.direction.z = static_cast<float>((rand() / static_cast<float>(RAND_MAX)) - 0.5f);
-
-			NormalizeFloat3(p.direction);
-			if (--spawnCount <= 0)
-			{
-				break;
-			}
+			return;
 		}
+		//Resetting the particle and moving it back to the position of the particle emitter
+		p->alive = true;
+		p->position = position;
+		//DirectX::XMStoreFloat4x4(&p->render_item.World, DirectX::XMMatrixTranslation(m_spawnPos.x, m_spawnPos.y, m_spawnPos.z));
+
+		//Give the particle its direction, the attribute policy decides whether it's kept or regenerated from the seed
+		p->seed = NextParticleSeed();
+		const DirectX::XMFLOAT3 direction = ParticleRandom::Attributes(p->seed).direction;
+		const float speed = m_emitSpeed * speedScale;
+		p->velocity = DirectX::XMFLOAT3(baseVelocity.x + direction.x * speed, baseVelocity.y + direction.y * speed, baseVelocity.z + direction.z * speed);
+		ParticleSpawned(*p, particles);
 	}
 }
 
@@ -49,55 +52,311 @@ void Update_policies::Constant::UpdatePositions(float deltaTime, std::vector<Par
 	{
 		if(p.alive)
 		{
-			const float SPEED_TIME = deltaTime * m_speed;
-			p.position.x += p.direction.x * SPEED_TIME;
-			p.position.y += p.direction.y * SPEED_TIME;
-			p.position.z += p.direction.z * SPEED_TIME;
+			p.position.x += p.velocity.x * deltaTime;
+			p.position.y += p.velocity.y * deltaTime;
+			p.position.z += p.velocity.z * deltaTime;
 			DirectX::XMStoreFloat4x4(&p.render_item.World,DirectX::XMMatrixTranslation(p.position.x, p.position.y, p.position.z));
 			p.render_item.NumFramesDirty = g_numFrameResources;
 		}
 	}
 }
 
-void Deletion_policies::LifeSpan::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
+namespace
 {
-	for(Particle& p : particles)
+	const DirectX::XMVECTORF32 g_laneIndex = { { { 0.0f, 1.0f, 2.0f, 3.0f } } };
+	constexpr size_t g_fluidGrain = 1024;
+
+	inline DirectX::XMVECTOR LoadFloat4(const float* src)
 	{
-		if(p.alive)
+		return DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(src));
+	}
+	inline float HorizontalSum(DirectX::FXMVECTOR v)
+	{
+		return DirectX::XMVectorGetX(DirectX::XMVector4Dot(v, DirectX::XMVectorSplatOne()));
+	}
+	//Mask of the lanes that hold one of the remaining slots of a bucket range
+	inline DirectX::XMVECTOR TailMask(uint32_t remaining)
+	{
+		return DirectX::XMVectorLess(g_laneIndex, DirectX::XMVectorReplicate(static_cast<float>(remaining)));
+	}
+}
+
+void Update_policies::SPHFluid::UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+{
+	m_aliveIndices.clear();
+	for(size_t i = 0; i < particles.size(); ++i)
+	{
+		if(particles[i].alive)
 		{
-			p.age += deltaTime;
-			if(p.age > m_maxLifeTime)
+			m_aliveIndices.push_back(static_cast<uint32_t>(i));
+		}
+	}
+
+	const size_t count = m_aliveIndices.size();
+	if(count == 0 || deltaTime <= 0.0f)
+	{
+		return;
+	}
+
+	m_x.resize(count); m_y.resize(count); m_z.resize(count);
+	m_vx.resize(count); m_vy.resize(count); m_vz.resize(count);
+	for(size_t slot = 0; slot < count; ++slot)
+	{
+		const uint32_t i = m_aliveIndices[slot];
+		m_x[slot] = particles[i].position.x;
+		m_y[slot] = particles[i].position.y;
+		m_z[slot] = particles[i].position.z;
+		m_vx[slot] = particles[i].velocity.x;
+		m_vy[slot] = particles[i].velocity.y;
+		m_vz[slot] = particles[i].velocity.z;
+	}
+
+	const int substeps = (std::max)(1, static_cast<int>(ceilf(deltaTime / m_params.maxTimeStep)));
+	const float stepTime = deltaTime / substeps;
+	for(int step = 0; step < substeps; ++step)
+	{
+		Step(stepTime);
+	}
+
+	for(size_t slot = 0; slot < count; ++slot)
+	{
+		const uint32_t i = m_aliveIndices[slot];
+		Particle& p = particles[i];
+		p.position = DirectX::XMFLOAT3(m_x[slot], m_y[slot], m_z[slot]);
+		p.velocity = DirectX::XMFLOAT3(m_vx[slot], m_vy[slot], m_vz[slot]);
+		DirectX::XMStoreFloat4x4(&p.render_item.World, DirectX::XMMatrixTranslation(p.position.x, p.position.y, p.position.z));
+		p.render_item.NumFramesDirty = g_numFrameResources;
+	}
+}
+
+void Update_policies::SPHFluid::Step(float deltaTime)
+{
+	using namespace DirectX;
+
+	const size_t count = m_x.size();
+	const size_t padded = count + SpatialGrid::k_simdPadding;
+	const float h = m_params.smoothingRadius;
+	const float h2 = h * h;
+	const float mass = m_params.particleMass;
+
+	//Muller et al. 2003 kernels
+	const float poly6 = 315.0f / (64.0f * DirectX::XM_PI * powf(h, 9.0f));
+	const float spikyGrad = 45.0f / (DirectX::XM_PI * powf(h, 6.0f));
+	const float viscLaplacian = 45.0f / (DirectX::XM_PI * powf(h, 6.0f));
+
+	m_grid.SetCellSize(h);
+	m_grid.Build(m_x.data(), m_y.data(), m_z.data(), count);
+
+	const uint32_t* sortedIndex = m_grid.GetSortedIndices().data();
+	const float* sx = m_grid.SortedX();
+	const float* sy = m_grid.SortedY();
+	const float* sz = m_grid.SortedZ();
+
+	m_sortedVX.resize(padded, 0.0f); m_sortedVY.resize(padded, 0.0f); m_sortedVZ.resize(padded, 0.0f);
+	m_density.resize(padded, 1.0f); m_pressure.resize(padded, 0.0f);
+	m_accX.resize(count); m_accY.resize(count); m_accZ.resize(count);
+
+	ThreadPool& pool = ThreadPool::Get();
+	pool.ParallelFor(0, count, g_fluidGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t slot = begin; slot < end; ++slot)
 			{
-				p.Reset();
+				m_sortedVX[slot] = m_vx[sortedIndex[slot]];
+				m_sortedVY[slot] = m_vy[sortedIndex[slot]];
+				m_sortedVZ[slot] = m_vz[sortedIndex[slot]];
 			}
-		}
+		});
+
+	//Density and pressure, four neighbours per iteration
+	const XMVECTOR h2V = XMVectorReplicate(h2);
+	const XMVECTOR zero = XMVectorZero();
+	pool.ParallelFor(0, count, g_fluidGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t slot = begin; slot < end; ++slot)
+			{
+				const XMFLOAT3 pos(sx[slot], sy[slot], sz[slot]);
+				const XMVECTOR px = XMVectorReplicate(pos.x);
+				const XMVECTOR py = XMVectorReplicate(pos.y);
+				const XMVECTOR pz = XMVectorReplicate(pos.z);
+				XMVECTOR sum = zero;
+				m_grid.ForEachNeighborRange(pos, [&](uint32_t first, uint32_t last)
+					{
+						for(uint32_t j = first; j < last; j += 4)
+						{
+							const XMVECTOR dx = LoadFloat4(sx + j) - px;
+							const XMVECTOR dy = LoadFloat4(sy + j) - py;
+							const XMVECTOR dz = LoadFloat4(sz + j) - pz;
+							const XMVECTOR diff = h2V - (dx * dx + dy * dy + dz * dz);
+							const XMVECTOR mask = XMVectorAndInt(TailMask(last - j), XMVectorGreater(diff, zero));
+							sum += XMVectorSelect(zero, diff * diff * diff, mask);
+						}
+					});
+				const float density = HorizontalSum(sum) * mass * poly6;
+				m_density[slot] = density;
+				m_pressure[slot] = (std::max)(0.0f, m_params.stiffness * (density - m_params.restDensity));
+			}
+		});
+
+	//Pressure, viscosity and cohesion accelerations
+	const XMVECTOR hV = XMVectorReplicate(h);
+	const XMVECTOR epsilon = XMVectorReplicate(1e-12f);
+	const XMVECTOR halfMassSpiky = XMVectorReplicate(0.5f * mass * spikyGrad);
+	const XMVECTOR massViscosity = XMVectorReplicate(mass * m_params.viscosity * viscLaplacian);
+	const XMVECTOR massCohesion = XMVectorReplicate(mass * m_params.surfaceTension * poly6);
+	pool.ParallelFor(0, count, g_fluidGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t slot = begin; slot < end; ++slot)
+			{
+				const XMFLOAT3 pos(sx[slot], sy[slot], sz[slot]);
+				const XMVECTOR px = XMVectorReplicate(pos.x);
+				const XMVECTOR py = XMVectorReplicate(pos.y);
+				const XMVECTOR pz = XMVectorReplicate(pos.z);
+				const XMVECTOR vx = XMVectorReplicate(m_sortedVX[slot]);
+				const XMVECTOR vy = XMVectorReplicate(m_sortedVY[slot]);
+				const XMVECTOR vz = XMVectorReplicate(m_sortedVZ[slot]);
+				const XMVECTOR pressure = XMVectorReplicate(m_pressure[slot]);
+				XMVECTOR fx = zero, fy = zero, fz = zero;		//Pressure and viscosity, divided by density below
+				XMVECTOR cx = zero, cy = zero, cz = zero;		//Cohesion, already an acceleration
+				m_grid.ForEachNeighborRange(pos, [&](uint32_t first, uint32_t last)
+					{
+						for(uint32_t j = first; j < last; j += 4)
+						{
+							const XMVECTOR dx = LoadFloat4(sx + j) - px;
+							const XMVECTOR dy = LoadFloat4(sy + j) - py;
+							const XMVECTOR dz = LoadFloat4(sz + j) - pz;
+							const XMVECTOR r2 = dx * dx + dy * dy + dz * dz;
+							const XMVECTOR mask = XMVectorAndInt(TailMask(last - j),
+								XMVectorAndInt(XMVectorLess(r2, h2V), XMVectorGreater(r2, epsilon)));
+
+							const XMVECTOR r = XMVectorSqrt(r2);
+							const XMVECTOR hr = hV - r;
+							const XMVECTOR invDensityJ = XMVectorReciprocal(LoadFloat4(m_density.data() + j));
+
+							//dx points from i to j, so the repulsive pressure term is negative
+							const XMVECTOR pressureTerm = XMVectorSelect(zero,
+								-(halfMassSpiky * (pressure + LoadFloat4(m_pressure.data() + j)) * invDensityJ * hr * hr / r), mask);
+							const XMVECTOR viscTerm = XMVectorSelect(zero, massViscosity * invDensityJ * hr, mask);
+							fx += pressureTerm * dx + viscTerm * (LoadFloat4(m_sortedVX.data() + j) - vx);
+							fy += pressureTerm * dy + viscTerm * (LoadFloat4(m_sortedVY.data() + j) - vy);
+							fz += pressureTerm * dz + viscTerm * (LoadFloat4(m_sortedVZ.data() + j) - vz);
+
+							const XMVECTOR diff = h2V - r2;
+							const XMVECTOR cohesion = XMVectorSelect(zero, massCohesion * diff * diff * diff, mask);
+							cx += cohesion * dx;
+							cy += cohesion * dy;
+							cz += cohesion * dz;
+						}
+					});
+				const float invDensity = 1.0f / m_density[slot];
+				m_accX[slot] = HorizontalSum(fx) * invDensity + HorizontalSum(cx);
+				m_accY[slot] = HorizontalSum(fy) * invDensity + HorizontalSum(cy) + m_params.gravity;
+				m_accZ[slot] = HorizontalSum(fz) * invDensity + HorizontalSum(cz);
+			}
+		});
+
+	//Semi-implicit Euler back into the compact streams
+	pool.ParallelFor(0, count, g_fluidGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t slot = begin; slot < end; ++slot)
+			{
+				const uint32_t i = sortedIndex[slot];
+				m_vx[i] = m_sortedVX[slot] + m_accX[slot] * deltaTime;
+				m_vy[i] = m_sortedVY[slot] + m_accY[slot] * deltaTime;
+				m_vz[i] = m_sortedVZ[slot] + m_accZ[slot] * deltaTime;
+				m_x[i] += m_vx[i] * deltaTime;
+				m_y[i] += m_vy[i] * deltaTime;
+				m_z[i] += m_vz[i] * deltaTime;
+			}
+		});
+}
+
+void Deletion_policies::LifeSpan::ResizeWheel()
+{
+	//A particle is never scheduled further ahead than its lifetime, so the wheel only has to
+	//span that many slots to never lap a bucket that still holds live entries
+	size_t slots(1);
+	while(slots < static_cast<size_t>(m_maxLifeTime / g_expirySlotDuration) + 2)
+	{
+		slots <<= 1;
 	}
+	m_wheel.assign(slots, std::vector<Expiry>());
+	m_nextSlot = SlotOf(m_now);
 }
 
-void Deletion_policies::CubeBoundaries::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
+void Deletion_policies::LifeSpan::Schedule(uint32_t index, const Particle& p)
 {
-	for(Particle& p : particles)
+	//Particles already past a shortened lifetime go in the next slot to be checked rather than one that has been passed
+	const int64_t slot = (std::max)(SlotOf(p.spawnTime + m_maxLifeTime), m_nextSlot);
+	m_wheel[slot & (m_wheel.size() - 1)].push_back({ index, p.spawnTime, slot });
+}
+
+bool Deletion_policies::LifeSpan::Expire(const Expiry& e, std::vector<Particle>& particles, bool force)
+{
+	Particle& p = particles[e.index];
+	if(!p.alive || p.spawnTime != e.spawnTime)
 	{
-		if(p.alive)
-		{
-			p.age += deltaTime;
+		return true;		//Stale, the particle it was scheduled for is gone
+	}
+	if(force || m_now - p.spawnTime > m_maxLifeTime)
+	{
+		Kill(p);
+		return true;
+	}
+	return false;
+}
 
-			if(p.position.x < m_bounds.xMin || p.position.x > m_bounds.xMax || p.position.y < m_bounds.yMin || p.position.y > m_bounds.yMax || p.position.z < m_bounds.zMin || p.position.z > m_bounds.zMax) //Do this
+void Deletion_policies::LifeSpan::ParticlesSpawned(double now, const std::vector<uint32_t>& spawned, std::vector<Particle>& particles)
+{
+	m_now = now;
+	if(m_rescheduleAll)
+	{
+		m_rescheduleAll = false;
+		ResizeWheel();
+		for(size_t i = 0; i < particles.size(); ++i)
+		{
+			if(particles[i].alive)
 			{
-				p.Reset();
+				Schedule(static_cast<uint32_t>(i), particles[i]);
 			}
 		}
+		return;
+	}
+	for(uint32_t index : spawned)
+	{
+		Schedule(index, particles[index]);
 	}
 }
 
-void Deletion_policies::CubeBoundaries::SetSpawnPos(DirectX::XMFLOAT3 pos)
+void Deletion_policies::LifeSpan::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
+{
+	//Only the buckets whose slot has come round are touched. Slots that are over expire the entries
+	//scheduled for them or earlier, the current slot only those actually past their lifetime. Entries
+	//for a later lap, spawned after a long frame skipped ahead, stay where they are.
+	const int64_t currentSlot = SlotOf(m_now);
+	const int64_t slotCount = static_cast<int64_t>(m_wheel.size());
+	const size_t mask = m_wheel.size() - 1;
+	m_nextSlot = (std::max)(m_nextSlot, currentSlot - slotCount);
+	for(; m_nextSlot < currentSlot; ++m_nextSlot)
+	{
+		std::vector<Expiry>& bucket = m_wheel[m_nextSlot & mask];
+		bucket.erase(std::remove_if(bucket.begin(), bucket.end(), [&](const Expiry& e) { return e.slot <= m_nextSlot && Expire(e, particles, true); }), bucket.end());
+	}
+	std::vector<Expiry>& current = m_wheel[currentSlot & mask];
+	current.erase(std::remove_if(current.begin(), current.end(), [&](const Expiry& e) { return e.slot <= currentSlot && Expire(e, particles, e.slot < currentSlot); }), current.end());
+}
+
+void Deletion_policies::CubeBoundaries::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
+{
+	m_bounds.Cull(particles, m_spawnPos, &m_deathEvents);
+}
+
+void Deletion_policies::SphereBoundaries::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
+{
+	m_bounds.Cull(particles, m_spawnPos, &m_deathEvents);
+}
+
+void Deletion_policies::KillVolumes::DeleteParticles(float deltaTime, std::vector<Particle>& particles)
 {
-	m_bounds.xMin += pos.x;
-	m_bounds.xMax += pos.x;
-	m_bounds.yMin += pos.y;
-	m_bounds.yMax += pos.y;
-	m_bounds.zMin += pos.z;
-	m_bounds.zMax += pos.z;
-	DeletionBase::SetSpawnPos(pos);
+	m_volumes.Cull(particles, m_spawnPos, &m_deathEvents);
 }
 
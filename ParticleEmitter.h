@@ -7,6 +7,20 @@
 #include <d3d12.h>
 #include <DirectXMath.h>
 #include "FrameResource.h"
+#include "SpawnQueue.h"
+#include "SpatialGrid.h"
+#include "SceneColliders.h"
+#include "MeshBVH.h"
+#include "VectorField.h"
+#include "BarnesHut.h"
+#include "KillVolumes.h"
+#include "ParticleRandom.h"
+#include "LifetimeCurves.h"
+#include "ParticleEvents.h"
+#include "ParticleTrails.h"
+#include "ForceTerms.h"
+#include "Integrators.h"
+#include "Common/ThreadPool.h"
 
 #pragma comment(lib,"d3dcompiler.lib")
 #pragma comment(lib, "D3D12.lib")
@@ -16,31 +30,84 @@ struct Particle
 {
 	RenderItem				render_item;
 	DirectX::XMFLOAT3		position;
-	DirectX::XMFLOAT3		direction;
-	float					age;
+	DirectX::XMFLOAT3		velocity;
+	uint32_t				seed;			//Random attributes are generated from this, see ParticleRandom.h
+	double					spawnTime;		//Emitter clock when the particle was spawned, age is the clock minus this
 	bool					alive;
 	Particle()
-		:render_item(), direction(0.0f, 0.0f, 0.0f), age(0.0f), alive(false)
+		:render_item(), velocity(0.0f, 0.0f, 0.0f), seed(0), spawnTime(0.0), alive(false)
 	{}
-	void Reset() { direction = DirectX::XMFLOAT3(); age = 0.0f; alive = false; position = DirectX::XMFLOAT3(); }
+	void Reset() { velocity = DirectX::XMFLOAT3(); seed = 0; spawnTime = 0.0; alive = false; position = DirectX::XMFLOAT3(); }
 };
 
 namespace Emission_policies
 {
 	constexpr float g_defaultEmitInterval = 0.1f;
+	constexpr float g_defaultEmitSpeed = 2.0f;
 	class EmissionBase									//Base for emission policy classes
 	{
 	public:
 		void SetSpawnPos(DirectX::XMFLOAT3 position) { m_spawnPos = position; }
+		void SetEmitSpeed(float speed) { m_emitSpeed = speed; }
+		void SetEmitInterval(float seconds) { m_emitInterval = seconds; }		//0 stops the regular emission, bursts and events still spawn
+		void SetSeed(uint32_t seed) { m_seed = seed; m_spawnCount = 0; }		//Same seed, same sequence of particles
+		//Spawns particlesPerEvent particles at every event in source each Update, for sub-emitters.
+		//The source emitter has to be updated first in the frame. Pass nullptr to stop.
+		void SetEventSource(const ParticleEventBuffer* source, unsigned int particlesPerEvent, float inheritVelocity = 0.0f)
+		{
+			m_eventSource = source;
+			m_particlesPerEvent = particlesPerEvent;
+			m_inheritVelocity = inheritVelocity;
+		}
 	protected:
 		virtual void Emit(float deltaTime, std::vector<Particle>& particles) = 0;
+		virtual void Burst(const SpawnRequest& request, std::vector<Particle>& particles) = 0;	//Spawns a queued burst outside the regular interval
+		void ParticleSpawned(const Particle& p, const std::vector<Particle>& particles) { m_spawned.push_back(static_cast<uint32_t>(&p - particles.data())); }
+		//Collects the dead slots once a frame, every burst, event and interval spawn takes from the same list
+		void BeginSpawning(const std::vector<Particle>& particles)
+		{
+			m_freeSlots.clear();
+			m_nextFreeSlot = 0;
+			for(size_t i = 0; i < particles.size(); ++i)
+			{
+				if(!particles[i].alive)
+				{
+					m_freeSlots.push_back(static_cast<uint32_t>(i));
+				}
+			}
+		}
+		//Lowest dead particle not yet spawned this frame, null once they've all been used
+		Particle* NextFreeParticle(std::vector<Particle>& particles)
+		{
+			return m_nextFreeSlot < m_freeSlots.size() ? &particles[m_freeSlots[m_nextFreeSlot++]] : nullptr;
+		}
+		void EmitFromEvents(std::vector<Particle>& particles)
+		{
+			if(m_eventSource == nullptr)
+			{
+				return;
+			}
+			for(const ParticleEvent& e : *m_eventSource)
+			{
+				const DirectX::XMFLOAT3 inherited(e.velocity.x * m_inheritVelocity, e.velocity.y * m_inheritVelocity, e.velocity.z * m_inheritVelocity);
+				Burst(SpawnRequest(e.position, m_particlesPerEvent, 1.0f, inherited), particles);
+			}
+		}
+		uint32_t NextParticleSeed() { return ParticleRandom::Hash(m_seed ^ ParticleRandom::Hash(m_spawnCount++)); }
+		uint32_t		m_seed;							//Effect seed, every particle's seed is derived from it and a spawn counter
+		uint32_t		m_spawnCount;
+		const ParticleEventBuffer* m_eventSource;		//Another emitter's events to spawn from, may be null
+		unsigned int	m_particlesPerEvent;
+		float			m_inheritVelocity;				//Fraction of the source particle's velocity children start with
+		std::vector<uint32_t> m_spawned;				//Indices of the particles spawned this frame, cleared by the emitter
+		std::vector<uint32_t> m_freeSlots;				//Particles that were dead when BeginSpawning ran, in index order
+		size_t			m_nextFreeSlot;
 		DirectX::XMFLOAT3 m_spawnPos;					//Position for spawning particles
 		float			m_spawnTime;					//An accumalative float which totals delta time and is decreased by spawning particles
 		float			m_emitInterval;					//Frequency of particle emission
-		EmissionBase():m_spawnPos(0.0f,0.0f,0.0f), m_spawnTime(0.0f), m_emitInterval(g_defaultEmitInterval)
-		{
-			srand(static_cast<unsigned>(time(nullptr)));
-		}
+		float			m_emitSpeed;					//Speed along the emitted direction given to new particles
+		EmissionBase():m_seed(static_cast<uint32_t>(time(nullptr))), m_spawnCount(0), m_eventSource(nullptr), m_particlesPerEvent(0), m_inheritVelocity(0.0f), m_nextFreeSlot(0), m_spawnPos(0.0f,0.0f,0.0f), m_spawnTime(0.0f), m_emitInterval(g_defaultEmitInterval), m_emitSpeed(g_defaultEmitSpeed)
+		{}
 	};
 
 	class ConeEmission: public EmissionBase				//Emits particles in cone shape 
@@ -49,6 +116,7 @@ namespace Emission_policies
 		float			m_maxAngle;	//Maximum angle of emission around the direction
 	protected:
 		void Emit(float deltaTime, std::vector<Particle>& particles)override{}
+		void Burst(const SpawnRequest& request, std::vector<Particle>& particles)override{}
 	public:
 		ConeEmission():EmissionBase(){}
 	};
@@ -57,8 +125,11 @@ namespace Emission_policies
 	{
 	protected:
 		void Emit(float deltaTime, std::vector<Particle>& particles) override;
+		void Burst(const SpawnRequest& request, std::vector<Particle>& particles) override;
 		SphereEmission():EmissionBase()
 		{}
+	private:
+		void SpawnParticles(int spawnCount, DirectX::XMFLOAT3 position, float speedScale, DirectX::XMFLOAT3 baseVelocity, std::vector<Particle>& particles);
 	};
 
 	class CircleEmission : public EmissionBase			//Emits particles in random directions on a plan defined by a normal vector
@@ -66,6 +137,7 @@ namespace Emission_policies
 		DirectX::XMFLOAT3 m_normal;		//The normal of the circle can be used to 
 	protected:
 		void Emit(float deltaTime, std::vector<Particle>& particles)override{};
+		void Burst(const SpawnRequest& request, std::vector<Particle>& particles)override{};
 	};
 }
 
@@ -79,12 +151,10 @@ namespace Update_policies			//These are used to define how the particles will mo
 	protected:
 		void UpdatePositions(float deltaTime, std::vector<Particle>& particles) {}
 	};
-	class Constant
+	class Constant					//Particles keep the velocity they were emitted with
 	{
-		float m_speed;				//The velocity of the particles when emitted
 	protected:
 		void UpdatePositions(float deltaTime, std::vector<Particle>& particles);
-		Constant() :m_speed(g_defualtSpeed) {};
 	};
 	class WithGravity
 	{
@@ -93,62 +163,321 @@ namespace Update_policies			//These are used to define how the particles will mo
 	protected:
 		void UpdatePositions(float deltaTime, std::vector<Particle>& particles){}
 	};
+
+	struct FluidParameters
+	{
+		float smoothingRadius = 1.0f;		//Interaction radius h of the SPH kernels
+		float particleMass = 1.0f;
+		float restDensity = 2.0f;			//Density the pressure term pushes the fluid towards
+		float stiffness = 20.0f;			//Gas constant turning density error into pressure
+		float viscosity = 0.5f;
+		float surfaceTension = 0.0f;		//Pairwise cohesion strength, 0 disables it
+		float gravity = -9.8f;
+		float maxTimeStep = 1.0f / 120.0f;	//Frames are split into substeps no longer than this
+	};
+	class SPHFluid						//Smoothed particle hydrodynamics, particles move as a fluid
+	{
+		FluidParameters			m_params;
+		SpatialGrid				m_grid;							//Neighbour search, rebuilt every substep
+		std::vector<uint32_t>	m_aliveIndices;					//Compact slot -> particle index
+		std::vector<float>		m_x, m_y, m_z;					//Compact SoA copies of the alive particles
+		std::vector<float>		m_vx, m_vy, m_vz;
+		std::vector<float>		m_sortedVX, m_sortedVY, m_sortedVZ;	//Velocities in grid sort order
+		std::vector<float>		m_density, m_pressure;			//In grid sort order
+		std::vector<float>		m_accX, m_accY, m_accZ;			//In grid sort order
+
+		void Step(float deltaTime);
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles);
+		SPHFluid() {};
+	public:
+		void SetFluidParameters(const FluidParameters& params) { m_params = params; }
+		const FluidParameters& GetFluidParameters()const { return m_params; }
+	};
+
+	//Integrates a compile time list of force terms from ForceTerms.h with an integrator from Integrators.h.
+	//The terms are summed for four particles at a time inside one loop, so adding a force costs
+	//its own arithmetic and nothing else. Get the parameters of a term with GetForce<Forces::Drag>()
+	//or, when a term is listed more than once, by position with GetForce<1>().
+	constexpr size_t g_forceStackGrain = 2048;		//Particles per worker chunk, a multiple of four
+	template<class Integrator, class... Terms>
+	class ForceIntegration
+	{
+		std::tuple<Terms...> m_forces;
+		Integrator m_integrator;
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+		{
+			using namespace DirectX;
+			if(deltaTime <= 0.0f)
+			{
+				return;
+			}
+			const XMVECTOR dt = XMVectorReplicate(deltaTime);
+			const auto accel = [this](const Float3x4& position, const Float3x4& velocity) { return AccumulateForces(m_forces, position, velocity); };
+			m_integrator.BeginStep(particles, deltaTime);
+			ThreadPool::Get().ParallelFor(0, particles.size(), g_forceStackGrain, [&](size_t begin, size_t end)
+				{
+					for(size_t first = begin; first < end; first += 4)
+					{
+						const size_t lanes = (std::min)(static_cast<size_t>(4), end - first);
+						XMFLOAT4A x, y, z, vx, vy, vz;
+						float* lane[6] = { &x.x, &y.x, &z.x, &vx.x, &vy.x, &vz.x };
+						bool alive(false);
+						for(size_t i = 0; i < 4; ++i)
+						{
+							const Particle& p = particles[first + (std::min)(i, lanes - 1)];		//Tail lanes repeat the last particle
+							lane[0][i] = p.position.x; lane[1][i] = p.position.y; lane[2][i] = p.position.z;
+							lane[3][i] = p.velocity.x; lane[4][i] = p.velocity.y; lane[5][i] = p.velocity.z;
+							alive |= i < lanes && p.alive;
+						}
+						if(!alive)
+						{
+							continue;
+						}
+
+						Float3x4 position = { XMLoadFloat4A(&x), XMLoadFloat4A(&y), XMLoadFloat4A(&z) };
+						Float3x4 velocity = { XMLoadFloat4A(&vx), XMLoadFloat4A(&vy), XMLoadFloat4A(&vz) };
+						m_integrator.Step(particles, first, position, velocity, dt, accel);
+						XMStoreFloat4A(&x, position.x); XMStoreFloat4A(&y, position.y); XMStoreFloat4A(&z, position.z);
+						XMStoreFloat4A(&vx, velocity.x); XMStoreFloat4A(&vy, velocity.y); XMStoreFloat4A(&vz, velocity.z);
+
+						for(size_t i = 0; i < lanes; ++i)
+						{
+							Particle& p = particles[first + i];
+							if(p.alive)
+							{
+								p.position = XMFLOAT3(lane[0][i], lane[1][i], lane[2][i]);
+								p.velocity = XMFLOAT3(lane[3][i], lane[4][i], lane[5][i]);
+								XMStoreFloat4x4(&p.render_item.World, XMMatrixTranslation(p.position.x, p.position.y, p.position.z));
+								p.render_item.NumFramesDirty = g_numFrameResources;
+							}
+						}
+					}
+				});
+		}
+	public:
+		template<size_t Index>
+		typename std::tuple_element<Index, std::tuple<Terms...>>::type& GetForce() { return std::get<Index>(m_forces); }
+		template<class Term>
+		Term& GetForce() { return std::get<Term>(m_forces); }
+	};
+	template<class... Terms>
+	using ForceStack = ForceIntegration<Integrators::SemiImplicitEuler, Terms...>;
+
+	template<class Motion>
+	class SceneCollision : public Motion		//Moves particles with another update policy, then pushes them out of the scene colliders
+	{
+		ColliderSet m_colliders;
+		ParticleEventBuffer m_collisionEvents;
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+		{
+			m_collisionEvents.Clear();
+			Motion::UpdatePositions(deltaTime, particles);
+			m_colliders.ResolveCollisions(particles, &m_collisionEvents);
+		}
+	public:
+		ColliderSet& GetColliders() { return m_colliders; }
+		ParticleEventBuffer& GetCollisionEvents() { return m_collisionEvents; }		//Off until given a capacity
+	};
+
+	template<class Motion>
+	class MeshCollision : public Motion		//Moves particles with another update policy, then sweeps them against a triangle mesh
+	{
+		MeshCollider m_mesh;
+		ParticleEventBuffer m_collisionEvents;
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+		{
+			m_collisionEvents.Clear();
+			m_mesh.BeginStep(particles);
+			Motion::UpdatePositions(deltaTime, particles);
+			m_mesh.ResolveCollisions(particles, &m_collisionEvents);
+		}
+	public:
+		MeshCollider& GetCollisionMesh() { return m_mesh; }
+		ParticleEventBuffer& GetCollisionEvents() { return m_collisionEvents; }		//Off until given a capacity
+	};
+
+	constexpr float g_defaultTurbulenceStrength = 4.0f;
+	template<class Motion>
+	class Turbulence : public Motion		//Pushes particles with a baked vector field, then moves them with another update policy
+	{
+		VectorField m_field;
+		float m_strength;					//Acceleration applied where the field has unit length
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+		{
+			m_field.Accelerate(particles, m_strength, deltaTime);
+			Motion::UpdatePositions(deltaTime, particles);
+		}
+		Turbulence() :m_strength(g_defaultTurbulenceStrength)
+		{ }
+	public:
+		VectorField& GetVectorField() { return m_field; }
+		void SetTurbulenceStrength(float strength) { m_strength = strength; }
+	};
+
+	template<class Motion>
+	class NBodyGravity : public Motion		//Particles attract each other through a Barnes-Hut tree, then move with another update policy
+	{
+		BarnesHutTree m_tree;				//Rebuilt every frame
+		NBodyParameters m_params;
+	protected:
+		void UpdatePositions(float deltaTime, std::vector<Particle>& particles)
+		{
+			m_tree.Accelerate(particles, m_params, deltaTime);
+			Motion::UpdatePositions(deltaTime, particles);
+		}
+	public:
+		void SetNBodyParameters(const NBodyParameters& params) { m_params = params; }
+		const NBodyParameters& GetNBodyParameters()const { return m_params; }
+	};
+}
+
+namespace Attribute_policies		//These are used to define where each particle's random attributes live between spawn and death
+{
+	class Hashed					//Only the seed is kept, attributes are hashed from it again whenever they're read
+	{
+	protected:
+		void AttributesSpawned(const std::vector<uint32_t>& spawned, const std::vector<Particle>& particles) {}
+		const ParticleAttributes* GetStoredAttributes()const { return nullptr; }
+	public:
+		ParticleAttributes GetAttributes(size_t index, const Particle& p)const { return ParticleRandom::Attributes(p.seed); }
+	};
+	class Stored					//Attributes are hashed once at spawn into a stream beside the particles, reads are loads for 16 more bytes a particle
+	{
+		std::vector<ParticleAttributes> m_attributes;		//Indexed like the particles
+	protected:
+		void AttributesSpawned(const std::vector<uint32_t>& spawned, const std::vector<Particle>& particles)
+		{
+			m_attributes.resize(particles.size());
+			for(uint32_t index : spawned)
+			{
+				m_attributes[index] = ParticleRandom::Attributes(particles[index].seed);
+			}
+		}
+		const ParticleAttributes* GetStoredAttributes()const { return m_attributes.data(); }
+	public:
+		ParticleAttributes GetAttributes(size_t index, const Particle& p)const { return m_attributes[index]; }
+	};
 }
 
 namespace Deletion_policies			//These are used to define how when particles are culled
 {
+	constexpr float g_defaultCurveLifeTime = 2.0f;
 	class DeletionBase
 	{
 	public:
 		virtual void SetSpawnPos(DirectX::XMFLOAT3 pos) { m_spawnPos = pos; };
 	protected:
 		virtual void DeleteParticles(float deltaTime, std::vector<Particle>& particles) = 0;
+		//Called every frame before DeleteParticles with the emitter clock and the particles spawned this frame
+		virtual void ParticlesSpawned(double now, const std::vector<uint32_t>& spawned, std::vector<Particle>& particles) {}
+		//Seconds the lifetime curves run over. Policies that don't cull by age play them over a default and hold the end.
+		virtual float GetLifeTime()const { return g_defaultCurveLifeTime; }
+		void Kill(Particle& p)						//Culls a particle, raising a death event first
+		{
+			m_deathEvents.Push(ParticleEventType::Death, p.position, p.velocity, p.seed);
+			p.Reset();
+		}
 		DirectX::XMFLOAT3 m_spawnPos;
+		ParticleEventBuffer m_deathEvents;			//Cleared by the emitter before every DeleteParticles
 	};
 	constexpr float g_defaultMaxLifeTime = 2.0f;
-	class LifeSpan : public DeletionBase
+	constexpr float g_expirySlotDuration = 1.0f / 60.0f;
+	class LifeSpan : public DeletionBase		//Particles are culled a fixed time after they spawn
 	{
-		float m_maxLifeTime;		//This is used to define how long, in seconds, a particle has before being culled
+		struct Expiry
+		{
+			uint32_t	index;
+			double		spawnTime;		//Stale entries, whose particle died some other way and respawned, don't match
+			int64_t		slot;			//Absolute slot, a bucket can also hold entries for later laps of the wheel
+		};
+		std::vector<std::vector<Expiry>> m_wheel;	//Timing wheel, particles are bucketed by the time slot they die in
+		int64_t	m_nextSlot;			//First slot that hasn't been fully expired yet
+		float	m_maxLifeTime;		//This is used to define how long, in seconds, a particle has before being culled
+		double	m_now;
+		bool	m_rescheduleAll;	//The lifetime changed, every alive particle needs a new slot
+
+		int64_t SlotOf(double time)const { return static_cast<int64_t>(time / g_expirySlotDuration); }
+		void ResizeWheel();
+		void Schedule(uint32_t index, const Particle& p);
+		bool Expire(const Expiry& e, std::vector<Particle>& particles, bool force);
 	protected:
 		void DeleteParticles(float deltaTime, std::vector<Particle>& particles) override;
-		LifeSpan() :m_maxLifeTime(g_defaultMaxLifeTime)
-		{}
+		void ParticlesSpawned(double now, const std::vector<uint32_t>& spawned, std::vector<Particle>& particles) override;
+		float GetLifeTime()const override { return m_maxLifeTime; }		//The curves end when the particle is culled
+		LifeSpan() :m_nextSlot(0), m_maxLifeTime(g_defaultMaxLifeTime), m_now(0.0), m_rescheduleAll(false)
+		{
+			ResizeWheel();
+		}
+	public:
+		void SetMaxLifeTime(float seconds) { m_maxLifeTime = seconds; m_rescheduleAll = true; }
 	};
+	constexpr float g_defaultBoundaryExtent = 3.0f;
 	class CubeBoundaries : public DeletionBase
 	{
-		struct Bounds
-		{
-			float xMin, xMax;
-			float yMin, yMax;
-			float zMin, zMax;
-			Bounds(DirectX::XMFLOAT3 init) :xMin(-init.x), xMax(init.x), yMin(-init.y), yMax(init.y), zMin(-init.z), zMax(init.z){};
-			Bounds() { memset(this, 0.0f, sizeof(Bounds)); }
-		}m_bounds;		//Defines how far in each direction a particle can travel before being culled
+		KillVolumeSet m_bounds;		//Box around the emitter, particles that leave it are culled
 	protected:
 		void DeleteParticles(float deltaTime, std::vector<Particle>& particles) override;
-		void SetSpawnPos(DirectX::XMFLOAT3 pos) override;
-		CubeBoundaries() :m_bounds(DirectX::XMFLOAT3{3.0f,3.0f,3.0f}){}
+		CubeBoundaries()
+		{
+			SetBoundaryExtents(DirectX::XMFLOAT3{ g_defaultBoundaryExtent, g_defaultBoundaryExtent, g_defaultBoundaryExtent });
+		}
+	public:
+		void SetBoundaryExtents(DirectX::XMFLOAT3 halfExtents)
+		{
+			m_bounds.Clear();
+			m_bounds.AddBox(DirectX::XMFLOAT3{ -halfExtents.x, -halfExtents.y, -halfExtents.z }, halfExtents, false);
+		}
 	};
 	class SphereBoundaries : public DeletionBase
 	{
-		float m_maxDistance;		//Defines how far a particle can travel from the emitted befor it is culled
+		KillVolumeSet m_bounds;		//Sphere around the emitter, particles further away than its radius are culled
 	protected:
-		void DeleteParticles(float deltaTime, std::vector<Particle>& particles) override {}
+		void DeleteParticles(float deltaTime, std::vector<Particle>& particles) override;
+		SphereBoundaries()
+		{
+			SetMaxDistance(g_defaultBoundaryExtent);
+		}
+	public:
+		void SetMaxDistance(float maxDistance)
+		{
+			m_bounds.Clear();
+			m_bounds.AddSphere(DirectX::XMFLOAT3{ 0.0f, 0.0f, 0.0f }, maxDistance, false);
+		}
+	};
+	class KillVolumes : public DeletionBase		//Any mix of spheres, boxes and half spaces, relative to the emitter
+	{
+		KillVolumeSet m_volumes;
+	protected:
+		void DeleteParticles(float deltaTime, std::vector<Particle>& particles) override;
+	public:
+		KillVolumeSet& GetKillVolumes() { return m_volumes; }
 	};
 }
 
 
-template<class Emission, class Update, class Deletion>
-class ParticleEmitter : public Emission, public Update, public Deletion
+template<class Emission, class Update, class Deletion, class Attributes = Attribute_policies::Hashed>
+class ParticleEmitter : public Emission, public Update, public Deletion, public Attributes
 {
 	std::vector<Particle>	m_vParticles;		//Stores the particle objects
+	SpawnQueue				m_spawnQueue;		//Burst requests pushed from other threads, drained at the start of Update
+	double					m_time;				//Emitter clock, particles store the time they were spawned. A float one stops
+												//resolving a frame's delta time once an effect has run for a few hours
+	LifetimeCurves			m_curves;			//Visual attributes over each particle's lifetime
+	std::vector<ParticleInstance> m_instances;	//Rewritten every Update once the curves are baked
+	ParticleTrails			m_trails;			//Off until given a length
 
 	using Emission::Emit;
+	using Emission::Burst;
 	using Update::UpdatePositions;
 	using Deletion::DeleteParticles;
 public:
 	ParticleEmitter()
-		:Emission(), m_vParticles(50)  //MOVE POLICY VALUES TO PUBLIC SETTERS
+		:Emission(), m_vParticles(50), m_time(0.0)  //MOVE POLICY VALUES TO PUBLIC SETTERS
 	{}
 
 	void Init(Particle initParticle, DirectX::XMFLOAT3 position)
@@ -163,9 +492,48 @@ public:
 	}
 	void Update(float deltaTime)
 	{
+		m_time += deltaTime;
+		Emission::m_spawned.clear();
+		Emission::BeginSpawning(m_vParticles);
+		m_spawnQueue.Drain([&](const SpawnRequest& request) { Burst(request, m_vParticles); });
+		Emission::EmitFromEvents(m_vParticles);
 		Emit(deltaTime, m_vParticles);
+		for(uint32_t index : Emission::m_spawned)
+		{
+			m_vParticles[index].spawnTime = m_time;
+		}
+		Attributes::AttributesSpawned(Emission::m_spawned, m_vParticles);
+		Deletion::ParticlesSpawned(m_time, Emission::m_spawned, m_vParticles);
 		UpdatePositions(deltaTime, m_vParticles);
+		Deletion::m_deathEvents.Clear();
 		DeleteParticles(deltaTime, m_vParticles);
+		m_curves.WriteInstances(m_vParticles, m_time, Deletion::GetLifeTime(), Attributes::GetStoredAttributes(), m_instances);
+		ApplyInstances();
+		m_trails.Record(m_vParticles, deltaTime);
+	}
+
+	//Folds the lifetime size and rotation of every alive particle into its world matrix and its colour
+	//into its tint, so the curves show on the meshes particles are drawn with. A mesh has no view axis,
+	//it turns about its own y axis instead.
+	void ApplyInstances()
+	{
+		if(m_instances.empty())
+		{
+			return;
+		}
+		size_t next(0);
+		for(Particle& p : m_vParticles)
+		{
+			if(!p.alive)
+			{
+				continue;
+			}
+			const ParticleInstance& instance = m_instances[next++];
+			DirectX::XMStoreFloat4x4(&p.render_item.World, DirectX::XMMatrixScaling(instance.size, instance.size, instance.size) *
+				DirectX::XMMatrixRotationY(instance.rotation) * DirectX::XMMatrixTranslation(instance.position.x, instance.position.y, instance.position.z));
+			DirectX::XMStoreFloat4(&p.render_item.Tint, DirectX::PackedVector::XMLoadUByteN4(&instance.color));
+			p.render_item.NumFramesDirty = g_numFrameResources;
+		}
 	}
 
 	void UpdateParticleCBs(UploadBuffer<ObjectConstants>* currObjectCB)
@@ -182,6 +550,8 @@ public:
 				ObjectConstants objConstants;
 				DirectX::XMStoreFloat4x4(&objConstants.World, DirectX::XMMatrixTranspose(world));
 				DirectX::XMStoreFloat4x4(&objConstants.TexTransform, DirectX::XMMatrixTranspose(texTransform));
+				objConstants.PosDecode = p.render_item.PosDecode;
+				objConstants.Tint = p.render_item.Tint;
 
 				currObjectCB->CopyData(p.render_item.ObjCBIndex, objConstants);
 
@@ -191,8 +561,9 @@ public:
 		}
 	}
 
+	//Each particle is drawn at the level of detail lodSelector picks for it
 	void DrawParticles(ID3D12GraphicsCommandList* cmdList,
-		ID3D12Resource* objCBResource, ID3D12Resource* matCBResource)
+		ID3D12Resource* objCBResource, ID3D12Resource* matCBResource, const LodSelector& lodSelector)
 	{
 		UINT objCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ObjectConstants));
 		UINT matCBByteSize = d3dUtil::CalcConstantBufferByteSize(sizeof(ToonMaterialConstants));
@@ -213,7 +584,10 @@ public:
 				cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
 				cmdList->SetGraphicsRootConstantBufferView(1, matCBAddress);
 
-				cmdList->DrawIndexedInstanced(p.render_item.IndexCount, 1, p.render_item.StartIndexLocation, p.render_item.BaseVertexLocation, 0);
+				if (const SubmeshGeometry* lod = lodSelector.Select(p.render_item))
+					cmdList->DrawIndexedInstanced(lod->IndexCount, 1, lod->StartIndexLocation, lod->BaseVertexLocation, 0);
+				else
+					cmdList->DrawIndexedInstanced(p.render_item.IndexCount, 1, p.render_item.StartIndexLocation, p.render_item.BaseVertexLocation, 0);
 
 			}
 		}
@@ -225,6 +599,9 @@ public:
 	void SetEmissionRate(){}  //TODO
 	void SetMaxParticles(){}  //TODO
 
+	//Thread safe and lock free, returns false if the queue is full and the request was dropped
+	bool RequestSpawn(const SpawnRequest& request) { return m_spawnQueue.Push(request); }
+
 	void SetPosition(DirectX::XMFLOAT3 newPos)
 	{
 		Emission::EmissionBase::SetSpawnPos(newPos);
@@ -232,4 +609,9 @@ public:
 	}
 
 	std::vector<Particle>& GetParticles() { return m_vParticles; }
+	double GetTime()const { return m_time; }
+	LifetimeCurves& GetLifetimeCurves() { return m_curves; }
+	ParticleEventBuffer& GetDeathEvents() { return Deletion::m_deathEvents; }		//Off until given a capacity
+	const std::vector<ParticleInstance>& GetInstances()const { return m_instances; }
+	ParticleTrails& GetTrails() { return m_trails; }
 };
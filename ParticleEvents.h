@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+
+#include <DirectXMath.h>
+
+enum class ParticleEventType : uint8_t
+{
+	Death,
+	Collision
+};
+
+struct ParticleEvent
+{
+	DirectX::XMFLOAT3	position;
+	DirectX::XMFLOAT3	velocity;		//Velocity of the particle when the event was raised
+	uint32_t			seed;			//Seed of the particle that raised it
+	ParticleEventType	type;
+};
+
+constexpr float g_minCollisionEventSpeed = 0.5f;		//Impacts that change the velocity less than this don't raise events, so resting particles stay quiet
+
+//Events raised by one emitter during a frame, for another emitter to spawn from.
+//Storage is only allocated by SetCapacity, never by the passes raising events, and events past the
+//capacity are dropped and counted. Push is lock free so parallel kill and collision passes can use it.
+//The capacity starts at 0, which turns events off.
+class ParticleEventBuffer
+{
+	std::vector<ParticleEvent>	m_events;
+	std::atomic<size_t>			m_count;		//Can run past the capacity, GetCount clamps it
+	std::atomic<size_t>			m_dropped;
+public:
+	ParticleEventBuffer() :m_count(0), m_dropped(0)
+	{}
+	ParticleEventBuffer(const ParticleEventBuffer& rhs) = delete;
+	ParticleEventBuffer& operator=(const ParticleEventBuffer& rhs) = delete;
+
+	void SetCapacity(size_t capacity) { m_events.resize(capacity); Clear(); }
+	size_t GetCapacity()const { return m_events.size(); }
+	bool IsEnabled()const { return !m_events.empty(); }
+
+	void Clear()
+	{
+		m_count.store(0, std::memory_order_relaxed);
+		m_dropped.store(0, std::memory_order_relaxed);
+	}
+
+	bool Push(ParticleEventType type, const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& velocity, uint32_t seed)
+	{
+		if(m_events.empty())
+		{
+			return false;
+		}
+		const size_t slot = m_count.fetch_add(1, std::memory_order_relaxed);
+		if(slot >= m_events.size())
+		{
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		m_events[slot] = { position, velocity, seed, type };
+		return true;
+	}
+
+	//Only valid once the pass that raised the events has finished
+	size_t GetCount()const { return (std::min)(m_count.load(std::memory_order_relaxed), m_events.size()); }
+	size_t GetDropped()const { return m_dropped.load(std::memory_order_relaxed); }
+	const ParticleEvent* begin()const { return m_events.data(); }
+	const ParticleEvent* end()const { return m_events.data() + GetCount(); }
+};
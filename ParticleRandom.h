@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include <DirectXMath.h>
+
+//Stateless per-particle randomness. A particle stores a 32 bit seed and every random attribute is
+//generated from the seed and a channel, so an effect replays identically from the same emitter seed.
+//Attribute_policies::Hashed regenerates them whenever they're needed, adding attributes adds no streams,
+//Attribute_policies::Stored keeps them beside the particles, for effects where reading them matters more than memory.
+enum class RandomChannel : uint32_t
+{
+	Direction = 0,
+	Speed,
+	Size,
+	Color,
+	Rotation,
+	AngularVelocity,
+	LifeTime,
+	User = 16			//First channel free for effect specific attributes
+};
+
+//The random attributes a particle is given when it spawns
+struct ParticleAttributes
+{
+	DirectX::XMFLOAT3	direction;		//Emission direction, the velocity starts along it
+	float				rotation;		//Radians added to the lifetime curve's rotation
+};
+
+namespace ParticleRandom
+{
+	//Integer finaliser with good avalanche, every input bit flips about half the output bits
+	inline uint32_t Hash(uint32_t x)
+	{
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t Hash(uint32_t seed, RandomChannel channel)
+	{
+		return Hash(seed + static_cast<uint32_t>(channel) * 0x9e3779b9u);
+	}
+
+	//Uniform in [0, 1), from the top 24 bits so every value is exactly representable
+	inline float Float(uint32_t seed, RandomChannel channel)
+	{
+		return static_cast<float>(Hash(seed, channel) >> 8) * (1.0f / 16777216.0f);
+	}
+
+	inline float Range(uint32_t seed, RandomChannel channel, float minValue, float maxValue)
+	{
+		return minValue + (maxValue - minValue) * Float(seed, channel);
+	}
+
+	//Uniform over the unit sphere, both coordinates come from one hash
+	inline DirectX::XMFLOAT3 UnitVector(uint32_t seed, RandomChannel channel)
+	{
+		const uint32_t h = Hash(seed, channel);
+		const float z = static_cast<float>(h >> 16) * (2.0f / 65536.0f) - 1.0f;
+		const float phi = static_cast<float>(h & 0xFFFFu) * (DirectX::XM_2PI / 65536.0f);
+		const float r = sqrtf((std::max)(0.0f, 1.0f - z * z));
+		float s, c;
+		DirectX::XMScalarSinCos(&s, &c, phi);
+		return DirectX::XMFLOAT3(r * c, r * s, z);
+	}
+
+	inline ParticleAttributes Attributes(uint32_t seed)
+	{
+		ParticleAttributes attributes;
+		attributes.direction = UnitVector(seed, RandomChannel::Direction);
+		attributes.rotation = Float(seed, RandomChannel::Rotation) * DirectX::XM_2PI;
+		return attributes;
+	}
+}
@@ -0,0 +1,177 @@
+#include "ParticleTrails.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr size_t g_trailGrain = 1024;		//Particles per worker chunk
+}
+
+ParticleTrails::ParticleTrails()
+	:m_length(0), m_sampleInterval(g_defaultTrailSampleInterval), m_sinceSample(0.0f)
+{}
+
+void ParticleTrails::SetLength(uint32_t samples)
+{
+	m_length = samples;
+	m_x.clear(); m_y.clear(); m_z.clear();
+	m_head.clear(); m_count.clear(); m_spawnStamp.clear();		//Reallocated on the next Record
+}
+
+void ParticleTrails::Record(const std::vector<Particle>& particles, float deltaTime)
+{
+	if(m_length == 0)
+	{
+		return;
+	}
+	m_sinceSample += deltaTime;
+	if(m_sinceSample < m_sampleInterval)
+	{
+		return;
+	}
+	m_sinceSample = fmodf(m_sinceSample, m_sampleInterval);
+
+	if(m_head.size() != particles.size())
+	{
+		const size_t samples = particles.size() * m_length;
+		m_x.resize(samples); m_y.resize(samples); m_z.resize(samples);
+		m_head.resize(particles.size(), 0);
+		m_count.resize(particles.size(), 0);
+		m_spawnStamp.resize(particles.size(), -1.0);		//Spawn times are never negative
+	}
+
+	ThreadPool::Get().ParallelFor(0, particles.size(), g_trailGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const Particle& p = particles[i];
+				if(!p.alive)
+				{
+					m_count[i] = 0;
+					continue;
+				}
+				if(m_spawnStamp[i] != p.spawnTime)
+				{
+					m_spawnStamp[i] = p.spawnTime;
+					m_count[i] = 0;
+				}
+				const size_t slot = i * m_length + m_head[i];
+				m_x[slot] = p.position.x;
+				m_y[slot] = p.position.y;
+				m_z[slot] = p.position.z;
+				m_head[i] = (m_head[i] + 1) % m_length;
+				m_count[i] = (std::min)(m_count[i] + 1, m_length);
+			}
+		});
+}
+
+std::vector<uint32_t> ParticleTrails::BuildIndices(size_t maxTrails, uint32_t length)
+{
+	std::vector<uint32_t> indices;
+	if(length < 2)
+	{
+		return indices;
+	}
+	indices.reserve(maxTrails * 6 * (length - 1));
+	for(size_t trail = 0; trail < maxTrails; ++trail)
+	{
+		const uint32_t base = static_cast<uint32_t>(trail * 2 * length);
+		for(uint32_t i = 0; i + 1 < length; ++i)
+		{
+			const uint32_t a = base + 2 * i;		//Left and right of sample i, then of sample i + 1
+			indices.push_back(a);
+			indices.push_back(a + 1);
+			indices.push_back(a + 2);
+			indices.push_back(a + 2);
+			indices.push_back(a + 1);
+			indices.push_back(a + 3);
+		}
+	}
+	return indices;
+}
+
+size_t ParticleTrails::WriteRibbons(const std::vector<Particle>& particles, FXMVECTOR eyePos, float halfWidth, RibbonVertex* out, size_t maxTrails)const
+{
+	if(m_length < 2 || m_head.size() != particles.size() || maxTrails == 0)
+	{
+		return 0;
+	}
+	ThreadPool& pool = ThreadPool::Get();
+
+	//Count the trails in each chunk first so every chunk knows where its ribbons start
+	const size_t chunks = (particles.size() + g_trailGrain - 1) / g_trailGrain;
+	m_chunkOffsets.assign(chunks + 1, 0);
+	pool.ParallelFor(0, chunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+		{
+			for(size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+			{
+				size_t count(0);
+				const size_t end = (std::min)((chunk + 1) * g_trailGrain, particles.size());
+				for(size_t i = chunk * g_trailGrain; i < end; ++i)
+				{
+					count += particles[i].alive && m_count[i] > 0;
+				}
+				m_chunkOffsets[chunk + 1] = count;
+			}
+		});
+	for(size_t chunk = 0; chunk < chunks; ++chunk)
+	{
+		m_chunkOffsets[chunk + 1] += m_chunkOffsets[chunk];
+	}
+	const size_t trails = (std::min)(m_chunkOffsets[chunks], maxTrails);
+
+	const float toU = 1.0f / (m_length - 1);
+	const XMVECTOR width = XMVectorReplicate(halfWidth);
+	pool.ParallelFor(0, chunks, 1, [&](size_t chunkBegin, size_t chunkEnd)
+		{
+			for(size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk)
+			{
+				size_t trail = m_chunkOffsets[chunk];
+				const size_t end = (std::min)((chunk + 1) * g_trailGrain, particles.size());
+				for(size_t i = chunk * g_trailGrain; i < end && trail < trails; ++i)
+				{
+					if(!particles[i].alive || m_count[i] == 0)
+					{
+						continue;
+					}
+					const uint32_t last = m_count[i] - 1;
+					auto sample = [&](uint32_t age)
+					{
+						const size_t slot = Slot(i, (std::min)(age, last));
+						return XMVectorSet(m_x[slot], m_y[slot], m_z[slot], 0.0f);
+					};
+					//The ribbon starts at the particle as it is now, samples lag it by up to a sample interval.
+					//A sample taken this frame sits on the head and is skipped.
+					const XMVECTOR head = XMLoadFloat3(&particles[i].position);
+					const uint32_t skip = XMVector3Equal(head, sample(0)) ? 1 : 0;
+					auto point = [&](uint32_t index)
+					{
+						return index == 0 ? head : sample(index - 1 + skip);
+					};
+
+					//Vertices are written strictly in order, upload memory is write combined
+					RibbonVertex* v = out + trail * GetVerticesPerTrail();
+					XMVECTOR prev = head, current = prev, next = point(1);
+					for(uint32_t age = 0; age < m_length; ++age)
+					{
+						const XMVECTOR tangent = prev - next;
+						const XMVECTOR side = XMVector3Normalize(XMVector3Cross(tangent, eyePos - current)) * width;
+						const float u = age * toU;
+						XMStoreFloat3(&v->position, current - side);
+						v->uv = XMFLOAT2(u, 0.0f);
+						++v;
+						XMStoreFloat3(&v->position, current + side);
+						v->uv = XMFLOAT2(u, 1.0f);
+						++v;
+						prev = current;
+						current = next;
+						next = point(age + 2);
+					}
+					++trail;
+				}
+			}
+		});
+	return trails;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+struct Particle;
+
+struct RibbonVertex
+{
+	DirectX::XMFLOAT3	position;
+	DirectX::XMFLOAT2	uv;			//u runs from 0 at the particle to 1 at the end of its trail, v is 0 or 1 across it
+};
+
+constexpr float g_defaultTrailSampleInterval = 1.0f / 30.0f;
+
+//Ring buffers of past positions for every particle, kept in their own SoA block so particles that
+//don't draw trails pay nothing. Each particle owns a fixed run of slots and a fixed range of ribbon
+//vertices, so the index buffer never changes and can be built once for the maximum particle count.
+class ParticleTrails
+{
+	std::vector<float>		m_x, m_y, m_z;			//m_length samples per particle, the oldest is overwritten first
+	std::vector<uint32_t>	m_head;					//Slot the next sample of each particle goes in
+	std::vector<uint32_t>	m_count;				//Samples recorded since the particle spawned, up to m_length
+	std::vector<double>		m_spawnStamp;			//Spawn time the history belongs to, so reused slots start over
+	mutable std::vector<size_t> m_chunkOffsets;		//Scratch for compacting the alive trails in parallel
+	uint32_t				m_length;				//Samples per trail, 0 turns trails off
+	float					m_sampleInterval;		//Seconds between samples
+	float					m_sinceSample;
+
+	size_t Slot(size_t particle, uint32_t age)const		//age 0 is the newest sample
+	{
+		return particle * m_length + (m_head[particle] + m_length - 1 - age) % m_length;
+	}
+public:
+	ParticleTrails();
+
+	void SetLength(uint32_t samples);
+	uint32_t GetLength()const { return m_length; }
+	void SetSampleInterval(float seconds) { m_sampleInterval = seconds; }
+
+	//Pushes the position of every alive particle once per sample interval
+	void Record(const std::vector<Particle>& particles, float deltaTime);
+
+	size_t GetVerticesPerTrail()const { return 2 * static_cast<size_t>(m_length); }
+	size_t GetIndicesPerTrail()const { return m_length > 1 ? 6 * static_cast<size_t>(m_length - 1) : 0; }
+	//Triangle list indices for maxTrails ribbons written by WriteRibbons, build once and reuse
+	static std::vector<uint32_t> BuildIndices(size_t maxTrails, uint32_t length);
+
+	//Writes a camera facing ribbon for every alive particle with a trail into out, which is meant to be
+	//mapped upload memory with room for maxTrails * GetVerticesPerTrail() vertices. Each ribbon runs from
+	//the particle's current position back through its recorded samples. Trails that haven't
+	//filled yet repeat their oldest sample, which only adds degenerate triangles. Returns the number of
+	//trails written, draw GetIndicesPerTrail() indices for each.
+	size_t WriteRibbons(const std::vector<Particle>& particles, DirectX::FXMVECTOR eyePos, float halfWidth, RibbonVertex* out, size_t maxTrails)const;
+};
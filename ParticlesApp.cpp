@@ -10,6 +10,11 @@
 #include "Common/GeometryGenerator.h"
 
 #include "ParticleEmitter.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ShapeLibrary.h"
+#include "Benchmarks.h"
 
 using Microsoft::WRL::ComPtr;
 using namespace DirectX;
@@ -19,7 +24,8 @@ using namespace DirectX::PackedVector;
 #pragma comment(lib, "D3D12.lib")
 
 typedef ParticleEmitter<Emission_policies::SphereEmission,
-	Update_policies::Constant, Deletion_policies::CubeBoundaries> BasicParticleEmitter;
+	Update_policies::SceneCollision<Update_policies::Constant>, Deletion_policies::CubeBoundaries> BasicParticleEmitter;
+typedef ParticleEmitter<Emission_policies::SphereEmission, Update_policies::Constant, Deletion_policies::LifeSpan> SparkEmitter;
 
 class ParticlesApp : public D3DApp
 {
@@ -46,11 +52,13 @@ private:
 	void UpdateObjectCBs(const GameTimer& gt);
 	void UpdateMaterialCBs(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
+	void UpdateTrails(const GameTimer& gt);
 
     void BuildRootSignature();
     void BuildShadersAndInputLayout();
     void BuildShapeGeometry();
 	void BuildSkullGeometry();
+	void BuildTrailGeometry();
     void BuildPSOs();
     void BuildFrameResources();
     void BuildMaterials();
@@ -70,24 +78,42 @@ private:
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
+	ShapeLibrary mShapeLibrary;
 	std::unordered_map<std::string, std::unique_ptr<ToonMaterial>> mMaterials;
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
+	std::unordered_map<std::string, std::vector<Meshlet>> mMeshlets;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
 
     std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;
+    std::vector<D3D12_INPUT_ELEMENT_DESC> mTrailInputLayout;
 
     ComPtr<ID3D12PipelineState> mOpaquePSO = nullptr;
+    ComPtr<ID3D12PipelineState> mTrailPSO = nullptr;
  
 	// List of all the render items.
 	std::vector<std::unique_ptr<RenderItem>> mAllRitems;
 
 	BasicParticleEmitter mParticleEmitter;
 
+	// Spawns a few short lived sparks wherever a particle of mParticleEmitter dies.
+	SparkEmitter mSparkEmitter;
+	bool mBurstKeyDown = false;
+
 	// Render items divided by PSO.
 	std::vector<RenderItem*> mOpaqueRitems;
+	std::vector<RenderItem*> mTrailRitems;
+
+	// Ribbons behind the emitter's particles, its vertices are rewritten every frame.
+	RenderItem* mTrailRitem = nullptr;
 
     PassConstants mMainPassCB;
 
+	// Picks the levels of detail drawn this frame, follows the camera.
+	LodSelector mLodSelector;
+
+	// Meshlets left after culling, reused between render items.
+	std::vector<IndexRange> mVisibleRanges;
+
 	XMFLOAT3 mEyePos = { 0.0f, 0.0f, 0.0f };
 	XMFLOAT4X4 mView = MathHelper::Identity4x4();
 	XMFLOAT4X4 mProj = MathHelper::Identity4x4();
@@ -107,6 +133,15 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 #endif
 
+    // Report the benchmarks instead of opening the window.
+    if(strstr(cmdLine, "-benchmark") != nullptr)
+    {
+        const std::string report = RunBenchmarks();
+        OutputDebugStringA(report.c_str());
+        MessageBoxA(nullptr, report.c_str(), "Benchmarks", MB_OK);
+        return 0;
+    }
+
     try
     {
         ParticlesApp theApp(hInstance);
@@ -149,6 +184,7 @@ bool ParticlesApp::Initialize()
     BuildShadersAndInputLayout();
     BuildShapeGeometry();
 	BuildSkullGeometry();
+	BuildTrailGeometry();
 	BuildMaterials();
     BuildRenderItems();
     BuildFrameResources();
@@ -193,7 +229,10 @@ void ParticlesApp::Update(const GameTimer& gt)
         CloseHandle(eventHandle);
     }
 
+	// The sparks spawn from this frame's deaths, so the emitter they come from has to update first.
 	mParticleEmitter.Update(gt.DeltaTime());
+	mSparkEmitter.Update(gt.DeltaTime());
+	UpdateTrails(gt);
 	AnimateMaterials(gt);
 	UpdateObjectCBs(gt);
 	UpdateMaterialCBs(gt);
@@ -232,7 +271,12 @@ void ParticlesApp::Draw(const GameTimer& gt)
 	mCommandList->SetGraphicsRootConstantBufferView(2, passCB->GetGPUVirtualAddress());
 
     DrawRenderItems(mCommandList.Get(), mOpaqueRitems);
-	mParticleEmitter.DrawParticles(mCommandList.Get(), mCurrFrameResource->ObjectCB->Resource(), mCurrFrameResource->MaterialCB->Resource());
+	mParticleEmitter.DrawParticles(mCommandList.Get(), mCurrFrameResource->ObjectCB->Resource(), mCurrFrameResource->MaterialCB->Resource(), mLodSelector);
+	mSparkEmitter.DrawParticles(mCommandList.Get(), mCurrFrameResource->ObjectCB->Resource(), mCurrFrameResource->MaterialCB->Resource(), mLodSelector);
+
+	// Trails are blended last, over everything they pass in front of.
+	mCommandList->SetPipelineState(mTrailPSO.Get());
+	DrawRenderItems(mCommandList.Get(), mTrailRitems);
 
     // Indicate a state transition on the resource usage.
 	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(CurrentBackBuffer(),
@@ -305,6 +349,11 @@ void ParticlesApp::OnMouseMove(WPARAM btnState, int x, int y)
  
 void ParticlesApp::OnKeyboardInput(const GameTimer& gt)
 {
+	// B queues a burst from the emitter, once per press.
+	const bool burstKey = (GetAsyncKeyState('B') & 0x8000) != 0;
+	if(burstKey && !mBurstKeyDown)
+		mParticleEmitter.RequestSpawn(SpawnRequest(XMFLOAT3(0.0f, 6.0f, -3.0f), 20, 1.5f));
+	mBurstKeyDown = burstKey;
 }
  
 void ParticlesApp::UpdateCamera(const GameTimer& gt)
@@ -343,6 +392,8 @@ void ParticlesApp::UpdateObjectCBs(const GameTimer& gt)
 			ObjectConstants objConstants;
 			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
 			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
+			objConstants.PosDecode = e->PosDecode;
+			objConstants.Tint = e->Tint;
 
 			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
 
@@ -352,6 +403,7 @@ void ParticlesApp::UpdateObjectCBs(const GameTimer& gt)
 	}
 
 	mParticleEmitter.UpdateParticleCBs(currObjectCB);
+	mSparkEmitter.UpdateParticleCBs(currObjectCB);
 }
 
 void ParticlesApp::UpdateMaterialCBs(const GameTimer& gt)
@@ -408,10 +460,25 @@ void ParticlesApp::UpdateMainPassCB(const GameTimer& gt)
 	mMainPassCB.Lights[0].Direction = { 0.57735f, -0.57735f, 0.57735f };
 	mMainPassCB.Lights[0].Strength = { 0.8f, 0.8f, 0.8f };
 
+	mLodSelector.EyePosW = mEyePos;
+	mLodSelector.ProjectionScale = 0.5f * mClientHeight * mProj._22;
+
 	auto currPassCB = mCurrFrameResource->PassCB.get();
 	currPassCB->CopyData(0, mMainPassCB);
 }
 
+void ParticlesApp::UpdateTrails(const GameTimer& gt)
+{
+	// Rebuilt into this frame's vertex buffer, the GPU may still be reading the others.
+	auto currTrailVB = mCurrFrameResource->TrailVB.get();
+	const ParticleTrails& trails = mParticleEmitter.GetTrails();
+	const size_t trailCount = trails.WriteRibbons(mParticleEmitter.GetParticles(), XMLoadFloat3(&mEyePos), 0.1f,
+		currTrailVB->MappedElements(), mParticleEmitter.GetParticles().size());
+
+	mTrailRitem->Geo->VertexBufferGPU = currTrailVB->Resource();
+	mTrailRitem->IndexCount = (UINT)(trailCount * trails.GetIndicesPerTrail());
+}
+
 void ParticlesApp::BuildRootSignature()
 {
 	// Root parameter can be a table, root descriptor or root constants.
@@ -453,209 +520,172 @@ void ParticlesApp::BuildShadersAndInputLayout()
 		NULL, NULL
 	};
 
-	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "VS", "vs_5_1");
+	const D3D_SHADER_MACRO packedVertexDefines[] =
+	{
+		"PACKED_VERTEX", "1",
+		NULL, NULL
+	};
+
+	mShaders["standardVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", packedVertexDefines, "VS", "vs_5_1");
 	mShaders["opaquePS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "PS", "ps_5_1");
+	mShaders["trailVS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "RibbonVS", "vs_5_1");
+	mShaders["trailPS"] = d3dUtil::CompileShader(L"Shaders\\Default.hlsl", nullptr, "RibbonPS", "ps_5_1");
 	
-    mInputLayout =
-    {
-        { "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        { "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-    };
+	// Generated from the vertex struct, so the declaration can't drift from what's in the buffers.
+    mInputLayout = InputLayout<PackedVertex>();
+    mTrailInputLayout = InputLayout<RibbonVertex>();
 }
 
 void ParticlesApp::BuildShapeGeometry()
 {
-    GeometryGenerator geoGen;
-	GeometryGenerator::MeshData box = geoGen.CreateBox(1.5f, 0.5f, 1.5f, 3);
-	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
-	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
-	GeometryGenerator::MeshData cylinder = geoGen.CreateCylinder(0.5f, 0.3f, 3.0f, 20, 20);
-
-	//
-	// We are concatenating all the geometry into one big vertex/index buffer.  So
-	// define the regions in the buffer each submesh covers.
-	//
-
-	// Cache the vertex offsets to each object in the concatenated vertex buffer.
-	UINT boxVertexOffset = 0;
-	UINT gridVertexOffset = (UINT)box.Vertices.size();
-	UINT sphereVertexOffset = gridVertexOffset + (UINT)grid.Vertices.size();
-	UINT cylinderVertexOffset = sphereVertexOffset + (UINT)sphere.Vertices.size();
-
-	// Cache the starting index for each object in the concatenated index buffer.
-	UINT boxIndexOffset = 0;
-	UINT gridIndexOffset = (UINT)box.Indices32.size();
-	UINT sphereIndexOffset = gridIndexOffset + (UINT)grid.Indices32.size();
-	UINT cylinderIndexOffset = sphereIndexOffset + (UINT)sphere.Indices32.size();
-
-	SubmeshGeometry boxSubmesh;
-	boxSubmesh.IndexCount = (UINT)box.Indices32.size();
-	boxSubmesh.StartIndexLocation = boxIndexOffset;
-	boxSubmesh.BaseVertexLocation = boxVertexOffset;
-
-	SubmeshGeometry gridSubmesh;
-	gridSubmesh.IndexCount = (UINT)grid.Indices32.size();
-	gridSubmesh.StartIndexLocation = gridIndexOffset;
-	gridSubmesh.BaseVertexLocation = gridVertexOffset;
-
-	SubmeshGeometry sphereSubmesh;
-	sphereSubmesh.IndexCount = (UINT)sphere.Indices32.size();
-	sphereSubmesh.StartIndexLocation = sphereIndexOffset;
-	sphereSubmesh.BaseVertexLocation = sphereVertexOffset;
-
-	SubmeshGeometry cylinderSubmesh;
-	cylinderSubmesh.IndexCount = (UINT)cylinder.Indices32.size();
-	cylinderSubmesh.StartIndexLocation = cylinderIndexOffset;
-	cylinderSubmesh.BaseVertexLocation = cylinderVertexOffset;
-
-	//
-	// Extract the vertex elements we are interested in and pack the
-	// vertices of all the meshes into one vertex buffer.
-	//
-
-	auto totalVertexCount =
-		box.Vertices.size() +
-		grid.Vertices.size() +
-		sphere.Vertices.size() +
-		cylinder.Vertices.size();
+	// The library sizes each shape as it's asked for and hands out its region of the pooled buffers, then
+	// generates every distinct one straight into them on Build.  Asking again for a shape, from here or an
+	// emitter, finds the same region.
+	const ShapeRegion box = mShapeLibrary.Box<PackedVertex>(1.5f, 0.5f, 1.5f);
+	const ShapeRegion grid = mShapeLibrary.Grid<PackedVertex>(20.0f, 30.0f, 60, 40);
+	const ShapeRegion sphere = mShapeLibrary.Sphere<PackedVertex>(0.5f, 20, 20);
+	const ShapeRegion cylinder = mShapeLibrary.Cylinder<PackedVertex>(0.5f, 0.3f, 3.0f, 20, 20);
+	const SubmeshGeometry& gridSubmesh = grid.submesh;
+	const SubmeshGeometry& sphereSubmesh = sphere.submesh;
+
+	// The grid is split into meshlets so the parts off screen aren't drawn, from the float copy the library
+	// writes it from.
+	const GeometryGenerator::MeshData& gridMesh = mShapeLibrary.GetMeshData(grid);
+
+	// Every particle is a sphere and most are a few pixels across, so the sphere gets levels of detail.
+	// They're simplified from the library's float copy, which numbers its vertices the same as the packed
+	// one, and go after the shapes in the index buffer.
+	const GeometryGenerator::MeshData& sphereMesh = mShapeLibrary.GetMeshData(sphere);
+	std::vector<std::uint32_t> sphereLodIndices = sphereMesh.Indices32;
+	const std::vector<LodLevel> sphereLods = BuildLodChain(sphereLodIndices, sphereLodIndices.size(),
+		&sphereMesh.Vertices[0].Position.x, &sphereMesh.Vertices[0].Normal.x, sizeof(GeometryGenerator::Vertex), sphereMesh.Vertices.size(),
+		{ sphereSubmesh.IndexCount / 6, sphereSubmesh.IndexCount / 12, sphereSubmesh.IndexCount / 24 });
+	const UINT sphereLodIndexOffset = mShapeLibrary.ReserveIndices<PackedVertex>((UINT)(sphereLodIndices.size() - sphereSubmesh.IndexCount));
+
+	// The library reorders each shape for the vertex cache before handing over the indices.  The
+	// levels come out of BuildLodChain already optimized.
+	auto geo = mShapeLibrary.Build<PackedVertex>(md3dDevice.Get(), mCommandList.Get(), "shapeGeo", [&](std::uint16_t* indices)
+	{
+		mMeshlets["grid"] = BuildMeshlets(&indices[gridSubmesh.StartIndexLocation], gridSubmesh.IndexCount, &gridMesh.Vertices[0].Position.x,
+			sizeof(GeometryGenerator::Vertex), gridMesh.Vertices.size());
 
-	std::vector<Vertex> vertices(totalVertexCount);
+		std::transform(sphereLodIndices.begin() + sphereSubmesh.IndexCount, sphereLodIndices.end(), &indices[sphereLodIndexOffset],
+			[](std::uint32_t i) { return static_cast<std::uint16_t>(i); });
+	});
 
-	UINT k = 0;
-	for(size_t i = 0; i < box.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = box.Vertices[i].Position;
-		vertices[k].Normal = box.Vertices[i].Normal;
-	}
+	geo->DrawArgs["box"] = box.submesh;
+	geo->DrawArgs["grid"] = gridSubmesh;
+	geo->DrawArgs["sphere"] = sphereSubmesh;
+	geo->DrawArgs["cylinder"] = cylinder.submesh;
 
-	for(size_t i = 0; i < grid.Vertices.size(); ++i, ++k)
+	geo->Lods["sphere"].push_back(sphereSubmesh);
+	for(size_t i = 0; i < sphereLods.size(); ++i)
 	{
-		vertices[k].Pos = grid.Vertices[i].Position;
-		vertices[k].Normal = grid.Vertices[i].Normal;
+		SubmeshGeometry lodSubmesh = sphereSubmesh;
+		lodSubmesh.IndexCount = sphereLods[i].indexCount;
+		lodSubmesh.StartIndexLocation = sphereLodIndexOffset + sphereLods[i].startIndex - sphereSubmesh.IndexCount;
+		lodSubmesh.LodError = sphereLods[i].error;
+		geo->DrawArgs["sphere_lod" + std::to_string(i + 1)] = lodSubmesh;
+		geo->Lods["sphere"].push_back(lodSubmesh);
 	}
 
-	for(size_t i = 0; i < sphere.Vertices.size(); ++i, ++k)
-	{
-		vertices[k].Pos = sphere.Vertices[i].Position;
-		vertices[k].Normal = sphere.Vertices[i].Normal;
-	}
+	mGeometries[geo->Name] = std::move(geo);
+}
 
-	for(size_t i = 0; i < cylinder.Vertices.size(); ++i, ++k)
+void ParticlesApp::BuildSkullGeometry()
+{
+	// The text model is converted to a binary cache the first time it's loaded, after that
+	// the index stream is mapped and uploaded as it is and the vertices are packed on the way.
+	MappedMesh mesh;
+	std::string error;
+	if(!OpenCachedModel("Models/skull.txt", mesh, &error))
 	{
-		vertices[k].Pos = cylinder.Vertices[i].Position;
-		vertices[k].Normal = cylinder.Vertices[i].Normal;
+		MessageBox(0, AnsiToWString(error).c_str(), 0, 0);
+		return;
 	}
 
-	std::vector<std::uint16_t> indices;
-	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
-	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
-	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
-	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
+	const MeshFileHeader& header = mesh.GetHeader();
+	const UINT ibByteSize = mesh.GetIndexBufferByteSize();
 
-    const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-    const UINT ibByteSize = (UINT)indices.size()  * sizeof(std::uint16_t);
+	// The file's bounds cover the mesh and its levels of detail, quantize across them.
+	BoundingBox bounds;
+	BoundingBox::CreateFromPoints(bounds, XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(header.boundsMin)),
+		XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(header.boundsMax)));
+	std::vector<PackedVertex> vertices(header.vertexCount);
+	EncodeVertices(static_cast<const ModelVertex*>(mesh.GetVertices()), header.vertexCount, bounds, vertices.data());
+	const UINT vbByteSize = (UINT)vertices.size() * sizeof(PackedVertex);
 
 	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "shapeGeo";
+	geo->Name = "skullGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
 	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), mesh.GetIndices(), ibByteSize);
 
 	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+		mCommandList.Get(), mesh.GetIndices(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexByteStride = sizeof(PackedVertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
+	geo->IndexFormat = header.indexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
+	geo->PositionFormat = VertexFormat<PackedVertex>::k_elements[0].format;
 
-	geo->DrawArgs["box"] = boxSubmesh;
-	geo->DrawArgs["grid"] = gridSubmesh;
-	geo->DrawArgs["sphere"] = sphereSubmesh;
-	geo->DrawArgs["cylinder"] = cylinderSubmesh;
-
-	mGeometries[geo->Name] = std::move(geo);
-}
-
-void ParticlesApp::BuildSkullGeometry()
-{
-	std::ifstream fin("Models/skull.txt");
-
-	if(!fin)
-	{
-		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
-		return;
-	}
-
-	UINT vcount = 0;
-	UINT tcount = 0;
-	std::string ignore;
-
-	fin >> ignore >> vcount;
-	fin >> ignore >> tcount;
-	fin >> ignore >> ignore >> ignore >> ignore;
-
-	std::vector<Vertex> vertices(vcount);
-	for(UINT i = 0; i < vcount; ++i)
-	{
-		fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
-		fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
-	}
-
-	fin >> ignore;
-	fin >> ignore;
-	fin >> ignore;
-
-	std::vector<std::int32_t> indices(3 * tcount);
-	for(UINT i = 0; i < tcount; ++i)
+	for(uint32_t i = 0; i < header.submeshCount; ++i)
 	{
-		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
+		const MeshFileSubmesh& file = mesh.GetSubmeshes()[i];
+		SubmeshGeometry submesh;
+		submesh.IndexCount = file.indexCount;
+		submesh.StartIndexLocation = file.startIndex;
+		submesh.BaseVertexLocation = file.baseVertex;
+		submesh.Bounds = bounds;
+		submesh.LodError = file.lodError;
+		geo->DrawArgs[file.name] = submesh;
+
+		// The full mesh comes first and its levels of detail follow it, coarsest last.
+		geo->Lods[mesh.GetSubmeshes()[0].name].push_back(submesh);
 	}
 
-	fin.close();
+	// The cache splits the full mesh into meshlets, its triangles are already in their order.
+	mMeshlets["skull"].assign(mesh.GetMeshlets(), mesh.GetMeshlets() + header.meshletCount);
+	OutputDebugStringA(DescribeMeshletCulling("Models/skull.txt", mesh.GetMeshlets(), header.meshletCount).c_str());
 
-	//
-	// Pack the indices of all the meshes into one index buffer.
-	//
-
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
+	mGeometries[geo->Name] = std::move(geo);
+}
 
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
+void ParticlesApp::BuildTrailGeometry()
+{
+	// Every particle owns a fixed range of ribbon vertices, so the indices are built once for all of them
+	// and only the vertices are streamed, from the frame resources.
+	ParticleTrails& trails = mParticleEmitter.GetTrails();
+	trails.SetLength(12);
+	const size_t maxTrails = mParticleEmitter.GetParticles().size();
+	std::vector<uint32_t> indices = ParticleTrails::BuildIndices(maxTrails, trails.GetLength());
+	const UINT ibByteSize = (UINT)indices.size() * sizeof(uint32_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
-	geo->Name = "skullGeo";
+	geo->Name = "trailGeo";
 
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	// Set dynamically.
+	geo->VertexBufferCPU = nullptr;
+	geo->VertexBufferGPU = nullptr;
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
-
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexByteStride = sizeof(Vertex);
-	geo->VertexBufferByteSize = vbByteSize;
+	geo->VertexByteStride = sizeof(RibbonVertex);
+	geo->VertexBufferByteSize = (UINT)(maxTrails * trails.GetVerticesPerTrail() * sizeof(RibbonVertex));
 	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-
-	geo->DrawArgs["skull"] = submesh;
-
 	mGeometries[geo->Name] = std::move(geo);
 }
 
@@ -690,6 +720,42 @@ void ParticlesApp::BuildPSOs()
 	opaquePsoDesc.SampleDesc.Quality = m4xMsaaState ? (m4xMsaaQuality - 1) : 0;
 	opaquePsoDesc.DSVFormat = mDepthStencilFormat;
     ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&opaquePsoDesc, IID_PPV_ARGS(&mOpaquePSO)));
+
+	//
+	// PSO for particle trails.
+	//
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC trailPsoDesc = opaquePsoDesc;
+	trailPsoDesc.InputLayout = { mTrailInputLayout.data(), (UINT)mTrailInputLayout.size() };
+	trailPsoDesc.VS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["trailVS"]->GetBufferPointer()),
+		mShaders["trailVS"]->GetBufferSize()
+	};
+	trailPsoDesc.PS =
+	{
+		reinterpret_cast<BYTE*>(mShaders["trailPS"]->GetBufferPointer()),
+		mShaders["trailPS"]->GetBufferSize()
+	};
+
+	// Ribbons turn to face the camera, so either winding can show.
+	trailPsoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+
+	D3D12_RENDER_TARGET_BLEND_DESC trailBlendDesc;
+	trailBlendDesc.BlendEnable = true;
+	trailBlendDesc.LogicOpEnable = false;
+	trailBlendDesc.SrcBlend = D3D12_BLEND_SRC_ALPHA;
+	trailBlendDesc.DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
+	trailBlendDesc.BlendOp = D3D12_BLEND_OP_ADD;
+	trailBlendDesc.SrcBlendAlpha = D3D12_BLEND_ONE;
+	trailBlendDesc.DestBlendAlpha = D3D12_BLEND_ZERO;
+	trailBlendDesc.BlendOpAlpha = D3D12_BLEND_OP_ADD;
+	trailBlendDesc.LogicOp = D3D12_LOGIC_OP_NOOP;
+	trailBlendDesc.RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
+	trailPsoDesc.BlendState.RenderTarget[0] = trailBlendDesc;
+
+	// Tested against the scene but not written, so overlapping trails don't cut into each other.
+	trailPsoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	ThrowIfFailed(md3dDevice->CreateGraphicsPipelineState(&trailPsoDesc, IID_PPV_ARGS(&mTrailPSO)));
 }
 
 void ParticlesApp::BuildFrameResources()
@@ -697,7 +763,8 @@ void ParticlesApp::BuildFrameResources()
     for(int i = 0; i < g_numFrameResources; ++i)
     {
         mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
-            1, (UINT)mAllRitems.size() +(UINT)mParticleEmitter.GetParticles().size(), (UINT)mMaterials.size()));
+            1, (UINT)mAllRitems.size() + (UINT)mParticleEmitter.GetParticles().size() + (UINT)mSparkEmitter.GetParticles().size(),
+            (UINT)mMaterials.size(), (UINT)mGeometries["trailGeo"]->VertexBufferByteSize / sizeof(RibbonVertex)));
     }
 }
 
@@ -745,12 +812,21 @@ void ParticlesApp::BuildMaterials()
 	skullMat->FresnelR0 = XMFLOAT3(0.05f, 0.05f, 0.05);
 	skullMat->Roughness = 0.3f;
 	skullMat->OutlineThreshold = 0.2f;
+
+	auto trail0 = std::make_unique<ToonMaterial>();
+	trail0->Name = "trail0";
+	trail0->MatCBIndex = 5;
+	trail0->DiffuseSrvHeapIndex = 4;
+	trail0->DiffuseAlbedo = XMFLOAT4(1.0f, 0.6f, 0.2f, 0.6f);
+	trail0->FresnelR0 = XMFLOAT3(0.02f, 0.02f, 0.02f);
+	trail0->Roughness = 1.0f;
 	
 	mMaterials["bricks0"] = std::move(bricks0);
 	mMaterials["stone0"] = std::move(stone0);
 	mMaterials["stone1"] = std::move(stone1);
 	mMaterials["tile0"] = std::move(tile0);
 	mMaterials["skullMat"] = std::move(skullMat);
+	mMaterials["trail0"] = std::move(trail0);
 }
 
 void ParticlesApp::BuildRenderItems()
@@ -778,6 +854,8 @@ void ParticlesApp::BuildRenderItems()
 	gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
 	gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
 	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	gridRitem->PosDecode = PositionDecode(gridRitem->Geo->DrawArgs["grid"].Bounds);
+	gridRitem->Meshlets = &mMeshlets["grid"];
 	mAllRitems.push_back(std::move(gridRitem));
 
 	//auto skullRitem = std::make_unique<RenderItem>();
@@ -790,6 +868,9 @@ void ParticlesApp::BuildRenderItems()
 	//skullRitem->IndexCount = skullRitem->Geo->DrawArgs["skull"].IndexCount;
 	//skullRitem->StartIndexLocation = skullRitem->Geo->DrawArgs["skull"].StartIndexLocation;
 	//skullRitem->BaseVertexLocation = skullRitem->Geo->DrawArgs["skull"].BaseVertexLocation;
+	//skullRitem->PosDecode = PositionDecode(skullRitem->Geo->DrawArgs["skull"].Bounds);
+	//skullRitem->Lods = &skullRitem->Geo->Lods["skull"];
+	//skullRitem->Meshlets = &mMeshlets["skull"];
 	//mAllRitems.push_back(std::move(skullRitem));
 
 	//XMMATRIX brickTexTransform = XMMatrixScaling(1.0f, 1.0f, 1.0f);
@@ -867,8 +948,47 @@ void ParticlesApp::BuildRenderItems()
 	initParticle.render_item.IndexCount = initParticle.render_item.Geo->DrawArgs["sphere"].IndexCount;
 	initParticle.render_item.StartIndexLocation = initParticle.render_item.Geo->DrawArgs["sphere"].StartIndexLocation;
 	initParticle.render_item.BaseVertexLocation = initParticle.render_item.Geo->DrawArgs["sphere"].BaseVertexLocation;
+	initParticle.render_item.PosDecode = PositionDecode(initParticle.render_item.Geo->DrawArgs["sphere"].Bounds);
+	initParticle.render_item.Lods = &initParticle.render_item.Geo->Lods["sphere"];
 
 	mParticleEmitter.Init(initParticle, XMFLOAT3(0.0f, 6.0f, -3.0f));
+
+	// Particles swell in, cool from white through orange to a dark red and spin up as they age.
+	LifetimeCurves& curves = mParticleEmitter.GetLifetimeCurves();
+	curves.SetSize({ { 0.0f, 0.3f }, { 0.15f, 1.0f }, { 1.0f, 0.5f } });
+	curves.SetColor({ { 0.0f, XMFLOAT3(1.0f, 1.0f, 1.0f) }, { 0.4f, XMFLOAT3(1.0f, 0.6f, 0.2f) }, { 1.0f, XMFLOAT3(0.5f, 0.1f, 0.1f) } });
+	curves.SetAngularVelocity({ { 0.0f, 0.0f }, { 1.0f, 2.0f * XM_PI } });
+	curves.Bake();
+
+	// Keep the particles above the ground grid.
+	mParticleEmitter.GetColliders().AddPlane(XMFLOAT3(0.0f, 1.0f, 0.0f), 0.0f);
+
+	// Every particle that leaves the emitter's bounds bursts into sparks, which only spawn from those deaths.
+	// Their constant buffers follow the emitter's.
+	mParticleEmitter.GetDeathEvents().SetCapacity(mParticleEmitter.GetParticles().size());
+	initParticle.render_item.ObjCBIndex += (UINT)mParticleEmitter.GetParticles().size();
+	mSparkEmitter.GetParticles().resize(200);
+	mSparkEmitter.Init(initParticle, XMFLOAT3(0.0f, 6.0f, -3.0f));
+	mSparkEmitter.SetEmitInterval(0.0f);
+	mSparkEmitter.SetEmitSpeed(3.0f);
+	mSparkEmitter.SetMaxLifeTime(0.6f);
+	mSparkEmitter.SetEventSource(&mParticleEmitter.GetDeathEvents(), 4, 0.5f);
+
+	LifetimeCurves& sparkCurves = mSparkEmitter.GetLifetimeCurves();
+	sparkCurves.SetSize({ { 0.0f, 0.35f }, { 1.0f, 0.05f } });
+	sparkCurves.SetColor({ { 0.0f, XMFLOAT3(1.0f, 1.0f, 0.6f) }, { 1.0f, XMFLOAT3(1.0f, 0.4f, 0.0f) } });
+	sparkCurves.Bake();
+
+	// The trail's vertices are already in world space. Its index count is set as the ribbons are written.
+	initParticle.render_item.ObjCBIndex += (UINT)mSparkEmitter.GetParticles().size();
+	auto trailRitem = std::make_unique<RenderItem>();
+	trailRitem->ObjCBIndex = initParticle.render_item.ObjCBIndex;
+	trailRitem->Mat = mMaterials["trail0"].get();
+	trailRitem->Geo = mGeometries["trailGeo"].get();
+	trailRitem->PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+	mTrailRitem = trailRitem.get();
+	mTrailRitems.push_back(trailRitem.get());
+	mAllRitems.push_back(std::move(trailRitem));
 }
 
 void ParticlesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
@@ -879,6 +999,8 @@ void ParticlesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std
 	auto objectCB = mCurrFrameResource->ObjectCB->Resource();
 	auto matCB = mCurrFrameResource->MaterialCB->Resource();
 
+	XMMATRIX viewProj = XMMatrixMultiply(XMLoadFloat4x4(&mView), XMLoadFloat4x4(&mProj));
+
     // For each render item...
     for(size_t i = 0; i < ritems.size(); ++i)
     {
@@ -894,7 +1016,19 @@ void ParticlesApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std
         cmdList->SetGraphicsRootConstantBufferView(0, objCBAddress);
 		cmdList->SetGraphicsRootConstantBufferView(1, matCBAddress);
 
-        cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+        // Only the full submesh is split into meshlets, coarser levels are drawn whole.
+        const SubmeshGeometry* lod = mLodSelector.Select(*ri);
+        if(ri->Meshlets != nullptr && (lod == nullptr || lod == &ri->Lods->front()))
+        {
+            mVisibleRanges.clear();
+            CullMeshlets(ri->Meshlets->data(), ri->Meshlets->size(), MeshletCullView(XMLoadFloat4x4(&ri->World), viewProj, mEyePos), mVisibleRanges);
+            for(const IndexRange& range : mVisibleRanges)
+                cmdList->DrawIndexedInstanced(range.indexCount, 1, ri->StartIndexLocation + range.startIndex, ri->BaseVertexLocation, 0);
+        }
+        else if(lod != nullptr)
+            cmdList->DrawIndexedInstanced(lod->IndexCount, 1, lod->StartIndexLocation, lod->BaseVertexLocation, 0);
+        else
+            cmdList->DrawIndexedInstanced(ri->IndexCount, 1, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
     }
 }
 
@@ -0,0 +1,458 @@
+#include "SceneColliders.h"
+#include "ParticleEmitter.h"
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr uint32_t g_maxCellsPerCollider = 512;		//Bigger colliders skip the grid and are always tested
+	constexpr uint32_t g_minColliderBuckets = 64;
+	const XMVECTORF32 g_colliderLaneIndex = { { { 0.0f, 1.0f, 2.0f, 3.0f } } };
+
+	struct ParticleBatch				//Four particles in SoA form
+	{
+		XMVECTOR x, y, z;
+		XMVECTOR vx, vy, vz;
+		XMVECTOR moved;
+	};
+
+	struct Contact
+	{
+		XMVECTOR hit;
+		XMVECTOR nx, ny, nz;			//Unit normal pointing out of the collider
+		XMVECTOR depth;					//How far to push the particle along the normal
+	};
+
+	inline XMVECTOR Dot3(FXMVECTOR ax, FXMVECTOR ay, FXMVECTOR az, GXMVECTOR bx, HXMVECTOR by, HXMVECTOR bz)
+	{
+		return ax * bx + ay * by + az * bz;
+	}
+
+	void Respond(ParticleBatch& b, const Contact& c, float restitution, float friction)
+	{
+		b.x = XMVectorSelect(b.x, b.x + c.nx * c.depth, c.hit);
+		b.y = XMVectorSelect(b.y, b.y + c.ny * c.depth, c.hit);
+		b.z = XMVectorSelect(b.z, b.z + c.nz * c.depth, c.hit);
+
+		//Only reflect particles moving into the surface, ones already leaving keep their velocity
+		const XMVECTOR vn = Dot3(b.vx, b.vy, b.vz, c.nx, c.ny, c.nz);
+		const XMVECTOR approaching = XMVectorAndInt(c.hit, XMVectorLess(vn, XMVectorZero()));
+		const XMVECTOR keepTangent = XMVectorReplicate(1.0f - friction);
+		const XMVECTOR bounce = vn * XMVectorReplicate(-restitution);
+		b.vx = XMVectorSelect(b.vx, (b.vx - vn * c.nx) * keepTangent + bounce * c.nx, approaching);
+		b.vy = XMVectorSelect(b.vy, (b.vy - vn * c.ny) * keepTangent + bounce * c.ny, approaching);
+		b.vz = XMVectorSelect(b.vz, (b.vz - vn * c.nz) * keepTangent + bounce * c.nz, approaching);
+		b.moved = XMVectorOrInt(b.moved, c.hit);
+	}
+
+	Contact PlaneContact(const ParticleBatch& b, const Collider& col, FXMVECTOR radius)
+	{
+		Contact c;
+		c.nx = XMVectorReplicate(col.a.x);
+		c.ny = XMVectorReplicate(col.a.y);
+		c.nz = XMVectorReplicate(col.a.z);
+		const XMVECTOR dist = Dot3(b.x, b.y, b.z, c.nx, c.ny, c.nz) + XMVectorReplicate(col.radius);
+		c.depth = radius - dist;
+		c.hit = XMVectorGreater(c.depth, XMVectorZero());
+		return c;
+	}
+
+	//Sphere around a per lane centre, shared by spheres and capsules
+	Contact PointContact(const ParticleBatch& b, FXMVECTOR cx, FXMVECTOR cy, FXMVECTOR cz, GXMVECTOR reach)
+	{
+		Contact c;
+		const XMVECTOR dx = b.x - cx;
+		const XMVECTOR dy = b.y - cy;
+		const XMVECTOR dz = b.z - cz;
+		const XMVECTOR lenSq = Dot3(dx, dy, dz, dx, dy, dz);
+		const XMVECTOR len = XMVectorSqrt(lenSq);
+		const XMVECTOR invLen = XMVectorReciprocal(len);
+		c.nx = dx * invLen;
+		c.ny = dy * invLen;
+		c.nz = dz * invLen;
+		c.depth = reach - len;
+		c.hit = XMVectorAndInt(XMVectorGreater(c.depth, XMVectorZero()), XMVectorGreater(lenSq, XMVectorReplicate(1e-12f)));
+		return c;
+	}
+
+	Contact SphereContact(const ParticleBatch& b, const Collider& col, FXMVECTOR radius)
+	{
+		return PointContact(b, XMVectorReplicate(col.a.x), XMVectorReplicate(col.a.y), XMVectorReplicate(col.a.z),
+			XMVectorReplicate(col.radius) + radius);
+	}
+
+	Contact CapsuleContact(const ParticleBatch& b, const Collider& col, FXMVECTOR radius)
+	{
+		const XMVECTOR abx = XMVectorReplicate(col.b.x - col.a.x);
+		const XMVECTOR aby = XMVectorReplicate(col.b.y - col.a.y);
+		const XMVECTOR abz = XMVectorReplicate(col.b.z - col.a.z);
+		const XMVECTOR ax = XMVectorReplicate(col.a.x);
+		const XMVECTOR ay = XMVectorReplicate(col.a.y);
+		const XMVECTOR az = XMVectorReplicate(col.a.z);
+		const float lengthSq = (std::max)(XMVectorGetX(Dot3(abx, aby, abz, abx, aby, abz)), 1e-12f);
+
+		const XMVECTOR t = XMVectorSaturate(Dot3(b.x - ax, b.y - ay, b.z - az, abx, aby, abz) * XMVectorReplicate(1.0f / lengthSq));
+		return PointContact(b, ax + abx * t, ay + aby * t, az + abz * t, XMVectorReplicate(col.radius) + radius);
+	}
+
+	//Box centred on the origin with half extents e, positions given in box space
+	Contact LocalBoxContact(FXMVECTOR px, FXMVECTOR py, FXMVECTOR pz, const XMFLOAT3& e, GXMVECTOR radius)
+	{
+		const XMVECTOR zero = XMVectorZero();
+		const XMVECTOR ex = XMVectorReplicate(e.x);
+		const XMVECTOR ey = XMVectorReplicate(e.y);
+		const XMVECTOR ez = XMVectorReplicate(e.z);
+
+		//Centre outside the box: push away from the closest point on the surface
+		const XMVECTOR dx = px - XMVectorClamp(px, -ex, ex);
+		const XMVECTOR dy = py - XMVectorClamp(py, -ey, ey);
+		const XMVECTOR dz = pz - XMVectorClamp(pz, -ez, ez);
+		const XMVECTOR lenSq = Dot3(dx, dy, dz, dx, dy, dz);
+		const XMVECTOR outside = XMVectorGreater(lenSq, XMVectorReplicate(1e-12f));
+		const XMVECTOR len = XMVectorSqrt(lenSq);
+		const XMVECTOR invLen = XMVectorReciprocal(len);
+
+		//Centre inside the box: leave through the nearest face
+		XMVECTOR faceDist = ex - px;
+		XMVECTOR inx = XMVectorSplatOne(), iny = zero, inz = zero;
+		XMVECTOR dist = ex + px;
+		XMVECTOR closer = XMVectorLess(dist, faceDist);
+		faceDist = XMVectorSelect(faceDist, dist, closer);
+		inx = XMVectorSelect(inx, -XMVectorSplatOne(), closer);
+		const XMVECTOR otherFaces[4] = { ey - py, ey + py, ez - pz, ez + pz };		//+y, -y, +z, -z
+		for(int face = 0; face < 4; ++face)
+		{
+			const float sign = (face & 1) ? -1.0f : 1.0f;
+			closer = XMVectorLess(otherFaces[face], faceDist);
+			faceDist = XMVectorSelect(faceDist, otherFaces[face], closer);
+			inx = XMVectorSelect(inx, zero, closer);
+			iny = XMVectorSelect(iny, face < 2 ? XMVectorReplicate(sign) : zero, closer);
+			inz = XMVectorSelect(inz, face < 2 ? zero : XMVectorReplicate(sign), closer);
+		}
+
+		Contact c;
+		c.nx = XMVectorSelect(inx, dx * invLen, outside);
+		c.ny = XMVectorSelect(iny, dy * invLen, outside);
+		c.nz = XMVectorSelect(inz, dz * invLen, outside);
+		c.depth = XMVectorSelect(faceDist + radius, radius - len, outside);
+		c.hit = XMVectorGreater(c.depth, zero);
+		return c;
+	}
+
+	Contact BoxContact(const ParticleBatch& b, const Collider& col, FXMVECTOR radius)
+	{
+		return LocalBoxContact(b.x - XMVectorReplicate(col.a.x), b.y - XMVectorReplicate(col.a.y), b.z - XMVectorReplicate(col.a.z), col.b, radius);
+	}
+
+	Contact OrientedBoxContact(const ParticleBatch& b, const Collider& col, FXMVECTOR radius)
+	{
+		const XMVECTOR rx = b.x - XMVectorReplicate(col.a.x);
+		const XMVECTOR ry = b.y - XMVectorReplicate(col.a.y);
+		const XMVECTOR rz = b.z - XMVectorReplicate(col.a.z);
+		XMVECTOR local[3];
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			local[axis] = Dot3(rx, ry, rz, XMVectorReplicate(col.axes[axis].x), XMVectorReplicate(col.axes[axis].y), XMVectorReplicate(col.axes[axis].z));
+		}
+		Contact c = LocalBoxContact(local[0], local[1], local[2], col.b, radius);
+
+		//Normal back to world space
+		const XMVECTOR lx = c.nx, ly = c.ny, lz = c.nz;
+		const XMFLOAT3* ax = col.axes;
+		c.nx = lx * XMVectorReplicate(ax[0].x) + ly * XMVectorReplicate(ax[1].x) + lz * XMVectorReplicate(ax[2].x);
+		c.ny = lx * XMVectorReplicate(ax[0].y) + ly * XMVectorReplicate(ax[1].y) + lz * XMVectorReplicate(ax[2].y);
+		c.nz = lx * XMVectorReplicate(ax[0].z) + ly * XMVectorReplicate(ax[1].z) + lz * XMVectorReplicate(ax[2].z);
+		return c;
+	}
+
+	uint32_t NextPowerOfTwo(uint32_t v)
+	{
+		--v;
+		v |= v >> 1;
+		v |= v >> 2;
+		v |= v >> 4;
+		v |= v >> 8;
+		v |= v >> 16;
+		return v + 1;
+	}
+}
+
+ColliderSet::ColliderSet()
+	:m_batchStamp(0), m_bucketMask(0), m_cellSize(4.0f), m_particleRadius(g_defaultParticleRadius), m_dirty(true)
+{}
+
+uint32_t ColliderSet::Add(const Collider& collider)
+{
+	m_colliders.push_back(collider);
+	m_dirty = true;
+	return static_cast<uint32_t>(m_colliders.size() - 1);
+}
+
+uint32_t ColliderSet::AddPlane(XMFLOAT3 normal, float offset, float restitution, float friction)
+{
+	Collider c = {};
+	c.type = ColliderType::Plane;
+	const float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+	c.a = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+	c.radius = offset / length;
+	c.restitution = restitution;
+	c.friction = friction;
+	return Add(c);
+}
+
+uint32_t ColliderSet::AddSphere(XMFLOAT3 centre, float radius, float restitution, float friction)
+{
+	Collider c = {};
+	c.type = ColliderType::Sphere;
+	c.a = centre;
+	c.radius = radius;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.boundsMin = XMFLOAT3(centre.x - radius, centre.y - radius, centre.z - radius);
+	c.boundsMax = XMFLOAT3(centre.x + radius, centre.y + radius, centre.z + radius);
+	return Add(c);
+}
+
+uint32_t ColliderSet::AddBox(XMFLOAT3 minCorner, XMFLOAT3 maxCorner, float restitution, float friction)
+{
+	Collider c = {};
+	c.type = ColliderType::Box;
+	c.a = XMFLOAT3(0.5f * (minCorner.x + maxCorner.x), 0.5f * (minCorner.y + maxCorner.y), 0.5f * (minCorner.z + maxCorner.z));
+	c.b = XMFLOAT3(0.5f * (maxCorner.x - minCorner.x), 0.5f * (maxCorner.y - minCorner.y), 0.5f * (maxCorner.z - minCorner.z));
+	c.restitution = restitution;
+	c.friction = friction;
+	c.boundsMin = minCorner;
+	c.boundsMax = maxCorner;
+	return Add(c);
+}
+
+uint32_t ColliderSet::AddOrientedBox(XMFLOAT3 centre, XMFLOAT3 extents, XMFLOAT4 orientation, float restitution, float friction)
+{
+	Collider c = {};
+	c.type = ColliderType::OrientedBox;
+	c.a = centre;
+	c.b = extents;
+	c.restitution = restitution;
+	c.friction = friction;
+
+	const XMMATRIX rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&orientation));
+	XMFLOAT3 worldExtents(0.0f, 0.0f, 0.0f);
+	const float e[3] = { extents.x, extents.y, extents.z };
+	for(int axis = 0; axis < 3; ++axis)
+	{
+		XMStoreFloat3(&c.axes[axis], rotation.r[axis]);
+		worldExtents.x += fabsf(c.axes[axis].x) * e[axis];
+		worldExtents.y += fabsf(c.axes[axis].y) * e[axis];
+		worldExtents.z += fabsf(c.axes[axis].z) * e[axis];
+	}
+	c.boundsMin = XMFLOAT3(centre.x - worldExtents.x, centre.y - worldExtents.y, centre.z - worldExtents.z);
+	c.boundsMax = XMFLOAT3(centre.x + worldExtents.x, centre.y + worldExtents.y, centre.z + worldExtents.z);
+	return Add(c);
+}
+
+uint32_t ColliderSet::AddCapsule(XMFLOAT3 start, XMFLOAT3 end, float radius, float restitution, float friction)
+{
+	Collider c = {};
+	c.type = ColliderType::Capsule;
+	c.a = start;
+	c.b = end;
+	c.radius = radius;
+	c.restitution = restitution;
+	c.friction = friction;
+	c.boundsMin = XMFLOAT3((std::min)(start.x, end.x) - radius, (std::min)(start.y, end.y) - radius, (std::min)(start.z, end.z) - radius);
+	c.boundsMax = XMFLOAT3((std::max)(start.x, end.x) + radius, (std::max)(start.y, end.y) + radius, (std::max)(start.z, end.z) + radius);
+	return Add(c);
+}
+
+void ColliderSet::Clear()
+{
+	m_colliders.clear();
+	m_dirty = true;
+}
+
+void ColliderSet::BuildBroadPhase()
+{
+	m_planes.clear();
+	m_lastBatch.assign(m_colliders.size(), 0);
+	m_batchStamp = 0;
+
+	//Count how many cells each bounded collider covers so the CSR arrays can be sized up front
+	std::vector<uint32_t> cellCounts(m_colliders.size(), 0);
+	uint32_t entries(0);
+	for(size_t i = 0; i < m_colliders.size(); ++i)
+	{
+		const Collider& c = m_colliders[i];
+		if(c.type == ColliderType::Plane)
+		{
+			m_planes.push_back(static_cast<uint32_t>(i));
+			continue;
+		}
+		const uint64_t cells =
+			static_cast<uint64_t>(CellCoord(c.boundsMax.x + m_particleRadius) - CellCoord(c.boundsMin.x - m_particleRadius) + 1) *
+			static_cast<uint64_t>(CellCoord(c.boundsMax.y + m_particleRadius) - CellCoord(c.boundsMin.y - m_particleRadius) + 1) *
+			static_cast<uint64_t>(CellCoord(c.boundsMax.z + m_particleRadius) - CellCoord(c.boundsMin.z - m_particleRadius) + 1);
+		if(cells > g_maxCellsPerCollider)
+		{
+			m_planes.push_back(static_cast<uint32_t>(i));
+			continue;
+		}
+		cellCounts[i] = static_cast<uint32_t>(cells);
+		entries += cellCounts[i];
+	}
+
+	const uint32_t buckets = (std::max)(g_minColliderBuckets, NextPowerOfTwo((std::max)(entries * 2, 1u)));
+	m_bucketMask = buckets - 1;
+	m_bucketStart.assign(static_cast<size_t>(buckets) + 1, 0);
+	m_bucketColliders.resize(entries);
+
+	auto forEachCell = [&](const Collider& c, auto&& func)
+	{
+		for(int32_t cz = CellCoord(c.boundsMin.z - m_particleRadius); cz <= CellCoord(c.boundsMax.z + m_particleRadius); ++cz)
+			for(int32_t cy = CellCoord(c.boundsMin.y - m_particleRadius); cy <= CellCoord(c.boundsMax.y + m_particleRadius); ++cy)
+				for(int32_t cx = CellCoord(c.boundsMin.x - m_particleRadius); cx <= CellCoord(c.boundsMax.x + m_particleRadius); ++cx)
+					func(HashCell(cx, cy, cz));
+	};
+
+	for(size_t i = 0; i < m_colliders.size(); ++i)
+	{
+		if(cellCounts[i] != 0)
+		{
+			forEachCell(m_colliders[i], [&](uint32_t bucket) { ++m_bucketStart[bucket + 1]; });
+		}
+	}
+	for(uint32_t b = 0; b < buckets; ++b)
+	{
+		m_bucketStart[b + 1] += m_bucketStart[b];
+	}
+	std::vector<uint32_t> cursor(m_bucketStart.begin(), m_bucketStart.end() - 1);
+	for(size_t i = 0; i < m_colliders.size(); ++i)
+	{
+		if(cellCounts[i] != 0)
+		{
+			forEachCell(m_colliders[i], [&](uint32_t bucket) { m_bucketColliders[cursor[bucket]++] = static_cast<uint32_t>(i); });
+		}
+	}
+	m_dirty = false;
+}
+
+void ColliderSet::ResolveCollisions(std::vector<Particle>& particles, ParticleEventBuffer* events)
+{
+	if(m_colliders.empty())
+	{
+		return;
+	}
+	if(m_dirty)
+	{
+		BuildBroadPhase();
+	}
+
+	m_aliveIndices.clear();
+	for(size_t i = 0; i < particles.size(); ++i)
+	{
+		if(particles[i].alive)
+		{
+			m_aliveIndices.push_back(static_cast<uint32_t>(i));
+		}
+	}
+	const size_t count = m_aliveIndices.size();
+	const size_t padded = (count + 3) & ~static_cast<size_t>(3);
+	m_x.resize(padded); m_y.resize(padded); m_z.resize(padded);
+	m_vx.resize(padded); m_vy.resize(padded); m_vz.resize(padded);
+	for(size_t slot = 0; slot < padded; ++slot)
+	{
+		const Particle& p = particles[m_aliveIndices[(std::min)(slot, count - 1)]];	//Padding lanes repeat the last particle
+		m_x[slot] = p.position.x; m_y[slot] = p.position.y; m_z[slot] = p.position.z;
+		m_vx[slot] = p.velocity.x; m_vy[slot] = p.velocity.y; m_vz[slot] = p.velocity.z;
+	}
+
+	const XMVECTOR radius = XMVectorReplicate(m_particleRadius);
+	for(size_t first = 0; first < count; first += 4)
+	{
+		const size_t lanes = (std::min)(count - first, static_cast<size_t>(4));
+
+		//Broad phase: unbounded colliders plus whatever shares a cell with one of the four particles
+		m_candidates.assign(m_planes.begin(), m_planes.end());
+		if(++m_batchStamp == 0)
+		{
+			//Wrapped, clear the stamps so none of them matches by accident
+			std::fill(m_lastBatch.begin(), m_lastBatch.end(), 0);
+			m_batchStamp = 1;
+		}
+		const uint32_t stamp = m_batchStamp;
+		for(size_t lane = 0; lane < lanes; ++lane)
+		{
+			const size_t slot = first + lane;
+			const uint32_t bucket = HashCell(CellCoord(m_x[slot]), CellCoord(m_y[slot]), CellCoord(m_z[slot]));
+			for(uint32_t k = m_bucketStart[bucket]; k < m_bucketStart[bucket + 1]; ++k)
+			{
+				const uint32_t collider = m_bucketColliders[k];
+				if(m_lastBatch[collider] != stamp)
+				{
+					m_lastBatch[collider] = stamp;
+					m_candidates.push_back(collider);
+				}
+			}
+		}
+		if(m_candidates.empty())
+		{
+			continue;
+		}
+
+		ParticleBatch b;
+		b.x = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_x[first]));
+		b.y = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_y[first]));
+		b.z = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_z[first]));
+		b.vx = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_vx[first]));
+		b.vy = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_vy[first]));
+		b.vz = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&m_vz[first]));
+		b.moved = XMVectorZero();
+
+		for(uint32_t index : m_candidates)
+		{
+			const Collider& col = m_colliders[index];
+			Contact c;
+			switch(col.type)
+			{
+			case ColliderType::Plane:		c = PlaneContact(b, col, radius); break;
+			case ColliderType::Sphere:		c = SphereContact(b, col, radius); break;
+			case ColliderType::Box:			c = BoxContact(b, col, radius); break;
+			case ColliderType::OrientedBox:	c = OrientedBoxContact(b, col, radius); break;
+			case ColliderType::Capsule:		c = CapsuleContact(b, col, radius); break;
+			}
+			Respond(b, c, col.restitution, col.friction);
+		}
+
+		XMVECTORU32 moved;
+		moved.v = XMVectorAndInt(b.moved, XMVectorLess(g_colliderLaneIndex, XMVectorReplicate(static_cast<float>(lanes))));
+		if((moved.u[0] | moved.u[1] | moved.u[2] | moved.u[3]) == 0)
+		{
+			continue;
+		}
+		XMFLOAT4 x, y, z, vx, vy, vz;
+		XMStoreFloat4(&x, b.x); XMStoreFloat4(&y, b.y); XMStoreFloat4(&z, b.z);
+		XMStoreFloat4(&vx, b.vx); XMStoreFloat4(&vy, b.vy); XMStoreFloat4(&vz, b.vz);
+		const float* laneX = &x.x; const float* laneY = &y.x; const float* laneZ = &z.x;
+		const float* laneVX = &vx.x; const float* laneVY = &vy.x; const float* laneVZ = &vz.x;
+		for(size_t lane = 0; lane < lanes; ++lane)
+		{
+			if(moved.u[lane] == 0)
+			{
+				continue;
+			}
+			Particle& p = particles[m_aliveIndices[first + lane]];
+			p.position = XMFLOAT3(laneX[lane], laneY[lane], laneZ[lane]);
+			if(events != nullptr)
+			{
+				const size_t slot = first + lane;
+				const float dvx = laneVX[lane] - m_vx[slot], dvy = laneVY[lane] - m_vy[slot], dvz = laneVZ[lane] - m_vz[slot];
+				if(dvx * dvx + dvy * dvy + dvz * dvz > g_minCollisionEventSpeed * g_minCollisionEventSpeed)
+				{
+					events->Push(ParticleEventType::Collision, p.position, p.velocity, p.seed);		//Velocity going into the impact
+				}
+			}
+			p.velocity = XMFLOAT3(laneVX[lane], laneVY[lane], laneVZ[lane]);
+			XMStoreFloat4x4(&p.render_item.World, XMMatrixTranslation(p.position.x, p.position.y, p.position.z));
+			p.render_item.NumFramesDirty = g_numFrameResources;
+		}
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+#include <DirectXMath.h>
+
+struct Particle;
+class ParticleEventBuffer;
+
+enum class ColliderType : uint8_t
+{
+	Plane,			//Half space, particles are kept on the side the normal points to
+	Sphere,
+	Box,			//Axis aligned box
+	OrientedBox,
+	Capsule
+};
+
+struct Collider
+{
+	ColliderType		type;
+	DirectX::XMFLOAT3	a;				//Plane normal, sphere/box centre or capsule start
+	DirectX::XMFLOAT3	b;				//Box half extents or capsule end
+	DirectX::XMFLOAT3	axes[3];		//Oriented box local axes
+	float				radius;			//Sphere/capsule radius or plane offset (n.x + d = 0)
+	float				restitution;	//Fraction of the normal velocity kept after a bounce
+	float				friction;		//Fraction of the tangential velocity removed on contact
+	DirectX::XMFLOAT3	boundsMin;		//World bounds, used by the broad phase
+	DirectX::XMFLOAT3	boundsMax;
+};
+
+constexpr float g_defaultParticleRadius = 0.5f;		//Matches the sphere mesh the demo draws particles with
+constexpr float g_defaultRestitution = 0.5f;
+constexpr float g_defaultFriction = 0.1f;
+
+//Static set of analytic colliders that particles are pushed out of.
+//Bounded colliders are binned into a coarse hashed grid so each batch of four particles
+//is only tested against the colliders near it, planes are unbounded and always tested.
+class ColliderSet
+{
+	std::vector<Collider>	m_colliders;
+	std::vector<uint32_t>	m_planes;				//Indices of the unbounded colliders
+	std::vector<uint32_t>	m_bucketStart;			//Broad phase grid in CSR form
+	std::vector<uint32_t>	m_bucketColliders;
+	std::vector<uint32_t>	m_lastBatch;			//Stamp per collider, stops a batch testing a collider twice
+	uint32_t				m_batchStamp;			//Keeps counting across frames so old stamps never match a new batch
+	std::vector<uint32_t>	m_candidates;
+	uint32_t				m_bucketMask;
+	float					m_cellSize;				//Broad phase cell edge length
+	float					m_particleRadius;		//Colliders are inflated by this much
+	bool					m_dirty;				//Broad phase needs rebuilding
+
+	std::vector<uint32_t>	m_aliveIndices;			//Scratch SoA batch storage
+	std::vector<float>		m_x, m_y, m_z, m_vx, m_vy, m_vz;
+
+	uint32_t Add(const Collider& collider);
+	void BuildBroadPhase();
+	int32_t CellCoord(float v)const { return static_cast<int32_t>(floorf(v / m_cellSize)); }
+	uint32_t HashCell(int32_t cx, int32_t cy, int32_t cz)const
+	{
+		return ((static_cast<uint32_t>(cx) * 73856093u) ^ (static_cast<uint32_t>(cy) * 19349663u) ^ (static_cast<uint32_t>(cz) * 83492791u)) & m_bucketMask;
+	}
+public:
+	ColliderSet();
+
+	uint32_t AddPlane(DirectX::XMFLOAT3 normal, float offset, float restitution = g_defaultRestitution, float friction = g_defaultFriction);
+	uint32_t AddSphere(DirectX::XMFLOAT3 centre, float radius, float restitution = g_defaultRestitution, float friction = g_defaultFriction);
+	uint32_t AddBox(DirectX::XMFLOAT3 minCorner, DirectX::XMFLOAT3 maxCorner, float restitution = g_defaultRestitution, float friction = g_defaultFriction);
+	uint32_t AddOrientedBox(DirectX::XMFLOAT3 centre, DirectX::XMFLOAT3 extents, DirectX::XMFLOAT4 orientation, float restitution = g_defaultRestitution, float friction = g_defaultFriction);
+	uint32_t AddCapsule(DirectX::XMFLOAT3 start, DirectX::XMFLOAT3 end, float radius, float restitution = g_defaultRestitution, float friction = g_defaultFriction);
+	void Clear();
+
+	void SetParticleRadius(float radius) { m_particleRadius = radius; m_dirty = true; }
+	void SetBroadPhaseCellSize(float cellSize) { m_cellSize = cellSize; m_dirty = true; }
+	size_t GetColliderCount()const { return m_colliders.size(); }
+
+	//Pushes every alive particle out of the colliders and reflects its velocity.
+	//Particles that were moved get their world matrix rewritten, and the ones that hit hard
+	//enough raise a collision event in events when it isn't null.
+	void ResolveCollisions(std::vector<Particle>& particles, ParticleEventBuffer* events = nullptr);
+};
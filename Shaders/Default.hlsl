@@ -25,6 +25,10 @@
 cbuffer cbPerObject : register(b0)
 {
     float4x4 gWorld;
+    float4x4 gTexTransform;
+    float4 gPosScale;       // Quantized positions decode as pos * gPosScale + gPosBias
+    float4 gPosBias;
+    float4 gTint;           // Multiplies the material's albedo, RGB and alpha
 };
 
 cbuffer cbMaterial : register(b1)
@@ -62,11 +66,28 @@ cbuffer cbPass : register(b2)
     Light gLights[MaxLights];
 };
  
+#ifdef PACKED_VERTEX
+// PackedVertex in VertexFormats.h: unorm position across the submesh bounds, octahedral normal.
+struct VertexIn
+{
+	float4 PosQ      : POSITION;
+    float2 NormalOct : NORMAL;
+};
+
+float3 DecodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+    return normalize(n);
+}
+#else
 struct VertexIn
 {
 	float3 PosL    : POSITION;
     float3 NormalL : NORMAL;
 };
+#endif
 
 struct VertexOut
 {
@@ -78,13 +99,21 @@ struct VertexOut
 VertexOut VS(VertexIn vin)
 {
 	VertexOut vout = (VertexOut)0.0f;
+
+#ifdef PACKED_VERTEX
+    float3 posL = vin.PosQ.xyz * gPosScale.xyz + gPosBias.xyz;
+    float3 normalL = DecodeOctahedral(vin.NormalOct);
+#else
+    float3 posL = vin.PosL;
+    float3 normalL = vin.NormalL;
+#endif
 	
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), gWorld);
     vout.PosW = posW.xyz;
 
     // Assumes nonuniform scaling; otherwise, need to use inverse-transpose of world matrix.
-    vout.NormalW = mul(vin.NormalL, (float3x3)gWorld);
+    vout.NormalW = mul(normalL, (float3x3)gWorld);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
@@ -108,7 +137,7 @@ float4 PS(VertexOut pin) : SV_Target
     intensity += dot(toLightW, pin.NormalW);
 
     //Create the initial pixel colour normally, multiplying the albedo by the light's diffuse colour
-    float4 litColor = gDiffuseAlbedo * float4(gLights[0].Strength.rgb, 1.0f);
+    float4 litColor = gDiffuseAlbedo * gTint * float4(gLights[0].Strength.rgb, 1.0f);
 
     //Creates a highlight based on material shininess and light, camera and normal vectors
     if (dot(normalize(toLightW + toEyeW), pin.NormalW) > (0.97f+(gRoughness*0.03f)))
@@ -127,9 +156,41 @@ float4 PS(VertexOut pin) : SV_Target
 
     
     // Common convention to take alpha from diffuse material.
-    litColor.a = gDiffuseAlbedo.a;
+    litColor.a = gDiffuseAlbedo.a * gTint.a;
 
     return litColor;
 }
 
+// RibbonVertex in ParticleTrails.h: world space position, u along the trail and v across it.
+struct RibbonIn
+{
+    float3 PosW : POSITION;
+    float2 TexC : TEXCOORD;
+};
 
+struct RibbonOut
+{
+    float4 PosH : SV_POSITION;
+    float2 TexC : TEXCOORD;
+};
+
+RibbonOut RibbonVS(RibbonIn vin)
+{
+    RibbonOut vout;
+
+    // Ribbons are built in world space.
+    vout.PosH = mul(float4(vin.PosW, 1.0f), gViewProj);
+    vout.TexC = vin.TexC;
+
+    return vout;
+}
+
+// Unlit, fades out along the trail and towards its edges.
+float4 RibbonPS(RibbonOut pin) : SV_Target
+{
+    float fade = (1.0f - pin.TexC.x) * (1.0f - abs(2.0f * pin.TexC.y - 1.0f));
+    float4 color = gDiffuseAlbedo * gTint;
+    color.a *= fade;
+
+    return color;
+}
@@ -0,0 +1,263 @@
+#include "ShapeLibrary.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace
+{
+	//Sizes are compared and hashed by their bits so equal keys always hash alike
+	uint32_t FloatBits(float f)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		return bits;
+	}
+
+	GeometryGenerator::MeshSize GetShapeSize(GeometryGenerator& generator, const ShapeKey& key)
+	{
+		switch(key.type)
+		{
+		case ShapeType::Box:		return generator.GetBoxSize(key.sizes[0], key.sizes[1], key.sizes[2]);
+		case ShapeType::Sphere:		return generator.GetSphereSize(key.sizes[0], key.counts[0], key.counts[1]);
+		case ShapeType::Cylinder:	return generator.GetCylinderSize(key.sizes[0], key.sizes[1], key.sizes[2], key.counts[0], key.counts[1]);
+		default:					return generator.GetGridSize(key.sizes[0], key.sizes[1], key.counts[0], key.counts[1]);
+		}
+	}
+
+	void WriteShape(GeometryGenerator& generator, const ShapeKey& key, const GeometryGenerator::MeshWriter& writer)
+	{
+		switch(key.type)
+		{
+		case ShapeType::Box:		generator.WriteBox(key.sizes[0], key.sizes[1], key.sizes[2], writer); break;
+		case ShapeType::Sphere:		generator.WriteSphere(key.sizes[0], key.counts[0], key.counts[1], writer); break;
+		case ShapeType::Cylinder:	generator.WriteCylinder(key.sizes[0], key.sizes[1], key.sizes[2], key.counts[0], key.counts[1], writer); break;
+		default:					generator.WriteGrid(key.sizes[0], key.sizes[1], key.counts[0], key.counts[1], writer); break;
+		}
+	}
+
+	std::string Number(float f)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), "%g", f);
+		return text;
+	}
+
+	//"sphere 0.5 20x20", for the optimisation log
+	std::string DescribeShape(const ShapeKey& key)
+	{
+		const std::string counts = " " + std::to_string(key.counts[0]) + "x" + std::to_string(key.counts[1]);
+		switch(key.type)
+		{
+		case ShapeType::Box:		return "box " + Number(key.sizes[0]) + "x" + Number(key.sizes[1]) + "x" + Number(key.sizes[2]);
+		case ShapeType::Sphere:		return "sphere " + Number(key.sizes[0]) + counts;
+		case ShapeType::Cylinder:	return "cylinder " + Number(key.sizes[0]) + "/" + Number(key.sizes[1]) + "x" + Number(key.sizes[2]) + counts;
+		default:					return "grid " + Number(key.sizes[0]) + "x" + Number(key.sizes[1]) + counts;
+		}
+	}
+
+	//The generators emit triangles row by row, reorder each shape's for the post-transform cache.
+	//Overdraw isn't worth sorting on these, they're convex or flat.
+	template<class Index>
+	MeshOptimizationStats OptimizeShape(Index* indices, size_t indexCount, size_t vertexCount)
+	{
+		MeshOptimizationStats stats;
+		stats.before = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		OptimizeVertexCache(indices, indexCount, vertexCount);
+		stats.after = AnalyzeVertexCache(indices, indexCount, vertexCount);
+		return stats;
+	}
+
+	//Writer that keeps the generator's float vertices as they are, for GetMeshData
+	GeometryGenerator::MeshWriter MakeFloatWriter(GeometryGenerator::MeshData& meshData)
+	{
+		GeometryGenerator::MeshWriter writer;
+		writer.Vertices = meshData.Vertices.data();
+		writer.VertexStride = sizeof(GeometryGenerator::Vertex);
+		writer.Encode = [](const GeometryGenerator::Vertex* in, size_t count, void* out, const void*)
+		{
+			std::copy(in, in + count, static_cast<GeometryGenerator::Vertex*>(out));
+		};
+		writer.Indices = meshData.Indices32.data();
+		writer.IndexSize = sizeof(GeometryGenerator::uint32);
+		return writer;
+	}
+
+	//Passes a float copy through the pool's writer instead of generating the shape again
+	void WriteMeshData(const GeometryGenerator::MeshData& meshData, const GeometryGenerator::MeshWriter& writer)
+	{
+		writer.Encode(meshData.Vertices.data(), meshData.Vertices.size(), writer.Vertices, writer.Context);
+		if(writer.IndexSize == sizeof(std::uint16_t))
+		{
+			std::transform(meshData.Indices32.begin(), meshData.Indices32.end(), static_cast<std::uint16_t*>(writer.Indices),
+				[](GeometryGenerator::uint32 i) { return static_cast<std::uint16_t>(i); });
+		}
+		else
+		{
+			std::copy(meshData.Indices32.begin(), meshData.Indices32.end(), static_cast<GeometryGenerator::uint32*>(writer.Indices));
+		}
+	}
+}
+
+bool ShapeKey::operator==(const ShapeKey& rhs)const
+{
+	for(int i = 0; i < 3; ++i)
+	{
+		if(FloatBits(sizes[i]) != FloatBits(rhs.sizes[i]))
+		{
+			return false;
+		}
+	}
+	return type == rhs.type && counts[0] == rhs.counts[0] && counts[1] == rhs.counts[1] && format == rhs.format;
+}
+
+size_t ShapeKeyHash::operator()(const ShapeKey& key)const
+{
+	uint64_t hash = 14695981039346656037ull;		//FNV-1a, a word at a time
+	auto mix = [&](uint64_t word) { hash = (hash ^ word) * 1099511628211ull; };
+	mix(static_cast<uint64_t>(key.type));
+	for(int i = 0; i < 3; ++i)
+	{
+		mix(FloatBits(key.sizes[i]));
+	}
+	mix(key.counts[0]);
+	mix(key.counts[1]);
+	mix(reinterpret_cast<uintptr_t>(key.format));
+	return static_cast<size_t>(hash);
+}
+
+ShapeLibrary::Pool& ShapeLibrary::GetPool(ShapeWriterFunc writer, UINT vertexStride, UINT indexSize, DXGI_FORMAT positionFormat)
+{
+	//Built pools' buffers are fixed, only the format's latest pool can still take shapes
+	for(const std::unique_ptr<Pool>& pool : m_pools)
+	{
+		if(pool->writer == writer && !pool->geometry)
+		{
+			return *pool;
+		}
+	}
+	m_pools.push_back(std::make_unique<Pool>());
+	Pool& pool = *m_pools.back();
+	pool.writer = writer;
+	pool.vertexStride = vertexStride;
+	pool.indexSize = indexSize;
+	pool.positionFormat = positionFormat;
+	return pool;
+}
+
+ShapeRegion ShapeLibrary::Request(Pool& pool, const ShapeKey& key)
+{
+	++m_requestCount;
+	const auto found = m_shapes.find(key);
+	if(found != m_shapes.end())
+	{
+		return ShapeRegion{ key, found->second.pool->geometry, found->second.submesh };
+	}
+
+	//16 bit indices count from the shape's first vertex, they can't reach past 65536 of them
+	const GeometryGenerator::MeshSize size = GetShapeSize(m_generator, key);
+	if(pool.indexSize == 2 && size.VertexCount > 65536)
+	{
+		OutputDebugStringA((DescribeShape(key) + ": too many vertices for 16 bit indices\n").c_str());
+		return ShapeRegion{ key };
+	}
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = size.IndexCount;
+	submesh.StartIndexLocation = pool.indexCount;
+	submesh.BaseVertexLocation = static_cast<INT>(pool.vertexCount);
+	submesh.Bounds = size.Bounds;
+	pool.vertexCount += size.VertexCount;
+	pool.indexCount += size.IndexCount;
+	pool.shapes.push_back(key);
+	m_shapes[key] = Shape{ &pool, submesh };
+	return ShapeRegion{ key, nullptr, submesh };
+}
+
+UINT ShapeLibrary::Reserve(Pool& pool, UINT indexCount)
+{
+	const UINT start = pool.indexCount;
+	pool.indexCount += indexCount;
+	return start;
+}
+
+std::unique_ptr<MeshGeometry> ShapeLibrary::Build(Pool& pool, ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+	const std::string& name, const std::function<void(void* indices)>& fillReserved)
+{
+	if(pool.indexCount == 0)
+	{
+		return nullptr;
+	}
+
+	const UINT vbByteSize = pool.vertexCount * pool.vertexStride;
+	const UINT ibByteSize = pool.indexCount * pool.indexSize;
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = name;
+	pool.geometry = geo.get();
+
+	//Vertices are packed straight into the mapped upload buffer, there's no system memory copy of them.
+	//The indices are generated into the CPU blob, reordered there and then uploaded, write combined
+	//upload memory is too slow to read back.
+	void* mappedVertices = nullptr;
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(device, cmdList, vbByteSize, geo->VertexBufferUploader, &mappedVertices);
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	uint8_t* vertices = static_cast<uint8_t*>(mappedVertices);
+	uint8_t* indices = static_cast<uint8_t*>(geo->IndexBufferCPU->GetBufferPointer());
+
+	for(const ShapeKey& key : pool.shapes)
+	{
+		//Bounds has to outlive the writes, the map's entries don't move
+		const Shape& shape = m_shapes[key];
+		const SubmeshGeometry& submesh = shape.submesh;
+		void* shapeIndices = indices + static_cast<size_t>(submesh.StartIndexLocation) * pool.indexSize;
+		const GeometryGenerator::MeshWriter writer = pool.writer(vertices + static_cast<size_t>(submesh.BaseVertexLocation) * pool.vertexStride,
+			shapeIndices, submesh.Bounds);
+		if(shape.meshData.Vertices.empty())
+		{
+			WriteShape(m_generator, key, writer);
+		}
+		else
+		{
+			WriteMeshData(shape.meshData, writer);
+		}
+
+		const size_t vertexCount = GetShapeSize(m_generator, key).VertexCount;
+		const MeshOptimizationStats stats = pool.indexSize == 2
+			? OptimizeShape(static_cast<std::uint16_t*>(shapeIndices), submesh.IndexCount, vertexCount)
+			: OptimizeShape(static_cast<std::uint32_t*>(shapeIndices), submesh.IndexCount, vertexCount);
+		OutputDebugStringA(DescribeStats(DescribeShape(key), stats).c_str());
+	}
+
+	fillReserved(indices);
+
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(device, cmdList, indices, ibByteSize, geo->IndexBufferUploader);
+
+	geo->VertexByteStride = pool.vertexStride;
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = pool.indexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+	geo->PositionFormat = pool.positionFormat;
+	return geo;
+}
+
+const GeometryGenerator::MeshData& ShapeLibrary::GetMeshData(const ShapeRegion& shape)
+{
+	static const GeometryGenerator::MeshData empty;
+	const auto found = m_shapes.find(shape.key);
+	if(found == m_shapes.end())
+	{
+		return empty;
+	}
+
+	GeometryGenerator::MeshData& meshData = found->second.meshData;
+	if(meshData.Vertices.empty())
+	{
+		const GeometryGenerator::MeshSize size = GetShapeSize(m_generator, shape.key);
+		meshData.Vertices.resize(size.VertexCount);
+		meshData.Indices32.resize(size.IndexCount);
+		WriteShape(m_generator, shape.key, MakeFloatWriter(meshData));
+	}
+	return meshData;
+}
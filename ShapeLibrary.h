@@ -0,0 +1,154 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <type_traits>
+#include <cstdint>
+
+#include "Common/d3dUtil.h"
+#include "Common/GeometryGenerator.h"
+#include "VertexFormats.h"
+
+enum class ShapeType : uint32_t
+{
+	Box,
+	Sphere,
+	Cylinder,
+	Grid
+};
+
+//Points a MeshWriter of one vertex and index format at a shape's region of its pool
+using ShapeWriterFunc = GeometryGenerator::MeshWriter(*)(void* vertices, void* indices, const DirectX::BoundingBox& bounds);
+
+//A procedural shape as it was asked for: what it is, what it was made with and what it's written as
+struct ShapeKey
+{
+	ShapeType		type;
+	float			sizes[3];		//Box width, height and depth, cylinder bottom and top radius and height, sphere radius, grid width and depth
+	uint32_t		counts[2];		//Slices and stacks, grid rows and columns
+	ShapeWriterFunc	format;			//One per vertex and index type
+
+	bool operator==(const ShapeKey& rhs)const;
+};
+
+struct ShapeKeyHash
+{
+	size_t operator()(const ShapeKey& key)const;
+};
+
+//Where a shape lives, the geometry of the pool it went into and its draw args there
+struct ShapeRegion
+{
+	ShapeKey		key;
+	MeshGeometry*	geometry = nullptr;		//Null until the pool is built
+	SubmeshGeometry	submesh;				//IndexCount is 0 if the shape couldn't be placed
+};
+
+//Memoises procedural shapes by their ShapeKey. Every request for the same shape in the same format gets the
+//same region of a pooled vertex and index buffer, so it's generated and uploaded once however many emitters
+//and render items draw it. Shapes are only sized when they're asked for, each is written once when its pool
+//is built, straight into the mapped upload buffer. Shapes first asked for after a Build go into a new pool of
+//their format, which the next Build creates the geometry for. Requests after that still find the shapes that
+//were built, along with the geometry they're in.
+class ShapeLibrary
+{
+	struct Pool
+	{
+		ShapeWriterFunc			writer;
+		UINT					vertexStride;
+		UINT					indexSize;
+		DXGI_FORMAT				positionFormat;
+		std::vector<ShapeKey>	shapes;				//Distinct shapes, in buffer order
+		UINT					vertexCount = 0;
+		UINT					indexCount = 0;		//Shapes' and reserved indices
+		MeshGeometry*			geometry = nullptr;	//Owned by whoever Build returned it to
+	};
+
+	struct Shape
+	{
+		Pool*						pool = nullptr;
+		SubmeshGeometry				submesh;
+		GeometryGenerator::MeshData	meshData;		//Float copy, only made when GetMeshData asks for it
+	};
+
+	GeometryGenerator									m_generator;
+	std::vector<std::unique_ptr<Pool>>					m_pools;
+	std::unordered_map<ShapeKey, Shape, ShapeKeyHash>	m_shapes;
+	size_t												m_requestCount = 0;
+
+	template<class V, class Index>
+	static GeometryGenerator::MeshWriter MakeWriter(void* vertices, void* indices, const DirectX::BoundingBox& bounds)
+	{
+		return MakeMeshWriter(static_cast<V*>(vertices), static_cast<Index*>(indices), bounds);
+	}
+
+	template<class V, class Index>
+	Pool& GetPool()
+	{
+		return GetPool(&MakeWriter<V, Index>, sizeof(V), sizeof(Index), VertexFormat<V>::k_elements[0].format);
+	}
+
+	Pool& GetPool(ShapeWriterFunc writer, UINT vertexStride, UINT indexSize, DXGI_FORMAT positionFormat);
+	ShapeRegion Request(Pool& pool, const ShapeKey& key);
+	UINT Reserve(Pool& pool, UINT indexCount);
+	std::unique_ptr<MeshGeometry> Build(Pool& pool, ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+		const std::string& name, const std::function<void(void* indices)>& fillReserved);
+public:
+	//Each shape in a pool of V vertices and Index indices, the same region every time it's asked for. Shapes
+	//with more vertices than 16 bit indices can reach fail, with an empty region.
+	template<class V, class Index = std::uint16_t>
+	ShapeRegion Box(float width, float height, float depth)
+	{
+		return Request(GetPool<V, Index>(), ShapeKey{ ShapeType::Box, { width, height, depth }, { 0, 0 }, &MakeWriter<V, Index> });
+	}
+	template<class V, class Index = std::uint16_t>
+	ShapeRegion Sphere(float radius, uint32_t sliceCount, uint32_t stackCount)
+	{
+		return Request(GetPool<V, Index>(), ShapeKey{ ShapeType::Sphere, { radius, 0.0f, 0.0f }, { sliceCount, stackCount }, &MakeWriter<V, Index> });
+	}
+	template<class V, class Index = std::uint16_t>
+	ShapeRegion Cylinder(float bottomRadius, float topRadius, float height, uint32_t sliceCount, uint32_t stackCount)
+	{
+		return Request(GetPool<V, Index>(), ShapeKey{ ShapeType::Cylinder, { bottomRadius, topRadius, height }, { sliceCount, stackCount }, &MakeWriter<V, Index> });
+	}
+	template<class V, class Index = std::uint16_t>
+	ShapeRegion Grid(float width, float depth, uint32_t m, uint32_t n)
+	{
+		return Request(GetPool<V, Index>(), ShapeKey{ ShapeType::Grid, { width, depth, 0.0f }, { m, n }, &MakeWriter<V, Index> });
+	}
+
+	//Room in the pool's index buffer for the caller's own indices, such as levels of detail, which are written
+	//by Build's fillReserved. Returns where they start.
+	template<class V, class Index = std::uint16_t>
+	UINT ReserveIndices(UINT indexCount)
+	{
+		return Reserve(GetPool<V, Index>(), indexCount);
+	}
+
+	//Creates the buffers of the pool of shapes asked for since the format's last Build and writes each of
+	//them into them, reordered for the vertex cache. fillReserved then gets the whole index buffer, to read the
+	//shapes' indices and write the reserved ones, before it's uploaded. Returns null when nothing new was asked
+	//for. Index is only ever given, never deduced from fillReserved, so a lambda can be passed.
+	template<class V, class Index = std::uint16_t>
+	std::unique_ptr<MeshGeometry> Build(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList, const std::string& name,
+		const std::function<void(std::add_pointer_t<Index> indices)>& fillReserved = nullptr)
+	{
+		return Build(GetPool<V, Index>(), device, cmdList, name, [&](void* indices)
+		{
+			if(fillReserved)
+			{
+				fillReserved(static_cast<Index*>(indices));
+			}
+		});
+	}
+
+	//The float vertices and indices the shape is written from, numbered as in its region, for building meshlets
+	//or levels of detail. Made on the first call and kept, a shape that has one is encoded from it rather than
+	//generated again when its pool is built. Empty for a shape that couldn't be placed.
+	const GeometryGenerator::MeshData& GetMeshData(const ShapeRegion& shape);
+
+	size_t GetRequestCount()const { return m_requestCount; }		//Every request made, GetShapeCount of which were generated
+	size_t GetShapeCount()const { return m_shapes.size(); }
+};
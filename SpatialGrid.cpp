@@ -0,0 +1,195 @@
+#include "SpatialGrid.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+
+namespace
+{
+	constexpr uint32_t g_minBuckets = 1024;
+	constexpr size_t g_gridGrain = 4096;		//Smallest slice of particles handed to a worker
+
+	uint32_t NextPowerOfTwo(uint32_t v)
+	{
+		--v;
+		v |= v >> 1;
+		v |= v >> 2;
+		v |= v >> 4;
+		v |= v >> 8;
+		v |= v >> 16;
+		return v + 1;
+	}
+}
+
+SpatialGrid::SpatialGrid(float cellSize)
+	:m_cellSize(cellSize), m_invCellSize(1.0f / cellSize), m_bucketMask(g_minBuckets - 1), m_count(0), m_cursorCapacity(0)
+{}
+
+void SpatialGrid::Resize(size_t count)
+{
+	m_count = count;
+	m_posX.resize(count);
+	m_posY.resize(count);
+	m_posZ.resize(count);
+	m_particleIndex.resize(count);
+	m_bucketOf.resize(count);
+	m_sortedIndices.resize(count);
+	m_sortedX.resize(count + k_simdPadding, 0.0f);
+	m_sortedY.resize(count + k_simdPadding, 0.0f);
+	m_sortedZ.resize(count + k_simdPadding, 0.0f);
+
+	//Roughly two buckets per particle keeps collisions between distinct cells rare
+	const uint32_t buckets = (std::max)(g_minBuckets, NextPowerOfTwo(static_cast<uint32_t>(count * 2)));
+	m_bucketMask = buckets - 1;
+	m_bucketStart.resize(static_cast<size_t>(buckets) + 1);
+	if(m_cursorCapacity < buckets)
+	{
+		m_bucketCursor.reset(new std::atomic<uint32_t>[buckets]);
+		m_cursorCapacity = buckets;
+	}
+}
+
+void SpatialGrid::Build(const std::vector<Particle>& particles)
+{
+	size_t alive(0);
+	for(const Particle& p : particles)
+	{
+		alive += p.alive ? 1 : 0;
+	}
+	Resize(alive);
+
+	size_t slot(0);
+	for(size_t i = 0; i < particles.size(); ++i)
+	{
+		const Particle& p = particles[i];
+		if(p.alive)
+		{
+			m_posX[slot] = p.position.x;
+			m_posY[slot] = p.position.y;
+			m_posZ[slot] = p.position.z;
+			m_particleIndex[slot] = static_cast<uint32_t>(i);
+			++slot;
+		}
+	}
+	SortIntoBuckets();
+}
+
+void SpatialGrid::Build(const float* x, const float* y, const float* z, size_t count)
+{
+	Resize(count);
+	ThreadPool::Get().ParallelFor(0, count, g_gridGrain, [&](size_t begin, size_t end)
+		{
+			std::copy(x + begin, x + end, m_posX.begin() + begin);
+			std::copy(y + begin, y + end, m_posY.begin() + begin);
+			std::copy(z + begin, z + end, m_posZ.begin() + begin);
+			for(size_t i = begin; i < end; ++i)
+			{
+				m_particleIndex[i] = static_cast<uint32_t>(i);
+			}
+		});
+	SortIntoBuckets();
+}
+
+void SpatialGrid::SortIntoBuckets()
+{
+	ThreadPool& pool = ThreadPool::Get();
+	const size_t buckets = GetBucketCount();
+
+	pool.ParallelFor(0, buckets, g_gridGrain * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t b = begin; b < end; ++b)
+			{
+				m_bucketCursor[b].store(0, std::memory_order_relaxed);
+			}
+		});
+
+	//Pass 1: hash every point and histogram the buckets. Buckets are spread out by the hash,
+	//so the atomic increments rarely contend.
+	pool.ParallelFor(0, m_count, g_gridGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const uint32_t bucket = HashCell(CellCoord(m_posX[i]), CellCoord(m_posY[i]), CellCoord(m_posZ[i]));
+				m_bucketOf[i] = bucket;
+				m_bucketCursor[bucket].fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+
+	//Pass 2: exclusive prefix sum over the bucket counts, one block per thread then a fix up
+	const size_t blockCount = pool.GetThreadCount();
+	const size_t blockSize = (buckets + blockCount - 1) / blockCount;
+	std::vector<uint32_t> blockTotals(blockCount + 1, 0);
+	pool.ParallelFor(0, blockCount, 1, [&](size_t begin, size_t end)
+		{
+			for(size_t block = begin; block < end; ++block)
+			{
+				const size_t first = block * blockSize;
+				const size_t last = (std::min)(first + blockSize, buckets);
+				uint32_t sum(0);
+				for(size_t b = first; b < last; ++b)
+				{
+					m_bucketStart[b] = sum;
+					sum += m_bucketCursor[b].load(std::memory_order_relaxed);
+				}
+				blockTotals[block + 1] = sum;
+			}
+		});
+	for(size_t block = 1; block <= blockCount; ++block)
+	{
+		blockTotals[block] += blockTotals[block - 1];
+	}
+	pool.ParallelFor(0, blockCount, 1, [&](size_t begin, size_t end)
+		{
+			for(size_t block = begin; block < end; ++block)
+			{
+				const size_t first = block * blockSize;
+				const size_t last = (std::min)(first + blockSize, buckets);
+				for(size_t b = first; b < last; ++b)
+				{
+					m_bucketStart[b] += blockTotals[block];
+					m_bucketCursor[b].store(m_bucketStart[b], std::memory_order_relaxed);
+				}
+			}
+		});
+	m_bucketStart[buckets] = static_cast<uint32_t>(m_count);
+
+	//Pass 3: scatter into the sorted streams. Threads race for the slots inside a bucket, so the order
+	//they come out in changes from run to run.
+	pool.ParallelFor(0, m_count, g_gridGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				const uint32_t slot = m_bucketCursor[m_bucketOf[i]].fetch_add(1, std::memory_order_relaxed);
+				m_sortedIndices[slot] = m_particleIndex[i];
+				m_sortedX[slot] = m_posX[i];
+				m_sortedY[slot] = m_posY[i];
+				m_sortedZ[slot] = m_posZ[i];
+			}
+		});
+
+	//Pass 4: put every bucket back in index order. Neighbours are then visited, and sums over them added
+	//up, in the same order every run, so simulations built on the grid are reproducible. Buckets hold a
+	//couple of points on average, an insertion sort is all they need.
+	pool.ParallelFor(0, buckets, g_gridGrain * 4, [&](size_t begin, size_t end)
+		{
+			for(size_t b = begin; b < end; ++b)
+			{
+				const uint32_t first = m_bucketStart[b], last = m_bucketStart[b + 1];
+				for(uint32_t i = first + 1; i < last; ++i)
+				{
+					const uint32_t index = m_sortedIndices[i];
+					const float x = m_sortedX[i], y = m_sortedY[i], z = m_sortedZ[i];
+					uint32_t j = i;
+					for(; j > first && m_sortedIndices[j - 1] > index; --j)
+					{
+						m_sortedIndices[j] = m_sortedIndices[j - 1];
+						m_sortedX[j] = m_sortedX[j - 1];
+						m_sortedY[j] = m_sortedY[j - 1];
+						m_sortedZ[j] = m_sortedZ[j - 1];
+					}
+					m_sortedIndices[j] = index;
+					m_sortedX[j] = x;
+					m_sortedY[j] = y;
+					m_sortedZ[j] = z;
+				}
+			}
+		});
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <cmath>
+
+#include <DirectXMath.h>
+
+struct Particle;
+
+//Uniform spatial hash over particle positions, rebuilt every frame with a parallel counting sort.
+//Cells are hashed into a power of two bucket table so the grid is unbounded in space.
+//After Build, m_sortedIndices holds particle indices grouped by bucket, ascending inside each, and m_bucketStart
+//gives each bucket's range, with positions copied into matching SoA streams for the queries.
+class SpatialGrid
+{
+	float						m_cellSize;			//Edge length of a cell, normally the interaction radius
+	float						m_invCellSize;
+	uint32_t					m_bucketMask;		//Bucket table size - 1
+	size_t						m_count;			//Number of particles inserted by the last Build
+
+	std::vector<float>			m_posX, m_posY, m_posZ;			//Input positions, gathered from the particles
+	std::vector<uint32_t>		m_particleIndex;				//Maps an input slot back to its index in the particle vector
+	std::vector<uint32_t>		m_bucketOf;						//Bucket of each input slot
+	std::vector<uint32_t>		m_bucketStart;					//Exclusive prefix sum of bucket counts, size buckets + 1
+	std::unique_ptr<std::atomic<uint32_t>[]> m_bucketCursor;	//Counts, then scatter cursors during the sort
+	size_t						m_cursorCapacity;
+	std::vector<uint32_t>		m_sortedIndices;				//Particle indices ordered by bucket
+	std::vector<float>			m_sortedX, m_sortedY, m_sortedZ;	//Positions in the same order as m_sortedIndices
+
+	void Resize(size_t count);
+	void SortIntoBuckets();
+public:
+	static constexpr size_t k_simdPadding = 3;		//Sorted streams are padded so a 4 wide load at the last slot stays in bounds
+
+	explicit SpatialGrid(float cellSize = 1.0f);
+
+	void SetCellSize(float cellSize) { m_cellSize = cellSize; m_invCellSize = 1.0f / cellSize; }
+	float GetCellSize()const { return m_cellSize; }
+
+	//Inserts every alive particle. Returned indices refer to the particle vector.
+	void Build(const std::vector<Particle>& particles);
+	//Inserts count points given as SoA streams, returned indices are positions in the streams.
+	void Build(const float* x, const float* y, const float* z, size_t count);
+
+	size_t GetCount()const { return m_count; }
+	size_t GetBucketCount()const { return static_cast<size_t>(m_bucketMask) + 1; }
+	const std::vector<uint32_t>& GetSortedIndices()const { return m_sortedIndices; }
+	const std::vector<uint32_t>& GetBucketStarts()const { return m_bucketStart; }
+
+	inline int32_t CellCoord(float v)const { return static_cast<int32_t>(floorf(v * m_invCellSize)); }
+	inline uint32_t HashCell(int32_t cx, int32_t cy, int32_t cz)const
+	{
+		return ((static_cast<uint32_t>(cx) * 73856093u) ^ (static_cast<uint32_t>(cy) * 19349663u) ^ (static_cast<uint32_t>(cz) * 83492791u)) & m_bucketMask;
+	}
+
+	//Calls func(index, distanceSq, sortedSlot) for every inserted point within radius of position.
+	//sortedSlot indexes the sorted SoA streams so callers can keep per-slot data in sort order.
+	template<class Func>
+	void ForEachNeighbor(const DirectX::XMFLOAT3& position, float radius, Func&& func)const
+	{
+		if(m_count == 0)
+		{
+			return;
+		}
+		const float radiusSq = radius * radius;
+		const int32_t xMin = CellCoord(position.x - radius), xMax = CellCoord(position.x + radius);
+		const int32_t yMin = CellCoord(position.y - radius), yMax = CellCoord(position.y + radius);
+		const int32_t zMin = CellCoord(position.z - radius), zMax = CellCoord(position.z + radius);
+
+		//Different cells can share a bucket, remember the visited ones so no point is reported twice
+		constexpr int k_maxVisited = 27;
+		uint32_t visited[k_maxVisited];
+		int visitedCount(0);
+		const bool trackVisited = (xMax - xMin + 1) * (yMax - yMin + 1) * (zMax - zMin + 1) <= k_maxVisited;
+
+		for(int32_t cz = zMin; cz <= zMax; ++cz)
+		{
+			for(int32_t cy = yMin; cy <= yMax; ++cy)
+			{
+				for(int32_t cx = xMin; cx <= xMax; ++cx)
+				{
+					const uint32_t bucket = HashCell(cx, cy, cz);
+					if(trackVisited)
+					{
+						bool seen(false);
+						for(int i = 0; i < visitedCount; ++i)
+						{
+							seen |= visited[i] == bucket;
+						}
+						if(seen)
+						{
+							continue;
+						}
+						visited[visitedCount++] = bucket;
+					}
+					const uint32_t end = m_bucketStart[bucket + 1];
+					for(uint32_t slot = m_bucketStart[bucket]; slot < end; ++slot)
+					{
+						const float dx = m_sortedX[slot] - position.x;
+						const float dy = m_sortedY[slot] - position.y;
+						const float dz = m_sortedZ[slot] - position.z;
+						const float distSq = dx * dx + dy * dy + dz * dz;
+						if(distSq > radiusSq)
+						{
+							continue;
+						}
+						//Large radii cover too many cells to track, so check the point really lives in this cell
+						if(!trackVisited && (CellCoord(m_sortedX[slot]) != cx || CellCoord(m_sortedY[slot]) != cy || CellCoord(m_sortedZ[slot]) != cz))
+						{
+							continue;
+						}
+						func(m_sortedIndices[slot], distSq, slot);
+					}
+				}
+			}
+		}
+	}
+
+	//Calls func(firstSlot, endSlot) for every bucket overlapping the 27 cells around position, each bucket
+	//once. Points in the ranges still need a distance test, this is meant for callers that batch
+	//the sorted streams themselves with SIMD and requires a radius no bigger than the cell size.
+	template<class Func>
+	void ForEachNeighborRange(const DirectX::XMFLOAT3& position, Func&& func)const
+	{
+		if(m_count == 0)
+		{
+			return;
+		}
+		const int32_t px = CellCoord(position.x), py = CellCoord(position.y), pz = CellCoord(position.z);
+		uint32_t visited[27];
+		int visitedCount(0);
+		for(int32_t cz = pz - 1; cz <= pz + 1; ++cz)
+		{
+			for(int32_t cy = py - 1; cy <= py + 1; ++cy)
+			{
+				for(int32_t cx = px - 1; cx <= px + 1; ++cx)
+				{
+					const uint32_t bucket = HashCell(cx, cy, cz);
+					bool seen(false);
+					for(int i = 0; i < visitedCount; ++i)
+					{
+						seen |= visited[i] == bucket;
+					}
+					if(seen)
+					{
+						continue;
+					}
+					visited[visitedCount++] = bucket;
+					if(m_bucketStart[bucket] != m_bucketStart[bucket + 1])
+					{
+						func(m_bucketStart[bucket], m_bucketStart[bucket + 1]);
+					}
+				}
+			}
+		}
+	}
+
+	//Sorted SoA position streams, indexed by the sortedSlot passed to ForEachNeighbor
+	const float* SortedX()const { return m_sortedX.data(); }
+	const float* SortedY()const { return m_sortedY.data(); }
+	const float* SortedZ()const { return m_sortedZ.data(); }
+};
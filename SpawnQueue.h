@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+struct SpawnRequest					//A request for a burst of particles, can be pushed from any thread
+{
+	DirectX::XMFLOAT3	position;		//World position the burst is emitted from
+	unsigned int		count;			//Number of particles to spawn
+	float				speedScale;		//Multiplies the emission policy's emit speed
+	DirectX::XMFLOAT3	velocity;		//Added to every emitted velocity, lets a burst carry on with its source's motion
+	SpawnRequest()
+		:position(0.0f, 0.0f, 0.0f), count(0), speedScale(1.0f), velocity(0.0f, 0.0f, 0.0f)
+	{}
+	SpawnRequest(DirectX::XMFLOAT3 pos, unsigned int num, float scale = 1.0f, DirectX::XMFLOAT3 vel = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f))
+		:position(pos), count(num), speedScale(scale), velocity(vel)
+	{}
+};
+
+//Bounded lock-free multi-producer single-consumer queue.
+//Each cell carries a sequence number so producers only contend on the enqueue counter
+//and the consumer never needs an atomic read-modify-write.
+template<class T, size_t Capacity>
+class BoundedMPSCQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+	static constexpr size_t k_mask = Capacity - 1;
+	static constexpr size_t k_cacheLine = 64;
+
+	struct Cell
+	{
+		std::atomic<size_t>	sequence;
+		T					data;
+	};
+
+	alignas(k_cacheLine) Cell				m_cells[Capacity];
+	alignas(k_cacheLine) std::atomic<size_t> m_enqueuePos;		//Shared between producers
+	alignas(k_cacheLine) size_t				m_dequeuePos;		//Only touched by the consumer
+public:
+	BoundedMPSCQueue()
+		:m_enqueuePos(0), m_dequeuePos(0)
+	{
+		for(size_t i = 0; i < Capacity; ++i)
+		{
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	BoundedMPSCQueue(const BoundedMPSCQueue&) = delete;
+	BoundedMPSCQueue& operator=(const BoundedMPSCQueue&) = delete;
+
+	//Safe to call from any thread, returns false without blocking when the queue is full
+	bool Push(const T& value)
+	{
+		Cell* cell;
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		for(;;)
+		{
+			cell = &m_cells[pos & k_mask];
+			const size_t seq = cell->sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if(diff == 0)
+			{
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = value;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Consumer thread only
+	bool Pop(T& out)
+	{
+		Cell& cell = m_cells[m_dequeuePos & k_mask];
+		if(cell.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1)
+		{
+			return false;
+		}
+		out = cell.data;
+		cell.sequence.store(m_dequeuePos + Capacity, std::memory_order_release);
+		++m_dequeuePos;
+		return true;
+	}
+
+	//Consumer thread only. Hands every queued item to func, stopping after one full lap of the
+	//ring so producers that keep pushing during the drain cannot stall the consumer.
+	template<class Func>
+	size_t Drain(Func&& func)
+	{
+		size_t drained(0);
+		T item;
+		while(drained < Capacity && Pop(item))
+		{
+			func(item);
+			++drained;
+		}
+		return drained;
+	}
+};
+
+constexpr size_t g_spawnQueueCapacity = 256;
+typedef BoundedMPSCQueue<SpawnRequest, g_spawnQueueCapacity> SpawnQueue;
@@ -0,0 +1,225 @@
+#include "VectorField.h"
+#include "ParticleEmitter.h"
+#include "Common/ThreadPool.h"
+
+#include <fstream>
+#include <random>
+
+using namespace DirectX;
+
+namespace
+{
+	constexpr float g_defaultFieldCellSize = 0.5f;
+	constexpr size_t g_fieldGrain = 2048;		//Particles per worker chunk
+
+	bool IsValidResolution(uint32_t resolution)
+	{
+		//At least one brick, and a power of two so coordinates wrap with a mask
+		return resolution >= 4 && resolution <= 256 && (resolution & (resolution - 1)) == 0;
+	}
+
+	inline float SmoothStep(float t)
+	{
+		return t * t * (3.0f - 2.0f * t);
+	}
+}
+
+VectorField::VectorField()
+	:m_resolution(0), m_bricksPerAxis(0), m_cellSize(g_defaultFieldCellSize), m_offset(0.0f, 0.0f, 0.0f)
+{}
+
+void VectorField::SetFromLinear(uint32_t resolution, const std::vector<XMFLOAT3>& linear)
+{
+	m_resolution = resolution;
+	m_bricksPerAxis = resolution >> k_brickShift;
+	m_cells.resize(static_cast<size_t>(resolution) * resolution * resolution);
+	for(uint32_t z = 0; z < resolution; ++z)
+	{
+		for(uint32_t y = 0; y < resolution; ++y)
+		{
+			for(uint32_t x = 0; x < resolution; ++x)
+			{
+				const XMFLOAT3& v = linear[(static_cast<size_t>(z) * resolution + y) * resolution + x];
+				m_cells[CellIndex(x, y, z)] = XMFLOAT4A(v.x, v.y, v.z, 0.0f);
+			}
+		}
+	}
+}
+
+void VectorField::BakeCurlNoise(uint32_t resolution, uint32_t frequency, uint32_t octaves, unsigned seed)
+{
+	if(!IsValidResolution(resolution))
+	{
+		return;
+	}
+	const size_t cellCount = static_cast<size_t>(resolution) * resolution * resolution;
+	const uint32_t mask = resolution - 1;
+	ThreadPool& pool = ThreadPool::Get();
+
+	//Potential: octaves of smoothly interpolated random lattice vectors. Each lattice period has to
+	//divide the resolution so the potential, and therefore the curl, wraps seamlessly. The resolution
+	//is a power of two, so rounding the frequency up to one makes every octave's period divide it.
+	uint32_t basePeriod(1);
+	while(basePeriod < frequency && basePeriod < resolution)
+	{
+		basePeriod <<= 1;
+	}
+	std::vector<XMFLOAT3> potential(cellCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	float amplitude(1.0f);
+	for(uint32_t octave = 0; octave < octaves; ++octave, amplitude *= 0.5f)
+	{
+		const uint32_t period = (std::min)(resolution, basePeriod << (std::min)(octave, 8u));		//8 doublings reach the largest resolution
+		std::vector<XMFLOAT3> lattice(static_cast<size_t>(period) * period * period);
+		for(XMFLOAT3& v : lattice)
+		{
+			v = XMFLOAT3(dist(generator), dist(generator), dist(generator));
+		}
+		const float toLattice = static_cast<float>(period) / resolution;
+
+		pool.ParallelFor(0, resolution, 1, [&](size_t zBegin, size_t zEnd)
+			{
+				for(size_t z = zBegin; z < zEnd; ++z)
+				{
+					for(uint32_t y = 0; y < resolution; ++y)
+					{
+						for(uint32_t x = 0; x < resolution; ++x)
+						{
+							const float u[3] = { x * toLattice, y * toLattice, z * toLattice };
+							uint32_t i0[3], i1[3];
+							float t[3];
+							for(int a = 0; a < 3; ++a)
+							{
+								i0[a] = static_cast<uint32_t>(u[a]);
+								i1[a] = (i0[a] + 1) % period;
+								t[a] = SmoothStep(u[a] - i0[a]);
+							}
+							auto corner = [&](uint32_t cx, uint32_t cy, uint32_t cz)
+							{
+								return XMLoadFloat3(&lattice[(static_cast<size_t>(cz) * period + cy) * period + cx]);
+							};
+							const XMVECTOR x00 = XMVectorLerp(corner(i0[0], i0[1], i0[2]), corner(i1[0], i0[1], i0[2]), t[0]);
+							const XMVECTOR x10 = XMVectorLerp(corner(i0[0], i1[1], i0[2]), corner(i1[0], i1[1], i0[2]), t[0]);
+							const XMVECTOR x01 = XMVectorLerp(corner(i0[0], i0[1], i1[2]), corner(i1[0], i0[1], i1[2]), t[0]);
+							const XMVECTOR x11 = XMVectorLerp(corner(i0[0], i1[1], i1[2]), corner(i1[0], i1[1], i1[2]), t[0]);
+							const XMVECTOR value = XMVectorLerp(XMVectorLerp(x00, x10, t[1]), XMVectorLerp(x01, x11, t[1]), t[2]);
+
+							XMFLOAT3& cell = potential[(z * resolution + y) * resolution + x];
+							XMStoreFloat3(&cell, XMLoadFloat3(&cell) + value * amplitude);
+						}
+					}
+				}
+			});
+	}
+
+	//Curl of the potential with wrapped central differences
+	std::vector<XMFLOAT3> curl(cellCount);
+	std::vector<float> magnitudeSq(resolution, 0.0f);		//Largest per z slice
+	pool.ParallelFor(0, resolution, 1, [&](size_t zBegin, size_t zEnd)
+		{
+			for(size_t z = zBegin; z < zEnd; ++z)
+			{
+				for(uint32_t y = 0; y < resolution; ++y)
+				{
+					for(uint32_t x = 0; x < resolution; ++x)
+					{
+						auto at = [&](uint32_t cx, uint32_t cy, size_t cz) -> const XMFLOAT3&
+						{
+							return potential[((cz & mask) * resolution + (cy & mask)) * resolution + (cx & mask)];
+						};
+						const XMFLOAT3& px1 = at(x + 1, y, z); const XMFLOAT3& px0 = at(x - 1, y, z);
+						const XMFLOAT3& py1 = at(x, y + 1, z); const XMFLOAT3& py0 = at(x, y - 1, z);
+						const XMFLOAT3& pz1 = at(x, y, z + 1); const XMFLOAT3& pz0 = at(x, y, z - 1);
+						const XMFLOAT3 v(
+							0.5f * ((py1.z - py0.z) - (pz1.y - pz0.y)),
+							0.5f * ((pz1.x - pz0.x) - (px1.z - px0.z)),
+							0.5f * ((px1.y - px0.y) - (py1.x - py0.x)));
+						curl[(z * resolution + y) * resolution + x] = v;
+						magnitudeSq[z] = (std::max)(magnitudeSq[z], v.x * v.x + v.y * v.y + v.z * v.z);
+					}
+				}
+			}
+		});
+
+	//Normalise so the strongest cell has unit length and strength means the same for any seed
+	const float largest = sqrtf(*std::max_element(magnitudeSq.begin(), magnitudeSq.end()));
+	if(largest > 0.0f)
+	{
+		const float scale = 1.0f / largest;
+		for(XMFLOAT3& v : curl)
+		{
+			v = XMFLOAT3(v.x * scale, v.y * scale, v.z * scale);
+		}
+	}
+	SetFromLinear(resolution, curl);
+}
+
+bool VectorField::LoadFromFile(const std::string& filename)
+{
+	std::ifstream fin(filename, std::ios::binary);
+	if(!fin)
+	{
+		return false;
+	}
+	uint32_t resolution(0);
+	fin.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+	if(!fin || !IsValidResolution(resolution))
+	{
+		return false;
+	}
+	std::vector<XMFLOAT3> linear(static_cast<size_t>(resolution) * resolution * resolution);
+	fin.read(reinterpret_cast<char*>(linear.data()), linear.size() * sizeof(XMFLOAT3));
+	if(!fin)
+	{
+		return false;
+	}
+	SetFromLinear(resolution, linear);
+	return true;
+}
+
+XMVECTOR VectorField::Sample(FXMVECTOR position)const
+{
+	const XMVECTOR grid = (position - XMLoadFloat3(&m_offset)) * (1.0f / m_cellSize);
+	const XMVECTOR cell = XMVectorFloor(grid);
+	const XMVECTOR t = grid - cell;
+
+	//Wrapping through a mask also handles negative coordinates, two's complement keeps the low bits periodic
+	XMFLOAT4A base;
+	XMStoreFloat4A(&base, cell);
+	const uint32_t mask = m_resolution - 1;
+	const uint32_t x0 = static_cast<uint32_t>(static_cast<int32_t>(base.x)) & mask, x1 = (x0 + 1) & mask;
+	const uint32_t y0 = static_cast<uint32_t>(static_cast<int32_t>(base.y)) & mask, y1 = (y0 + 1) & mask;
+	const uint32_t z0 = static_cast<uint32_t>(static_cast<int32_t>(base.z)) & mask, z1 = (z0 + 1) & mask;
+
+	const XMVECTOR tx = XMVectorSplatX(t);
+	const XMVECTOR ty = XMVectorSplatY(t);
+	const XMVECTOR tz = XMVectorSplatZ(t);
+	const XMVECTOR c00 = XMVectorLerpV(XMLoadFloat4A(&m_cells[CellIndex(x0, y0, z0)]), XMLoadFloat4A(&m_cells[CellIndex(x1, y0, z0)]), tx);
+	const XMVECTOR c10 = XMVectorLerpV(XMLoadFloat4A(&m_cells[CellIndex(x0, y1, z0)]), XMLoadFloat4A(&m_cells[CellIndex(x1, y1, z0)]), tx);
+	const XMVECTOR c01 = XMVectorLerpV(XMLoadFloat4A(&m_cells[CellIndex(x0, y0, z1)]), XMLoadFloat4A(&m_cells[CellIndex(x1, y0, z1)]), tx);
+	const XMVECTOR c11 = XMVectorLerpV(XMLoadFloat4A(&m_cells[CellIndex(x0, y1, z1)]), XMLoadFloat4A(&m_cells[CellIndex(x1, y1, z1)]), tx);
+	return XMVectorLerpV(XMVectorLerpV(c00, c10, ty), XMVectorLerpV(c01, c11, ty), tz);
+}
+
+void VectorField::Accelerate(std::vector<Particle>& particles, float strength, float deltaTime)const
+{
+	if(m_cells.empty())
+	{
+		return;
+	}
+	const float scale = strength * deltaTime;
+	ThreadPool::Get().ParallelFor(0, particles.size(), g_fieldGrain, [&](size_t begin, size_t end)
+		{
+			for(size_t i = begin; i < end; ++i)
+			{
+				Particle& p = particles[i];
+				if(!p.alive)
+				{
+					continue;
+				}
+				const XMVECTOR force = Sample(XMLoadFloat3(&p.position));
+				XMStoreFloat3(&p.velocity, XMLoadFloat3(&p.velocity) + force * scale);
+			}
+		});
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <DirectXMath.h>
+
+struct Particle;
+
+//Periodic 3D grid of vectors that tiles through space, sampled with trilinear interpolation.
+//Cells are stored in 4x4x4 bricks so the eight corners of a sample usually share a cache line or two.
+class VectorField
+{
+	static constexpr uint32_t k_brickShift = 2;
+	static constexpr uint32_t k_brickSize = 1u << k_brickShift;
+	static constexpr uint32_t k_brickMask = k_brickSize - 1;
+
+	std::vector<DirectX::XMFLOAT4A>	m_cells;			//Bricked, w is unused padding so each cell is one aligned load
+	uint32_t						m_resolution;		//Cells along each axis, a power of two
+	uint32_t						m_bricksPerAxis;
+	float							m_cellSize;			//World units covered by one cell
+	DirectX::XMFLOAT3				m_offset;			//World offset of the field, scroll it to animate
+
+	size_t CellIndex(uint32_t x, uint32_t y, uint32_t z)const
+	{
+		const size_t brick = (x >> k_brickShift) + ((y >> k_brickShift) + (z >> k_brickShift) * static_cast<size_t>(m_bricksPerAxis)) * m_bricksPerAxis;
+		return (brick << (3 * k_brickShift)) + (x & k_brickMask) + ((y & k_brickMask) << k_brickShift) + ((z & k_brickMask) << (2 * k_brickShift));
+	}
+	void SetFromLinear(uint32_t resolution, const std::vector<DirectX::XMFLOAT3>& linear);
+public:
+	VectorField();
+
+	//Bakes divergence free turbulence, the curl of a periodic noise potential.
+	//frequency is the number of noise features across the tile for the first octave, doubling each
+	//octave up to one per cell. It is rounded up to a power of two so every octave's lattice divides
+	//the resolution and the tile wraps without a seam, 3 bakes as 4.
+	void BakeCurlNoise(uint32_t resolution, uint32_t frequency = 4, uint32_t octaves = 2, unsigned seed = 0);
+	//Raw little endian file: uint32 resolution then resolution^3 float3 vectors, x varying fastest
+	bool LoadFromFile(const std::string& filename);
+
+	bool IsEmpty()const { return m_cells.empty(); }
+	uint32_t GetResolution()const { return m_resolution; }
+	void SetCellSize(float cellSize) { m_cellSize = cellSize; }
+	void SetOffset(DirectX::XMFLOAT3 offset) { m_offset = offset; }
+
+	DirectX::XMVECTOR Sample(DirectX::FXMVECTOR position)const;
+
+	//Adds the field, scaled by strength, to the velocity of every alive particle
+	void Accelerate(std::vector<Particle>& particles, float strength, float deltaTime)const;
+};
@@ -0,0 +1,134 @@
+#include "VertexFormats.h"
+#include "MeshCache.h"
+#include "Common/ThreadPool.h"
+
+#include <cfloat>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace
+{
+	constexpr size_t g_encodeGrain = 4096;			//Vertices per worker chunk
+
+	inline XMVECTOR SignNotZero(FXMVECTOR v)
+	{
+		return XMVectorSelect(XMVectorReplicate(1.0f), XMVectorReplicate(-1.0f), XMVectorLess(v, XMVectorZero()));
+	}
+
+	//Maps positions inside bounds to [0, 1], flat axes map to 0
+	struct PositionEncode
+	{
+		XMVECTOR boundsMin;
+		XMVECTOR invSize;
+
+		explicit PositionEncode(const BoundingBox& bounds)
+		{
+			const XMVECTOR extents = XMLoadFloat3(&bounds.Extents);
+			boundsMin = XMVectorSubtract(XMLoadFloat3(&bounds.Center), extents);
+			invSize = XMVectorSelect(XMVectorZero(), XMVectorReciprocal(XMVectorAdd(extents, extents)), XMVectorGreater(extents, XMVectorZero()));
+			invSize = XMVectorSetW(invSize, 0.0f);
+		}
+
+		void Store(XMUSHORTN4* out, FXMVECTOR position)const
+		{
+			XMStoreUShortN4(out, XMVectorMultiply(XMVectorSubtract(position, boundsMin), invSize));
+		}
+	};
+
+	template<class In>
+	BoundingBox Bounds(const In* vertices, size_t count, const XMFLOAT3 In::* position)
+	{
+		XMVECTOR boundsMin = XMVectorReplicate(FLT_MAX), boundsMax = XMVectorReplicate(-FLT_MAX);
+		for(size_t i = 0; i < count; ++i)
+		{
+			const XMVECTOR p = XMLoadFloat3(&(vertices[i].*position));
+			boundsMin = XMVectorMin(boundsMin, p);
+			boundsMax = XMVectorMax(boundsMax, p);
+		}
+		BoundingBox bounds;
+		if(count == 0)
+		{
+			boundsMin = boundsMax = XMVectorZero();
+		}
+		XMStoreFloat3(&bounds.Center, XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f));
+		XMStoreFloat3(&bounds.Extents, XMVectorScale(XMVectorSubtract(boundsMax, boundsMin), 0.5f));
+		return bounds;
+	}
+}
+
+PositionDecode::PositionDecode(const BoundingBox& bounds)
+{
+	scale = XMFLOAT4(2.0f * bounds.Extents.x, 2.0f * bounds.Extents.y, 2.0f * bounds.Extents.z, 0.0f);
+	bias = XMFLOAT4(bounds.Center.x - bounds.Extents.x, bounds.Center.y - bounds.Extents.y, bounds.Center.z - bounds.Extents.z, 0.0f);
+}
+
+XMVECTOR EncodeOctahedral(FXMVECTOR normal)
+{
+	//Project onto the octahedron, then fold the lower half over the diagonals: (1 - |y|, 1 - |x|) with the signs of x and y
+	const XMVECTOR l1 = XMVectorMax(XMVector3Dot(XMVectorAbs(normal), XMVectorReplicate(1.0f)), XMVectorReplicate(FLT_MIN));
+	const XMVECTOR p = XMVectorDivide(normal, l1);
+	const XMVECTOR folded = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(1.0f), XMVectorAbs(XMVectorSwizzle<1, 0, 2, 3>(p))), SignNotZero(p));
+	return XMVectorSelect(p, folded, XMVectorLess(XMVectorSplatZ(p), XMVectorZero()));
+}
+
+XMVECTOR DecodeOctahedral(FXMVECTOR encoded)
+{
+	const XMVECTOR a = XMVectorAbs(encoded);
+	XMVECTOR n = XMVectorSetZ(encoded, 1.0f - XMVectorGetX(a) - XMVectorGetY(a));
+	//Unfold: below the upper half every point moved out by how far z went negative
+	const XMVECTOR t = XMVectorMax(XMVectorNegate(XMVectorSplatZ(n)), XMVectorZero());
+	const XMVECTOR shift = XMVectorMultiply(t, SignNotZero(n));
+	n = XMVectorSelect(XMVectorSubtract(n, shift), n, XMVectorSelectControl(0, 0, 1, 1));
+	return XMVector3Normalize(n);
+}
+
+BoundingBox ComputeBounds(const GeometryGenerator::Vertex* vertices, size_t count)
+{
+	return Bounds(vertices, count, &GeometryGenerator::Vertex::Position);
+}
+
+BoundingBox ComputeBounds(const ModelVertex* vertices, size_t count)
+{
+	return Bounds(vertices, count, &ModelVertex::position);
+}
+
+void EncodeVertices(const GeometryGenerator::Vertex* vertices, size_t count, const BoundingBox& bounds, PackedVertex* out)
+{
+	const PositionEncode encode(bounds);
+	ThreadPool::Get().ParallelFor(0, count, g_encodeGrain, [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; ++i)
+		{
+			encode.Store(&out[i].position, XMLoadFloat3(&vertices[i].Position));
+			XMStoreShortN2(&out[i].normal, EncodeOctahedral(XMLoadFloat3(&vertices[i].Normal)));
+		}
+	});
+}
+
+void EncodeVertices(const GeometryGenerator::Vertex* vertices, size_t count, const BoundingBox& bounds, PackedVertexUV* out)
+{
+	const PositionEncode encode(bounds);
+	ThreadPool::Get().ParallelFor(0, count, g_encodeGrain, [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; ++i)
+		{
+			encode.Store(&out[i].position, XMLoadFloat3(&vertices[i].Position));
+			XMStoreShortN2(&out[i].normal, EncodeOctahedral(XMLoadFloat3(&vertices[i].Normal)));
+			XMStoreHalf2(&out[i].texC, XMLoadFloat2(&vertices[i].TexC));
+		}
+	});
+}
+
+void EncodeVertices(const ModelVertex* vertices, size_t count, const BoundingBox& bounds, PackedVertex* out)
+{
+	const PositionEncode encode(bounds);
+	ThreadPool::Get().ParallelFor(0, count, g_encodeGrain, [&](size_t begin, size_t end)
+	{
+		for(size_t i = begin; i < end; ++i)
+		{
+			encode.Store(&out[i].position, XMLoadFloat3(&vertices[i].position));
+			XMStoreShortN2(&out[i].normal, EncodeOctahedral(XMLoadFloat3(&vertices[i].normal)));
+		}
+	});
+}
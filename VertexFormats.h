@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include <d3d12.h>
+#include <DirectXMath.h>
+#include <DirectXPackedVector.h>
+#include <DirectXCollision.h>
+
+#include "Common/GeometryGenerator.h"
+
+struct ModelVertex;
+
+//One attribute of a vertex format. Elements are listed in member order and each records the size of
+//the member it describes, so a format whose DXGI formats don't tile its struct fails to compile.
+struct VertexElement
+{
+	const char*	semantic;
+	UINT		semanticIndex;
+	DXGI_FORMAT	format;
+	UINT		offset;
+	UINT		size;
+};
+
+#define VERTEX_ELEMENT(Type, member, semantic, semanticIndex, format) \
+	VertexElement{ semantic, semanticIndex, format, static_cast<UINT>(offsetof(Type, member)), static_cast<UINT>(sizeof(Type::member)) }
+
+//Specialised for every vertex struct with a static constexpr VertexElement k_elements[]
+template<class V>
+struct VertexFormat;
+
+constexpr UINT FormatByteSize(DXGI_FORMAT format)
+{
+	switch(format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:	return 16;
+	case DXGI_FORMAT_R32G32B32_FLOAT:		return 12;
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R16G16B16A16_SNORM:
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R32G32_FLOAT:			return 8;
+	case DXGI_FORMAT_R16G16_SNORM:
+	case DXGI_FORMAT_R16G16_FLOAT:
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:				return 4;
+	default:								return 0;
+	}
+}
+
+//True when the elements cover the struct back to back with formats the size of their members
+template<size_t N>
+constexpr bool ElementsTileStruct(const VertexElement (&elements)[N], size_t stride)
+{
+	UINT offset = 0;
+	for(size_t i = 0; i < N; ++i)
+	{
+		if(elements[i].offset != offset || FormatByteSize(elements[i].format) != elements[i].size)
+		{
+			return false;
+		}
+		offset += elements[i].size;
+	}
+	return offset == stride;
+}
+
+template<class V>
+std::vector<D3D12_INPUT_ELEMENT_DESC> InputLayout(UINT inputSlot = 0)
+{
+	static_assert(ElementsTileStruct(VertexFormat<V>::k_elements, sizeof(V)), "Vertex format doesn't match its struct");
+	std::vector<D3D12_INPUT_ELEMENT_DESC> layout;
+	for(const VertexElement& e : VertexFormat<V>::k_elements)
+	{
+		layout.push_back({ e.semantic, e.semanticIndex, e.format, inputSlot, e.offset, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 });
+	}
+	return layout;
+}
+
+//Position as 16 bit unorms across the submesh bounds, w is unused. The normal is octahedral encoded:
+//projected onto the octahedron |x| + |y| + |z| = 1, with the lower half folded over the upper, which
+//spreads 32 bits far more evenly over the sphere than three components would. 12 bytes.
+struct PackedVertex
+{
+	DirectX::PackedVector::XMUSHORTN4	position;
+	DirectX::PackedVector::XMSHORTN2	normal;
+};
+
+//PackedVertex with half precision texture coordinates, 16 bytes
+struct PackedVertexUV
+{
+	DirectX::PackedVector::XMUSHORTN4	position;
+	DirectX::PackedVector::XMSHORTN2	normal;
+	DirectX::PackedVector::XMHALF2		texC;
+};
+
+template<>
+struct VertexFormat<PackedVertex>
+{
+	static constexpr VertexElement k_elements[] =
+	{
+		VERTEX_ELEMENT(PackedVertex, position, "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM),
+		VERTEX_ELEMENT(PackedVertex, normal, "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM),
+	};
+};
+
+template<>
+struct VertexFormat<PackedVertexUV>
+{
+	static constexpr VertexElement k_elements[] =
+	{
+		VERTEX_ELEMENT(PackedVertexUV, position, "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM),
+		VERTEX_ELEMENT(PackedVertexUV, normal, "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM),
+		VERTEX_ELEMENT(PackedVertexUV, texC, "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT),
+	};
+};
+
+//Packed positions decode as position * scale + bias, the identity for float vertices
+struct PositionDecode
+{
+	DirectX::XMFLOAT4 scale = { 1.0f, 1.0f, 1.0f, 0.0f };
+	DirectX::XMFLOAT4 bias = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	PositionDecode() = default;
+	explicit PositionDecode(const DirectX::BoundingBox& bounds);
+};
+
+DirectX::XMVECTOR EncodeOctahedral(DirectX::FXMVECTOR normal);			//Unit normal to [-1, 1]^2 in x and y
+DirectX::XMVECTOR DecodeOctahedral(DirectX::FXMVECTOR encoded);		//Back to a unit normal
+
+//Bounds of a vertex stream, what packed positions are quantised across
+DirectX::BoundingBox ComputeBounds(const GeometryGenerator::Vertex* vertices, size_t count);
+DirectX::BoundingBox ComputeBounds(const ModelVertex* vertices, size_t count);
+
+//Encoders write count vertices to out, which may be mapped upload memory. Positions are quantised
+//across bounds, pass the same box to PositionDecode for the render item. Large streams are split
+//across the thread pool.
+void EncodeVertices(const GeometryGenerator::Vertex* vertices, size_t count, const DirectX::BoundingBox& bounds, PackedVertex* out);
+void EncodeVertices(const GeometryGenerator::Vertex* vertices, size_t count, const DirectX::BoundingBox& bounds, PackedVertexUV* out);
+void EncodeVertices(const ModelVertex* vertices, size_t count, const DirectX::BoundingBox& bounds, PackedVertex* out);
+
+//Writer for GeometryGenerator's Write functions that packs each vertex across bounds on its way into
+//vertices. bounds must outlive the writes, usually it's the Bounds of the shape's MeshSize.
+template<class V, class Index>
+GeometryGenerator::MeshWriter MakeMeshWriter(V* vertices, Index* indices, const DirectX::BoundingBox& bounds)
+{
+	static_assert(sizeof(Index) == 2 || sizeof(Index) == 4, "Indices are 16 or 32 bits");
+	GeometryGenerator::MeshWriter writer;
+	writer.Vertices = vertices;
+	writer.VertexStride = sizeof(V);
+	writer.Encode = [](const GeometryGenerator::Vertex* in, size_t count, void* out, const void* context)
+	{
+		EncodeVertices(in, count, *static_cast<const DirectX::BoundingBox*>(context), static_cast<V*>(out));
+	};
+	writer.Context = &bounds;
+	writer.Indices = indices;
+	writer.IndexSize = sizeof(Index);
+	return writer;
+}